@@ -31,9 +31,12 @@
 #include <sys/types.h>
 
 #define _PATH_WTMPDB "/var/lib/wtmpdb/wtmp.db"
+#define _PATH_WTMPDB_CACHE "/var/cache/wtmpdb"
 
 #define _VARLINK_WTMPDB_SOCKET_DIR "/run/wtmpdb"
 #define _VARLINK_WTMPDB_SOCKET _VARLINK_WTMPDB_SOCKET_DIR"/socket"
+/* root only, dispatched before the calls of _VARLINK_WTMPDB_SOCKET */
+#define _VARLINK_WTMPDB_WRITE_SOCKET _VARLINK_WTMPDB_SOCKET_DIR"/socket-write"
 
 #define EMPTY           0  /* No valid user accounting information.  */
 #define BOOT_TIME       1  /* Time of system boot.  */
@@ -44,6 +47,37 @@
 #define NSEC_PER_USEC ((uint64_t) 1000ULL)
 #define USEC_PER_SEC  ((uint64_t) 1000000ULL)
 
+/* Column mask for wtmpdb_read_all_v3 */
+#define WTMPDB_COL_ID         (1U << 0)
+#define WTMPDB_COL_TYPE       (1U << 1)
+#define WTMPDB_COL_USER       (1U << 2)
+#define WTMPDB_COL_LOGIN      (1U << 3)
+#define WTMPDB_COL_LOGOUT     (1U << 4)
+#define WTMPDB_COL_TTY        (1U << 5)
+#define WTMPDB_COL_REMOTEHOST (1U << 6)
+#define WTMPDB_COL_SERVICE    (1U << 7)
+#define WTMPDB_COL_ALL        0xffU
+
+/* Number of entries passed at most per call of the wtmpdb_read_batch
+   callback. */
+#define WTMPDB_BATCH_SIZE 1024
+
+/* Entries in column layout. login and logout are 0 if not set, string
+   columns NULL. The strings are only valid during the callback. */
+struct wtmpdb_batch {
+  size_t count;
+  int64_t id[WTMPDB_BATCH_SIZE];
+  int type[WTMPDB_BATCH_SIZE];
+  uint64_t login[WTMPDB_BATCH_SIZE];
+  uint64_t logout[WTMPDB_BATCH_SIZE];
+  const char *user[WTMPDB_BATCH_SIZE];
+  const char *tty[WTMPDB_BATCH_SIZE];
+  const char *rhost[WTMPDB_BATCH_SIZE];
+  const char *service[WTMPDB_BATCH_SIZE];
+};
+
+/* All functions may be called concurrently from several threads. */
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -55,6 +89,14 @@ extern int64_t wtmpdb_login (const char *db_path, int type,
 			     const char *user, uint64_t usec_login,
 			     const char *tty, const char *rhost,
 			     const char *service, char **error);
+/* Same as wtmpdb_login, but if a login with the same token was recorded
+   within the last hour, returns its ID instead of adding another entry.
+   token is any unique string, e.g. a random UUID. */
+extern int64_t wtmpdb_login_v2 (const char *db_path, int type,
+				const char *user, uint64_t usec_login,
+				const char *tty, const char *rhost,
+				const char *service, const char *token,
+				char **error);
 extern int wtmpdb_logout (const char *db_path, int64_t id,
 			  uint64_t usec_logout, char **error);
 extern int wtmpdb_read_all (const char *db_path, int uniq,
@@ -65,12 +107,169 @@ extern int wtmpdb_read_all_v2 (const char *db_path, int uniq,
 			       int (*cb_func) (void *unused, int argc,
 					       char **argv, char **azColName),
 			       void *userdata, char **error);
+/* Same as wtmpdb_read_all_v2, but only the columns in the columns mask
+   (WTMPDB_COL_*) are read. The callback still gets all 8 columns, the
+   others are NULL. */
+extern int wtmpdb_read_all_v3 (const char *db_path, int uniq,
+			       unsigned int columns,
+			       int (*cb_func) (void *unused, int argc,
+					       char **argv, char **azColName),
+			       void *userdata, char **error);
+/* Same as wtmpdb_read_all_v2, but the result is kept in a cache file in
+   cache_dir (_PATH_WTMPDB_CACHE if NULL) and on later calls only new or
+   closed entries are read from the database. */
+extern int wtmpdb_read_all_cached (const char *db_path, int uniq,
+				   const char *cache_dir,
+				   int (*cb_func) (void *unused, int argc,
+						   char **argv, char **azColName),
+				   void *userdata, char **error);
+/* Same as wtmpdb_read_all_v2, but cb_func gets called once per up to
+   WTMPDB_BATCH_SIZE entries. A non-zero return value aborts reading,
+   a negative errno value is returned, -ENOMEM if out of memory. */
+extern int wtmpdb_read_batch (const char *db_path, int uniq,
+			      int (*cb_func) (void *userdata,
+					      const struct wtmpdb_batch *batch),
+			      void *userdata, char **error);
+/* Reads the entries of wtmpdb_read_all_v2 in pages: every call of
+   wtmpdb_cursor_read passes up to count entries to cb_func. All pages
+   show the database as of wtmpdb_cursor_open, writers are not blocked
+   meanwhile. wtmpdb_cursor_read returns the number of entries, 0 after
+   the last one, < 0 on failure. */
+struct wtmpdb_cursor;
+extern int wtmpdb_cursor_open (const char *db_path, int uniq,
+			       struct wtmpdb_cursor **cursor, char **error);
+extern int wtmpdb_cursor_read (struct wtmpdb_cursor *cursor, size_t count,
+			       int (*cb_func) (void *unused, int argc,
+					       char **argv, char **azColName),
+			       void *userdata, char **error);
+extern void wtmpdb_cursor_close (struct wtmpdb_cursor *cursor);
+/* Calls cb_func once per boot, newest first, with the columns
+   ID, User, BootTime, ShutdownTime, Kernel, NextBoot, Sessions, Crash */
+extern int wtmpdb_read_boots (const char *db_path,
+			      int (*cb_func) (void *unused, int argc,
+					      char **argv, char **azColName),
+			      void *userdata, char **error);
+/* Selects the entries with the given user, remote host and TTY for
+   wtmpdb_read_match, NULL matches everything. */
+struct wtmpdb_match {
+  const char *user;
+  const char *rhost;
+  const char *tty;
+};
+/* Calls cb_func for all entries matching match, newest first, also
+   those in the archives written by wtmpdb_rotate next to db_path.
+   Archives and past partitions of a time-partitioned database have a
+   Bloom filter of their users, hosts and TTYs; if it rules out a
+   match, the file is not opened at all. */
+extern int wtmpdb_read_match (const char *db_path,
+			      const struct wtmpdb_match *match,
+			      int (*cb_func) (void *unused, int argc,
+					      char **argv, char **azColName),
+			      void *userdata, char **error);
+/* Calls cb_func once with the newest login (USER_PROCESS) of user,
+   which is kept per user, so the lookup does not depend on the size
+   of the database. If the user has no login in the database, its
+   archives are searched, newest first. Returns 0 on success, -ENOENT
+   if the user never logged in, other < 0 values on failure. */
+extern int wtmpdb_get_last_login (const char *db_path, const char *user,
+				  int (*cb_func) (void *unused, int argc,
+						  char **argv, char **azColName),
+				  void *userdata, char **error);
+/* Writes counters and gauges of the database in OpenMetrics text format
+   to path (stdout if NULL), e.g. for the textfile collector of the
+   Prometheus node exporter. The file gets replaced atomically.
+   Returns 0 on success, < 0 on failure. */
+extern int wtmpdb_write_metrics (const char *db_path, const char *path,
+				 char **error);
 extern int wtmpdb_rotate (const char *db_path, const int days, char **error,
 			  char **wtmpdb_name, uint64_t *entries);
 
+/* Instead of moving the old entries to the archive, rename the database
+   to the archive and continue with a new one, which gets the open
+   sessions and the last boot entry with their IDs. */
+#define WTMPDB_ROTATE_SWAP 0x1
+/* Store the archive page-compressed as <archive>.z, which can be read
+   but not modified. Expired partitions get compressed instead of
+   removed. */
+#define WTMPDB_ROTATE_COMPRESS 0x2
+
+/* If max_size or max_rows is set, the database is only rotated if it
+   is larger or has more entries. Afterwards all but the newest keep
+   archives and the archives older than keep_days get removed.
+   0 disables the respective limit. */
+struct wtmpdb_rotate_opts {
+  int days;		/* archive entries older than days */
+  unsigned int flags;	/* WTMPDB_ROTATE_* */
+  uint64_t max_size;	/* in bytes */
+  uint64_t max_rows;
+  int keep;
+  int keep_days;
+};
+extern int wtmpdb_rotate_v2 (const char *db_path,
+			     const struct wtmpdb_rotate_opts *opts,
+			     char **error, char **wtmpdb_name,
+			     uint64_t *entries);
+
+/* Create a compact copy with VACUUM INTO, which reads the database in
+   one transaction instead of in small steps. */
+#define WTMPDB_BACKUP_VACUUM 0x1
+
+/* Copies the database consistently to dest while it is in use, without
+   blocking writers for long. For a time-partitioned database, dest is
+   a directory. */
+extern int wtmpdb_backup (const char *db_path, const char *dest,
+			  unsigned int flags, char **error);
+
 /* Returns last "BOOT_TIME" entry as usec */
+/* Writes pending changes of an in-memory database ("memory:NAME?flush=PATH")
+   to PATH, does nothing for other databases. */
+extern int wtmpdb_flush (const char *db_path, char **error);
+
 extern uint64_t wtmpdb_get_boottime (const char *db_path, char **error);
 
+/* The schema of a database is migrated in small transactions, so that
+   large databases stay writable meanwhile; every writer spends a few
+   milliseconds on it. This runs pending migrations for about usec
+   microseconds (0: until done).
+   Returns 0 if the schema is current, 1 if migrations are pending,
+   < 0 on failure. */
+extern int wtmpdb_migrate (const char *db_path, uint64_t usec, char **error);
+
+/* Maintenance tasks for wtmpdb_maintain, run in this order */
+#define WTMPDB_MAINT_MIGRATE    0x1	/* finish schema migrations */
+#define WTMPDB_MAINT_CHECKPOINT 0x2	/* copy the write-ahead log back */
+#define WTMPDB_MAINT_ANALYZE    0x4	/* statistics for the query planner */
+#define WTMPDB_MAINT_OPTIMIZE   0x8	/* update outdated statistics */
+#define WTMPDB_MAINT_ALL        0xf
+
+/* Runs the maintenance tasks on the database. Nothing of it is needed
+   for correct results, but it keeps queries fast.
+   Returns 0 on success, < 0 on failure. */
+extern int wtmpdb_maintain (const char *db_path, unsigned int tasks,
+			    char **error);
+
+/* Statistics of the calls of this process. A writer waits for a locked
+   database with exponential backoff until the busy timeout (default
+   5 seconds) is over. */
+struct wtmpdb_stats {
+  uint64_t busy_waits;		/* database found locked */
+  uint64_t busy_retries;	/* retries after waiting */
+  uint64_t busy_usec;		/* time spent waiting */
+  uint64_t busy_timeouts;	/* gave up after the busy timeout */
+};
+extern void wtmpdb_get_stats (struct wtmpdb_stats *stats);
+extern void wtmpdb_set_busy_timeout (uint64_t usec);
+
+/* If wtmpdbd did not answer a login, logout or ID lookup within the
+   timeout, do it on the local database instead, which needs write
+   access. A login then gets a random token, so that it is recorded
+   only once, even if wtmpdbd commits it late. */
+#define WTMPDB_VARLINK_FALLBACK 0x1
+
+/* Sets how long a call waits for wtmpdbd, for all threads. 0 restores
+   the default of sd-varlink (45 seconds). flags are WTMPDB_VARLINK_*. */
+extern void wtmpdb_set_varlink_timeout (uint64_t usec, unsigned int flags);
+
 /* helper function */
 extern int64_t wtmpdb_get_id (const char *db_path, const char *tty,
 			      char **error);
@@ -0,0 +1,508 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Storage backends of libwtmpdb and the selection between them. */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/random.h>
+
+#include "basics.h"
+#include "wtmpdb.h"
+#include "sqlite.h"
+#include "varlink.h"
+#include "batch.h"
+#include "backend.h"
+#include "memory.h"
+
+#define DB_PATH(p) ((p) ? (p) : _PATH_WTMPDB)
+
+static int64_t
+sqlite_be_login (const char *db_path, int type, const char *user,
+		 uint64_t usec_login, const char *tty, const char *rhost,
+		 const char *service, const char *token, char **error)
+{
+  return sqlite_login (DB_PATH(db_path), type, user, usec_login, tty,
+		       rhost, service, token, error);
+}
+
+static int
+sqlite_be_logout (const char *db_path, int64_t id, uint64_t usec_logout,
+		  char **error)
+{
+  return sqlite_logout (DB_PATH(db_path), id, usec_logout, error);
+}
+
+static int64_t
+sqlite_be_get_id (const char *db_path, const char *tty, char **error)
+{
+  return sqlite_get_id (DB_PATH(db_path), tty, error);
+}
+
+static int
+sqlite_be_read_all (const char *db_path, int uniq, unsigned int columns,
+		    int (*cb_func)(void *unused, int argc, char **argv,
+				   char **azColName),
+		    void *userdata, char **error)
+{
+  return sqlite_read_all (DB_PATH(db_path), uniq, columns, cb_func,
+			  userdata, error);
+}
+
+static int
+sqlite_be_read_batch (const char *db_path, int uniq, struct batch_ctx *ctx,
+		      char **error)
+{
+  return sqlite_read_batch (DB_PATH(db_path), uniq, ctx, error);
+}
+
+static int
+sqlite_be_read_boots (const char *db_path,
+		      int (*cb_func)(void *unused, int argc, char **argv,
+				     char **azColName),
+		      void *userdata, char **error)
+{
+  return sqlite_read_boots (DB_PATH(db_path), cb_func, userdata, error);
+}
+
+static int
+sqlite_be_rotate (const char *db_path, const struct wtmpdb_rotate_opts *opts,
+		  char **wtmpdb_name, uint64_t *entries, char **error)
+{
+  return sqlite_rotate (DB_PATH(db_path), opts, wtmpdb_name, entries, error);
+}
+
+static int
+sqlite_be_get_boottime (const char *db_path, uint64_t *boottime,
+			char **error)
+{
+  return sqlite_get_boottime (DB_PATH(db_path), boottime, error);
+}
+
+static int
+sqlite_be_read_metrics (const char *db_path,
+			int (*cb_func)(void *unused, int argc, char **argv,
+				       char **azColName),
+			void *userdata, char **error)
+{
+  return sqlite_read_metrics (DB_PATH(db_path), cb_func, userdata, error);
+}
+
+static int
+sqlite_be_backup (const char *db_path, const char *dest, unsigned int flags,
+		  char **error)
+{
+  return sqlite_backup (DB_PATH(db_path), dest, flags, error);
+}
+
+static int
+sqlite_be_read_match (const char *db_path, const struct wtmpdb_match *match,
+		      int (*cb_func)(void *unused, int argc, char **argv,
+				     char **azColName),
+		      void *userdata, char **error)
+{
+  return sqlite_read_match (DB_PATH(db_path), match, cb_func, userdata,
+			    error);
+}
+
+static int
+sqlite_be_migrate (const char *db_path, uint64_t usec, char **error)
+{
+  return sqlite_migrate (DB_PATH(db_path), usec, error);
+}
+
+static int
+sqlite_be_maintain (const char *db_path, unsigned int tasks, char **error)
+{
+  return sqlite_maintain (DB_PATH(db_path), tasks, error);
+}
+
+static int
+sqlite_be_cursor_open (const char *db_path, int uniq, void **cursor,
+		       char **error)
+{
+  return sqlite_cursor_open (DB_PATH(db_path), uniq,
+			     (struct sqlite_cursor **)cursor, error);
+}
+
+static int
+sqlite_be_cursor_read (void *cursor, size_t count,
+		       int (*cb_func)(void *unused, int argc, char **argv,
+				      char **azColName),
+		       void *userdata, char **error)
+{
+  return sqlite_cursor_read (cursor, count, cb_func, userdata, error);
+}
+
+static void
+sqlite_be_cursor_close (void *cursor)
+{
+  sqlite_cursor_close (cursor);
+}
+
+static int
+sqlite_be_get_last_login (const char *db_path, const char *user,
+			  int (*cb_func)(void *unused, int argc, char **argv,
+					 char **azColName),
+			  void *userdata, char **error)
+{
+  return sqlite_get_last_login (DB_PATH(db_path), user, cb_func, userdata,
+				error);
+}
+
+const struct wtmpdb_backend_ops sqlite_backend_ops = {
+  .name = "sqlite",
+  .login = sqlite_be_login,
+  .logout = sqlite_be_logout,
+  .get_id = sqlite_be_get_id,
+  .read_all = sqlite_be_read_all,
+  .read_batch = sqlite_be_read_batch,
+  .read_boots = sqlite_be_read_boots,
+  .rotate = sqlite_be_rotate,
+  .get_boottime = sqlite_be_get_boottime,
+  .backup = sqlite_be_backup,
+  .read_match = sqlite_be_read_match,
+  .migrate = sqlite_be_migrate,
+  .maintain = sqlite_be_maintain,
+  .cursor_open = sqlite_be_cursor_open,
+  .cursor_read = sqlite_be_cursor_read,
+  .cursor_close = sqlite_be_cursor_close,
+  .get_last_login = sqlite_be_get_last_login,
+  .read_metrics = sqlite_be_read_metrics,
+};
+
+#if WITH_WTMPDBD
+/* shared by all threads, only ever change from 1 to 0 resp. 0 to 1 */
+static _Atomic int varlink_is_active = 1;
+static _Atomic int varlink_is_enforced = 0;
+static _Atomic int varlink_fallback = 0;
+
+static int64_t
+varlink_be_login (const char *db_path __attribute__((__unused__)),
+		  int type, const char *user, uint64_t usec_login,
+		  const char *tty, const char *rhost, const char *service,
+		  const char *token, char **error)
+{
+  return varlink_login (type, user, usec_login, tty, rhost, service, token,
+			error);
+}
+
+static int
+varlink_be_logout (const char *db_path __attribute__((__unused__)),
+		   int64_t id, uint64_t usec_logout, char **error)
+{
+  return varlink_logout (id, usec_logout, error);
+}
+
+static int64_t
+varlink_be_get_id (const char *db_path __attribute__((__unused__)),
+		   const char *tty, char **error)
+{
+  return varlink_get_id (tty, error);
+}
+
+struct project_data {
+  unsigned int columns;
+  int (*cb_func)(void *unused, int argc, char **argv, char **azColName);
+  void *userdata;
+};
+
+/* wtmpdbd always sends all columns, hide the unwanted ones */
+static int
+project_cb (void *data, int argc, char **argv, char **azColName)
+{
+  struct project_data *p = data;
+
+  for (int i = 0; i < argc && i < 8; i++)
+    if (!(p->columns & (1U << i)))
+      argv[i] = NULL;
+
+  return p->cb_func (p->userdata, argc, argv, azColName);
+}
+
+static int
+varlink_be_read_all (const char *db_path __attribute__((__unused__)),
+		     int uniq, unsigned int columns,
+		     int (*cb_func)(void *unused, int argc, char **argv,
+				    char **azColName),
+		     void *userdata, char **error)
+{
+  struct project_data p = {
+    .columns = columns,
+    .cb_func = cb_func,
+    .userdata = userdata,
+  };
+
+  if (columns == WTMPDB_COL_ALL)
+    return varlink_read_all (uniq, cb_func, userdata, error);
+
+  return varlink_read_all (uniq, project_cb, &p, error);
+}
+
+static int
+varlink_be_read_batch (const char *db_path __attribute__((__unused__)),
+		       int uniq, struct batch_ctx *ctx, char **error)
+{
+  int r = varlink_read_all (uniq, batch_add_argv, ctx, error);
+
+  if (r >= 0 && batch_flush (ctx) != 0)
+    {
+      if (error)
+	*error = strdup ("varlink_read_batch: query aborted");
+      r = -ECANCELED;
+    }
+  return r;
+}
+
+static int
+varlink_be_cursor_open (const char *db_path __attribute__((__unused__)),
+			int uniq, void **cursor, char **error)
+{
+  return varlink_cursor_open (uniq, (struct varlink_cursor **)cursor, error);
+}
+
+static int
+varlink_be_cursor_read (void *cursor, size_t count,
+			int (*cb_func)(void *unused, int argc, char **argv,
+				       char **azColName),
+			void *userdata, char **error)
+{
+  return varlink_cursor_read (cursor, count, cb_func, userdata, error);
+}
+
+static void
+varlink_be_cursor_close (void *cursor)
+{
+  varlink_cursor_close (cursor);
+}
+
+static int
+varlink_be_read_boots (const char *db_path __attribute__((__unused__)),
+		       int (*cb_func)(void *unused, int argc, char **argv,
+				      char **azColName),
+		       void *userdata, char **error)
+{
+  return varlink_read_boots (cb_func, userdata, error);
+}
+
+static int
+varlink_be_rotate (const char *db_path __attribute__((__unused__)),
+		   const struct wtmpdb_rotate_opts *opts, char **wtmpdb_name,
+		   uint64_t *entries, char **error)
+{
+  return varlink_rotate (opts, wtmpdb_name, entries, error);
+}
+
+static int
+varlink_be_get_boottime (const char *db_path __attribute__((__unused__)),
+			 uint64_t *boottime, char **error)
+{
+  return varlink_get_boottime (boottime, error);
+}
+
+static int
+varlink_be_backup (const char *db_path __attribute__((__unused__)),
+		   const char *dest, unsigned int flags, char **error)
+{
+  return varlink_backup (dest, flags, error);
+}
+
+static int
+varlink_be_read_match (const char *db_path __attribute__((__unused__)),
+		       const struct wtmpdb_match *match,
+		       int (*cb_func)(void *unused, int argc, char **argv,
+				      char **azColName),
+		       void *userdata, char **error)
+{
+  return varlink_read_match (match, cb_func, userdata, error);
+}
+
+static int
+varlink_be_get_last_login (const char *db_path __attribute__((__unused__)),
+			   const char *user,
+			   int (*cb_func)(void *unused, int argc, char **argv,
+					  char **azColName),
+			   void *userdata, char **error)
+{
+  return varlink_get_last_login (user, cb_func, userdata, error);
+}
+
+const struct wtmpdb_backend_ops varlink_backend_ops = {
+  .name = "varlink",
+  .login = varlink_be_login,
+  .logout = varlink_be_logout,
+  .get_id = varlink_be_get_id,
+  .read_all = varlink_be_read_all,
+  .read_batch = varlink_be_read_batch,
+  .read_boots = varlink_be_read_boots,
+  .rotate = varlink_be_rotate,
+  .get_boottime = varlink_be_get_boottime,
+  .backup = varlink_be_backup,
+  .read_match = varlink_be_read_match,
+  .cursor_open = varlink_be_cursor_open,
+  .cursor_read = varlink_be_cursor_read,
+  .cursor_close = varlink_be_cursor_close,
+  .get_last_login = varlink_be_get_last_login,
+};
+#endif
+
+/* Backends selected by a prefix of db_path. */
+static const struct {
+  const char *prefix;
+  const struct wtmpdb_backend_ops *ops;
+} backends[] = {
+  { "sqlite:", &sqlite_backend_ops },
+  { "memory:", &memory_backend_ops },
+};
+
+/* Returns the backend for *db_path, NULL if it is not available.
+   wtmpdbd is used if db_path is "varlink" or if no specific database
+   is requested and wtmpdbd was not found not running before. A backend
+   prefix is removed from *db_path. */
+const struct wtmpdb_backend_ops *
+backend_select (const char **db_path)
+{
+  if (*db_path == NULL)
+    {
+#if WITH_WTMPDBD
+      if (varlink_is_active)
+	return &varlink_backend_ops;
+#endif
+      return &sqlite_backend_ops;
+    }
+
+  if (strcmp (*db_path, "varlink") == 0)
+    {
+#if WITH_WTMPDBD
+      varlink_is_enforced = 1;
+      return &varlink_backend_ops;
+#else
+      return NULL;
+#endif
+    }
+
+  for (size_t i = 0; i < sizeof (backends) / sizeof (backends[0]); i++)
+    {
+      size_t len = strlen (backends[i].prefix);
+
+      if (strncmp (*db_path, backends[i].prefix, len) == 0)
+	{
+	  *db_path += len;
+	  return backends[i].ops;
+	}
+    }
+
+  return &sqlite_backend_ops;
+}
+
+/* Checks the result r of a call via *ops. If wtmpdbd is not running and
+   was not explicitly requested, switches *ops to the local database and
+   returns 1 to repeat the call there, otherwise returns 0. */
+int
+backend_retry (const struct wtmpdb_backend_ops **ops, int64_t r,
+	       char **error)
+{
+#if WITH_WTMPDBD
+  if (*ops == &varlink_backend_ops && r < 0 && !varlink_is_enforced &&
+      (r == -ECONNREFUSED || r == -ENOENT || r == -ECONNRESET || r == -EACCES))
+    {
+      varlink_is_active = 0;
+      if (error)
+	*error = mfree (*error);
+      *ops = &sqlite_backend_ops;
+      return 1;
+    }
+#else
+  (void)ops;
+  (void)r;
+  (void)error;
+#endif
+  return 0;
+}
+
+/* Sets the deadline of calls to wtmpdbd and whether logins, logouts
+   and ID lookups, which wtmpdbd did not answer in time, are repeated
+   on the local database. */
+void
+backend_set_varlink_timeout (uint64_t usec, int fallback)
+{
+#if WITH_WTMPDBD
+  varlink_set_timeout (usec);
+  varlink_fallback = fallback;
+#else
+  (void)usec;
+  (void)fallback;
+#endif
+}
+
+/* Returns a new token in buf for a login via *ops, which may get
+   written twice by backend_fallback, else NULL. */
+const char *
+backend_login_token (const struct wtmpdb_backend_ops *ops,
+		     char buf[BACKEND_TOKEN_LEN + 1])
+{
+#if WITH_WTMPDBD
+  unsigned char rnd[BACKEND_TOKEN_LEN / 2];
+
+  if (ops != &varlink_backend_ops || !varlink_fallback || varlink_is_enforced ||
+      getrandom (rnd, sizeof (rnd), 0) != (ssize_t)sizeof (rnd))
+    return NULL;
+  for (size_t i = 0; i < sizeof (rnd); i++)
+    snprintf (buf + 2 * i, 3, "%02x", rnd[i]);
+  return buf;
+#else
+  (void)ops;
+  (void)buf;
+  return NULL;
+#endif
+}
+
+/* Like backend_retry, but also switches to the local database if
+   wtmpdbd did not answer in time and the fallback is enabled. wtmpdbd
+   stays in use for later calls. Only for calls which may be repeated:
+   a login needs a token of backend_login_token. */
+int
+backend_fallback (const struct wtmpdb_backend_ops **ops, int64_t r,
+		  char **error)
+{
+#if WITH_WTMPDBD
+  if (*ops == &varlink_backend_ops && r == -ETIME && varlink_fallback &&
+      !varlink_is_enforced)
+    {
+      if (error)
+	*error = mfree (*error);
+      *ops = &sqlite_backend_ops;
+      return 1;
+    }
+#endif
+  return backend_retry (ops, r, error);
+}
@@ -0,0 +1,110 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct batch_ctx;
+struct wtmpdb_rotate_opts;
+struct wtmpdb_match;
+
+/* Operations of a storage backend. db_path is the path as passed to
+   the public libwtmpdb functions, backends which don't need it ignore
+   it. All functions return <0 on failure and set error if not NULL. */
+struct wtmpdb_backend_ops {
+  const char *name;
+  /* a login with the token of an earlier one returns its ID, backends
+     which cannot get a login twice ignore it */
+  int64_t (*login) (const char *db_path, int type, const char *user,
+		    uint64_t usec_login, const char *tty, const char *rhost,
+		    const char *service, const char *token, char **error);
+  int (*logout) (const char *db_path, int64_t id, uint64_t usec_logout,
+		 char **error);
+  int64_t (*get_id) (const char *db_path, const char *tty, char **error);
+  int (*read_all) (const char *db_path, int uniq, unsigned int columns,
+		   int (*cb_func)(void *unused, int argc, char **argv,
+				  char **azColName),
+		   void *userdata, char **error);
+  int (*read_batch) (const char *db_path, int uniq, struct batch_ctx *ctx,
+		     char **error);
+  int (*read_boots) (const char *db_path,
+		     int (*cb_func)(void *unused, int argc, char **argv,
+				    char **azColName),
+		     void *userdata, char **error);
+  int (*rotate) (const char *db_path, const struct wtmpdb_rotate_opts *opts,
+		 char **wtmpdb_name, uint64_t *entries, char **error);
+  int (*get_boottime) (const char *db_path, uint64_t *boottime,
+		       char **error);
+  int (*backup) (const char *db_path, const char *dest, unsigned int flags,
+		 char **error);
+  /* optional, else all entries are read and filtered */
+  int (*read_match) (const char *db_path, const struct wtmpdb_match *match,
+		     int (*cb_func)(void *unused, int argc, char **argv,
+				    char **azColName),
+		     void *userdata, char **error);
+  /* optional, for backends which don't write through */
+  int (*flush) (const char *db_path, char **error);
+  /* optional, for backends with a versioned schema */
+  int (*migrate) (const char *db_path, uint64_t usec, char **error);
+  /* optional, for backends which need maintenance */
+  int (*maintain) (const char *db_path, unsigned int tasks, char **error);
+  /* optional, paginated reads, see wtmpdb_cursor_open */
+  int (*cursor_open) (const char *db_path, int uniq, void **cursor,
+		      char **error);
+  int (*cursor_read) (void *cursor, size_t count,
+		      int (*cb_func)(void *unused, int argc, char **argv,
+				     char **azColName),
+		      void *userdata, char **error);
+  void (*cursor_close) (void *cursor);
+  /* optional, else all entries are read */
+  int (*get_last_login) (const char *db_path, const char *user,
+			 int (*cb_func)(void *unused, int argc, char **argv,
+					char **azColName),
+			 void *userdata, char **error);
+  /* optional, else all entries are read */
+  int (*read_metrics) (const char *db_path,
+		       int (*cb_func)(void *unused, int argc, char **argv,
+				      char **azColName),
+		       void *userdata, char **error);
+};
+
+extern const struct wtmpdb_backend_ops sqlite_backend_ops;
+#if WITH_WTMPDBD
+extern const struct wtmpdb_backend_ops varlink_backend_ops;
+#endif
+
+extern const struct wtmpdb_backend_ops *backend_select (const char **db_path);
+extern int backend_retry (const struct wtmpdb_backend_ops **ops, int64_t r,
+			  char **error);
+extern int backend_fallback (const struct wtmpdb_backend_ops **ops, int64_t r,
+			     char **error);
+#define BACKEND_TOKEN_LEN 32
+extern const char *backend_login_token (const struct wtmpdb_backend_ops *ops,
+					char buf[BACKEND_TOKEN_LEN + 1]);
+extern void backend_set_varlink_timeout (uint64_t usec, int fallback);
@@ -0,0 +1,164 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Collects entries into struct wtmpdb_batch and hands them over to the
+   callback once per WTMPDB_BATCH_SIZE entries. The strings of a batch
+   are copied into one buffer, which is reused for the next batch. */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+
+#define NSTR 4
+
+struct batch_ctx {
+  struct wtmpdb_batch batch;
+  int (*cb_func)(void *userdata, const struct wtmpdb_batch *batch);
+  void *userdata;
+  char *buf;
+  size_t used, size;
+  /* offset + 1 into buf, 0 for NULL; resolved to pointers on flush */
+  size_t off[WTMPDB_BATCH_SIZE][NSTR];
+};
+
+struct batch_ctx *
+batch_new (int (*cb_func)(void *userdata, const struct wtmpdb_batch *batch),
+	   void *userdata)
+{
+  struct batch_ctx *ctx = calloc (1, sizeof (*ctx));
+
+  if (ctx == NULL)
+    return NULL;
+  ctx->cb_func = cb_func;
+  ctx->userdata = userdata;
+  return ctx;
+}
+
+void
+batch_free (struct batch_ctx *ctx)
+{
+  if (ctx == NULL)
+    return;
+  free (ctx->buf);
+  free (ctx);
+}
+
+static size_t
+batch_str (struct batch_ctx *ctx, const char *str)
+{
+  size_t len, off;
+
+  if (str == NULL)
+    return 0;
+
+  len = strlen (str) + 1;
+  if (ctx->used + len > ctx->size)
+    {
+      size_t size = ctx->size ? ctx->size : 64 * 1024;
+      char *buf;
+
+      while (ctx->used + len > size)
+	size *= 2;
+      buf = realloc (ctx->buf, size);
+      if (buf == NULL)
+	return SIZE_MAX;
+      ctx->buf = buf;
+      ctx->size = size;
+    }
+  off = ctx->used;
+  memcpy (ctx->buf + off, str, len);
+  ctx->used += len;
+  return off + 1;
+}
+
+/* Calls the callback for the pending entries.
+   Returns 0 on success, the return value of the callback otherwise. */
+int
+batch_flush (struct batch_ctx *ctx)
+{
+  struct wtmpdb_batch *b = &ctx->batch;
+  const char **str[NSTR] = {b->user, b->tty, b->rhost, b->service};
+  int r;
+
+  if (b->count == 0)
+    return 0;
+
+  for (size_t i = 0; i < b->count; i++)
+    for (int j = 0; j < NSTR; j++)
+      str[j][i] = ctx->off[i][j] ? ctx->buf + ctx->off[i][j] - 1 : NULL;
+
+  r = ctx->cb_func (ctx->userdata, b);
+  b->count = 0;
+  ctx->used = 0;
+  return r;
+}
+
+/* Adds one entry, flushes the batch if it is full.
+   Returns 0 on success, -ENOMEM or the return value of the callback
+   otherwise. */
+int
+batch_add (struct batch_ctx *ctx, int64_t id, int type,
+	   uint64_t login, uint64_t logout, const char *user,
+	   const char *tty, const char *rhost, const char *service)
+{
+  struct wtmpdb_batch *b = &ctx->batch;
+  const char *str[NSTR] = {user, tty, rhost, service};
+  size_t i = b->count;
+
+  b->id[i] = id;
+  b->type[i] = type;
+  b->login[i] = login;
+  b->logout[i] = logout;
+  for (int j = 0; j < NSTR; j++)
+    if ((ctx->off[i][j] = batch_str (ctx, str[j])) == SIZE_MAX)
+      return -ENOMEM;
+
+  if (++b->count == WTMPDB_BATCH_SIZE)
+    return batch_flush (ctx);
+  return 0;
+}
+
+/* sqlite3_exec style callback with the columns ID, Type, User, Login,
+   Logout, TTY, RemoteHost and Service, for read functions which only
+   deliver strings. */
+int
+batch_add_argv (void *ctx, int argc, char **argv,
+		char **azColName __attribute__((__unused__)))
+{
+  if (argc != 8)
+    return 1;
+
+  return batch_add (ctx, strtoll (argv[0] ? argv[0] : "0", NULL, 10),
+		    atoi (argv[1] ? argv[1] : "0"),
+		    argv[3] ? strtoull (argv[3], NULL, 10) : 0,
+		    argv[4] ? strtoull (argv[4], NULL, 10) : 0,
+		    argv[2], argv[5], argv[6], argv[7]) != 0;
+}
@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "wtmpdb.h"
+
+struct batch_ctx;
+
+extern struct batch_ctx *batch_new (int (*cb_func)(void *userdata,
+						   const struct wtmpdb_batch *batch),
+				    void *userdata);
+extern void batch_free (struct batch_ctx *ctx);
+extern int batch_add (struct batch_ctx *ctx, int64_t id, int type,
+		      uint64_t login, uint64_t logout, const char *user,
+		      const char *tty, const char *rhost,
+		      const char *service);
+extern int batch_add_argv (void *ctx, int argc, char **argv,
+			   char **azColName);
+extern int batch_flush (struct batch_ctx *ctx);
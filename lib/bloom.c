@@ -0,0 +1,241 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Bloom filters of the values in an archive, stored next to it in
+   <archive>.bloom (without the .z of a compressed archive). A filter
+   may report values which are not in the archive, but never misses
+   one, so readers can skip an archive if a searched value is not in
+   its filter. Layout (little endian):
+
+     "WTMPBLM1"   magic
+     uint32       number of hash functions k
+     uint32       number of bits m, a multiple of 64
+     uint64[m/64] bits */
+
+#include "config.h"
+
+#include <errno.h>
+#include <endian.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bloom.h"
+#include "compress.h"
+
+#define BLOOM_MAGIC "WTMPBLM1"
+#define BLOOM_HEADER_SIZE 16
+/* about 1% false positives */
+#define BLOOM_BITS_PER_VALUE 10
+#define BLOOM_HASHES 7
+/* a corrupt header must not let us allocate arbitrary memory */
+#define BLOOM_MAX_BITS (64U * 1024 * 1024)
+
+struct bloom {
+  uint32_t k;
+  uint32_t m;
+  uint64_t *bits;
+};
+
+char *
+bloom_path (const char *db_path)
+{
+  size_t len = strlen (db_path);
+  char *path;
+
+  if (is_compressed (db_path))
+    len -= strlen (COMPRESS_SUFFIX);
+  if (asprintf (&path, "%.*s.bloom", (int)len, db_path) < 0)
+    return NULL;
+  return path;
+}
+
+struct bloom *
+bloom_new (size_t n)
+{
+  struct bloom *b = calloc (1, sizeof (struct bloom));
+  uint64_t m = ((uint64_t)n * BLOOM_BITS_PER_VALUE + 63) / 64 * 64;
+
+  if (b == NULL)
+    return NULL;
+  if (m == 0)
+    m = 64;
+  if (m > BLOOM_MAX_BITS)
+    m = BLOOM_MAX_BITS;
+  b->k = BLOOM_HASHES;
+  b->m = m;
+  b->bits = calloc (m / 64, sizeof (uint64_t));
+  if (b->bits == NULL)
+    {
+      free (b);
+      return NULL;
+    }
+  return b;
+}
+
+void
+bloom_free (struct bloom *b)
+{
+  if (b == NULL)
+    return;
+  free (b->bits);
+  free (b);
+}
+
+/* FNV-1a of tag and value with a final mix, the two halves are used
+   for double hashing. */
+static uint64_t
+bloom_hash (char tag, const char *value)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+
+  h = (h ^ (unsigned char)tag) * 0x100000001b3ULL;
+  for (const unsigned char *p = (const unsigned char *)value; *p; p++)
+    h = (h ^ *p) * 0x100000001b3ULL;
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+void
+bloom_add (struct bloom *b, char tag, const char *value)
+{
+  uint64_t h = bloom_hash (tag, value);
+  uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+
+  for (uint32_t i = 0; i < b->k; i++)
+    {
+      uint32_t bit = (h1 + i * h2) % b->m;
+      b->bits[bit / 64] |= 1ULL << (bit % 64);
+    }
+}
+
+/* Returns 0 if value is not in the filter, 1 if it may be. */
+int
+bloom_maybe (const struct bloom *b, char tag, const char *value)
+{
+  uint64_t h = bloom_hash (tag, value);
+  uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+
+  for (uint32_t i = 0; i < b->k; i++)
+    {
+      uint32_t bit = (h1 + i * h2) % b->m;
+      if (!(b->bits[bit / 64] & (1ULL << (bit % 64))))
+	return 0;
+    }
+  return 1;
+}
+
+/* Writes the filter to path, via a temporary file which is renamed.
+   Returns 0 on success, <0 on failure. */
+int
+bloom_write (const struct bloom *b, const char *path)
+{
+  unsigned char header[BLOOM_HEADER_SIZE];
+  uint32_t val;
+  char *tmp_path;
+  FILE *fp;
+  int r = 0;
+
+  if (asprintf (&tmp_path, "%s.tmp", path) < 0)
+    return -ENOMEM;
+  fp = fopen (tmp_path, "we");
+  if (fp == NULL)
+    {
+      r = -errno;
+      free (tmp_path);
+      return r;
+    }
+
+  memcpy (header, BLOOM_MAGIC, 8);
+  val = htole32 (b->k);
+  memcpy (header + 8, &val, sizeof (val));
+  val = htole32 (b->m);
+  memcpy (header + 12, &val, sizeof (val));
+  if (fwrite (header, sizeof (header), 1, fp) != 1)
+    r = -EIO;
+  for (uint32_t i = 0; r == 0 && i < b->m / 64; i++)
+    {
+      uint64_t word = htole64 (b->bits[i]);
+      if (fwrite (&word, sizeof (word), 1, fp) != 1)
+	r = -EIO;
+    }
+  if (fclose (fp) != 0 && r == 0)
+    r = -errno;
+  if (r == 0 && rename (tmp_path, path) < 0)
+    r = -errno;
+  if (r < 0)
+    unlink (tmp_path);
+  free (tmp_path);
+  return r;
+}
+
+/* Returns the filter stored in path, NULL if there is none or it is
+   not valid. */
+struct bloom *
+bloom_read (const char *path)
+{
+  unsigned char header[BLOOM_HEADER_SIZE];
+  struct bloom *b;
+  uint32_t val;
+  FILE *fp;
+
+  fp = fopen (path, "re");
+  if (fp == NULL)
+    return NULL;
+
+  b = calloc (1, sizeof (struct bloom));
+  if (b == NULL || fread (header, sizeof (header), 1, fp) != 1 ||
+      memcmp (header, BLOOM_MAGIC, 8) != 0)
+    goto fail;
+  memcpy (&val, header + 8, sizeof (val));
+  b->k = le32toh (val);
+  memcpy (&val, header + 12, sizeof (val));
+  b->m = le32toh (val);
+  if (b->k == 0 || b->k > 32 || b->m == 0 || b->m % 64 != 0 ||
+      b->m > BLOOM_MAX_BITS)
+    goto fail;
+
+  b->bits = malloc (b->m / 8);
+  if (b->bits == NULL || fread (b->bits, b->m / 8, 1, fp) != 1)
+    goto fail;
+  for (uint32_t i = 0; i < b->m / 64; i++)
+    b->bits[i] = le64toh (b->bits[i]);
+  fclose (fp);
+  return b;
+
+ fail:
+  fclose (fp);
+  bloom_free (b);
+  return NULL;
+}
@@ -0,0 +1,606 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Persistent cache for the results of wtmpdb_read_all().
+
+   The cache file contains the rows of one query (all entries or the
+   latest entry per user) as read from the database, together with the
+   change counter of the database and the highest ID seen (watermark).
+   If the counter did not change, only entries added after the watermark
+   and entries which were open (no logout time) are read from the
+   database and merged into the cached result. Otherwise the complete
+   result is read again. */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "wtmpdb.h"
+#include "sqlite.h"
+#include "mkdir_p.h"
+#include "cache.h"
+
+#define CACHE_MAGIC "WTMPDBC\001"
+#define NCOLS 8
+#define COL_ID      0
+#define COL_USER    2
+#define COL_LOGIN   3
+#define COL_LOGOUT  4
+#define COL_TTY     5
+#define NULL_LEN UINT32_MAX
+#define NO_ROW SIZE_MAX
+
+struct cache_header {
+  char magic[8];
+  uint32_t uniq;
+  uint32_t ncols;
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t counter;
+  int64_t watermark;
+  uint64_t nrows;
+};
+
+struct cache_row {
+  int64_t id;
+  uint64_t login;  /* 0 if NULL */
+  uint64_t logout; /* 0 if NULL */
+  char *col[NCOLS];
+  size_t next_id;   /* hash chains, see cache_index */
+  size_t next_user;
+};
+
+struct cache {
+  int uniq;
+  int64_t watermark; /* rows with a higher ID are not cached yet */
+  size_t n, alloc;
+  struct cache_row *rows;
+  int changed;
+  /* heads of the hash chains by ID and by user (uniq only), the rows
+     are referenced by index, so that they can be moved by realloc */
+  size_t *by_id, *by_user;
+  size_t nbuckets;	/* power of 2, 0 if not indexed */
+};
+
+static void
+row_free (struct cache_row *row)
+{
+  for (int i = 0; i < NCOLS; i++)
+    free (row->col[i]);
+}
+
+static void
+cache_free (struct cache *c)
+{
+  for (size_t i = 0; i < c->n; i++)
+    row_free (&c->rows[i]);
+  free (c->rows);
+  free (c->by_id);
+  free (c->by_user);
+  c->rows = NULL;
+  c->by_id = c->by_user = NULL;
+  c->n = c->alloc = c->nbuckets = 0;
+}
+
+static uint64_t
+str2u64 (const char *s)
+{
+  return s ? strtoull (s, NULL, 10) : 0;
+}
+
+static int
+row_set (struct cache_row *row, char **argv)
+{
+  memset (row, 0, sizeof (*row));
+  for (int i = 0; i < NCOLS; i++)
+    if (argv[i] && (row->col[i] = strdup (argv[i])) == NULL)
+      {
+	row_free (row);
+	return -ENOMEM;
+      }
+  row->id = strtoll (row->col[COL_ID] ? row->col[COL_ID] : "-1", NULL, 10);
+  row->login = str2u64 (row->col[COL_LOGIN]);
+  row->logout = str2u64 (row->col[COL_LOGOUT]);
+  return 0;
+}
+
+static struct cache_row *
+cache_append (struct cache *c)
+{
+  if (c->n == c->alloc)
+    {
+      size_t alloc = c->alloc ? c->alloc * 2 : 256;
+      struct cache_row *rows = realloc (c->rows, alloc * sizeof (*rows));
+      if (rows == NULL)
+	return NULL;
+      c->rows = rows;
+      c->alloc = alloc;
+    }
+  return &c->rows[c->n++];
+}
+
+/* FNV-1a */
+static uint64_t
+hash_str (const char *str)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  for (const char *p = str; *p; p++)
+    {
+      hash ^= (unsigned char)*p;
+      hash *= 0x100000001b3ULL;
+    }
+  return hash;
+}
+
+static size_t
+bucket_id (const struct cache *c, int64_t id)
+{
+  return ((uint64_t)id * 0x9e3779b97f4a7c15ULL >> 32) & (c->nbuckets - 1);
+}
+
+static size_t
+bucket_user (const struct cache *c, const char *user)
+{
+  return hash_str (user) & (c->nbuckets - 1);
+}
+
+static void
+index_link (struct cache *c, size_t i)
+{
+  struct cache_row *row = &c->rows[i];
+  size_t b = bucket_id (c, row->id);
+
+  row->next_id = c->by_id[b];
+  c->by_id[b] = i;
+  row->next_user = NO_ROW;
+  if (c->uniq && row->col[COL_USER])
+    {
+      b = bucket_user (c, row->col[COL_USER]);
+      row->next_user = c->by_user[b];
+      c->by_user[b] = i;
+    }
+}
+
+static void
+index_unlink (struct cache *c, size_t i)
+{
+  struct cache_row *row = &c->rows[i];
+  size_t *p;
+
+  for (p = &c->by_id[bucket_id (c, row->id)]; *p != NO_ROW;
+       p = &c->rows[*p].next_id)
+    if (*p == i)
+      {
+	*p = row->next_id;
+	break;
+      }
+  if (c->uniq && row->col[COL_USER])
+    for (p = &c->by_user[bucket_user (c, row->col[COL_USER])]; *p != NO_ROW;
+	 p = &c->rows[*p].next_user)
+      if (*p == i)
+	{
+	  *p = row->next_user;
+	  break;
+	}
+}
+
+/* (Re)builds the hash chains with at least twice as many buckets as
+   rows, so that a lookup does not depend on the size of the cache. */
+static int
+cache_index (struct cache *c)
+{
+  size_t nbuckets = 256;
+  size_t *by_id, *by_user = NULL;
+
+  while (nbuckets < 2 * c->n)
+    nbuckets *= 2;
+  by_id = malloc (nbuckets * sizeof (*by_id));
+  if (by_id == NULL ||
+      (c->uniq && (by_user = malloc (nbuckets * sizeof (*by_user))) == NULL))
+    {
+      free (by_id);
+      return -ENOMEM;
+    }
+  free (c->by_id);
+  free (c->by_user);
+  c->by_id = by_id;
+  c->by_user = by_user;
+  c->nbuckets = nbuckets;
+  for (size_t i = 0; i < nbuckets; i++)
+    {
+      by_id[i] = NO_ROW;
+      if (by_user)
+	by_user[i] = NO_ROW;
+    }
+  for (size_t i = 0; i < c->n; i++)
+    index_link (c, i);
+  return 0;
+}
+
+static struct cache_row *
+cache_find (struct cache *c, int64_t id)
+{
+  for (size_t i = c->by_id[bucket_id (c, id)]; i != NO_ROW;
+       i = c->rows[i].next_id)
+    if (c->rows[i].id == id)
+      return &c->rows[i];
+  return NULL;
+}
+
+static struct cache_row *
+cache_find_user (struct cache *c, const char *user)
+{
+  for (size_t i = c->by_user[bucket_user (c, user)]; i != NO_ROW;
+       i = c->rows[i].next_user)
+    if (strcmp (c->rows[i].col[COL_USER], user) == 0)
+      return &c->rows[i];
+  return NULL;
+}
+
+/* Merges one database row into the cached result, following the same
+   rules as the SQL queries in sqlite_read_all(). */
+static int
+cache_merge_cb (void *data, int argc, char **argv,
+		char **azColName __attribute__((__unused__)))
+{
+  struct cache *c = data;
+  struct cache_row row, *dst;
+
+  if (argc != NCOLS)
+    return 1;
+  if (row_set (&row, argv) < 0)
+    return 1;
+  if (c->nbuckets == 0 && cache_index (c) < 0)
+    {
+      row_free (&row);
+      return 1;
+    }
+
+  dst = row.id <= c->watermark ? cache_find (c, row.id) : NULL;
+  if (dst == NULL && c->uniq)
+    {
+      /* only the latest login per user, without system entries */
+      if (row.col[COL_LOGIN] == NULL || row.col[COL_TTY] == NULL ||
+	  strcmp (row.col[COL_TTY], "~") == 0 || row.col[COL_USER] == NULL)
+	{
+	  row_free (&row);
+	  return 0;
+	}
+      dst = cache_find_user (c, row.col[COL_USER]);
+      if (dst && dst->login > row.login)
+	{
+	  row_free (&row);
+	  return 0;
+	}
+    }
+
+  if (dst)
+    {
+      index_unlink (c, dst - c->rows);
+      row_free (dst);
+    }
+  else if ((dst = cache_append (c)) == NULL)
+    {
+      row_free (&row);
+      return 1;
+    }
+  *dst = row;
+  c->changed = 1;
+  if (c->n > c->nbuckets / 2)
+    return cache_index (c) < 0;
+  index_link (c, dst - c->rows);
+  return 0;
+}
+
+/* ORDER BY Login DESC, Logout ASC resp. by user for the uniq query. */
+static int
+row_cmp (const void *p1, const void *p2)
+{
+  const struct cache_row *r1 = p1, *r2 = p2;
+
+  if (r1->login != r2->login)
+    return r1->login > r2->login ? -1 : 1;
+  if (r1->logout != r2->logout)
+    return r1->logout < r2->logout ? -1 : 1;
+  return r1->id < r2->id ? -1 : r1->id > r2->id;
+}
+
+static int
+row_cmp_user (const void *p1, const void *p2)
+{
+  const struct cache_row *r1 = p1, *r2 = p2;
+
+  return strcmp (r1->col[COL_USER], r2->col[COL_USER]);
+}
+
+static char *
+cache_file_name (const char *cache_dir, const char *db_path, int uniq)
+{
+  uint64_t hash = hash_str (db_path);
+  char *name;
+
+  if (asprintf (&name, "%s/%s-%016llx.cache", cache_dir,
+		uniq ? "lastlog" : "last", (unsigned long long)hash) < 0)
+    return NULL;
+  return name;
+}
+
+static int
+read_str (FILE *fp, char **str)
+{
+  uint32_t len;
+
+  *str = NULL;
+  if (fread (&len, sizeof (len), 1, fp) != 1)
+    return -1;
+  if (len == NULL_LEN)
+    return 0;
+  if (len > 1024 * 1024 || (*str = malloc (len + 1)) == NULL)
+    return -1;
+  if (len > 0 && fread (*str, len, 1, fp) != 1)
+    {
+      free (*str);
+      *str = NULL;
+      return -1;
+    }
+  (*str)[len] = '\0';
+  return 0;
+}
+
+static int
+write_str (FILE *fp, const char *str)
+{
+  uint32_t len = str ? (uint32_t)strlen (str) : NULL_LEN;
+
+  if (fwrite (&len, sizeof (len), 1, fp) != 1)
+    return -1;
+  if (str && len > 0 && fwrite (str, len, 1, fp) != 1)
+    return -1;
+  return 0;
+}
+
+/* Loads the cache file. Returns 0 if a usable cache was loaded. */
+static int
+cache_load (const char *fname, const struct stat *db_st, int uniq,
+	    struct cache *c, struct cache_header *hdr)
+{
+  FILE *fp = fopen (fname, "re");
+
+  if (fp == NULL)
+    return -1;
+
+  if (fread (hdr, sizeof (*hdr), 1, fp) != 1 ||
+      memcmp (hdr->magic, CACHE_MAGIC, sizeof (hdr->magic)) != 0 ||
+      hdr->uniq != (uint32_t)uniq || hdr->ncols != NCOLS ||
+      hdr->dev != (uint64_t)db_st->st_dev || hdr->ino != (uint64_t)db_st->st_ino)
+    {
+      fclose (fp);
+      return -1;
+    }
+
+  for (uint64_t i = 0; i < hdr->nrows; i++)
+    {
+      char *argv[NCOLS];
+      int r = 0;
+
+      for (int j = 0; j < NCOLS; j++)
+	if (read_str (fp, &argv[j]) < 0)
+	  {
+	    while (j-- > 0)
+	      free (argv[j]);
+	    r = -1;
+	    break;
+	  }
+      if (r == 0)
+	{
+	  struct cache_row *row = cache_append (c);
+	  if (row == NULL)
+	    r = -1;
+	  else
+	    {
+	      memset (row, 0, sizeof (*row));
+	      memcpy (row->col, argv, sizeof (argv));
+	      row->id = strtoll (argv[COL_ID] ? argv[COL_ID] : "-1", NULL, 10);
+	      row->login = str2u64 (argv[COL_LOGIN]);
+	      row->logout = str2u64 (argv[COL_LOGOUT]);
+	    }
+	}
+      if (r < 0)
+	{
+	  fclose (fp);
+	  cache_free (c);
+	  return -1;
+	}
+    }
+
+  fclose (fp);
+  return 0;
+}
+
+/* Writes the cache file atomically, failures are not fatal. */
+static void
+cache_save (const char *fname, const struct stat *db_st,
+	    const struct cache_header *hdr, const struct cache *c)
+{
+  char *tmpname;
+  FILE *fp;
+  int fd;
+
+  if (asprintf (&tmpname, "%s.XXXXXX", fname) < 0)
+    return;
+
+  fd = mkostemp (tmpname, O_CLOEXEC);
+  if (fd < 0)
+    {
+      free (tmpname);
+      return;
+    }
+  /* the cache must not be more readable than the database */
+  fchmod (fd, db_st->st_mode & 0644);
+
+  fp = fdopen (fd, "w");
+  if (fp == NULL)
+    {
+      close (fd);
+      goto fail;
+    }
+
+  if (fwrite (hdr, sizeof (*hdr), 1, fp) != 1)
+    goto fail_fp;
+  for (size_t i = 0; i < c->n; i++)
+    for (int j = 0; j < NCOLS; j++)
+      if (write_str (fp, c->rows[i].col[j]) < 0)
+	goto fail_fp;
+
+  if (fclose (fp) != 0)
+    goto fail;
+  if (rename (tmpname, fname) < 0)
+    goto fail;
+  free (tmpname);
+  return;
+
+ fail_fp:
+  fclose (fp);
+ fail:
+  unlink (tmpname);
+  free (tmpname);
+}
+
+/* Returns 0 on success, -ENOENT if the database cannot be cached and
+   the caller should read it directly, other <0 values on failure. */
+int
+cache_read_all (const char *db_path, int uniq, const char *cache_dir,
+		int (*cb_func)(void *unused, int argc, char **argv,
+			       char **azColName),
+		void *userdata, char **error)
+{
+  static char *colnames[NCOLS] = {"ID", "Type", "User", "Login",
+				  "Logout", "TTY", "RemoteHost",
+				  "Service"};
+  struct cache c = { .uniq = uniq };
+  struct cache_header hdr;
+  struct stat db_st;
+  char *fname;
+  int64_t *open_ids = NULL;
+  size_t n_open = 0;
+  uint64_t counter;
+  int64_t max_id;
+  int r;
+
+  /* partitioned databases (directories) are not cached */
+  if (stat (db_path, &db_st) < 0 || !S_ISREG (db_st.st_mode) ||
+      db_st.st_size == 0 || access (db_path, R_OK) < 0)
+    return -ENOENT;
+
+  fname = cache_file_name (cache_dir, db_path, uniq);
+  if (fname == NULL)
+    {
+      if (error)
+	*error = strdup ("cache_read_all: Out of memory");
+      return -ENOMEM;
+    }
+
+  if (cache_load (fname, &db_st, uniq, &c, &hdr) == 0)
+    {
+      c.watermark = hdr.watermark;
+      /* entries without logout time could have been closed since */
+      open_ids = calloc (c.n ? c.n : 1, sizeof (*open_ids));
+      if (open_ids == NULL)
+	{
+	  r = -ENOMEM;
+	  goto out;
+	}
+      for (size_t i = 0; i < c.n; i++)
+	if (c.rows[i].col[COL_LOGOUT] == NULL)
+	  open_ids[n_open++] = c.rows[i].id;
+
+      r = sqlite_read_delta (db_path, hdr.watermark, open_ids, n_open,
+			     &counter, &max_id, cache_merge_cb, &c, error);
+      if (r == 0 && counter != hdr.counter)
+	{
+	  /* entries were modified or deleted, start from scratch */
+	  cache_free (&c);
+	  r = 1;
+	}
+    }
+  else
+    r = 1;
+
+  if (r == 1)
+    {
+      cache_free (&c);
+      c.changed = 1;
+      c.watermark = -1;
+      r = sqlite_read_delta (db_path, -1, NULL, 0, &counter, &max_id,
+			     cache_merge_cb, &c, error);
+    }
+  if (r < 0)
+    goto out;
+
+  if (c.n > 0)
+    qsort (c.rows, c.n, sizeof (c.rows[0]), uniq ? row_cmp_user : row_cmp);
+
+  if (c.changed || hdr.watermark != max_id)
+    {
+      memset (&hdr, 0, sizeof (hdr));
+      memcpy (hdr.magic, CACHE_MAGIC, sizeof (hdr.magic));
+      hdr.uniq = uniq;
+      hdr.ncols = NCOLS;
+      hdr.dev = db_st.st_dev;
+      hdr.ino = db_st.st_ino;
+      hdr.counter = counter;
+      hdr.watermark = max_id;
+      hdr.nrows = c.n;
+      mkdir_p (cache_dir, 0755);
+      cache_save (fname, &db_st, &hdr, &c);
+    }
+
+  for (size_t i = 0; i < c.n; i++)
+    if (cb_func (userdata, NCOLS, c.rows[i].col, colnames) != 0)
+      {
+	if (error)
+	  *error = strdup ("cache_read_all: query aborted");
+	r = -ECANCELED;
+	break;
+      }
+
+ out:
+  if (r == -ENOMEM && error)
+    *error = strdup ("cache_read_all: Out of memory");
+  free (open_ids);
+  free (fname);
+  cache_free (&c);
+  return r;
+}
@@ -0,0 +1,679 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Page-compressed archives: a database which does not change anymore
+   gets stored with each page compressed separately, so pages can be
+   read without decompressing the whole file. Layout (little endian):
+
+     "WTMPDBZ1"        magic
+     uint32            page size
+     uint32            number of pages N
+     uint64            size of the database
+     uint64[N + 1]     file offsets of the pages, page i is stored in
+                       [offset[i], offset[i + 1]), uncompressed if that
+                       is page size long, else zlib compressed.
+
+   The read-only VFS "wtmpdbz" opens such files for SQLite and keeps
+   the last uncompressed pages in a small LRU cache. Other files are
+   passed on to the default VFS, so plain databases can be attached
+   to the same connection. */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <sqlite3.h>
+
+#include "compress.h"
+
+#define ZMAGIC "WTMPDBZ1"
+#define ZHEADER_SIZE 24
+#define ZVFS_NAME "wtmpdbz"
+#define ZCACHE_PAGES 16
+
+int
+is_compressed (const char *path)
+{
+  size_t len = strlen (path);
+
+  return len > strlen (COMPRESS_SUFFIX) &&
+    strcmp (path + len - strlen (COMPRESS_SUFFIX), COMPRESS_SUFFIX) == 0;
+}
+
+static void
+put_le32 (unsigned char *p, uint32_t val)
+{
+  val = htole32 (val);
+  memcpy (p, &val, sizeof (val));
+}
+
+static void
+put_le64 (unsigned char *p, uint64_t val)
+{
+  val = htole64 (val);
+  memcpy (p, &val, sizeof (val));
+}
+
+static uint32_t
+get_le32 (const unsigned char *p)
+{
+  uint32_t val;
+
+  memcpy (&val, p, sizeof (val));
+  return le32toh (val);
+}
+
+static uint64_t
+get_le64 (const unsigned char *p)
+{
+  uint64_t val;
+
+  memcpy (&val, p, sizeof (val));
+  return le64toh (val);
+}
+
+static int
+write_all (int fd, const void *buf, size_t len, off_t offset)
+{
+  const char *p = buf;
+
+  while (len > 0)
+    {
+      ssize_t n = pwrite (fd, p, len, offset);
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -errno;
+	}
+      p += n;
+      len -= n;
+      offset += n;
+    }
+  return 0;
+}
+
+static int
+read_all (int fd, void *buf, size_t len, off_t offset)
+{
+  char *p = buf;
+
+  while (len > 0)
+    {
+      ssize_t n = pread (fd, p, len, offset);
+      if (n < 0 && errno == EINTR)
+	continue;
+      if (n <= 0)
+	return n < 0 ? -errno : -EIO;
+      p += n;
+      len -= n;
+      offset += n;
+    }
+  return 0;
+}
+
+/* Writes the page-compressed copy of the database src to dest, via a
+   temporary file which is renamed at the end. src must not be in use.
+   Returns 0 on success, <0 on failure. */
+int
+compress_database (const char *src, const char *dest, char **error)
+{
+  unsigned char header[ZHEADER_SIZE];
+  unsigned char *page = NULL, *zpage = NULL;
+  uint64_t *index = NULL;
+  uint32_t page_size, pages;
+  char *tmp_path = NULL;
+  const char *what;
+  struct stat st;
+  uLong zsize;
+  off_t pos;
+  int fd_src, fd_dest = -1;
+  int r;
+
+  fd_src = open (src, O_RDONLY | O_CLOEXEC);
+  if (fd_src < 0 || fstat (fd_src, &st) < 0)
+    {
+      r = -errno;
+      what = "Cannot open";
+      goto fail;
+    }
+
+  /* the page size is stored big endian at offset 16, 1 means 65536 */
+  r = read_all (fd_src, header, ZHEADER_SIZE, 0);
+  if (r < 0 || memcmp (header, "SQLite format 3", 16) != 0)
+    {
+      r = r < 0 ? r : -EINVAL;
+      what = "Not a database";
+      goto fail;
+    }
+  page_size = (header[16] << 8) | header[17];
+  if (page_size == 1)
+    page_size = 65536;
+  if (page_size < 512 || (page_size & (page_size - 1)) != 0 ||
+      st.st_size % page_size != 0)
+    {
+      r = -EINVAL;
+      what = "Invalid page size of";
+      goto fail;
+    }
+  pages = st.st_size / page_size;
+
+  zsize = compressBound (page_size);
+  page = malloc (page_size);
+  zpage = malloc (zsize);
+  index = calloc (pages + 1, sizeof (uint64_t));
+  if (page == NULL || zpage == NULL || index == NULL ||
+      asprintf (&tmp_path, "%s.tmp", dest) < 0)
+    {
+      tmp_path = NULL;
+      r = -ENOMEM;
+      what = "Out of memory compressing";
+      goto fail;
+    }
+
+  fd_dest = open (tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		  st.st_mode & 0666);
+  if (fd_dest < 0)
+    {
+      r = -errno;
+      what = "Cannot create archive for";
+      goto fail;
+    }
+
+  pos = ZHEADER_SIZE + (off_t)(pages + 1) * sizeof (uint64_t);
+  for (uint32_t i = 0; i < pages; i++)
+    {
+      const unsigned char *data;
+      uLong len = zsize;
+
+      r = read_all (fd_src, page, page_size, (off_t)i * page_size);
+      if (r < 0)
+	{
+	  what = "Cannot read";
+	  goto fail;
+	}
+      /* the archive is read-only, so no WAL mode (file format 1) */
+      if (i == 0 && page[18] == 2 && page[19] == 2)
+	page[18] = page[19] = 1;
+
+      if (compress2 (zpage, &len, page, page_size, Z_BEST_COMPRESSION) == Z_OK &&
+	  len < page_size)
+	data = zpage;
+      else
+	{
+	  data = page;
+	  len = page_size;
+	}
+      put_le64 ((unsigned char *)&index[i], pos);
+      r = write_all (fd_dest, data, len, pos);
+      if (r < 0)
+	{
+	  what = "Cannot write archive for";
+	  goto fail;
+	}
+      pos += len;
+    }
+  put_le64 ((unsigned char *)&index[pages], pos);
+
+  memcpy (header, ZMAGIC, 8);
+  put_le32 (header + 8, page_size);
+  put_le32 (header + 12, pages);
+  put_le64 (header + 16, (uint64_t)st.st_size);
+  r = write_all (fd_dest, header, ZHEADER_SIZE, 0);
+  if (r == 0)
+    r = write_all (fd_dest, index, (pages + 1) * sizeof (uint64_t),
+		   ZHEADER_SIZE);
+  if (r == 0 && fsync (fd_dest) < 0)
+    r = -errno;
+  if (r < 0)
+    {
+      what = "Cannot write archive for";
+      goto fail;
+    }
+  close (fd_dest);
+  fd_dest = -1;
+
+  if (rename (tmp_path, dest) < 0)
+    {
+      r = -errno;
+      what = "Cannot rename archive of";
+      goto fail;
+    }
+
+  close (fd_src);
+  free (tmp_path);
+  free (index);
+  free (zpage);
+  free (page);
+  return 0;
+
+ fail:
+  if (error)
+    if (asprintf (error, "%s %s: %s", what, src, strerror (-r)) < 0)
+      *error = strdup ("compress_database: Out of memory");
+  if (fd_dest >= 0)
+    close (fd_dest);
+  if (tmp_path)
+    unlink (tmp_path);
+  if (fd_src >= 0)
+    close (fd_src);
+  free (tmp_path);
+  free (index);
+  free (zpage);
+  free (page);
+  return r;
+}
+
+struct zpage {
+  int64_t page;		/* -1 if unused */
+  uint64_t used;	/* last access, for LRU */
+  unsigned char *data;
+};
+
+struct zfile {
+  sqlite3_file base;
+  int fd;
+  uint32_t page_size;
+  uint32_t pages;
+  sqlite3_int64 size;
+  uint64_t *index;
+  unsigned char *zbuf;
+  uint64_t tick;
+  struct zpage cache[ZCACHE_PAGES];
+};
+
+/* Returns the uncompressed page pg from the cache, reads and
+   decompresses it if needed, NULL on failure. */
+static const unsigned char *
+zfile_page (struct zfile *f, uint32_t pg)
+{
+  struct zpage *slot = &f->cache[0];
+  uint64_t len;
+  uLongf dlen;
+
+  for (int i = 0; i < ZCACHE_PAGES; i++)
+    {
+      if (f->cache[i].page == pg)
+	{
+	  f->cache[i].used = ++f->tick;
+	  return f->cache[i].data;
+	}
+      if (f->cache[i].used < slot->used)
+	slot = &f->cache[i];
+    }
+
+  /* replace the least recently used page */
+  if (slot->data == NULL && (slot->data = malloc (f->page_size)) == NULL)
+    return NULL;
+  slot->page = -1;
+
+  len = f->index[pg + 1] - f->index[pg];
+  if (len == f->page_size)
+    {
+      if (read_all (f->fd, slot->data, len, f->index[pg]) < 0)
+	return NULL;
+    }
+  else
+    {
+      dlen = f->page_size;
+      if (read_all (f->fd, f->zbuf, len, f->index[pg]) < 0 ||
+	  uncompress (slot->data, &dlen, f->zbuf, len) != Z_OK ||
+	  dlen != f->page_size)
+	return NULL;
+    }
+  slot->page = pg;
+  slot->used = ++f->tick;
+  return slot->data;
+}
+
+static int
+zfile_close (sqlite3_file *file)
+{
+  struct zfile *f = (struct zfile *)file;
+
+  close (f->fd);
+  for (int i = 0; i < ZCACHE_PAGES; i++)
+    free (f->cache[i].data);
+  free (f->zbuf);
+  free (f->index);
+  return SQLITE_OK;
+}
+
+static int
+zfile_read (sqlite3_file *file, void *buf, int amt, sqlite3_int64 offset)
+{
+  struct zfile *f = (struct zfile *)file;
+  unsigned char *p = buf;
+
+  while (amt > 0 && offset < f->size)
+    {
+      uint32_t pg = offset / f->page_size;
+      uint32_t in_page = offset % f->page_size;
+      int n = f->page_size - in_page;
+      const unsigned char *data = zfile_page (f, pg);
+
+      if (data == NULL)
+	return SQLITE_IOERR_READ;
+      if (n > amt)
+	n = amt;
+      memcpy (p, data + in_page, n);
+      p += n;
+      amt -= n;
+      offset += n;
+    }
+  if (amt > 0)
+    {
+      memset (p, 0, amt);
+      return SQLITE_IOERR_SHORT_READ;
+    }
+  return SQLITE_OK;
+}
+
+static int
+zfile_write (sqlite3_file *file __attribute__((__unused__)),
+	     const void *buf __attribute__((__unused__)),
+	     int amt __attribute__((__unused__)),
+	     sqlite3_int64 offset __attribute__((__unused__)))
+{
+  return SQLITE_IOERR_WRITE;
+}
+
+static int
+zfile_truncate (sqlite3_file *file __attribute__((__unused__)),
+		sqlite3_int64 size __attribute__((__unused__)))
+{
+  return SQLITE_IOERR_TRUNCATE;
+}
+
+static int
+zfile_sync (sqlite3_file *file __attribute__((__unused__)),
+	    int flags __attribute__((__unused__)))
+{
+  return SQLITE_OK;
+}
+
+static int
+zfile_size (sqlite3_file *file, sqlite3_int64 *size)
+{
+  *size = ((struct zfile *)file)->size;
+  return SQLITE_OK;
+}
+
+/* the file never changes, so no locking is needed */
+static int
+zfile_lock (sqlite3_file *file __attribute__((__unused__)),
+	    int lock __attribute__((__unused__)))
+{
+  return SQLITE_OK;
+}
+
+static int
+zfile_reserved_lock (sqlite3_file *file __attribute__((__unused__)),
+		     int *res)
+{
+  *res = 0;
+  return SQLITE_OK;
+}
+
+static int
+zfile_control (sqlite3_file *file __attribute__((__unused__)),
+	       int op __attribute__((__unused__)),
+	       void *arg __attribute__((__unused__)))
+{
+  return SQLITE_NOTFOUND;
+}
+
+static int
+zfile_sector_size (sqlite3_file *file __attribute__((__unused__)))
+{
+  return 512;
+}
+
+static int
+zfile_characteristics (sqlite3_file *file __attribute__((__unused__)))
+{
+  return SQLITE_IOCAP_IMMUTABLE;
+}
+
+static const sqlite3_io_methods zfile_methods = {
+  .iVersion = 1,
+  .xClose = zfile_close,
+  .xRead = zfile_read,
+  .xWrite = zfile_write,
+  .xTruncate = zfile_truncate,
+  .xSync = zfile_sync,
+  .xFileSize = zfile_size,
+  .xLock = zfile_lock,
+  .xUnlock = zfile_lock,
+  .xCheckReservedLock = zfile_reserved_lock,
+  .xFileControl = zfile_control,
+  .xSectorSize = zfile_sector_size,
+  .xDeviceCharacteristics = zfile_characteristics,
+};
+
+/* Reads and checks header and index of a compressed archive.
+   Returns 1 if fd is one, 0 if not, <0 on failure. */
+static int
+zfile_init (struct zfile *f, int fd)
+{
+  unsigned char header[ZHEADER_SIZE];
+  struct stat st;
+  uint64_t end;
+
+  if (read_all (fd, header, ZHEADER_SIZE, 0) < 0 ||
+      memcmp (header, ZMAGIC, 8) != 0)
+    return 0;
+
+  memset (f, 0, sizeof (*f));
+  f->fd = fd;
+  f->page_size = get_le32 (header + 8);
+  f->pages = get_le32 (header + 12);
+  f->size = (sqlite3_int64)get_le64 (header + 16);
+  if (f->page_size < 512 || f->page_size > 65536 ||
+      (uint64_t)f->size != (uint64_t)f->pages * f->page_size ||
+      fstat (fd, &st) < 0)
+    return -EINVAL;
+
+  f->index = malloc ((f->pages + 1) * sizeof (uint64_t));
+  f->zbuf = malloc (f->page_size);
+  if (f->index == NULL || f->zbuf == NULL)
+    return -ENOMEM;
+  if (read_all (fd, f->index, (f->pages + 1) * sizeof (uint64_t),
+		ZHEADER_SIZE) < 0)
+    return -EIO;
+
+  /* a corrupt index must not lead to reads beyond the buffers */
+  end = ZHEADER_SIZE + (uint64_t)(f->pages + 1) * sizeof (uint64_t);
+  for (uint32_t i = 0; i <= f->pages; i++)
+    {
+      f->index[i] = get_le64 ((unsigned char *)&f->index[i]);
+      if (f->index[i] < end || f->index[i] > (uint64_t)st.st_size ||
+	  (i > 0 && f->index[i] - f->index[i - 1] > f->page_size))
+	return -EINVAL;
+      end = f->index[i];
+    }
+  for (int i = 0; i < ZCACHE_PAGES; i++)
+    f->cache[i].page = -1;
+  return 1;
+}
+
+static int
+zvfs_open (sqlite3_vfs *vfs, const char *name, sqlite3_file *file,
+	   int flags, int *out_flags)
+{
+  sqlite3_vfs *root = vfs->pAppData;
+  struct zfile *f = (struct zfile *)file;
+  int fd, r;
+
+  if (name == NULL || !(flags & SQLITE_OPEN_MAIN_DB))
+    return root->xOpen (root, name, file, flags, out_flags);
+
+  fd = open (name, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return root->xOpen (root, name, file, flags, out_flags);
+
+  r = zfile_init (f, fd);
+  if (r <= 0)
+    {
+      if (r < 0)
+	{
+	  free (f->index);
+	  free (f->zbuf);
+	}
+      close (fd);
+      if (r < 0)
+	return SQLITE_CORRUPT;
+      /* no archive, use the default VFS */
+      return root->xOpen (root, name, file, flags, out_flags);
+    }
+
+  f->base.pMethods = &zfile_methods;
+  if (out_flags)
+    *out_flags = (flags & ~SQLITE_OPEN_READWRITE) | SQLITE_OPEN_READONLY;
+  return SQLITE_OK;
+}
+
+/* everything else is done by the default VFS */
+#define ROOT(vfs) ((sqlite3_vfs *)(vfs)->pAppData)
+
+static int
+zvfs_delete (sqlite3_vfs *vfs, const char *name, int sync_dir)
+{
+  return ROOT(vfs)->xDelete (ROOT(vfs), name, sync_dir);
+}
+
+static int
+zvfs_access (sqlite3_vfs *vfs, const char *name, int flags, int *res)
+{
+  return ROOT(vfs)->xAccess (ROOT(vfs), name, flags, res);
+}
+
+static int
+zvfs_full_pathname (sqlite3_vfs *vfs, const char *name, int n, char *out)
+{
+  return ROOT(vfs)->xFullPathname (ROOT(vfs), name, n, out);
+}
+
+static void *
+zvfs_dlopen (sqlite3_vfs *vfs, const char *name)
+{
+  return ROOT(vfs)->xDlOpen (ROOT(vfs), name);
+}
+
+static void
+zvfs_dlerror (sqlite3_vfs *vfs, int n, char *msg)
+{
+  ROOT(vfs)->xDlError (ROOT(vfs), n, msg);
+}
+
+static void
+(*zvfs_dlsym (sqlite3_vfs *vfs, void *handle, const char *sym)) (void)
+{
+  return ROOT(vfs)->xDlSym (ROOT(vfs), handle, sym);
+}
+
+static void
+zvfs_dlclose (sqlite3_vfs *vfs, void *handle)
+{
+  ROOT(vfs)->xDlClose (ROOT(vfs), handle);
+}
+
+static int
+zvfs_randomness (sqlite3_vfs *vfs, int n, char *out)
+{
+  return ROOT(vfs)->xRandomness (ROOT(vfs), n, out);
+}
+
+static int
+zvfs_sleep (sqlite3_vfs *vfs, int usec)
+{
+  return ROOT(vfs)->xSleep (ROOT(vfs), usec);
+}
+
+static int
+zvfs_current_time (sqlite3_vfs *vfs, double *now)
+{
+  return ROOT(vfs)->xCurrentTime (ROOT(vfs), now);
+}
+
+static int
+zvfs_last_error (sqlite3_vfs *vfs, int n, char *msg)
+{
+  return ROOT(vfs)->xGetLastError (ROOT(vfs), n, msg);
+}
+
+static sqlite3_vfs zvfs = {
+  .iVersion = 1,
+  .zName = ZVFS_NAME,
+  .xOpen = zvfs_open,
+  .xDelete = zvfs_delete,
+  .xAccess = zvfs_access,
+  .xFullPathname = zvfs_full_pathname,
+  .xDlOpen = zvfs_dlopen,
+  .xDlError = zvfs_dlerror,
+  .xDlSym = zvfs_dlsym,
+  .xDlClose = zvfs_dlclose,
+  .xRandomness = zvfs_randomness,
+  .xSleep = zvfs_sleep,
+  .xCurrentTime = zvfs_current_time,
+  .xGetLastError = zvfs_last_error,
+};
+
+static pthread_once_t zvfs_once = PTHREAD_ONCE_INIT;
+static int zvfs_registered = 0;
+
+static void
+zvfs_register (void)
+{
+  sqlite3_vfs *root = sqlite3_vfs_find (NULL);
+
+  if (root == NULL)
+    return;
+  zvfs.pAppData = root;
+  zvfs.mxPathname = root->mxPathname;
+  zvfs.szOsFile = root->szOsFile > (int)sizeof (struct zfile) ?
+    root->szOsFile : (int)sizeof (struct zfile);
+  zvfs_registered = sqlite3_vfs_register (&zvfs, 0) == SQLITE_OK;
+}
+
+/* Returns the name of the VFS for compressed archives, registers it
+   on the first call. NULL if that failed. */
+const char *
+compress_vfs (void)
+{
+  pthread_once (&zvfs_once, zvfs_register);
+  return zvfs_registered ? ZVFS_NAME : NULL;
+}
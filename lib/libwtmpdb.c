@@ -28,32 +28,29 @@
 #include "config.h"
 
 #include <errno.h>
+#include <stdio.h>
 #include <string.h>
 #include <stddef.h>
 #include <stdlib.h>
 
 #include "basics.h"
 #include "wtmpdb.h"
+#include "cache.h"
+#include "batch.h"
+#include "metrics.h"
+#include "backend.h"
 #include "sqlite.h"
 
-#include "varlink.h"
-
-#if WITH_WTMPDBD
-static int varlink_is_active = 1;
-#else
-static int varlink_is_active = 0;
-#endif
-static int varlink_is_enforced = 0;
-
-#define VARLINK_CHECKS \
-   if (varlink_is_enforced == 0 && db_path != NULL && \
-      strcmp (db_path, "varlink") == 0) \
-    varlink_is_enforced = 1; \
-\
-  /* we can use varlink only if no specific database is requested */ \
-  if (varlink_is_enforced || (varlink_is_active && db_path == NULL))
-
-#define VARLINK_IS_NOT_RUNNING(r) (r == -ECONNREFUSED || r == -ENOENT || r == -ECONNRESET || r == -EACCES)
+/* Selects the backend for db_path, returns from the calling function
+   if there is none. */
+#define SELECT_BACKEND(ops, retval) \
+  const struct wtmpdb_backend_ops *ops = backend_select (&db_path); \
+  if (ops == NULL) \
+    { \
+      if (error) \
+	*error = strdup ("wtmpdbd support not available"); \
+      return retval; \
+    }
 
 /*
   Add new wtmp entry to db.
@@ -65,30 +62,30 @@ wtmpdb_login (const char *db_path, int type, const char *user,
 	      uint64_t usec_login, const char *tty, const char *rhost,
 	      const char *service, char **error)
 {
-  VARLINK_CHECKS
-    {
-#if WITH_WTMPDBD
-      int64_t id;
-
-      id = varlink_login (type, user, usec_login, tty, rhost,
-			  service, error);
-      if (id >= 0 || varlink_is_enforced)
-	return id;
+  return wtmpdb_login_v2 (db_path, type, user, usec_login, tty, rhost,
+			  service, NULL, error);
+}
 
-      if (VARLINK_IS_NOT_RUNNING(id))
-	{
-	  varlink_is_active = 0;
-	  if (error)
-	    *error = mfree (*error);
-	}
-      else
-	return id; /* return the error if wtmpdbd is active */
-#else
-      return -EPROTONOSUPPORT;
-#endif
-    }
-  return sqlite_login (db_path?db_path:_PATH_WTMPDB, type, user,
-		       usec_login, tty, rhost, service, error);
+/* Same as wtmpdb_login, but a login with the token of one recorded
+   within the last hour returns the ID of that one. */
+int64_t
+wtmpdb_login_v2 (const char *db_path, int type, const char *user,
+		 uint64_t usec_login, const char *tty, const char *rhost,
+		 const char *service, const char *token, char **error)
+{
+  char buf[BACKEND_TOKEN_LEN + 1];
+  int64_t id;
+
+  SELECT_BACKEND (ops, -EPROTONOSUPPORT);
+  /* wtmpdbd may commit the login after we wrote it ourselves */
+  if (token == NULL)
+    token = backend_login_token (ops, buf);
+  do
+    id = ops->login (db_path, type, user, usec_login, tty, rhost,
+		     service, token, error);
+  while (backend_fallback (&ops, id, error));
+
+  return id;
 }
 
 /*
@@ -101,57 +98,27 @@ int
 wtmpdb_logout (const char *db_path, int64_t id, uint64_t usec_logout,
 	       char **error)
 {
-  VARLINK_CHECKS
-    {
-#if WITH_WTMPDBD
-      int r;
-
-      r = varlink_logout (id, usec_logout, error);
-      if (r >= 0)
-	return r;
+  int r;
 
-      if (VARLINK_IS_NOT_RUNNING(id))
-	{
-	  varlink_is_active = 0;
-	  if (error)
-	    *error = mfree (*error);
-	}
-      else
-	return r; /* return the error if wtmpdbd is active */
-#else
-      return -EPROTONOSUPPORT;
-#endif
-    }
+  SELECT_BACKEND (ops, -EPROTONOSUPPORT);
+  do
+    r = ops->logout (db_path, id, usec_logout, error);
+  while (backend_fallback (&ops, r, error));
 
-  return sqlite_logout (db_path?db_path:_PATH_WTMPDB, id, usec_logout, error);
+  return r;
 }
 
 int64_t
 wtmpdb_get_id (const char *db_path, const char *tty, char **error)
 {
-  VARLINK_CHECKS
-    {
-#if WITH_WTMPDBD
-      int64_t id;
-
-      id = varlink_get_id (tty, error);
-      if (id >= 0)
-	return id;
+  int64_t id;
 
-      if (VARLINK_IS_NOT_RUNNING(id))
-	{
-	  varlink_is_active = 0;
-	  if (error)
-	    *error = mfree (*error);
-	}
-      else
-	return id; /* return the error if wtmpdbd is active */
-#else
-      return -EPROTONOSUPPORT;
-#endif
-    }
+  SELECT_BACKEND (ops, -EPROTONOSUPPORT);
+  do
+    id = ops->get_id (db_path, tty, error);
+  while (backend_fallback (&ops, id, error));
 
-  return sqlite_get_id (db_path?db_path:_PATH_WTMPDB, tty, error);
+  return id;
 }
 
 /* Reads all entries from database and calls the callback function for
@@ -163,62 +130,382 @@ wtmpdb_read_all (const char *db_path, int uniq,
 				char **azColName),
 		 char **error)
 {
-  VARLINK_CHECKS
+  return wtmpdb_read_all_v3 (db_path, uniq, WTMPDB_COL_ALL, cb_func,
+			     NULL, error);
+}
+
+int
+wtmpdb_read_all_v2 (const char *db_path, int uniq,
+		    int (*cb_func)(void *unused, int argc, char **argv,
+				   char **azColName),
+		    void *userdata, char **error)
+{
+  return wtmpdb_read_all_v3 (db_path, uniq, WTMPDB_COL_ALL, cb_func,
+			     userdata, error);
+}
+
+/*
+  Like wtmpdb_read_all_v2, but reads only the columns in the mask
+  columns. The others are passed as NULL to cb_func.
+  Returns 0 on success, <0 on failure.
+ */
+int
+wtmpdb_read_all_v3 (const char *db_path, int uniq, unsigned int columns,
+		    int (*cb_func)(void *unused, int argc, char **argv,
+				   char **azColName),
+		    void *userdata, char **error)
+{
+  int r;
+
+  SELECT_BACKEND (ops, -EPROTONOSUPPORT);
+  do
+    r = ops->read_all (db_path, uniq, columns, cb_func, userdata, error);
+  while (backend_retry (&ops, r, error));
+
+  return r;
+}
+
+/*
+  Like wtmpdb_read_all_v2, but passes the entries in batches of up to
+  WTMPDB_BATCH_SIZE entries to cb_func.
+  Returns 0 on success, <0 on failure.
+ */
+int
+wtmpdb_read_batch (const char *db_path, int uniq,
+		   int (*cb_func)(void *userdata,
+				  const struct wtmpdb_batch *batch),
+		   void *userdata, char **error)
+{
+  struct batch_ctx *ctx;
+  int r;
+
+  SELECT_BACKEND (ops, -EPROTONOSUPPORT);
+
+  ctx = batch_new (cb_func, userdata);
+  if (ctx == NULL)
     {
-#if WITH_WTMPDBD
-      int r;
+      if (error)
+	*error = strdup ("wtmpdb_read_batch: Out of memory");
+      return -ENOMEM;
+    }
 
-      r = varlink_read_all (uniq, cb_func, NULL, error);
-      if (r >= 0)
-	return r;
+  do
+    r = ops->read_batch (db_path, uniq, ctx, error);
+  while (backend_retry (&ops, r, error));
+
+  batch_free (ctx);
+  return r;
+}
+
+struct match_filter {
+  const struct wtmpdb_match *match;
+  int (*cb_func)(void *unused, int argc, char **argv, char **azColName);
+  void *userdata;
+};
+
+static int
+match_field (const char *pattern, const char *value)
+{
+  return pattern == NULL || (value && strcmp (pattern, value) == 0);
+}
 
-      if (VARLINK_IS_NOT_RUNNING(r))
+/* Passes only the matching entries to the callback, for backends
+   without read_match. */
+static int
+match_cb (void *data, int argc, char **argv, char **azColName)
+{
+  struct match_filter *f = data;
+
+  if (!match_field (f->match->user, argv[2]) ||
+      !match_field (f->match->tty, argv[5]) ||
+      !match_field (f->match->rhost, argv[6]))
+    return 0;
+  return f->cb_func (f->userdata, argc, argv, azColName);
+}
+
+/*
+  Calls cb_func for all entries matching match. Files which cannot
+  contain a match according to their filter are skipped.
+  Returns 0 on success, <0 on failure.
+ */
+int
+wtmpdb_read_match (const char *db_path, const struct wtmpdb_match *match,
+		   int (*cb_func)(void *unused, int argc, char **argv,
+				  char **azColName),
+		   void *userdata, char **error)
+{
+  struct match_filter f = {
+    .match = match,
+    .cb_func = cb_func,
+    .userdata = userdata,
+  };
+  int r;
+
+  SELECT_BACKEND (ops, -EPROTONOSUPPORT);
+  do
+    {
+      r = ops->read_match ?
+	ops->read_match (db_path, match, cb_func, userdata, error) :
+	-EOPNOTSUPP;
+      /* also if wtmpdbd is older than ReadMatch */
+      if (r == -EOPNOTSUPP)
 	{
-	  varlink_is_active = 0;
 	  if (error)
 	    *error = mfree (*error);
+	  r = ops->read_all (db_path, 0, WTMPDB_COL_ALL, match_cb, &f, error);
+	}
+    }
+  while (backend_retry (&ops, r, error));
+
+  return r;
+}
+
+struct last_login {
+  const char *user;
+  uint64_t login;
+  char *argv[8];	/* copy of the newest login so far */
+  int failed;
+};
+
+/* Keeps the newest login of the user, for backends without
+   get_last_login. */
+static int
+last_login_cb (void *data, int argc, char **argv,
+	       char **azColName __attribute__((__unused__)))
+{
+  struct last_login *l = data;
+  uint64_t login;
+
+  if (argc != 8 || argv[1] == NULL || atoi (argv[1]) != USER_PROCESS ||
+      argv[2] == NULL || strcmp (argv[2], l->user) != 0 || argv[3] == NULL)
+    return 0;
+  login = strtoull (argv[3], NULL, 10);
+  if (l->argv[0] != NULL && login < l->login)
+    return 0;
+
+  l->login = login;
+  for (int i = 0; i < 8; i++)
+    {
+      free (l->argv[i]);
+      l->argv[i] = argv[i] ? strdup (argv[i]) : NULL;
+      if (argv[i] && l->argv[i] == NULL)
+	l->failed = 1;
+    }
+  return 0;
+}
+
+/*
+  Calls cb_func once with the newest login (USER_PROCESS) of user.
+  Returns 0 on success, -ENOENT if the user never logged in, other
+  <0 values on failure.
+ */
+int
+wtmpdb_get_last_login (const char *db_path, const char *user,
+		       int (*cb_func)(void *unused, int argc, char **argv,
+				      char **azColName),
+		       void *userdata, char **error)
+{
+  static char *colnames[] = {"ID", "Type", "User", "Login", "Logout",
+			     "TTY", "RemoteHost", "Service"};
+  struct last_login l = {
+    .user = user,
+  };
+  int r;
+
+  SELECT_BACKEND (ops, -EPROTONOSUPPORT);
+  do
+    {
+      for (int i = 0; i < 8; i++)
+	l.argv[i] = mfree (l.argv[i]);
+      l.failed = 0;
+      r = ops->get_last_login ?
+	ops->get_last_login (db_path, user, cb_func, userdata, error) :
+	ops->read_all (db_path, 0, WTMPDB_COL_ALL, last_login_cb, &l, error);
+    }
+  while (backend_retry (&ops, r, error));
+
+  if (r == 0 && ops->get_last_login == NULL)
+    {
+      if (l.failed)
+	{
+	  if (error)
+	    *error = strdup ("wtmpdb_get_last_login: Out of memory");
+	  r = -ENOMEM;
+	}
+      else if (l.argv[0] == NULL)
+	{
+	  if (error)
+	    if (asprintf (error, "No login of '%s' found", user) < 0)
+	      *error = strdup ("wtmpdb_get_last_login: Out of memory");
+	  r = -ENOENT;
 	}
       else
-	return r; /* return the error if wtmpdbd is active */
-#else
-      return -EPROTONOSUPPORT;
-#endif
+	cb_func (userdata, 8, l.argv, colnames);
     }
+  for (int i = 0; i < 8; i++)
+    free (l.argv[i]);
 
-  return sqlite_read_all (db_path?db_path:_PATH_WTMPDB, uniq, cb_func, NULL, error);
+  return r;
 }
 
+/*
+  Writes the number of entries per type and service, the open sessions
+  of the current and the previous boot and the last boot time in
+  OpenMetrics text format to path, to stdout if path is NULL. The file
+  gets replaced atomically.
+  Returns 0 on success, < 0 on failure.
+ */
 int
-wtmpdb_read_all_v2 (const char *db_path, int uniq,
-		    int (*cb_func)(void *unused, int argc, char **argv,
-				   char **azColName),
-		    void *userdata, char **error)
+wtmpdb_write_metrics (const char *db_path, const char *path, char **error)
 {
-  VARLINK_CHECKS
+  struct metrics *m = NULL;
+  int r;
+
+  SELECT_BACKEND (ops, -EPROTONOSUPPORT);
+  do
     {
-#if WITH_WTMPDBD
-      int r;
+      metrics_free (m);
+      m = metrics_new ();
+      if (m == NULL)
+	{
+	  if (error)
+	    *error = strdup ("wtmpdb_write_metrics: Out of memory");
+	  return -ENOMEM;
+	}
+      r = ops->read_metrics ?
+	ops->read_metrics (db_path, metrics_add_cb, m, error) :
+	ops->read_all (db_path, 0, WTMPDB_COL_ALL, metrics_count_cb, m, error);
+    }
+  while (backend_retry (&ops, r, error));
+
+  if (r == 0)
+    r = metrics_finish (m, error);
+  if (r == 0)
+    r = metrics_write (m, path, error);
+  metrics_free (m);
+
+  return r;
+}
 
-      r = varlink_read_all (uniq, cb_func, userdata, error);
-      if (r >= 0)
+/*
+  Like wtmpdb_read_all_v2, but keeps a copy of the result in cache_dir
+  (_PATH_WTMPDB_CACHE if NULL), which is only extended by new entries
+  as long as no existing entry was modified or deleted.
+  Falls back to wtmpdb_read_all_v2 if the database cannot be read
+  directly.
+  Returns 0 on success, <0 on failure.
+ */
+int
+wtmpdb_read_all_cached (const char *db_path, int uniq, const char *cache_dir,
+			int (*cb_func)(void *unused, int argc, char **argv,
+				       char **azColName),
+			void *userdata, char **error)
+{
+  const char *path = db_path;
+
+  /* the cache reads the SQLite database file directly */
+  if (backend_select (&path) == &sqlite_backend_ops)
+    {
+      int r = cache_read_all (path?path:_PATH_WTMPDB, uniq,
+			      cache_dir?cache_dir:_PATH_WTMPDB_CACHE,
+			      cb_func, userdata, error);
+      if (r != -ENOENT)
 	return r;
+      if (error)
+	*error = mfree (*error);
+    }
+
+  return wtmpdb_read_all_v2 (db_path, uniq, cb_func, userdata, error);
+}
+
+struct wtmpdb_cursor {
+  const struct wtmpdb_backend_ops *ops;
+  void *data;
+};
+
+/*
+  Opens a cursor over the entries of wtmpdb_read_all_v2, which are then
+  read in pages by wtmpdb_cursor_read.
+  Returns 0 on success, < 0 on failure.
+ */
+int
+wtmpdb_cursor_open (const char *db_path, int uniq,
+		    struct wtmpdb_cursor **cursor, char **error)
+{
+  struct wtmpdb_cursor *c;
+  int r;
 
-      if (VARLINK_IS_NOT_RUNNING(r))
+  SELECT_BACKEND (ops, -EPROTONOSUPPORT);
+  c = malloc (sizeof (*c));
+  if (c == NULL)
+    {
+      if (error)
+	*error = strdup ("wtmpdb_cursor_open: Out of memory");
+      return -ENOMEM;
+    }
+  do
+    {
+      if (ops->cursor_open == NULL)
 	{
-	  varlink_is_active = 0;
 	  if (error)
-	    *error = mfree (*error);
+	    if (asprintf (error, "Backend %s has no cursors", ops->name) < 0)
+	      *error = strdup ("wtmpdb_cursor_open: Out of memory");
+	  r = -EOPNOTSUPP;
 	}
       else
-	return r; /* return the error if wtmpdbd is active */
-#else
-      return -EPROTONOSUPPORT;
-#endif
+	r = ops->cursor_open (db_path, uniq, &c->data, error);
+    }
+  while (backend_retry (&ops, r, error));
+
+  if (r < 0)
+    {
+      free (c);
+      return r;
     }
+  c->ops = ops;
+  *cursor = c;
+  return 0;
+}
+
+/* Calls cb_func for the next up to count entries.
+   Returns the number of entries, 0 after the last one, < 0 on failure. */
+int
+wtmpdb_cursor_read (struct wtmpdb_cursor *cursor, size_t count,
+		    int (*cb_func)(void *unused, int argc, char **argv,
+				   char **azColName),
+		    void *userdata, char **error)
+{
+  return cursor->ops->cursor_read (cursor->data, count, cb_func, userdata,
+				   error);
+}
 
-  return sqlite_read_all (db_path?db_path:_PATH_WTMPDB, uniq, cb_func, userdata, error);
+void
+wtmpdb_cursor_close (struct wtmpdb_cursor *cursor)
+{
+  if (cursor == NULL)
+    return;
+  cursor->ops->cursor_close (cursor->data);
+  free (cursor);
 }
 
+/* Reads all boot entries from database and calls the callback function
+   once per boot with uptime relevant data and the number of sessions.
+   Returns 0 on success, < 0 on failure. */
+int
+wtmpdb_read_boots (const char *db_path,
+		   int (*cb_func)(void *unused, int argc, char **argv,
+				  char **azColName),
+		   void *userdata, char **error)
+{
+  int r;
+
+  SELECT_BACKEND (ops, -EPROTONOSUPPORT);
+  do
+    r = ops->read_boots (db_path, cb_func, userdata, error);
+  while (backend_retry (&ops, r, error));
+
+  return r;
+}
 
 /* Reads all entries from database and calls the callback function for
    each entry.
@@ -227,29 +514,41 @@ int
 wtmpdb_rotate (const char *db_path, const int days, char **error,
 	       char **wtmpdb_name, uint64_t *entries)
 {
-  VARLINK_CHECKS
-    {
-#if WITH_WTMPDBD
-      int r;
+  struct wtmpdb_rotate_opts opts = { .days = days };
 
-      r = varlink_rotate (days, wtmpdb_name, entries, error);
-      if (r >= 0)
-	return r;
+  return wtmpdb_rotate_v2 (db_path, &opts, error, wtmpdb_name, entries);
+}
 
-      if (VARLINK_IS_NOT_RUNNING(r))
-	{
-	  varlink_is_active = 0;
-	  if (error)
-	    *error = mfree (*error);
-	}
-      else
-	return r; /* return the error if wtmpdbd is active */
-#else
-      return -EPROTONOSUPPORT;
-#endif
-    }
+/* Like wtmpdb_rotate, with the rotation mode selected by opts->flags.
+   Returns 0 on success, < 0 on failure. */
+int
+wtmpdb_rotate_v2 (const char *db_path, const struct wtmpdb_rotate_opts *opts,
+		  char **error, char **wtmpdb_name, uint64_t *entries)
+{
+  int r;
+
+  SELECT_BACKEND (ops, -EPROTONOSUPPORT);
+  do
+    r = ops->rotate (db_path, opts, wtmpdb_name, entries, error);
+  while (backend_retry (&ops, r, error));
+
+  return r;
+}
 
-  return sqlite_rotate (db_path?db_path:_PATH_WTMPDB, days, wtmpdb_name, entries, error);
+/* Copies the database to dest.
+   Returns 0 on success, < 0 on failure. */
+int
+wtmpdb_backup (const char *db_path, const char *dest, unsigned int flags,
+	       char **error)
+{
+  int r;
+
+  SELECT_BACKEND (ops, -EPROTONOSUPPORT);
+  do
+    r = ops->backup (db_path, dest, flags, error);
+  while (backend_retry (&ops, r, error));
+
+  return r;
 }
 
 /* returns boottime entry on success or 0 in error case */
@@ -259,30 +558,66 @@ wtmpdb_get_boottime (const char *db_path, char **error)
   uint64_t boottime;
   int r;
 
-  VARLINK_CHECKS
-    {
-#if WITH_WTMPDBD
-      r = varlink_get_boottime (&boottime, error);
-      if (r >= 0)
-	return boottime;
+  SELECT_BACKEND (ops, 0);
+  do
+    r = ops->get_boottime (db_path, &boottime, error);
+  while (backend_retry (&ops, r, error));
 
-      if (VARLINK_IS_NOT_RUNNING(r))
-	{
-	  varlink_is_active = 0;
-	  if (error)
-	    *error = mfree (*error);
-	}
-      else
-	return 0; /* return the error if wtmpdbd is active */
-#else
-      return -EPROTONOSUPPORT;
-#endif
-    }
-
-  r = sqlite_get_boottime (db_path?db_path:_PATH_WTMPDB,
-			   &boottime, error);
   if (r < 0)
     return 0;
   else
     return boottime;
 }
+
+/* Writes pending changes of backends which keep entries in memory.
+   Returns 0 on success, < 0 on failure. */
+int
+wtmpdb_flush (const char *db_path, char **error)
+{
+  SELECT_BACKEND (ops, -EPROTONOSUPPORT);
+
+  return ops->flush ? ops->flush (db_path, error) : 0;
+}
+
+/* Runs pending schema migrations for about usec microseconds, 0 means
+   until all are done. wtmpdbd migrates its database itself.
+   Returns 0 if the schema is current, 1 if migrations are pending,
+   < 0 on failure. */
+int
+wtmpdb_migrate (const char *db_path, uint64_t usec, char **error)
+{
+  SELECT_BACKEND (ops, -EPROTONOSUPPORT);
+
+  return ops->migrate ? ops->migrate (db_path, usec, error) : 0;
+}
+
+/* Runs the maintenance tasks (WTMPDB_MAINT_*). wtmpdbd maintains its
+   database itself.
+   Returns 0 on success, < 0 on failure. */
+int
+wtmpdb_maintain (const char *db_path, unsigned int tasks, char **error)
+{
+  SELECT_BACKEND (ops, -EPROTONOSUPPORT);
+
+  return ops->maintain ? ops->maintain (db_path, tasks, error) : 0;
+}
+
+void
+wtmpdb_get_stats (struct wtmpdb_stats *stats)
+{
+  sqlite_get_stats (stats);
+}
+
+/* Sets how long to wait for a locked database, for all threads. */
+void
+wtmpdb_set_busy_timeout (uint64_t usec)
+{
+  sqlite_set_busy_timeout (usec);
+}
+
+/* Sets how long to wait for wtmpdbd, for all threads. */
+void
+wtmpdb_set_varlink_timeout (uint64_t usec, unsigned int flags)
+{
+  backend_set_varlink_timeout (usec, (flags & WTMPDB_VARLINK_FALLBACK) != 0);
+}
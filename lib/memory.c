@@ -0,0 +1,897 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* In-process backend for database paths "memory:NAME[?OPTIONS]".
+
+   Entries are kept in an append-only vector, the index + 1 is the ID.
+   Open sessions are indexed by tty, the latest login by user. Nothing
+   is written to disk unless the option flush=PATH is given: then new
+   entries and logouts are written to the SQLite database PATH when the
+   process exits, and additionally after every write if interval=SECONDS
+   have passed since the last flush. Options are separated by '&', they
+   are only evaluated when the store is created by the first access. */
+
+#include "config.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "wtmpdb.h"
+#include "sqlite.h"
+#include "batch.h"
+#include "memory.h"
+
+struct mem_entry {
+  int type;
+  uint64_t login;
+  uint64_t logout;	/* 0 if still open */
+  char *user;
+  char *tty;
+  char *rhost;
+  char *service;
+  int64_t db_id;	/* ID in the flush database, 0 if not written */
+  int logout_dirty;	/* logout not written to the flush database */
+};
+
+struct map_entry {
+  char *key;
+  int64_t latest;	/* user index: latest login */
+  size_t n, alloc;	/* tty index: open sessions */
+  int64_t *ids;
+};
+
+struct map {
+  size_t n, size;
+  struct map_entry *tab;
+};
+
+struct mem_store {
+  char *name;
+  char *flush_path;
+  uint64_t interval_usec;
+  uint64_t last_flush;
+  size_t n, alloc;
+  struct mem_entry *entries;
+  size_t flushed;	/* entries[0 .. flushed-1] have a db_id */
+  size_t n_dirty, alloc_dirty;
+  int64_t *dirty;	/* flushed entries with a new logout */
+  struct map ttys;
+  struct map users;
+  uint64_t boottime;
+  struct mem_store *next;
+};
+
+static struct mem_store *stores = NULL;
+
+/* Protects all stores. Recursive, since callbacks of read functions
+   may access the same store again. */
+static pthread_mutex_t stores_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+static uint64_t
+now_usec (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return wtmpdb_timespec2usec (ts);
+}
+
+static int
+set_oom (char **error, const char *func)
+{
+  if (error)
+    if (asprintf (error, "%s: Out of memory", func) < 0)
+      *error = NULL;
+  return -ENOMEM;
+}
+
+static int
+push_id (int64_t **ids, size_t *n, size_t *alloc, int64_t id)
+{
+  if (*n == *alloc)
+    {
+      size_t new_alloc = *alloc ? *alloc * 2 : 4;
+      int64_t *tmp = realloc (*ids, new_alloc * sizeof (*tmp));
+      if (tmp == NULL)
+	return -ENOMEM;
+      *ids = tmp;
+      *alloc = new_alloc;
+    }
+  (*ids)[(*n)++] = id;
+  return 0;
+}
+
+static uint64_t
+map_hash (const char *s)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+
+  for (; *s; s++)
+    {
+      h ^= (unsigned char)*s;
+      h *= 0x100000001b3ULL;
+    }
+  return h;
+}
+
+static struct map_entry *
+map_slot (struct map *m, const char *key)
+{
+  size_t i = map_hash (key) & (m->size - 1);
+
+  while (m->tab[i].key && strcmp (m->tab[i].key, key) != 0)
+    i = (i + 1) & (m->size - 1);
+  return &m->tab[i];
+}
+
+static struct map_entry *
+map_find (struct map *m, const char *key)
+{
+  struct map_entry *e;
+
+  if (m->size == 0)
+    return NULL;
+  e = map_slot (m, key);
+  return e->key ? e : NULL;
+}
+
+/* Returns the entry for key, creating it if needed. */
+static struct map_entry *
+map_get (struct map *m, const char *key)
+{
+  struct map_entry *e;
+
+  if (2 * (m->n + 1) > m->size)
+    {
+      struct map old = *m;
+
+      m->size = old.size ? old.size * 2 : 64;
+      m->n = 0;
+      m->tab = calloc (m->size, sizeof (*m->tab));
+      if (m->tab == NULL)
+	{
+	  *m = old;
+	  return NULL;
+	}
+      for (size_t i = 0; i < old.size; i++)
+	if (old.tab[i].key)
+	  {
+	    *map_slot (m, old.tab[i].key) = old.tab[i];
+	    m->n++;
+	  }
+      free (old.tab);
+    }
+
+  e = map_slot (m, key);
+  if (e->key == NULL)
+    {
+      if ((e->key = strdup (key)) == NULL)
+	return NULL;
+      e->latest = 0;
+      m->n++;
+    }
+  return e;
+}
+
+static void
+map_free (struct map *m)
+{
+  for (size_t i = 0; i < m->size; i++)
+    {
+      free (m->tab[i].key);
+      free (m->tab[i].ids);
+    }
+  free (m->tab);
+}
+
+static void
+store_free (struct mem_store *st)
+{
+  for (size_t i = 0; i < st->n; i++)
+    {
+      free (st->entries[i].user);
+      free (st->entries[i].tty);
+      free (st->entries[i].rhost);
+      free (st->entries[i].service);
+    }
+  free (st->entries);
+  free (st->dirty);
+  map_free (&st->ttys);
+  map_free (&st->users);
+  free (st->flush_path);
+  free (st->name);
+  free (st);
+}
+
+static int
+parse_options (struct mem_store *st, const char *opts, char **error)
+{
+  char *buf = strdup (opts), *saveptr = NULL;
+
+  if (buf == NULL)
+    return set_oom (error, "memory");
+
+  for (char *opt = strtok_r (buf, "&", &saveptr); opt;
+       opt = strtok_r (NULL, "&", &saveptr))
+    {
+      if (strncmp (opt, "flush=", 6) == 0)
+	{
+	  free (st->flush_path);
+	  if ((st->flush_path = strdup (opt + 6)) == NULL)
+	    {
+	      free (buf);
+	      return set_oom (error, "memory");
+	    }
+	}
+      else if (strncmp (opt, "interval=", 9) == 0)
+	st->interval_usec = strtoull (opt + 9, NULL, 10) * USEC_PER_SEC;
+      else
+	{
+	  if (error)
+	    if (asprintf (error, "Unknown option for in-memory database: %s", opt) < 0)
+	      *error = NULL;
+	  free (buf);
+	  return -EINVAL;
+	}
+    }
+
+  free (buf);
+  return 0;
+}
+
+/* Returns the store for "NAME[?OPTIONS]", creating it on first use. */
+static struct mem_store *
+get_store (const char *db_path, char **error)
+{
+  const char *opts = strchr (db_path, '?');
+  size_t len = opts ? (size_t)(opts - db_path) : strlen (db_path);
+  struct mem_store *st;
+
+  for (st = stores; st; st = st->next)
+    if (strlen (st->name) == len && strncmp (st->name, db_path, len) == 0)
+      return st;
+
+  st = calloc (1, sizeof (*st));
+  if (st == NULL || (st->name = strndup (db_path, len)) == NULL)
+    {
+      free (st);
+      set_oom (error, "memory");
+      return NULL;
+    }
+  if (opts && parse_options (st, opts + 1, error) < 0)
+    {
+      store_free (st);
+      return NULL;
+    }
+  st->last_flush = now_usec ();
+  st->next = stores;
+  stores = st;
+  return st;
+}
+
+static struct mem_entry *
+get_entry (struct mem_store *st, int64_t id, char **error)
+{
+  if (id <= 0 || (uint64_t)id > st->n)
+    {
+      if (error)
+	if (asprintf (error, "Entry with ID %lld not found",
+		      (long long)id) < 0)
+	  *error = NULL;
+      return NULL;
+    }
+  return &st->entries[id - 1];
+}
+
+static int
+store_flush (struct mem_store *st, char **error)
+{
+  struct sqlite_row *rows;
+  size_t n = 0;
+  int r;
+
+  if (st->flush_path == NULL)
+    return 0;
+  if (st->flushed == st->n && st->n_dirty == 0)
+    return 0;
+
+  rows = calloc (st->n - st->flushed + st->n_dirty, sizeof (*rows));
+  if (rows == NULL)
+    return set_oom (error, "memory_flush");
+
+  for (size_t i = 0; i < st->n_dirty; i++)
+    {
+      struct mem_entry *e = &st->entries[st->dirty[i] - 1];
+      rows[n].id = e->db_id;
+      rows[n++].logout = e->logout;
+    }
+  for (size_t i = st->flushed; i < st->n; i++)
+    {
+      struct mem_entry *e = &st->entries[i];
+      rows[n].type = e->type;
+      rows[n].user = e->user;
+      rows[n].login = e->login;
+      rows[n].logout = e->logout;
+      rows[n].tty = e->tty;
+      rows[n].rhost = e->rhost;
+      rows[n++].service = e->service;
+    }
+
+  r = sqlite_write_rows (st->flush_path, rows, n, error);
+  if (r == 0)
+    {
+      for (size_t i = 0; i < st->n_dirty; i++)
+	st->entries[st->dirty[i] - 1].logout_dirty = 0;
+      st->n_dirty = 0;
+      for (size_t i = st->flushed, j = n - (st->n - st->flushed); i < st->n; i++, j++)
+	st->entries[i].db_id = rows[j].id;
+      st->flushed = st->n;
+    }
+  st->last_flush = now_usec ();
+
+  free (rows);
+  return r;
+}
+
+static void
+maybe_flush (struct mem_store *st)
+{
+  if (st->flush_path && st->interval_usec &&
+      now_usec () - st->last_flush >= st->interval_usec)
+    {
+      char *error = NULL;
+
+      /* not fatal for the write itself, retried with the next write */
+      store_flush (st, &error);
+      free (error);
+    }
+}
+
+/* Writes pending changes of the store db_path ("NAME[?OPTIONS]")
+   to its flush database.
+   Returns 0 on success, < 0 on failure. */
+static int
+mem_flush_locked (const char *db_path, char **error)
+{
+  struct mem_store *st = get_store (db_path, error);
+
+  if (st == NULL)
+    return -ENOMEM;
+  return store_flush (st, error);
+}
+
+__attribute__((destructor)) static void
+memory_flush_all (void)
+{
+  pthread_mutex_lock (&stores_lock);
+  while (stores)
+    {
+      struct mem_store *st = stores;
+      char *error = NULL;
+
+      stores = st->next;
+      if (store_flush (st, &error) < 0)
+	fprintf (stderr, "wtmpdb: flushing in-memory database %s failed: %s\n",
+		 st->name, error ? error : "unknown error");
+      free (error);
+      store_free (st);
+    }
+  pthread_mutex_unlock (&stores_lock);
+}
+
+static int64_t
+mem_login_locked (const char *db_path, int type, const char *user,
+		  uint64_t usec_login, const char *tty, const char *rhost,
+		  const char *service, char **error)
+{
+  struct mem_store *st = get_store (db_path, error);
+  struct mem_entry *e;
+  int64_t id;
+
+  if (st == NULL)
+    return -ENOMEM;
+
+  if (st->n == st->alloc)
+    {
+      size_t alloc = st->alloc ? st->alloc * 2 : 1024;
+      struct mem_entry *tmp = realloc (st->entries, alloc * sizeof (*tmp));
+      if (tmp == NULL)
+	return set_oom (error, "memory_login");
+      st->entries = tmp;
+      st->alloc = alloc;
+    }
+
+  e = &st->entries[st->n];
+  memset (e, 0, sizeof (*e));
+  e->type = type;
+  e->login = usec_login;
+  if ((e->user = strdup (user)) == NULL ||
+      (tty && (e->tty = strdup (tty)) == NULL) ||
+      (rhost && (e->rhost = strdup (rhost)) == NULL) ||
+      (service && (e->service = strdup (service)) == NULL))
+    goto oom;
+  id = (int64_t)st->n + 1;
+
+  /* the entry counts only once it is indexed */
+  if (tty)
+    {
+      struct map_entry *t = map_get (&st->ttys, tty);
+      struct map_entry *u = NULL;
+
+      /* same rule as the lastlog query */
+      if (t == NULL || (strcmp (tty, "~") != 0 &&
+			(u = map_get (&st->users, user)) == NULL) ||
+	  push_id (&t->ids, &t->n, &t->alloc, id) < 0)
+	goto oom;
+      if (u && (u->latest == 0 ||
+		st->entries[u->latest - 1].login <= usec_login))
+	u->latest = id;
+    }
+  st->n++;
+
+  if (strcmp (user, "reboot") == 0 && usec_login > st->boottime)
+    st->boottime = usec_login;
+
+  maybe_flush (st);
+  return id;
+
+ oom:
+  free (e->user);
+  free (e->tty);
+  free (e->rhost);
+  free (e->service);
+  return set_oom (error, "memory_login");
+}
+
+static int
+mem_logout_locked (const char *db_path, int64_t id, uint64_t usec_logout,
+		   char **error)
+{
+  struct mem_store *st = get_store (db_path, error);
+  struct mem_entry *e;
+
+  if (st == NULL)
+    return -ENOMEM;
+  if ((e = get_entry (st, id, error)) == NULL)
+    return -ENOENT;
+
+  e->logout = usec_logout;
+
+  if (e->tty)
+    {
+      struct map_entry *m = map_find (&st->ttys, e->tty);
+      for (size_t i = 0; m && i < m->n; i++)
+	if (m->ids[i] == id)
+	  {
+	    m->ids[i] = m->ids[--m->n];
+	    break;
+	  }
+    }
+
+  if ((size_t)id <= st->flushed && !e->logout_dirty)
+    {
+      if (push_id (&st->dirty, &st->n_dirty, &st->alloc_dirty, id) < 0)
+	return set_oom (error, "memory_logout");
+      e->logout_dirty = 1;
+    }
+
+  maybe_flush (st);
+  return 0;
+}
+
+static int64_t
+mem_get_id_locked (const char *db_path, const char *tty, char **error)
+{
+  struct mem_store *st = get_store (db_path, error);
+  struct map_entry *m;
+  int64_t id = 0;
+
+  if (st == NULL)
+    return -ENOMEM;
+
+  m = map_find (&st->ttys, tty);
+  for (size_t i = 0; m && i < m->n; i++)
+    if (id == 0 || st->entries[m->ids[i] - 1].login > st->entries[id - 1].login)
+      id = m->ids[i];
+
+  if (id == 0)
+    {
+      if (error)
+	if (asprintf (error, "Open entry for tty '%s' not found (search_id)", tty) < 0)
+	  *error = NULL;
+      return -ENOENT;
+    }
+  return id;
+}
+
+/* ORDER BY Login DESC, Logout ASC */
+static int
+cmp_login (const void *p1, const void *p2, void *data)
+{
+  const struct mem_store *st = data;
+  const struct mem_entry *e1 = &st->entries[*(const int64_t *)p1 - 1];
+  const struct mem_entry *e2 = &st->entries[*(const int64_t *)p2 - 1];
+
+  if (e1->login != e2->login)
+    return e1->login > e2->login ? -1 : 1;
+  if (e1->logout != e2->logout)
+    return e1->logout < e2->logout ? -1 : 1;
+  return *(const int64_t *)p1 < *(const int64_t *)p2 ? -1 : 1;
+}
+
+static int
+cmp_user (const void *p1, const void *p2, void *data)
+{
+  const struct mem_store *st = data;
+  const struct mem_entry *e1 = &st->entries[*(const int64_t *)p1 - 1];
+  const struct mem_entry *e2 = &st->entries[*(const int64_t *)p2 - 1];
+
+  return strcmp (e1->user, e2->user);
+}
+
+/* Returns the IDs in the order of the read_all query. */
+static int64_t *
+sorted_ids (struct mem_store *st, int uniq, size_t *n, char **error)
+{
+  int64_t *ids;
+
+  ids = malloc ((st->n ? st->n : 1) * sizeof (*ids));
+  if (ids == NULL)
+    {
+      set_oom (error, "memory_read_all");
+      return NULL;
+    }
+
+  *n = 0;
+  if (uniq)
+    {
+      for (size_t i = 0; i < st->users.size; i++)
+	if (st->users.tab[i].key)
+	  ids[(*n)++] = st->users.tab[i].latest;
+    }
+  else
+    for (size_t i = 0; i < st->n; i++)
+      ids[(*n)++] = (int64_t)i + 1;
+
+  qsort_r (ids, *n, sizeof (*ids), uniq ? cmp_user : cmp_login, st);
+  return ids;
+}
+
+static int
+mem_read_all_locked (const char *db_path, int uniq, unsigned int columns,
+		     int (*cb_func)(void *unused, int argc, char **argv,
+				    char **azColName),
+		     void *userdata, char **error)
+{
+  static char *colnames[] = {"ID", "Type", "User", "Login", "Logout",
+			     "TTY", "RemoteHost", "Service"};
+  struct mem_store *st = get_store (db_path, error);
+  int64_t *ids;
+  size_t n;
+  int r = 0;
+
+  if (st == NULL)
+    return -ENOMEM;
+  if ((ids = sorted_ids (st, uniq, &n, error)) == NULL)
+    return -ENOMEM;
+
+  for (size_t i = 0; i < n && r == 0; i++)
+    {
+      struct mem_entry *e = &st->entries[ids[i] - 1];
+      char id_s[24], type_s[16], login_s[24], logout_s[24];
+      char *argv[8];
+
+      snprintf (id_s, sizeof (id_s), "%lld", (long long)ids[i]);
+      snprintf (type_s, sizeof (type_s), "%d", e->type);
+      snprintf (login_s, sizeof (login_s), "%llu", (unsigned long long)e->login);
+      snprintf (logout_s, sizeof (logout_s), "%llu", (unsigned long long)e->logout);
+      argv[0] = id_s;
+      argv[1] = type_s;
+      argv[2] = e->user;
+      argv[3] = login_s;
+      argv[4] = e->logout ? logout_s : NULL;
+      argv[5] = e->tty;
+      argv[6] = e->rhost;
+      argv[7] = e->service;
+      for (int j = 0; j < 8; j++)
+	if (!(columns & (1U << j)))
+	  argv[j] = NULL;
+
+      if (cb_func (userdata, 8, argv, colnames) != 0)
+	{
+	  if (error)
+	    *error = strdup ("memory_read_all: query aborted");
+	  r = -ECANCELED;
+	}
+    }
+
+  free (ids);
+  return r;
+}
+
+static int
+mem_read_batch_locked (const char *db_path, int uniq,
+		       struct batch_ctx *ctx, char **error)
+{
+  struct mem_store *st = get_store (db_path, error);
+  int64_t *ids;
+  size_t n;
+  int r = 0;
+
+  if (st == NULL)
+    return -ENOMEM;
+  if ((ids = sorted_ids (st, uniq, &n, error)) == NULL)
+    return -ENOMEM;
+
+  for (size_t i = 0; i < n && r == 0; i++)
+    {
+      struct mem_entry *e = &st->entries[ids[i] - 1];
+      r = batch_add (ctx, ids[i], e->type, e->login, e->logout, e->user,
+		     e->tty, e->rhost, e->service);
+    }
+  if (r == 0)
+    r = batch_flush (ctx);
+  if (r == -ENOMEM)
+    set_oom (error, "memory_read_batch");
+  else if (r < 0)
+    {
+      if (error)
+	if (asprintf (error, "memory_read_batch: %s", strerror (-r)) < 0)
+	  *error = strdup ("memory_read_batch: Out of memory");
+    }
+  else if (r != 0)
+    {
+      if (error)
+	*error = strdup ("memory_read_batch: query aborted");
+      r = -ECANCELED;
+    }
+
+  free (ids);
+  return r;
+}
+
+static int
+cmp_u64 (const void *p1, const void *p2)
+{
+  uint64_t a = *(const uint64_t *)p1, b = *(const uint64_t *)p2;
+
+  return a < b ? -1 : a > b;
+}
+
+/* Number of values in sorted v[0..n-1] which are < x */
+static size_t
+lower_bound (const uint64_t *v, size_t n, uint64_t x)
+{
+  size_t lo = 0, hi = n;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (v[mid] < x)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+static int
+mem_read_boots_locked (const char *db_path,
+		       int (*cb_func)(void *unused, int argc, char **argv,
+				      char **azColName),
+		       void *userdata, char **error)
+{
+  static char *colnames[] = {"ID", "User", "BootTime", "ShutdownTime",
+			     "Kernel", "NextBoot", "Sessions", "Crash"};
+  struct mem_store *st = get_store (db_path, error);
+  uint64_t *logins;
+  int64_t *boots;
+  size_t n_logins = 0, n_boots = 0;
+  int r = 0;
+
+  if (st == NULL)
+    return -ENOMEM;
+
+  logins = malloc ((st->n ? st->n : 1) * sizeof (*logins));
+  boots = malloc ((st->n ? st->n : 1) * sizeof (*boots));
+  if (logins == NULL || boots == NULL)
+    {
+      free (logins);
+      free (boots);
+      return set_oom (error, "memory_read_boots");
+    }
+
+  for (size_t i = 0; i < st->n; i++)
+    if (st->entries[i].type == USER_PROCESS)
+      logins[n_logins++] = st->entries[i].login;
+    else if (st->entries[i].type == BOOT_TIME)
+      boots[n_boots++] = (int64_t)i + 1;
+  qsort (logins, n_logins, sizeof (*logins), cmp_u64);
+  /* newest first */
+  qsort_r (boots, n_boots, sizeof (*boots), cmp_login, st);
+
+  for (size_t i = 0; i < n_boots && r == 0; i++)
+    {
+      struct mem_entry *e = &st->entries[boots[i] - 1];
+      const struct mem_entry *next = i > 0 ? &st->entries[boots[i - 1] - 1] : NULL;
+      char id_s[24], boot_s[24], shutdown_s[24], next_s[24], sessions_s[24];
+      size_t sessions;
+      char *argv[8];
+
+      sessions = (next ? lower_bound (logins, n_logins, next->login) : n_logins)
+	- lower_bound (logins, n_logins, e->login);
+
+      snprintf (id_s, sizeof (id_s), "%lld", (long long)boots[i]);
+      snprintf (boot_s, sizeof (boot_s), "%llu", (unsigned long long)e->login);
+      snprintf (shutdown_s, sizeof (shutdown_s), "%llu", (unsigned long long)e->logout);
+      snprintf (next_s, sizeof (next_s), "%llu",
+		(unsigned long long)(next ? next->login : 0));
+      snprintf (sessions_s, sizeof (sessions_s), "%zu", sessions);
+      argv[0] = id_s;
+      argv[1] = e->user;
+      argv[2] = boot_s;
+      argv[3] = e->logout ? shutdown_s : NULL;
+      argv[4] = e->rhost;
+      argv[5] = next ? next_s : NULL;
+      argv[6] = sessions_s;
+      argv[7] = (e->logout == 0 && next) ? "1" : "0";
+
+      if (cb_func (userdata, 8, argv, colnames) != 0)
+	{
+	  if (error)
+	    *error = strdup ("memory_read_boots: query aborted");
+	  r = -ECANCELED;
+	}
+    }
+
+  free (logins);
+  free (boots);
+  return r;
+}
+
+static int
+mem_rotate (const char *db_path __attribute__((__unused__)),
+	    const struct wtmpdb_rotate_opts *opts __attribute__((__unused__)),
+	    char **wtmpdb_name __attribute__((__unused__)),
+	    uint64_t *entries __attribute__((__unused__)), char **error)
+{
+  if (error)
+    *error = strdup ("Rotating an in-memory database is not supported");
+  return -EOPNOTSUPP;
+}
+
+static int
+mem_get_boottime_locked (const char *db_path, uint64_t *boottime,
+			 char **error)
+{
+  struct mem_store *st = get_store (db_path, error);
+
+  if (st == NULL)
+    return -ENOMEM;
+  *boottime = st->boottime;
+  return 0;
+}
+
+/* The backend operations, serialized by stores_lock. */
+
+#define LOCKED(call) \
+  ({ \
+    __typeof__ (call) _r; \
+    pthread_mutex_lock (&stores_lock); \
+    _r = call; \
+    pthread_mutex_unlock (&stores_lock); \
+    _r; \
+  })
+
+static int
+mem_flush (const char *db_path, char **error)
+{
+  return LOCKED (mem_flush_locked (db_path, error));
+}
+
+static int64_t
+mem_login (const char *db_path, int type, const char *user,
+	   uint64_t usec_login, const char *tty, const char *rhost,
+	   const char *service, const char *token __attribute__((__unused__)),
+	   char **error)
+{
+  return LOCKED (mem_login_locked (db_path, type, user, usec_login, tty, rhost,
+				   service, error));
+}
+
+static int
+mem_logout (const char *db_path, int64_t id, uint64_t usec_logout,
+	    char **error)
+{
+  return LOCKED (mem_logout_locked (db_path, id, usec_logout, error));
+}
+
+static int64_t
+mem_get_id (const char *db_path, const char *tty, char **error)
+{
+  return LOCKED (mem_get_id_locked (db_path, tty, error));
+}
+
+static int
+mem_read_all (const char *db_path, int uniq, unsigned int columns,
+	      int (*cb_func)(void *unused, int argc, char **argv,
+			     char **azColName),
+	      void *userdata, char **error)
+{
+  return LOCKED (mem_read_all_locked (db_path, uniq, columns, cb_func,
+				      userdata, error));
+}
+
+static int
+mem_read_batch (const char *db_path, int uniq, struct batch_ctx *ctx,
+		char **error)
+{
+  return LOCKED (mem_read_batch_locked (db_path, uniq, ctx, error));
+}
+
+static int
+mem_read_boots (const char *db_path,
+		int (*cb_func)(void *unused, int argc, char **argv,
+			       char **azColName),
+		void *userdata, char **error)
+{
+  return LOCKED (mem_read_boots_locked (db_path, cb_func, userdata, error));
+}
+
+static int
+mem_get_boottime (const char *db_path, uint64_t *boottime, char **error)
+{
+  return LOCKED (mem_get_boottime_locked (db_path, boottime, error));
+}
+
+static int
+mem_backup (const char *db_path __attribute__((__unused__)),
+	    const char *dest __attribute__((__unused__)),
+	    unsigned int flags __attribute__((__unused__)), char **error)
+{
+  if (error)
+    *error = strdup ("Backup of an in-memory database is not supported, use flush");
+  return -EOPNOTSUPP;
+}
+
+const struct wtmpdb_backend_ops memory_backend_ops = {
+  .name = "memory",
+  .login = mem_login,
+  .logout = mem_logout,
+  .get_id = mem_get_id,
+  .read_all = mem_read_all,
+  .read_batch = mem_read_batch,
+  .read_boots = mem_read_boots,
+  .rotate = mem_rotate,
+  .get_boottime = mem_get_boottime,
+  .backup = mem_backup,
+  .flush = mem_flush,
+};
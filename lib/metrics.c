@@ -0,0 +1,360 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Metrics of the database in OpenMetrics text format.
+
+   The values come from the read_metrics operation of a backend, which
+   can use indexes and side tables, or else from counting all entries.
+   The text file is written to a temporary file in the same directory
+   and renamed, so that a collector never sees a partial one. */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "basics.h"
+#include "wtmpdb.h"
+#include "metrics.h"
+
+enum {
+  M_LOGINS,
+  M_ACTIVE,
+  M_CRASHED,
+  M_MAX
+};
+
+static const struct {
+  const char *key;	/* Metric column of read_metrics */
+  const char *name;
+  const char *type;
+  const char *help;
+} families[M_MAX] = {
+  { "logins",  "wtmpdb_logins",           "counter",
+    "Entries added to the database" },
+  { "active",  "wtmpdb_sessions_active",  "gauge",
+    "Sessions without logout since the last boot" },
+  { "crashed", "wtmpdb_sessions_crashed", "gauge",
+    "Sessions of the previous boot without logout" },
+};
+
+struct sample {
+  int metric;
+  int type;
+  char *service;
+  uint64_t value;
+};
+
+/* open session, for metrics_count_cb */
+struct session {
+  uint64_t login;
+  char *service;
+};
+
+struct metrics {
+  struct sample *samples;
+  size_t n_samples;
+  uint64_t boottime;	/* usec, 0 if unknown */
+  uint64_t prev_boot;	/* usec, 0 if none */
+  struct session *sessions;
+  size_t n_sessions;
+  int failed;
+};
+
+struct metrics *
+metrics_new (void)
+{
+  return calloc (1, sizeof (struct metrics));
+}
+
+void
+metrics_free (struct metrics *m)
+{
+  if (m == NULL)
+    return;
+  for (size_t i = 0; i < m->n_samples; i++)
+    free (m->samples[i].service);
+  for (size_t i = 0; i < m->n_sessions; i++)
+    free (m->sessions[i].service);
+  free (m->samples);
+  free (m->sessions);
+  free (m);
+}
+
+static void
+add_sample (struct metrics *m, int metric, int type, const char *service,
+	    uint64_t value)
+{
+  struct sample *s;
+
+  for (size_t i = 0; i < m->n_samples; i++)
+    {
+      s = &m->samples[i];
+      if (s->metric == metric && s->type == type &&
+	  strcmp (s->service, service) == 0)
+	{
+	  s->value += value;
+	  return;
+	}
+    }
+
+  s = realloc (m->samples, (m->n_samples + 1) * sizeof (*s));
+  if (s == NULL)
+    {
+      m->failed = 1;
+      return;
+    }
+  m->samples = s;
+  s = &m->samples[m->n_samples];
+  s->service = strdup (service);
+  if (s->service == NULL)
+    {
+      m->failed = 1;
+      return;
+    }
+  s->metric = metric;
+  s->type = type;
+  s->value = value;
+  m->n_samples++;
+}
+
+int
+metrics_add_cb (void *data, int argc, char **argv,
+		char **azColName __attribute__((__unused__)))
+{
+  struct metrics *m = data;
+
+  if (argc != 4 || argv[0] == NULL || argv[1] == NULL || argv[3] == NULL)
+    return 0;
+
+  if (strcmp (argv[0], "boottime") == 0)
+    {
+      m->boottime = strtoull (argv[3], NULL, 10);
+      return 0;
+    }
+  for (int i = 0; i < M_MAX; i++)
+    if (strcmp (argv[0], families[i].key) == 0)
+      add_sample (m, i, atoi (argv[1]), argv[2] ? argv[2] : "",
+		  strtoull (argv[3], NULL, 10));
+  return 0;
+}
+
+int
+metrics_count_cb (void *data, int argc, char **argv,
+		  char **azColName __attribute__((__unused__)))
+{
+  struct metrics *m = data;
+  const char *service;
+  uint64_t login;
+  int type;
+
+  if (argc != 8 || argv[3] == NULL)
+    return 0;
+
+  type = argv[1] ? atoi (argv[1]) : 0;
+  service = argv[7] ? argv[7] : "";
+  login = strtoull (argv[3], NULL, 10);
+  add_sample (m, M_LOGINS, type, service, 1);
+
+  if (type == BOOT_TIME && login > m->boottime)
+    {
+      m->prev_boot = m->boottime;
+      m->boottime = login;
+    }
+  else if (type == BOOT_TIME && login > m->prev_boot && login < m->boottime)
+    m->prev_boot = login;
+  else if (type == USER_PROCESS && argv[4] == NULL)
+    {
+      struct session *s = realloc (m->sessions,
+				   (m->n_sessions + 1) * sizeof (*s));
+      if (s == NULL)
+	{
+	  m->failed = 1;
+	  return 0;
+	}
+      m->sessions = s;
+      s[m->n_sessions].login = login;
+      s[m->n_sessions].service = strdup (service);
+      if (s[m->n_sessions].service == NULL)
+	m->failed = 1;
+      else
+	m->n_sessions++;
+    }
+  return 0;
+}
+
+/* Assigns the open sessions found by metrics_count_cb to the boots */
+int
+metrics_finish (struct metrics *m, char **error)
+{
+  for (size_t i = 0; i < m->n_sessions; i++)
+    {
+      struct session *s = &m->sessions[i];
+
+      if (s->login >= m->boottime)
+	add_sample (m, M_ACTIVE, USER_PROCESS, s->service, 1);
+      else if (m->prev_boot != 0 && s->login >= m->prev_boot)
+	add_sample (m, M_CRASHED, USER_PROCESS, s->service, 1);
+    }
+
+  if (m->failed)
+    {
+      if (error)
+	*error = strdup ("metrics_finish: Out of memory");
+      return -ENOMEM;
+    }
+  return 0;
+}
+
+static const char *
+type_name (int type)
+{
+  switch (type)
+    {
+    case EMPTY:
+      return "empty";
+    case BOOT_TIME:
+      return "boot";
+    case RUNLEVEL:
+      return "runlevel";
+    case USER_PROCESS:
+      return "user";
+    default:
+      return "unknown";
+    }
+}
+
+/* Label values escape backslash, double quote and line feed */
+static void
+print_label (FILE *fp, const char *value)
+{
+  for (; *value; value++)
+    switch (*value)
+      {
+      case '\\':
+	fputs ("\\\\", fp);
+	break;
+      case '"':
+	fputs ("\\\"", fp);
+	break;
+      case '\n':
+	fputs ("\\n", fp);
+	break;
+      default:
+	fputc (*value, fp);
+      }
+}
+
+static void
+print_metrics (const struct metrics *m, FILE *fp)
+{
+  for (int i = 0; i < M_MAX; i++)
+    {
+      int counter = strcmp (families[i].type, "counter") == 0;
+
+      fprintf (fp, "# TYPE %s %s\n# HELP %s %s.\n", families[i].name,
+	       families[i].type, families[i].name, families[i].help);
+      for (size_t j = 0; j < m->n_samples; j++)
+	{
+	  const struct sample *s = &m->samples[j];
+
+	  if (s->metric != i)
+	    continue;
+	  fprintf (fp, "%s%s{type=\"%s\",service=\"", families[i].name,
+		   counter ? "_total" : "", type_name (s->type));
+	  print_label (fp, s->service);
+	  fprintf (fp, "\"} %llu\n", (unsigned long long)s->value);
+	}
+    }
+
+  fputs ("# TYPE wtmpdb_boot_time_seconds gauge\n"
+	 "# UNIT wtmpdb_boot_time_seconds seconds\n"
+	 "# HELP wtmpdb_boot_time_seconds Time of the last boot.\n", fp);
+  if (m->boottime != 0)
+    fprintf (fp, "wtmpdb_boot_time_seconds %llu.%06llu\n",
+	     (unsigned long long)(m->boottime / USEC_PER_SEC),
+	     (unsigned long long)(m->boottime % USEC_PER_SEC));
+  fputs ("# EOF\n", fp);
+}
+
+/* Writes the metrics to path, to stdout if path is NULL.
+   Returns 0 on success, <0 on failure. */
+int
+metrics_write (const struct metrics *m, const char *path, char **error)
+{
+  char *tmp = NULL;
+  FILE *fp;
+  int fd, r = 0;
+
+  if (path == NULL)
+    {
+      print_metrics (m, stdout);
+      return fflush (stdout) == 0 ? 0 : -errno;
+    }
+
+  if (asprintf (&tmp, "%s.XXXXXX", path) < 0)
+    {
+      if (error)
+	*error = strdup ("metrics_write: Out of memory");
+      return -ENOMEM;
+    }
+
+  fd = mkstemp (tmp);
+  if (fd < 0 || (fp = fdopen (fd, "w")) == NULL)
+    {
+      r = -errno;
+      if (fd >= 0)
+	close (fd);
+      goto fail;
+    }
+
+  print_metrics (m, fp);
+  if (fflush (fp) != 0 || fchmod (fd, 0644) < 0 || fsync (fd) < 0)
+    r = -errno;
+  if (fclose (fp) != 0 && r == 0)
+    r = -errno;
+  if (r == 0 && rename (tmp, path) < 0)
+    r = -errno;
+  if (r == 0)
+    {
+      free (tmp);
+      return 0;
+    }
+
+ fail:
+  if (error)
+    if (asprintf (error, "Cannot write %s: %s", path, strerror (-r)) < 0)
+      *error = strdup ("metrics_write: Out of memory");
+  if (fd >= 0)
+    unlink (tmp);
+  free (tmp);
+  return r;
+}
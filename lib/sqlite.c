@@ -28,6 +28,7 @@
 #include "config.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -35,15 +36,111 @@
 #include <libgen.h>
 #include <string.h>
 #include <limits.h>
+#include <dirent.h>
+#include <sys/file.h>
 #include <sys/stat.h>
 #include <sqlite3.h>
 
+#include "basics.h"
 #include "wtmpdb.h"
 #include "sqlite.h"
+#include "batch.h"
+#include "bloom.h"
+#include "compress.h"
 #include "mkdir_p.h"
 
 #define TIMEOUT 5000 /* 5 sec */
 
+#define _STR(x) #x
+#define STR(x) _STR(x)
+
+/* Waiting for a lock: the first retry comes after BUSY_MIN_USEC, the
+   interval doubles up to BUSY_MAX_USEC. The sleep is a random time
+   between half and the full interval, so writers blocked at the same
+   time don't retry at the same time, and the limit keeps writers which
+   waited long from falling behind new ones. */
+#define BUSY_MIN_USEC 1000
+#define BUSY_MAX_USEC (64 * 1000)
+
+static _Atomic uint64_t busy_timeout = TIMEOUT * 1000ULL;
+
+/* per-process statistics, see wtmpdb_get_stats */
+static _Atomic uint64_t busy_waits;
+static _Atomic uint64_t busy_retries;
+static _Atomic uint64_t busy_usec;
+static _Atomic uint64_t busy_timeouts;
+
+/* a connection is only used by the thread which opened it */
+static _Thread_local uint64_t busy_start;
+static _Thread_local unsigned int busy_seed;
+
+static uint64_t
+monotonic_usec (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return wtmpdb_timespec2usec (ts);
+}
+
+/* sqlite3 busy handler, count is the number of calls before for the
+   same lock. Returns 1 to retry, 0 to give up. */
+static int
+busy_handler (void *unused __attribute__((__unused__)), int count)
+{
+  uint64_t now = monotonic_usec ();
+  uint64_t deadline, interval, wait;
+
+  if (count == 0)
+    {
+      busy_start = now;
+      busy_waits++;
+      if (busy_seed == 0)
+	busy_seed = (unsigned int)(now ^ ((uint64_t)getpid () << 16)) | 1;
+    }
+  deadline = busy_start + busy_timeout;
+  if (now >= deadline)
+    {
+      busy_timeouts++;
+      return 0;
+    }
+
+  interval = count < 6 ? (uint64_t)BUSY_MIN_USEC << count : BUSY_MAX_USEC;
+  wait = interval / 2 + (uint64_t)rand_r (&busy_seed) % (interval / 2 + 1);
+  if (wait > deadline - now)
+    wait = deadline - now;
+  usleep (wait);
+
+  busy_retries++;
+  busy_usec += monotonic_usec () - now;
+  return 1;
+}
+
+static void
+set_busy_handler (sqlite3 *db)
+{
+  sqlite3_busy_handler (db, busy_handler, NULL);
+}
+
+void
+sqlite_set_busy_timeout (uint64_t usec)
+{
+  busy_timeout = usec;
+}
+
+void
+sqlite_get_stats (struct wtmpdb_stats *stats)
+{
+  stats->busy_waits = busy_waits;
+  stats->busy_retries = busy_retries;
+  stats->busy_usec = busy_usec;
+  stats->busy_timeouts = busy_timeouts;
+}
+
+/* columns of the wtmp table besides the ID */
+#define WTMP_COLUMNS "Type INTEGER, User TEXT NOT NULL, Login INTEGER, " \
+  "Logout INTEGER, TTY TEXT, RemoteHost TEXT, Service TEXT"
+
 static void
 strip_extension(char *in_str)
 {
@@ -61,435 +158,2706 @@ strip_extension(char *in_str)
     }
 }
 
-/* Creates the table if it does not exist.
- * Returns 0 on success, -1 on failure. */
+/* Triggers of the change counter for result caches: bumped by every
+   modification except appending new rows and closing an open session,
+   which a cache can pick up incrementally. */
+#define WTMP_CHANGES_TRIGGERS \
+  "CREATE TRIGGER IF NOT EXISTS wtmp_changes_delete AFTER DELETE ON wtmp BEGIN " \
+    "INSERT INTO wtmp_changes VALUES(0, 1) ON CONFLICT(ID) DO UPDATE SET Counter = Counter + 1; " \
+  "END;" \
+  "CREATE TRIGGER IF NOT EXISTS wtmp_changes_update AFTER UPDATE ON wtmp " \
+    "WHEN NOT (OLD.Logout IS NULL AND NEW.Logout IS NOT NULL AND NEW.ID = OLD.ID " \
+      "AND NEW.Type IS OLD.Type AND NEW.User IS OLD.User AND NEW.Login IS OLD.Login " \
+      "AND NEW.TTY IS OLD.TTY AND NEW.RemoteHost IS OLD.RemoteHost " \
+      "AND NEW.Service IS OLD.Service) BEGIN " \
+    "INSERT INTO wtmp_changes VALUES(0, 1) ON CONFLICT(ID) DO UPDATE SET Counter = Counter + 1; " \
+  "END;"
+
+/* ID 1 of wtmp_changes is set by rotate --swap to the last archived
+   ID, the entries of the database are counted from there.
+   wtmp_migration keeps the progress of a running migration. */
+#define WTMP_TABLES \
+  "CREATE TABLE IF NOT EXISTS wtmp(ID INTEGER PRIMARY KEY, " WTMP_COLUMNS ") STRICT;" \
+  "CREATE TABLE IF NOT EXISTS wtmp_changes(ID INTEGER PRIMARY KEY, Counter INTEGER NOT NULL) STRICT;" \
+  "CREATE TABLE IF NOT EXISTS wtmp_migration(Step INTEGER PRIMARY KEY, Progress INTEGER NOT NULL) STRICT;" \
+  WTMP_CHANGES_TRIGGERS
+
+#define WTMP_INDEXES \
+  "CREATE INDEX IF NOT EXISTS wtmp_type_login ON wtmp(Type, Login);"
+
+/* The newest login of every user, so that it is found without
+   searching wtmp. Kept up to date by triggers; entries of imports may
+   be older than the one of the user. */
+#define WTMP_LASTLOG_UPSERT \
+  "ON CONFLICT(User) DO UPDATE SET Login = excluded.Login, ID = excluded.ID " \
+  "WHERE excluded.Login >= Login"
+#define WTMP_LASTLOG \
+  "CREATE TABLE IF NOT EXISTS wtmp_lastlog(User TEXT PRIMARY KEY, " \
+    "Login INTEGER, ID INTEGER NOT NULL) STRICT, WITHOUT ROWID;" \
+  "CREATE TRIGGER IF NOT EXISTS wtmp_lastlog_insert AFTER INSERT ON wtmp " \
+    "WHEN NEW.Type = " STR(USER_PROCESS) " BEGIN " \
+    "INSERT INTO wtmp_lastlog VALUES(NEW.User, NEW.Login, NEW.ID) " \
+    WTMP_LASTLOG_UPSERT "; " \
+  "END;" \
+  "CREATE TRIGGER IF NOT EXISTS wtmp_lastlog_delete AFTER DELETE ON wtmp " \
+    "WHEN OLD.Type = " STR(USER_PROCESS) " BEGIN " \
+    "DELETE FROM wtmp_lastlog WHERE User = OLD.User AND ID = OLD.ID; " \
+  "END;"
+
+/* Tokens of the logins of the last TOKEN_KEEP_USEC, see add_token */
+#define WTMP_TOKENS \
+  "CREATE TABLE IF NOT EXISTS wtmp_tokens(Token TEXT PRIMARY KEY, " \
+    "ID INTEGER NOT NULL, Time INTEGER NOT NULL) STRICT, WITHOUT ROWID;"
+
+/* The number of entries added per Type and Service for the counters of
+   wtmpdb_write_metrics; deleting entries does not decrease it. Type -1
+   holds the last ID of wtmp at the start of migration 8, which counts
+   the older entries, the newer ones are counted by the trigger. */
+#define WTMP_COUNTERS_UPSERT \
+  "ON CONFLICT(Type, Service) DO UPDATE SET Count = Count + excluded.Count"
+#define WTMP_COUNTERS \
+  "CREATE TABLE IF NOT EXISTS wtmp_counters(Type INTEGER NOT NULL, " \
+    "Service TEXT NOT NULL, Count INTEGER NOT NULL, " \
+    "PRIMARY KEY(Type, Service)) STRICT, WITHOUT ROWID;" \
+  "CREATE TRIGGER IF NOT EXISTS wtmp_counters_insert AFTER INSERT ON wtmp BEGIN " \
+    "INSERT INTO wtmp_counters VALUES(IFNULL(NEW.Type, 0), " \
+    "IFNULL(NEW.Service, ''), 1) " WTMP_COUNTERS_UPSERT "; " \
+  "END;"
+
+#define WTMP_NEW_ROW "VALUES(NEW.ID, NEW.Type, NEW.User, NEW.Login, " \
+  "NEW.Logout, NEW.TTY, NEW.RemoteHost, NEW.Service)"
+
+/* Schema migrations. The schema version (PRAGMA user_version) is the
+   number of migrations done. A migration runs sql in one transaction.
+   If chunk is set, it then runs chunk for the rows of table with
+   ?1 < ID <= ?2, MIGRATE_CHUNK rows per transaction, until all rows
+   are done; the progress is kept in wtmp_migration, so it continues
+   after an interruption. If skip returns a row, the migration is not
+   needed. New databases get the current schema directly. */
+static const struct migration {
+  const char *skip;
+  const char *sql;
+  const char *table;
+  const char *chunk;
+} migrations[] = {
+  /* 1: tables of wtmpdb < 0.77 and the change counter */
+  { NULL, WTMP_TABLES, NULL, NULL },
+  /* 2-4: index wtmp_type_login. CREATE INDEX would lock out writers
+     until the whole table is indexed, so the index is built on a copy,
+     which gets the rows in chunks and concurrent changes via triggers.
+     Then the tables get swapped and the old one is emptied in chunks
+     before it is dropped. The copy uses AUTOINCREMENT, so the IDs
+     of a database created by rotate --swap keep counting. */
+  { "SELECT 1 FROM sqlite_master WHERE type = 'index' AND name = 'wtmp_type_login' "
+    "AND tbl_name = 'wtmp'",
+    "CREATE TABLE wtmp_new(ID INTEGER PRIMARY KEY AUTOINCREMENT, " WTMP_COLUMNS ") STRICT;"
+    "CREATE INDEX wtmp_type_login ON wtmp_new(Type, Login);"
+    "CREATE TRIGGER wtmp_new_insert AFTER INSERT ON wtmp BEGIN "
+      "INSERT OR REPLACE INTO wtmp_new " WTMP_NEW_ROW "; "
+    "END;"
+    "CREATE TRIGGER wtmp_new_update AFTER UPDATE ON wtmp BEGIN "
+      "DELETE FROM wtmp_new WHERE ID = OLD.ID; "
+      "INSERT OR REPLACE INTO wtmp_new " WTMP_NEW_ROW "; "
+    "END;"
+    "CREATE TRIGGER wtmp_new_delete AFTER DELETE ON wtmp BEGIN "
+      "DELETE FROM wtmp_new WHERE ID = OLD.ID; "
+    "END;",
+    "wtmp",
+    "INSERT OR REPLACE INTO wtmp_new SELECT * FROM wtmp WHERE ID > ?1 AND ID <= ?2" },
+  { "SELECT 1 FROM sqlite_master WHERE type = 'index' AND name = 'wtmp_type_login' "
+    "AND tbl_name = 'wtmp'",
+    "DROP TRIGGER wtmp_new_insert;"
+    "DROP TRIGGER wtmp_new_update;"
+    "DROP TRIGGER wtmp_new_delete;"
+    "DROP TRIGGER IF EXISTS wtmp_changes_delete;"
+    "DROP TRIGGER IF EXISTS wtmp_changes_update;"
+    "INSERT INTO sqlite_sequence (name, seq) SELECT 'wtmp_new', 0 "
+      "WHERE NOT EXISTS (SELECT 1 FROM sqlite_sequence WHERE name = 'wtmp_new');"
+    "UPDATE sqlite_sequence SET seq = MAX(seq, "
+      "IFNULL((SELECT seq FROM sqlite_sequence WHERE name = 'wtmp'), 0)) "
+      "WHERE name = 'wtmp_new';"
+    "ALTER TABLE wtmp RENAME TO wtmp_old;"
+    "ALTER TABLE wtmp_new RENAME TO wtmp;"
+    WTMP_CHANGES_TRIGGERS,
+    "wtmp_old",
+    "DELETE FROM wtmp_old WHERE ID > ?1 AND ID <= ?2" },
+  { "SELECT 1 WHERE NOT EXISTS (SELECT 1 FROM sqlite_master WHERE name = 'wtmp_old')",
+    "DROP TABLE wtmp_old;", NULL, NULL },
+  /* 5: WAL, so that readers see a snapshot without blocking writers.
+     The journal mode cannot change within a transaction, create_table
+     switches it outside of the migration steps. */
+  { "SELECT 1", NULL, NULL, NULL },
+  /* 6: wtmp_lastlog, filled from the existing rows in chunks */
+  { NULL, WTMP_LASTLOG, "wtmp",
+    "INSERT INTO wtmp_lastlog SELECT User, Login, ID FROM wtmp "
+    "WHERE ID > ?1 AND ID <= ?2 AND Type = " STR(USER_PROCESS) " "
+    WTMP_LASTLOG_UPSERT },
+  /* 7: wtmp_tokens */
+  { NULL, WTMP_TOKENS, NULL, NULL },
+  /* 8: wtmp_counters, the existing rows are counted in chunks */
+  { NULL, WTMP_COUNTERS
+    "INSERT INTO wtmp_counters SELECT -1, '', IFNULL(MAX(ID), 0) FROM wtmp;",
+    "wtmp",
+    "INSERT INTO wtmp_counters SELECT IFNULL(Type, 0), IFNULL(Service, ''), COUNT(*) "
+    "FROM wtmp WHERE ID > ?1 AND ID <= ?2 "
+    "AND ID <= (SELECT Count FROM wtmp_counters WHERE Type = -1) "
+    "GROUP BY 1, 2 " WTMP_COUNTERS_UPSERT },
+};
+#define SCHEMA_VERSION ((int)(sizeof (migrations) / sizeof (migrations[0])))
+
+#define MIGRATE_CHUNK 1000 /* rows per transaction */
+#define MIGRATE_USEC 5000 /* 5 msec, spent by every writer */
+
+/* Returns 1 if sql returns a row, 0 if not, <0 on failure. */
+static int
+sql_exists (sqlite3 *db, const char *sql)
+{
+  sqlite3_stmt *res;
+  int r;
+
+  if (sqlite3_prepare_v2 (db, sql, -1, &res, 0) != SQLITE_OK)
+    return -EIO;
+  r = sqlite3_step (res);
+  sqlite3_finalize (res);
+  return r == SQLITE_ROW ? 1 : (r == SQLITE_DONE ? 0 : -EIO);
+}
+
+/* Runs sql with the parameters ?1 = p1 and ?2 = p2. The first column
+   of the first row is stored in *value if not NULL, *is_null is set if
+   there is none or it is NULL.
+   Returns 0 on success, <0 on failure. */
+static int
+sql_int64 (sqlite3 *db, const char *sql, int64_t p1, int64_t p2,
+	   int64_t *value, int *is_null)
+{
+  sqlite3_stmt *res;
+  int r;
+
+  if (sqlite3_prepare_v2 (db, sql, -1, &res, 0) != SQLITE_OK)
+    return -EIO;
+  if (sqlite3_bind_parameter_count (res) >= 1)
+    sqlite3_bind_int64 (res, 1, p1);
+  if (sqlite3_bind_parameter_count (res) >= 2)
+    sqlite3_bind_int64 (res, 2, p2);
+  r = sqlite3_step (res);
+  if (is_null)
+    *is_null = r != SQLITE_ROW || sqlite3_column_type (res, 0) == SQLITE_NULL;
+  if (r == SQLITE_ROW && value)
+    *value = sqlite3_column_int64 (res, 0);
+  sqlite3_finalize (res);
+  return r == SQLITE_ROW || r == SQLITE_DONE ? 0 : -EIO;
+}
+
+/* Runs one transaction of the next migration.
+   Returns 0 if the schema is current, 1 if more migrations are
+   pending, -EBUSY if the database is locked, <0 on failure. */
+static int
+migrate_step (sqlite3 *db, char **error)
+{
+  const struct migration *m;
+  char bounds[256];
+  int64_t version, progress, upper;
+  int empty;
+  int r;
+
+  r = sqlite3_exec (db, "BEGIN IMMEDIATE", NULL, NULL, NULL);
+  if (r == SQLITE_BUSY)
+    return -EBUSY;
+  if (r != SQLITE_OK)
+    goto sql_error;
+
+  /* re-read within the transaction, another process may migrate, too */
+  if (sql_int64 (db, "PRAGMA user_version", 0, 0, &version, NULL) < 0)
+    goto sql_error;
+  if (version >= SCHEMA_VERSION)
+    {
+      sqlite3_exec (db, "COMMIT", NULL, NULL, NULL);
+      return 0;
+    }
+
+  if (version == 0 &&
+      (r = sql_exists (db, "SELECT 1 FROM sqlite_master WHERE name = 'wtmp'")) <= 0)
+    {
+      if (r < 0 ||
+	  sqlite3_exec (db, WTMP_TABLES WTMP_INDEXES WTMP_LASTLOG WTMP_TOKENS
+			WTMP_COUNTERS, NULL, NULL, NULL) != SQLITE_OK)
+	goto sql_error;
+      version = SCHEMA_VERSION;
+      goto set_version;
+    }
+
+  m = &migrations[version];
+  if (sql_int64 (db, "SELECT Progress FROM wtmp_migration WHERE Step = ?1",
+		 version + 1, 0, &progress, &empty) < 0)
+    {
+      /* wtmp_migration is created by the first migration */
+      if (version != 0)
+	goto sql_error;
+      empty = 1;
+    }
+
+  if (empty)
+    {
+      /* start the migration */
+      if (m->skip && (r = sql_exists (db, m->skip)) != 0)
+	{
+	  if (r < 0)
+	    goto sql_error;
+	  version++;
+	  goto set_version;
+	}
+      if (sqlite3_exec (db, m->sql, NULL, NULL, NULL) != SQLITE_OK)
+	goto sql_error;
+      if (m->chunk == NULL)
+	{
+	  version++;
+	  goto set_version;
+	}
+      if (sql_int64 (db, "INSERT INTO wtmp_migration VALUES(?1, ?2)",
+		     version + 1, INT64_MIN, NULL, NULL) < 0)
+	goto sql_error;
+      goto commit;
+    }
+
+  snprintf (bounds, sizeof (bounds), "SELECT MAX(ID) FROM (SELECT ID FROM %s "
+	    "WHERE ID > ?1 ORDER BY ID LIMIT " STR(MIGRATE_CHUNK) ")",
+	    m->table);
+  if (sql_int64 (db, bounds, progress, 0, &upper, &empty) < 0)
+    goto sql_error;
+  if (empty)
+    {
+      /* all rows done */
+      if (sql_int64 (db, "DELETE FROM wtmp_migration WHERE Step = ?1",
+		     version + 1, 0, NULL, NULL) < 0)
+	goto sql_error;
+      version++;
+      goto set_version;
+    }
+  if (sql_int64 (db, m->chunk, progress, upper, NULL, NULL) < 0 ||
+      sql_int64 (db, "UPDATE wtmp_migration SET Progress = ?2 WHERE Step = ?1",
+		 version + 1, upper, NULL, NULL) < 0)
+    goto sql_error;
+  goto commit;
+
+ set_version:
+  snprintf (bounds, sizeof (bounds), "PRAGMA user_version = %d", (int)version);
+  if (sqlite3_exec (db, bounds, NULL, NULL, NULL) != SQLITE_OK)
+    goto sql_error;
+ commit:
+  r = sqlite3_exec (db, "COMMIT", NULL, NULL, NULL);
+  if (r == SQLITE_BUSY)
+    {
+      sqlite3_exec (db, "ROLLBACK", NULL, NULL, NULL);
+      return -EBUSY;
+    }
+  if (r != SQLITE_OK)
+    goto sql_error;
+  return version < SCHEMA_VERSION;
+
+ sql_error:
+  if (error)
+    if (asprintf (error, "Schema migration %d failed: %s", (int)version + 1,
+		  sqlite3_errmsg (db)) < 0)
+      *error = strdup ("migrate_step: Out of memory");
+  sqlite3_exec (db, "ROLLBACK", NULL, NULL, NULL);
+  return -EIO;
+}
+
+/* Runs migrations for about usec microseconds, 0 means until all are
+   done. Every transaction is short, writers wait for one at most.
+   Returns 0 if the schema is current, 1 if migrations are pending,
+   <0 on failure. */
+static int
+migrate (sqlite3 *db, uint64_t usec, char **error)
+{
+  struct timespec ts;
+  uint64_t deadline;
+  int r;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  deadline = wtmpdb_timespec2usec (ts) + usec;
+  do
+    {
+      r = migrate_step (db, error);
+      clock_gettime (CLOCK_MONOTONIC, &ts);
+    }
+  while (r == 1 && (usec == 0 || wtmpdb_timespec2usec (ts) < deadline));
+
+  return r == -EBUSY ? 1 : r;
+}
+
+/* Creates the tables if they don't exist and spends up to MIGRATE_USEC
+   on pending migrations, without waiting for locks.
+   Returns 0 on success, -1 on failure. */
 static int64_t
 create_table (sqlite3 *db, char **error)
 {
-  char *err_msg = NULL;
-  char *sql_table = "CREATE TABLE IF NOT EXISTS wtmp(ID INTEGER PRIMARY KEY, Type INTEGER, User TEXT NOT NULL, Login INTEGER, Logout INTEGER, TTY TEXT, RemoteHost TEXT, Service TEXT) STRICT;";
+  int64_t version = 0;
+  int r;
+
+  if (sql_int64 (db, "PRAGMA user_version", 0, 0, &version, NULL) == 0 &&
+      version >= SCHEMA_VERSION)
+    return 0;
+
+  /* the tables are required */
+  if (version < 1 && (r = migrate_step (db, error)) < 0)
+    {
+      if (r == -EBUSY && error)
+	*error = strdup ("create_table: database is locked");
+      return -1;
+    }
+
+  /* Only now, readers must not see a database without tables. Fails
+     while other connections use the database, the maintenance of
+     wtmpdbd retries. */
+  sqlite3_exec (db, "PRAGMA journal_mode = WAL", NULL, NULL, NULL);
+
+  sqlite3_busy_handler (db, NULL, NULL);
+  migrate (db, MIGRATE_USEC, NULL);
+  set_busy_handler (db);
+  return 0;
+}
+
+/* Archives written by rotate are marked with this PRAGMA application_id
+   ("wtma"), they don't change anymore. */
+#define ARCHIVE_APPLICATION_ID 0x77746d61
+
+/* rotate --swap marks the old database with this application_id
+   ("wtmr") before the new one replaces it, see open_write. */
+#define RETIRED_APPLICATION_ID 0x77746d72
+
+/* Starts a write transaction. Taking the write lock up front means a
+   conflict is handled by the busy handler before anything was done,
+   instead of failing when a read lock gets upgraded. The application_id
+   and the schema version are checked within the transaction, where the
+   database header was read anyway; only a new or outdated database gets
+   the tables created or migrated first.
+   Returns 0 on success, -ESTALE if the database was retired by rotate
+   or is an archive (see open_write), other <0 values on failure. */
+static int
+begin_write (sqlite3 *db, const char *func, char **error)
+{
+  int64_t version = 0, app_id = 0;
+  int r = sqlite3_exec (db, "BEGIN IMMEDIATE", NULL, NULL, NULL);
+
+  if (r == SQLITE_OK)
+    {
+      if (sql_int64 (db, "PRAGMA application_id", 0, 0, &app_id, NULL) == 0 &&
+	  (app_id == RETIRED_APPLICATION_ID || app_id == ARCHIVE_APPLICATION_ID))
+	{
+	  sqlite3_exec (db, "ROLLBACK", NULL, NULL, NULL);
+	  return -ESTALE;
+	}
+      if (sql_int64 (db, "PRAGMA user_version", 0, 0, &version, NULL) == 0 &&
+	  version >= SCHEMA_VERSION)
+	return 0;
+      sqlite3_exec (db, "ROLLBACK", NULL, NULL, NULL);
+      if (create_table (db, error) != 0)
+	return -EIO;
+      r = sqlite3_exec (db, "BEGIN IMMEDIATE", NULL, NULL, NULL);
+      if (r == SQLITE_OK)
+	return 0;
+    }
+  if (error)
+    if (asprintf (error, "%s: cannot start transaction: %s", func,
+		  sqlite3_errmsg (db)) < 0)
+      *error = strdup ("begin_write: Out of memory");
+  return r == SQLITE_BUSY ? -EBUSY : -EIO;
+}
+
+/* Commits the write transaction if r is 0, else rolls it back.
+   Returns r, or <0 if the commit failed. */
+static int64_t
+end_write (sqlite3 *db, int64_t r, const char *func, char **error)
+{
+  if (r < 0)
+    {
+      sqlite3_exec (db, "ROLLBACK", NULL, NULL, NULL);
+      return r;
+    }
+  if (sqlite3_exec (db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK)
+    {
+      if (error)
+	if (asprintf (error, "%s: commit failed: %s", func,
+		      sqlite3_errmsg (db)) < 0)
+	  *error = strdup ("end_write: Out of memory");
+      sqlite3_exec (db, "ROLLBACK", NULL, NULL, NULL);
+      return -EIO;
+    }
+  return r;
+}
+
+#define ARCHIVE_MMAP_SIZE 268435456 /* 256 MiB */
+
+/* Reads the first size bytes of the database header of path.
+   Returns the number of bytes read, <0 if path cannot be read. */
+static ssize_t
+read_header (const char *path, unsigned char *buf, size_t size)
+{
+  ssize_t n;
+  int fd;
+
+  fd = open (path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -errno;
+  n = pread (fd, buf, size, 0);
+  close (fd);
+  return n;
+}
+
+/* The application ID is stored at offset 68 of the header, big endian */
+#define HEADER_SIZE 72
+#define HEADER_APPLICATION_ID(buf) \
+  ((uint32_t)(buf)[68] << 24 | (uint32_t)(buf)[69] << 16 | \
+   (uint32_t)(buf)[70] << 8 | (buf)[71])
+
+/* Returns 1 if path is an archive. Reading the header is cheaper than
+   opening the database. */
+static int
+is_archive (const char *path)
+{
+  unsigned char buf[HEADER_SIZE];
+
+  return read_header (path, buf, sizeof (buf)) == sizeof (buf) &&
+    HEADER_APPLICATION_ID (buf) == ARCHIVE_APPLICATION_ID;
+}
+
+/* Opens an archive without locking and journal checks and reads it
+   via mmap.
+   Returns 0 on success, != 0 on failure. */
+static int
+open_archive (const char *path, sqlite3 **db, char **error)
+{
+  char *uri, *p;
+  int r;
+
+  /* "file:" + path with '?', '#' and '%' escaped + "?immutable=1" */
+  uri = malloc (strlen (path) * 3 + sizeof ("file:?immutable=1"));
+  if (uri == NULL)
+    {
+      if (error)
+	*error = strdup ("open_archive: Out of memory");
+      *db = NULL;
+      return SQLITE_NOMEM;
+    }
+  p = stpcpy (uri, "file:");
+  for (const char *c = path; *c; c++)
+    if (*c == '?' || *c == '#' || *c == '%')
+      p += sprintf (p, "%%%02X", (unsigned char)*c);
+    else
+      *p++ = *c;
+  strcpy (p, "?immutable=1");
+
+  r = sqlite3_open_v2 (uri, db, SQLITE_OPEN_READONLY | SQLITE_OPEN_URI |
+		       SQLITE_OPEN_NOMUTEX, NULL);
+  free (uri);
+  if (r != SQLITE_OK)
+    {
+      if (error)
+	if (asprintf (error, "Cannot open archive (%s): %s",
+		      path, sqlite3_errmsg (*db)) < 0)
+	  *error = strdup ("open_archive: Out of memory");
+      sqlite3_close (*db);
+      *db = NULL;
+      return r;
+    }
+  sqlite3_exec (*db, "PRAGMA mmap_size = " STR(ARCHIVE_MMAP_SIZE), NULL,
+		NULL, NULL);
+  return 0;
+}
+
+static int
+open_database_ro (const char *path, sqlite3 **db, char **error)
+{
+  unsigned char buf[HEADER_SIZE];
+  int empty_file = 0;
+  int r;
+
+  /* one read tells an empty file and an archive apart */
+  if (!is_compressed (path))
+    {
+      ssize_t n = read_header (path, buf, sizeof (buf));
+
+      empty_file = n == 0;
+      if (n == sizeof (buf) &&
+	  HEADER_APPLICATION_ID (buf) == ARCHIVE_APPLICATION_ID)
+	return open_archive (path, db, error);
+    }
+
+  /* a connection is only used by the thread which opened it */
+  r = sqlite3_open_v2 (path, db, (empty_file ?
+                       SQLITE_OPEN_READWRITE | SQLITE_OPEN_MEMORY :
+                       SQLITE_OPEN_READONLY) | SQLITE_OPEN_NOMUTEX,
+		       is_compressed (path) ? compress_vfs () : NULL);
+  if (r != SQLITE_OK)
+    {
+      if (error)
+	if (asprintf(error, "Cannot open database (%s) read-only: %s",
+		     path, sqlite3_errmsg(*db)) < 0)
+	  *error = strdup("open_database_ro: Out of memory");
+      sqlite3_close(*db);
+      *db = NULL;
+      return r;
+    }
+
+  set_busy_handler (*db);
+
+  if (empty_file)
+    r = create_table (*db, error);
+
+  return r == SQLITE_OK ? 0 : -1;
+}
+
+/* Bytes the WAL is truncated to after a checkpoint */
+#define WAL_SIZE_LIMIT 1048576
+
+/* with wtmpdbd, only the daemon has access to the database */
+#if WITH_WTMPDBD
+#define DB_CREATE_MODE 0600
+#else
+#define DB_CREATE_MODE 0644
+#endif
+
+/* Opens path for writing. The directory and the database file are only
+   created if there is no database yet, the schema is left to the caller
+   (see begin_write).
+   Returns 0 on success, <0 on failure. */
+static int
+open_database_file (const char *path, sqlite3 **db, char **error)
+{
+  int r;
+
+  if (is_compressed (path))
+    {
+      if (error)
+	if (asprintf (error, "Compressed archive (%s) is read-only",
+		      path) < 0)
+	  *error = strdup ("open_database_file: Out of memory");
+      *db = NULL;
+      return -EROFS;
+    }
+
+  r = sqlite3_open_v2 (path, db, SQLITE_OPEN_READWRITE |
+		       SQLITE_OPEN_NOMUTEX, NULL);
+  if (r == SQLITE_CANTOPEN)
+    {
+      sqlite3_close (*db);
+
+      char *buf = strdup(path);
+      if (buf != NULL)
+	mkdir_p(dirname(buf), 0755);
+      free(buf);
+
+      /* The file gets created here with its mode instead of changing
+	 the umask, which is shared by all threads of the process.
+	 SQLite gives the WAL the mode of the database. Another writer
+	 may have created it meanwhile (EEXIST). */
+      int fd = open (path, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC,
+		     DB_CREATE_MODE);
+      if (fd >= 0)
+	close (fd);
+      r = sqlite3_open_v2 (path, db, SQLITE_OPEN_READWRITE |
+			   SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, NULL);
+    }
+  if (r != SQLITE_OK)
+    {
+      if (error)
+	if (asprintf (error, "Cannot create/open database (%s): %s",
+		      path, sqlite3_errmsg (*db)) < 0)
+	  *error = strdup ("open_database_file: Out of memory");
+
+      sqlite3_close (*db);
+      *db = NULL;
+      return -r;
+    }
+
+  set_busy_handler (*db);
+
+  /* The last connection keeps the WAL and its index, truncated to 0,
+     instead of removing them. Else readers without write access to
+     the directory could not open the database in between. */
+  int persist = 1;
+  sqlite3_file_control (*db, "main", SQLITE_FCNTL_PERSIST_WAL, &persist);
+  sqlite3_exec (*db, "PRAGMA journal_size_limit = " STR(WAL_SIZE_LIMIT),
+		NULL, NULL, NULL);
+  return 0;
+}
+
+/* Takes the flock op (LOCK_SH or LOCK_EX) on the file which is path
+   while the lock is taken. rotate --swap renames path with LOCK_EX only,
+   so a file locked with LOCK_SH stays at path: SQLite names the journal
+   and WAL after the path, a connection to the old file must never see
+   the ones of the new database.
+   Returns a file descriptor, -1 if path doesn't exist, <-1 (-errno) on
+   failure. */
+static int
+lock_path (const char *path, int op)
+{
+  uint64_t deadline = monotonic_usec () + busy_timeout;
+  struct stat st_fd, st_path;
+  int fd;
+
+  for (;;)
+    {
+      fd = open (path, O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+	return errno == ENOENT ? -1 : -errno;
+      if (flock (fd, op | LOCK_NB) == 0)
+	{
+	  if (fstat (fd, &st_fd) == 0 && stat (path, &st_path) == 0 &&
+	      st_fd.st_dev == st_path.st_dev && st_fd.st_ino == st_path.st_ino)
+	    return fd;
+	  /* replaced meanwhile */
+	  close (fd);
+	  continue;
+	}
+      close (fd);
+      if (errno != EWOULDBLOCK)
+	return -errno;
+      if (monotonic_usec () >= deadline)
+	return -EBUSY;
+      usleep (BUSY_MIN_USEC);
+    }
+}
+
+/* Opens path and starts a write transaction on it. *lock gets the
+   LOCK_SH of path (see lock_path), close_write releases it. rotate
+   --swap retires the old database before the new one is renamed to
+   path and marks it as archive afterwards, a writer which got the old
+   file anyway reopens path until it gets the new one.
+   Returns 0 on success, <0 on failure; *db is NULL then. */
+static int
+open_write (const char *path, sqlite3 **db, int *lock, const char *func,
+	    char **error)
+{
+  uint64_t deadline = monotonic_usec () + busy_timeout;
+  int r;
+
+  for (;;)
+    {
+      *lock = lock_path (path, LOCK_SH);
+      if (*lock < -1)
+	{
+	  r = *lock;
+	  *db = NULL;
+	  if (error)
+	    if (asprintf (error, "%s: cannot lock %s: %s", func, path,
+			  strerror (-r)) < 0)
+	      *error = strdup ("open_write: Out of memory");
+	  return r;
+	}
+      r = open_database_file (path, db, error);
+      if (r == 0)
+	{
+	  r = begin_write (*db, func, error);
+	  if (r == 0)
+	    return 0;
+	  sqlite3_close (*db);
+	  *db = NULL;
+	}
+      if (*lock >= 0)
+	close (*lock);
+      if (r != -ESTALE)
+	return r;
+      if (is_archive (path))
+	{
+	  if (error)
+	    if (asprintf (error, "Archive (%s) is read-only", path) < 0)
+	      *error = strdup ("open_write: Out of memory");
+	  return -EROFS;
+	}
+      if (monotonic_usec () >= deadline)
+	break;
+      usleep (BUSY_MIN_USEC);
+    }
+  if (error)
+    if (asprintf (error, "%s: database was retired by rotate (%s)",
+		  func, path) < 0)
+      *error = strdup ("open_write: Out of memory");
+  return -EBUSY;
+}
+
+/* Closes a database opened with open_write */
+static void
+close_write (sqlite3 *db, int lock)
+{
+  sqlite3_close (db);
+  if (lock >= 0)
+    close (lock);
+}
+
+static int
+open_database_rw (const char *path, sqlite3 **db, char **error)
+{
+  int r = open_database_file (path, db, error);
+
+  if (r < 0)
+    return r;
+  if (create_table (*db, error) != 0)
+    {
+      sqlite3_close (*db);
+      *db = NULL;
+      return -1;
+    }
+  return 0;
+}
 
-  if (sqlite3_exec (db, sql_table, 0, 0, &err_msg) != SQLITE_OK)
+/* Time-partitioned databases: if db_path is a directory, the entries
+   are stored in one database file per month of the login time,
+   DIR/wtmp_YYYYMM.db. The partition is encoded in the upper bits of
+   the ID, so a logout finds its entry without searching, and expired
+   entries are removed by deleting whole files. Expired partitions may
+   be compressed instead (wtmp_YYYYMM.db.z), they stay readable. */
+#define PARTITION_SHIFT 32
+#define PARTITION_ID_BASE(part) ((int64_t)(part) << PARTITION_SHIFT)
+#define ID_PARTITION(id) ((int)((id) >> PARTITION_SHIFT))
+
+static int
+is_partitioned (const char *db_path)
+{
+  struct stat st;
+
+  return stat (db_path, &st) == 0 && S_ISDIR (st.st_mode);
+}
+
+/* Returns the partition (YYYYMM) of a login time. */
+static int
+usec2partition (uint64_t usec)
+{
+  time_t t = (time_t)(usec / USEC_PER_SEC);
+  struct tm tm;
+
+  if (localtime_r (&t, &tm) == NULL)
+    return 0;
+  return (tm.tm_year + 1900) * 100 + tm.tm_mon + 1;
+}
+
+/* Returns the path of a partition, the compressed one if only that
+   exists. */
+static char *
+partition_path (const char *dir, int part)
+{
+  char *path;
+
+  if (asprintf (&path, "%s/wtmp_%06d.db" COMPRESS_SUFFIX, dir, part) < 0)
+    return NULL;
+  if (access (path, F_OK) < 0)
+    path[strlen (path) - strlen (COMPRESS_SUFFIX)] = '\0';
+  return path;
+}
+
+static int
+cmp_partition_desc (const void *a, const void *b)
+{
+  int pa = *(const int *)a;
+  int pb = *(const int *)b;
+
+  return (pa < pb) - (pa > pb);
+}
+
+/* Returns the number of partitions in dir and stores them in *parts,
+   newest first, or < 0 on failure. */
+static int
+list_partitions (const char *dir, int **parts, char **error)
+{
+  DIR *d;
+  struct dirent *ent;
+  int *list = NULL;
+  int n = 0, size = 0;
+
+  *parts = NULL;
+  d = opendir (dir);
+  if (d == NULL)
+    {
+      int r = -errno;
+      if (error)
+	if (asprintf (error, "Cannot open database directory (%s): %s",
+		      dir, strerror (-r)) < 0)
+	  *error = strdup ("list_partitions: Out of memory");
+      return r;
+    }
+
+  while ((ent = readdir (d)) != NULL)
+    {
+      int part, len = 0;
+
+      if (sscanf (ent->d_name, "wtmp_%6d.db%n", &part, &len) != 1 ||
+	  part <= 0 || (strcmp (ent->d_name + len, "") != 0 &&
+			strcmp (ent->d_name + len, COMPRESS_SUFFIX) != 0))
+	continue;
+      if (n == size)
+	{
+	  int *tmp = realloc (list, (size + 16) * sizeof (int));
+	  if (tmp == NULL)
+	    {
+	      free (list);
+	      closedir (d);
+	      if (error)
+		*error = strdup ("list_partitions: Out of memory");
+	      return -ENOMEM;
+	    }
+	  list = tmp;
+	  size += 16;
+	}
+      list[n++] = part;
+    }
+  closedir (d);
+
+  if (n > 1)
+    {
+      int j = 0;
+
+      qsort (list, n, sizeof (int), cmp_partition_desc);
+      /* a partition may exist compressed and not yet removed */
+      for (int i = 1; i < n; i++)
+	if (list[i] != list[j])
+	  list[++j] = list[i];
+      n = j + 1;
+    }
+  *parts = list;
+  return n;
+}
+
+/* The rows of a partition which can be part of the result of a uniq
+   query resp. which are needed to list the boots. */
+#define PARTITION_UNIQ_ROWS "SELECT ID, Type, User, Login, Logout, TTY, RemoteHost, Service FROM (" \
+  "SELECT *,ROW_NUMBER() OVER (PARTITION BY User ORDER BY Login DESC) AS rn " \
+  "FROM part.wtmp WHERE Login IS NOT NULL AND TTY != '~') WHERE rn = 1"
+#define PARTITION_ALL_ROWS "SELECT * FROM part.wtmp"
+#define PARTITION_BOOT_ROWS "SELECT ID, Type, User, Login, Logout, NULL, RemoteHost, NULL " \
+  "FROM part.wtmp WHERE Type IN (" STR(BOOT_TIME) "," STR(USER_PROCESS) ")"
+
+/* Opens db_path for reading. For a partitioned database the rows
+   selected by rows_sql from all partitions are collected in an
+   in-memory database first, so that queries which need to see all
+   entries at once run unchanged.
+   Returns 0 on success, != 0 on failure. */
+static int
+open_database_read (const char *db_path, const char *rows_sql,
+		    sqlite3 **db, char **error)
+{
+  sqlite3_stmt *res;
+  char *sql;
+  int *parts;
+  int n, r;
+
+  if (!is_partitioned (db_path))
+    return open_database_ro (db_path, db, error);
+
+  n = list_partitions (db_path, &parts, error);
+  if (n < 0)
+    return SQLITE_CANTOPEN;
+
+  /* the VFS for compressed partitions passes other files through */
+  r = sqlite3_open_v2 (":memory:", db, SQLITE_OPEN_READWRITE |
+		       SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX,
+		       compress_vfs ());
+  if (r != SQLITE_OK || create_table (*db, error) != 0)
+    {
+      if (error && *error == NULL)
+	*error = strdup ("open_database_read: Cannot create in-memory database");
+      free (parts);
+      sqlite3_close (*db);
+      *db = NULL;
+      return SQLITE_CANTOPEN;
+    }
+  if (asprintf (&sql, "INSERT INTO main.wtmp %s", rows_sql) < 0)
+    {
+      if (error)
+	*error = strdup ("open_database_read: Out of memory");
+      free (parts);
+      sqlite3_close (*db);
+      *db = NULL;
+      return SQLITE_NOMEM;
+    }
+
+  for (int i = 0; i < n && r == SQLITE_OK; i++)
+    {
+      char *path = partition_path (db_path, parts[i]);
+
+      if (path == NULL)
+	r = SQLITE_NOMEM;
+      else if ((r = sqlite3_prepare_v2 (*db, "ATTACH ? AS part", -1,
+					&res, 0)) == SQLITE_OK)
+	{
+	  sqlite3_bind_text (res, 1, path, -1, SQLITE_STATIC);
+	  r = sqlite3_step (res);
+	  sqlite3_finalize (res);
+	  if (r == SQLITE_DONE)
+	    {
+	      r = sqlite3_exec (*db, sql, NULL, NULL, NULL);
+	      sqlite3_exec (*db, "DETACH part", NULL, NULL, NULL);
+	    }
+	}
+      if (r != SQLITE_OK && error)
+	if (asprintf (error, "Cannot read partition (%s): %s",
+		      path, sqlite3_errmsg (*db)) < 0)
+	  *error = strdup ("open_database_read: Out of memory");
+      free (path);
+    }
+  free (sql);
+  free (parts);
+
+  if (r != SQLITE_OK)
+    {
+      sqlite3_close (*db);
+      *db = NULL;
+    }
+  return r;
+}
+
+/* Add a new entry. If id_base is not 0, the ID of the first entry of
+   the table is id_base + 1, following entries count up from there.
+   Returns ID (>=0) on success, -1 on failure. */
+static int64_t
+add_entry (sqlite3 *db, int64_t id_base, int type, const char *user,
+	   uint64_t usec_login, const char *tty, const char *rhost,
+	   const char *service, char **error)
+{
+  sqlite3_stmt *res;
+  char *sql_insert = id_base == 0 ?
+    "INSERT INTO wtmp (Type,User,Login,TTY,RemoteHost,Service) VALUES(?1,?2,?3,?4,?5,?6);" :
+    "INSERT INTO wtmp (ID,Type,User,Login,TTY,RemoteHost,Service) "
+    "VALUES((SELECT IFNULL(MAX(ID), ?7) + 1 FROM wtmp),?1,?2,?3,?4,?5,?6);";
+
+  if (sqlite3_prepare_v2 (db, sql_insert, -1, &res, 0) != SQLITE_OK)
+    {
+      if (error)
+        if (asprintf (error, "Failed to prepare statement (add_entry): %s",
+                      sqlite3_errmsg (db)) < 0)
+          *error = strdup ("add_entry: Out of memory");
+
+      return -1;
+    }
+
+  if (sqlite3_bind_int (res, 1, type) != SQLITE_OK)
+    {
+      if (error)
+        if (asprintf (error, "Failed to create add statement for 'type': %s",
+                      sqlite3_errmsg (db)) < 0)
+          *error = strdup("add_entry: Out of memory");
+
+      sqlite3_finalize(res);
+      return -1;
+    }
+
+  if (sqlite3_bind_text (res, 2, user, -1, SQLITE_STATIC) != SQLITE_OK)
+    {
+      if (error)
+        if (asprintf (error, "Failed to create add statement for 'user': %s",
+                      sqlite3_errmsg (db)) < 0)
+          *error = strdup ("add_entry: Out of memory");
+
+      sqlite3_finalize (res);
+      return -1;
+    }
+
+  if (sqlite3_bind_int64 (res, 3, usec_login) != SQLITE_OK)
+    {
+      if (error)
+        if (asprintf (error, "Failed to create add statement for 'login' time (add_entry): %s",
+                      sqlite3_errmsg (db)) < 0)
+          *error = strdup("add_entry: Out of memory");
+
+      sqlite3_finalize(res);
+      return -1;
+    }
+
+  if (sqlite3_bind_text (res, 4, tty, -1, SQLITE_STATIC) != SQLITE_OK)
+    {
+      if (error)
+        if (asprintf (error, "Failed to create add statement for 'tty': %s",
+                      sqlite3_errmsg (db)) < 0)
+          *error = strdup("add_entry: Out of memory");
+
+      sqlite3_finalize(res);
+      return -1;
+    }
+
+  if (sqlite3_bind_text (res, 5, rhost, -1, SQLITE_STATIC) != SQLITE_OK)
+    {
+      if (error)
+        if (asprintf (error, "Failed to create add statement for 'rhost': %s",
+                      sqlite3_errmsg (db)) < 0)
+          *error = strdup("add_entry: Out of memory");
+
+      sqlite3_finalize(res);
+      return -1;
+    }
+
+  if (sqlite3_bind_text (res, 6, service, -1, SQLITE_STATIC) != SQLITE_OK)
+    {
+      if (error)
+        if (asprintf (error, "Failed to create add statement for 'service': %s",
+                      sqlite3_errmsg (db)) < 0)
+          *error = strdup("add_entry: Out of memory");
+
+      sqlite3_finalize(res);
+      return -1;
+    }
+
+  if (id_base != 0 && sqlite3_bind_int64 (res, 7, id_base) != SQLITE_OK)
+    {
+      if (error)
+        if (asprintf (error, "Failed to create add statement for 'id': %s",
+                      sqlite3_errmsg (db)) < 0)
+          *error = strdup("add_entry: Out of memory");
+
+      sqlite3_finalize(res);
+      return -1;
+    }
+
+  int step = sqlite3_step (res);
+
+  if (step != SQLITE_DONE)
+    {
+      if (error)
+        if (asprintf (error, "Adding an entry failed: %s",
+                      sqlite3_errstr(step)) < 0)
+          *error = strdup("add_entry: Out of memory");
+
+      sqlite3_finalize(res);
+      return -1;
+    }
+
+  sqlite3_finalize(res);
+
+  return sqlite3_last_insert_rowid(db);
+}
+
+#define TOKEN_KEEP_USEC (3600 * USEC_PER_SEC)
+
+/* A login may be sent with a token by a client, which writes it to the
+   database itself if wtmpdbd does not answer in time; wtmpdbd may still
+   commit it later. The first login with a token is recorded, later ones
+   get its ID. Tokens are kept for TOKEN_KEEP_USEC. Until migration 7 is
+   done, tokens are ignored.
+   Returns the ID of the login with token, 0 if there is none, <0 on
+   failure. */
+static int64_t
+find_token (sqlite3 *db, const char *token, char **error)
+{
+  sqlite3_stmt *res;
+  int64_t id = 0;
+  int r;
+
+  if ((r = sql_exists (db, "SELECT 1 FROM sqlite_master WHERE name = 'wtmp_tokens'")) <= 0)
+    return r;
+
+  if (sqlite3_prepare_v2 (db, "SELECT ID FROM wtmp_tokens WHERE Token = ?1",
+			  -1, &res, 0) != SQLITE_OK)
+    {
+      if (error)
+	if (asprintf (error, "Failed to prepare statement (find_token): %s",
+		      sqlite3_errmsg (db)) < 0)
+	  *error = strdup ("find_token: Out of memory");
+      return -EIO;
+    }
+  sqlite3_bind_text (res, 1, token, -1, SQLITE_STATIC);
+  r = sqlite3_step (res);
+  if (r == SQLITE_ROW)
+    id = sqlite3_column_int64 (res, 0);
+  sqlite3_finalize (res);
+  if (r != SQLITE_ROW && r != SQLITE_DONE)
+    {
+      if (error)
+	if (asprintf (error, "Searching the token failed: %s",
+		      sqlite3_errstr (r)) < 0)
+	  *error = strdup ("find_token: Out of memory");
+      return -EIO;
+    }
+  return id;
+}
+
+/* Records token for the login id and removes expired tokens.
+   Returns id on success, <0 on failure. */
+static int64_t
+add_token (sqlite3 *db, const char *token, int64_t id, char **error)
+{
+  sqlite3_stmt *res;
+  struct timespec ts;
+  int r;
+
+  if (id < 0 ||
+      sql_exists (db, "SELECT 1 FROM sqlite_master WHERE name = 'wtmp_tokens'") <= 0)
+    return id;
+
+  clock_gettime (CLOCK_REALTIME, &ts);
+  uint64_t now = wtmpdb_timespec2usec (ts);
+
+  if (sql_int64 (db, "DELETE FROM wtmp_tokens WHERE Time < ?1",
+		 (int64_t)(now - TOKEN_KEEP_USEC), 0, NULL, NULL) < 0 ||
+      sqlite3_prepare_v2 (db, "INSERT INTO wtmp_tokens VALUES(?1, ?2, ?3)",
+			  -1, &res, 0) != SQLITE_OK)
+    {
+      if (error)
+	if (asprintf (error, "Failed to prepare statement (add_token): %s",
+		      sqlite3_errmsg (db)) < 0)
+	  *error = strdup ("add_token: Out of memory");
+      return -EIO;
+    }
+  sqlite3_bind_text (res, 1, token, -1, SQLITE_STATIC);
+  sqlite3_bind_int64 (res, 2, id);
+  sqlite3_bind_int64 (res, 3, now);
+  r = sqlite3_step (res);
+  sqlite3_finalize (res);
+  if (r != SQLITE_DONE)
+    {
+      if (error)
+	if (asprintf (error, "Adding the token failed: %s",
+		      sqlite3_errstr (r)) < 0)
+	  *error = strdup ("add_token: Out of memory");
+      return -EIO;
+    }
+  return id;
+}
+
+/*
+  Add new wtmp entry to db.
+  login timestamp is in usec.
+  If token is not NULL and a login with it was recorded already,
+  returns its ID instead of adding another entry.
+  Returns ID on success, < 0 on failure.
+ */
+int64_t
+sqlite_login(const char *db_path, int type, const char *user,
+	     uint64_t usec_login, const char *tty, const char *rhost,
+	     const char *service, const char *token, char **error)
+{
+  sqlite3 *db;
+  int64_t id_base = 0;
+  char *part_path = NULL;
+  int64_t id;
+  int lock;
+  int r;
+
+  if (is_partitioned (db_path))
+    {
+      int part = usec2partition (usec_login);
+
+      id_base = PARTITION_ID_BASE (part);
+      part_path = partition_path (db_path, part);
+      if (part_path == NULL)
+	{
+	  if (error)
+	    *error = strdup ("sqlite_login: Out of memory");
+	  return -ENOMEM;
+	}
+      /* the filter of a past month doesn't know the new entry */
+      if (part < usec2partition ((uint64_t)time (NULL) * USEC_PER_SEC))
+	{
+	  char *filter = bloom_path (part_path);
+	  if (filter)
+	    unlink (filter);
+	  free (filter);
+	}
+      db_path = part_path;
+    }
+
+  r = open_write (db_path, &db, &lock, "sqlite_login", error);
+  free (part_path);
+  if (r < 0)
+    return r;
+
+  if (token)
+    {
+      id = find_token (db, token, error);
+      if (id != 0)
+	{
+	  sqlite3_exec (db, "ROLLBACK", NULL, NULL, NULL);
+	  close_write (db, lock);
+	  return id;
+	}
+    }
+  id = add_entry (db, id_base, type, user, usec_login, tty, rhost,
+		  service, error);
+  if (token)
+    id = add_token (db, token, id, error);
+  id = end_write (db, id, "sqlite_login", error);
+
+  close_write (db, lock);
+
+  return id;
+}
+
+/* Updates logout field.
+   logout timestamp is in usec.
+   Returns 0 on success, < 0 on failure. */
+static int
+update_logout (sqlite3 *db, int64_t id, uint64_t usec_logout, char **error)
+{
+  sqlite3_stmt *res;
+  char *sql = "UPDATE wtmp SET Logout = ? WHERE ID = ?";
+
+  if (sqlite3_prepare_v2 (db, sql, -1, &res, 0) != SQLITE_OK)
+    {
+      if (error)
+        if (asprintf (error, "Failed to prepare statement (update_logout): %s",
+                      sqlite3_errmsg (db)) < 0)
+          *error = strdup ("update_logout: Out of memory");
+
+      return -1;
+    }
+
+  if (sqlite3_bind_int64 (res, 1, usec_logout) != SQLITE_OK)
+    {
+      if (error)
+        if (asprintf (error, "Failed to create update query (logout): %s",
+                      sqlite3_errmsg (db)) < 0)
+          *error = strdup("update_logout: Out of memory");
+
+      sqlite3_finalize(res);
+      return -1;
+    }
+
+  if (sqlite3_bind_int64 (res, 2, id) != SQLITE_OK)
+    {
+      if (error)
+        if (asprintf (error, "Failed to create update query (ID): %s",
+                      sqlite3_errmsg (db)) < 0)
+          *error = strdup("update_logout: Out of memory");
+
+      sqlite3_finalize(res);
+      return -1;
+    }
+
+  int step = sqlite3_step (res);
+
+  if (step != SQLITE_DONE)
+    {
+      if (error)
+        if (asprintf (error, "Updating logout time failed: %s",
+                      sqlite3_errstr(step)) < 0)
+          *error = strdup("update_logout: Out of memory");
+
+      sqlite3_finalize(res);
+      return -1;
+    }
+
+  int changes;
+  if ((changes = sqlite3_changes (db)) != 1)
+    {
+      if (error)
+        if (asprintf (error, "Update of logout time changed wrong number of rows, expected 1, got %d",
+                      changes) < 0)
+          *error = strdup("update_logout: Out of memory");
+
+      sqlite3_finalize(res);
+      return -1;
+    }
+
+  sqlite3_finalize (res);
+
+  return 0;
+}
+
+
+/*
+  Add logout timestamp to existingentry.
+  logout timestamp is in usec.
+  ID is the return value of wtmpdb_login/logwtmpdb.
+  Returns 0 on success, < 0 on failure.
+ */
+int
+sqlite_logout (const char *db_path, int64_t id, uint64_t usec_logout,
+	       char **error)
+{
+  sqlite3 *db;
+  char *part_path = NULL;
+  int lock;
+  int r;
+
+  if (is_partitioned (db_path))
+    {
+      part_path = partition_path (db_path, ID_PARTITION (id));
+      if (part_path == NULL)
+	{
+	  if (error)
+	    *error = strdup ("sqlite_logout: Out of memory");
+	  return -ENOMEM;
+	}
+      /* don't create a partition for an unknown ID */
+      if (access (part_path, F_OK) < 0)
+	{
+	  if (error)
+	    if (asprintf (error, "No partition for ID %lld (%s)",
+			  (long long)id, part_path) < 0)
+	      *error = strdup ("sqlite_logout: Out of memory");
+	  free (part_path);
+	  return -ENOENT;
+	}
+      db_path = part_path;
+    }
+
+  r = open_write (db_path, &db, &lock, "sqlite_logout", error);
+  free (part_path);
+  if (r < 0)
+    return r;
+
+  r = end_write (db, update_logout (db, id, usec_logout, error),
+		 "sqlite_logout", error);
+
+  close_write (db, lock);
+
+  return r;
+}
+
+/* Writes several entries in one transaction. Rows with id 0 are added
+   and get the new ID assigned, for the others only a logout time != 0
+   is stored.
+   Returns 0 on success, < 0 on failure. */
+int
+sqlite_write_rows (const char *db_path, struct sqlite_row *rows, size_t n,
+		   char **error)
+{
+  sqlite3 *db;
+  int lock;
+  int r;
+
+  if (is_partitioned (db_path))
+    {
+      /* the rows may belong to different partitions, write them one
+	 by one */
+      for (size_t i = 0; i < n; i++)
+	{
+	  rows[i].is_new = rows[i].id == 0;
+	  if (rows[i].is_new)
+	    {
+	      int64_t id = sqlite_login (db_path, rows[i].type, rows[i].user,
+					 rows[i].login, rows[i].tty,
+					 rows[i].rhost, rows[i].service,
+					 NULL, error);
+	      if (id < 0)
+		return -EIO;
+	      rows[i].id = id;
+	    }
+	  if (rows[i].logout != 0 &&
+	      sqlite_logout (db_path, rows[i].id, rows[i].logout, error) < 0)
+	    return -EIO;
+	}
+      return 0;
+    }
+
+  r = open_write (db_path, &db, &lock, "sqlite_write_rows", error);
+  if (r < 0)
+    return r;
+
+  for (size_t i = 0; i < n; i++)
+    rows[i].is_new = rows[i].id == 0;
+
+  for (size_t i = 0; i < n && r == 0; i++)
+    {
+      if (rows[i].is_new)
+	{
+	  int64_t id = add_entry (db, 0, rows[i].type, rows[i].user,
+				  rows[i].login, rows[i].tty, rows[i].rhost,
+				  rows[i].service, error);
+	  if (id < 0)
+	    r = -EIO;
+	  else
+	    rows[i].id = id;
+	}
+      if (r == 0 && rows[i].logout != 0 &&
+	  update_logout (db, rows[i].id, rows[i].logout, error) < 0)
+	r = -EIO;
+    }
+
+  r = end_write (db, r, "sqlite_write_rows", error);
+  if (r < 0)
+    /* IDs assigned in the rolled back transaction are invalid */
+    for (size_t i = 0; i < n; i++)
+      if (rows[i].id > 0 && rows[i].is_new)
+	rows[i].id = 0;
+
+  close_write (db, lock);
+  return r;
+}
+
+static int64_t
+search_id (sqlite3 *db, const char *tty, char **error)
+{
+  int64_t id = -1;
+  sqlite3_stmt *res;
+  char *sql = "SELECT ID FROM wtmp WHERE TTY = ? AND Logout IS NULL ORDER BY Login DESC LIMIT 1";
+
+  if (sqlite3_prepare_v2 (db, sql, -1, &res, 0) != SQLITE_OK)
+    {
+      int r = -ENOTSUP;
+      if (error)
+        if (asprintf (error, "Failed to prepare statement (search_id): %s",
+                      sqlite3_errmsg (db)) < 0)
+	  {
+	    r = -ENOMEM;
+	    *error = strdup ("search_id: Out of memory");
+	  }
+      return r;
+    }
+
+  if (sqlite3_bind_text (res, 1, tty, -1, SQLITE_STATIC) != SQLITE_OK)
+    {
+      int r = -EPROTO;
+      if (error)
+        if (asprintf (error, "Failed to create search query 'tty': %s",
+                      sqlite3_errmsg (db)) < 0)
+	  {
+	    r = -ENOMEM;
+	    *error = strdup("search_id: Out of memory");
+	  }
+
+      sqlite3_finalize(res);
+      return r;
+    }
+
+  int step = sqlite3_step (res);
+
+  if (step == SQLITE_ROW)
+    id = sqlite3_column_int64 (res, 0);
+  else if (step == SQLITE_DONE)
+    {
+      id = -ENOENT;
+      if (error)
+        if (asprintf (error, "Open entry for tty '%s' not found (search_id)", tty) < 0)
+	  {
+	    *error = strdup("search_id: Out of memory");
+	    id = -ENOMEM;
+	  }
+    }
+  else
+    {
+      id = -ENOENT;
+      if (error)
+        if (asprintf (error, "Error searching open entry for tty '%s': %s",
+		      tty, sqlite3_errstr(step)) < 0)
+	  {
+	    *error = strdup("search_id: Out of memory");
+	    id = -ENOMEM;
+	  }
+    }
+
+  sqlite3_finalize (res);
+
+  return id;
+}
+
+int64_t
+sqlite_get_id (const char *db_path, const char *tty, char **error)
+{
+  sqlite3 *db;
+  int64_t retval;
+  int r;
+
+  if (is_partitioned (db_path))
+    {
+      int *parts;
+      int n = list_partitions (db_path, &parts, error);
+
+      if (n < 0)
+	return n;
+
+      /* sessions may span several months, search newest first */
+      retval = -ENOENT;
+      for (int i = 0; i < n && retval == -ENOENT; i++)
+	{
+	  char *part_path = partition_path (db_path, parts[i]);
+
+	  if (error)
+	    *error = mfree (*error);
+	  if (part_path == NULL)
+	    {
+	      if (error)
+		*error = strdup ("sqlite_get_id: Out of memory");
+	      retval = -ENOMEM;
+	    }
+	  else
+	    {
+	      retval = sqlite_get_id (part_path, tty, error);
+	      free (part_path);
+	    }
+	}
+      free (parts);
+      if (retval == -ENOENT && n == 0 && error)
+	if (asprintf (error, "Open entry for tty '%s' not found (search_id)", tty) < 0)
+	  *error = strdup ("sqlite_get_id: Out of memory");
+      return retval;
+    }
+
+  r = open_database_ro (db_path, &db, error);
+  if (r != 0)
+    return -r;
+
+  retval = search_id (db, tty, error);
+
+  sqlite3_close (db);
+
+  return retval;
+}
+
+/* Builds the query for sqlite_read_all. Columns not in the mask are
+   returned as NULL, so the layout of the result does not change. */
+static int
+read_all_sql (int uniq, unsigned int columns, char *buf, size_t size)
+{
+  static const char *names[] = {"ID", "Type", "User", "Login", "Logout",
+				"TTY", "RemoteHost", "Service"};
+  char list[128];
+  size_t len = 0;
+
+  for (unsigned int i = 0; i < sizeof (names) / sizeof (names[0]); i++)
+    len += snprintf (list + len, sizeof (list) - len, "%s%s", i ? ", " : "",
+		     (columns & (1U << i)) ? names[i] : "NULL");
+
+  return snprintf (buf, size, uniq
+		   ? "SELECT %s FROM ("
+		   "SELECT *,ROW_NUMBER() OVER (PARTITION BY User ORDER BY Login DESC) AS rn "
+		   "FROM wtmp WHERE Login IS NOT NULL AND TTY != '~') WHERE rn = 1"
+		   : "SELECT %s FROM wtmp ORDER BY Login DESC, Logout ASC",
+		   list) < (int)size ? 0 : -1;
+}
+
+/* Reads all entries from database and calls the callback function for
+   each entry.
+   Returns 0 on success, -1 on failure. */
+int
+sqlite_read_all (const char *db_path, int uniq, unsigned int columns,
+		 int (*cb_func)(void *unused, int argc, char **argv,
+				char **azColName),
+		 void *userdata, char **error)
+{
+  sqlite3 *db;
+  char *err_msg = 0;
+  char sql[512];
+  int r;
+
+  if (read_all_sql (uniq, columns, sql, sizeof (sql)) < 0)
+    {
+      if (error)
+	*error = strdup ("sqlite_read_all: query too long");
+      return -EINVAL;
+    }
+
+  if (!uniq && is_partitioned (db_path))
+    {
+      int *parts;
+      int n = list_partitions (db_path, &parts, error);
+
+      /* a partition only contains logins of its month, so reading
+	 them newest first keeps the order */
+      r = n < 0 ? n : 0;
+      for (int i = 0; i < n && r == 0; i++)
+	{
+	  char *part_path = partition_path (db_path, parts[i]);
+
+	  if (part_path == NULL)
+	    {
+	      if (error)
+		*error = strdup ("sqlite_read_all: Out of memory");
+	      r = -ENOMEM;
+	    }
+	  else
+	    r = sqlite_read_all (part_path, 0, columns, cb_func, userdata,
+				 error);
+	  free (part_path);
+	}
+      free (parts);
+      return r;
+    }
+
+  r = open_database_read (db_path, PARTITION_UNIQ_ROWS, &db, error);
+  if (r != 0)
+    return -r;
+
+  r = sqlite3_exec (db, sql, cb_func, userdata, &err_msg);
+  sqlite3_close (db);
+  if (r != SQLITE_OK)
+    {
+      if (error)
+        if (asprintf (error, "sqlite_read_all: SQL error: %s", err_msg) < 0)
+          *error = strdup ("sqlite_read_all: Out of memory");
+
+      sqlite3_free (err_msg);
+      return -r;
+    }
+
+  return 0;
+}
+
+/* Same as sqlite_read_all, but adds the entries to a batch instead of
+   calling a callback per entry.
+   Returns 0 on success, <0 on failure. */
+int
+sqlite_read_batch (const char *db_path, int uniq, struct batch_ctx *ctx,
+		   char **error)
+{
+  sqlite3 *db;
+  sqlite3_stmt *res;
+  char sql[512];
+  int br = 0;
+  int r;
+
+  if (read_all_sql (uniq, WTMPDB_COL_ALL, sql, sizeof (sql)) < 0)
+    return -EINVAL;
+
+  if (!uniq && is_partitioned (db_path))
+    {
+      int *parts;
+      int n = list_partitions (db_path, &parts, error);
+
+      r = n < 0 ? n : 0;
+      for (int i = 0; i < n && r == 0; i++)
+	{
+	  char *part_path = partition_path (db_path, parts[i]);
+
+	  if (part_path == NULL)
+	    {
+	      if (error)
+		*error = strdup ("sqlite_read_batch: Out of memory");
+	      r = -ENOMEM;
+	    }
+	  else
+	    r = sqlite_read_batch (part_path, 0, ctx, error);
+	  free (part_path);
+	}
+      free (parts);
+      return r;
+    }
+
+  r = open_database_read (db_path, PARTITION_UNIQ_ROWS, &db, error);
+  if (r != 0)
+    return -r;
+
+  if (sqlite3_prepare_v2 (db, sql, -1, &res, 0) != SQLITE_OK)
+    {
+      if (error)
+	if (asprintf (error, "Failed to prepare statement (sqlite_read_batch): %s",
+		      sqlite3_errmsg (db)) < 0)
+	  *error = strdup ("sqlite_read_batch: Out of memory");
+      sqlite3_close (db);
+      return -EIO;
+    }
+
+  while ((r = sqlite3_step (res)) == SQLITE_ROW)
+    {
+      /* NULL columns yield 0 resp. a NULL pointer */
+      br = batch_add (ctx, sqlite3_column_int64 (res, 0),
+		      sqlite3_column_int (res, 1),
+		      (uint64_t)sqlite3_column_int64 (res, 3),
+		      (uint64_t)sqlite3_column_int64 (res, 4),
+		      (const char *)sqlite3_column_text (res, 2),
+		      (const char *)sqlite3_column_text (res, 5),
+		      (const char *)sqlite3_column_text (res, 6),
+		      (const char *)sqlite3_column_text (res, 7));
+      if (br != 0)
+	{
+	  r = SQLITE_ABORT;
+	  break;
+	}
+    }
+  if (r == SQLITE_DONE)
+    r = (br = batch_flush (ctx)) != 0 ? SQLITE_ABORT : SQLITE_OK;
+
+  if (br < 0)
+    {
+      /* not an SQL error: -ENOMEM of batch_add or an errno value of
+	 the callback */
+      if (error)
+	if (br == -ENOMEM ||
+	    asprintf (error, "sqlite_read_batch: %s", strerror (-br)) < 0)
+	  *error = strdup ("sqlite_read_batch: Out of memory");
+      r = -br;
+    }
+  else if (r != SQLITE_OK && error)
+    if (asprintf (error, "sqlite_read_batch: SQL error: %s",
+		  r == SQLITE_ABORT ? "query aborted" : sqlite3_errstr (r)) < 0)
+      *error = strdup ("sqlite_read_batch: Out of memory");
+
+  sqlite3_finalize (res);
+  sqlite3_close (db);
+  return -r;
+}
+
+/* Reads all boot entries from database and calls the callback function
+   for each boot, newest first. The columns are ID, User, BootTime,
+   ShutdownTime, Kernel, NextBoot, Sessions and Crash. Sessions is the
+   number of USER_PROCESS entries which started within this boot, Crash
+   is 1 if there was a later boot but no shutdown was recorded.
+   Returns 0 on success, <0 on failure. */
+int
+sqlite_read_boots (const char *db_path,
+		   int (*cb_func)(void *unused, int argc, char **argv,
+				  char **azColName),
+		   void *userdata, char **error)
+{
+  sqlite3 *db;
+  char *err_msg = 0;
+  int r;
+
+  r = open_database_read (db_path, PARTITION_BOOT_ROWS, &db, error);
+  if (r != 0)
+    return -r;
+
+  /* Boots are found via the (Type, Login) index, the sessions of a boot
+     are counted as index range [boot, next boot) on the same index. */
+  char *sql = "SELECT b.ID, b.User, b.Login AS BootTime, b.Logout AS ShutdownTime, "
+		"b.RemoteHost AS Kernel, b.NextBoot, "
+		"(SELECT COUNT(*) FROM wtmp s WHERE s.Type = " STR(USER_PROCESS) " "
+		"AND s.Login >= b.Login AND (b.NextBoot IS NULL OR s.Login < b.NextBoot)) AS Sessions, "
+		"(b.Logout IS NULL AND b.NextBoot IS NOT NULL) AS Crash "
+	"FROM (SELECT ID, User, Login, Logout, RemoteHost, "
+		"LEAD(Login) OVER (ORDER BY Login) AS NextBoot "
+		"FROM wtmp WHERE Type = " STR(BOOT_TIME) ") AS b "
+	"ORDER BY b.Login DESC";
+
+  r = sqlite3_exec (db, sql, cb_func, userdata, &err_msg);
+  sqlite3_close (db);
+  if (r != SQLITE_OK)
+    {
+      if (error)
+        if (asprintf (error, "sqlite_read_boots: SQL error: %s", err_msg) < 0)
+          *error = strdup ("sqlite_read_boots: Out of memory");
+
+      sqlite3_free (err_msg);
+      return -r;
+    }
+
+  return 0;
+}
+
+/* The newest boot and the one before, the bounds of the "active" and
+   "crashed" sessions. */
+struct metrics_boots {
+  int64_t boot, prev;
+  int no_boot, no_prev;
+};
+
+/* Looks in db for the boots not found yet. The databases have to be
+   passed newest first.
+   Returns 0 on success, <0 on failure. */
+static int
+metrics_find_boots (sqlite3 *db, struct metrics_boots *b)
+{
+  if (b->no_boot &&
+      sql_int64 (db, "SELECT MAX(Login) FROM wtmp WHERE Type = " STR(BOOT_TIME),
+		 0, 0, &b->boot, &b->no_boot) < 0)
+    return -EIO;
+  if (!b->no_boot && b->no_prev &&
+      sql_int64 (db, "SELECT MAX(Login) FROM wtmp WHERE Type = " STR(BOOT_TIME)
+		 " AND Login < ?1", b->boot, 0, &b->prev, &b->no_prev) < 0)
+    return -EIO;
+  return 0;
+}
+
+/* Calls cb_func with the metrics of the entries in db, the boottime
+   only if boottime is set.
+   Returns 0 on success, <0 on failure. */
+static int
+metrics_exec (sqlite3 *db, const struct metrics_boots *b, int boottime,
+	      int (*cb_func)(void *unused, int argc, char **argv,
+			     char **azColName),
+	      void *userdata, char **error)
+{
+  int64_t version = 0;
+  char *err_msg = NULL;
+  char *sql;
+  int r;
+
+  sql_int64 (db, "PRAGMA user_version", 0, 0, &version, NULL);
+  if (asprintf (&sql, "%s;"
+		"SELECT 'active', Type, IFNULL(Service, ''), COUNT(*) FROM wtmp "
+		"WHERE Type = " STR(USER_PROCESS) " AND Login >= %lld "
+		"AND Logout IS NULL GROUP BY 3;"
+		"SELECT 'crashed', Type, IFNULL(Service, ''), COUNT(*) FROM wtmp "
+		"WHERE Type = " STR(USER_PROCESS) " AND Login >= %lld AND Login < %lld "
+		"AND Logout IS NULL GROUP BY 3;"
+		"SELECT 'boottime', " STR(BOOT_TIME) ", '', %lld WHERE %d;",
+		version >= 8 ?
+		"SELECT 'logins', Type, Service, Count FROM wtmp_counters "
+		"WHERE Type >= 0" :
+		"SELECT 'logins', IFNULL(Type, 0), IFNULL(Service, ''), COUNT(*) "
+		"FROM wtmp GROUP BY 2, 3",
+		(long long)b->boot, (long long)b->prev,
+		/* without a previous boot, nothing crashed */
+		(long long)(b->no_prev ? b->prev : b->boot), (long long)b->boot,
+		boottime && !b->no_boot) < 0)
+    {
+      if (error)
+	*error = strdup ("sqlite_read_metrics: Out of memory");
+      return -ENOMEM;
+    }
+
+  r = sqlite3_exec (db, sql, cb_func, userdata, &err_msg);
+  free (sql);
+  if (r != SQLITE_OK)
     {
       if (error)
-	if (asprintf (error, "SQL error creating table: %s", err_msg) < 0)
-	  *error = strdup ("create_table: Out of memory");
+	if (asprintf (error, "sqlite_read_metrics: SQL error: %s", err_msg) < 0)
+	  *error = strdup ("sqlite_read_metrics: Out of memory");
       sqlite3_free (err_msg);
-
-      return -1;
+      return -EIO;
     }
   return 0;
 }
 
-static int
-open_database_ro (const char *path, sqlite3 **db, char **error)
+/* Calls cb_func with the columns Metric, Type, Service, Value for the
+   metrics "logins" (entries added), "active" (open sessions since the
+   last boot), "crashed" (sessions of the previous boot without logout)
+   and "boottime" (usec). The sessions are found via the (Type, Login)
+   index, the logins in wtmp_counters; until migration 8 is done, wtmp
+   gets counted. The partitions of a partitioned database are queried
+   one by one, the values of all of them add up.
+   Returns 0 on success, <0 on failure. */
+int
+sqlite_read_metrics (const char *db_path,
+		     int (*cb_func)(void *unused, int argc, char **argv,
+				    char **azColName),
+		     void *userdata, char **error)
 {
-  struct stat statbuf;
-  int empty_file;
-  int r;
+  struct metrics_boots b = { .no_boot = 1, .no_prev = 1 };
+  sqlite3 *db;
+  int *parts;
+  int n, r;
 
-  empty_file = stat(path, &statbuf) == 0 && statbuf.st_size == 0;
-  r = sqlite3_open_v2 (path, db, empty_file ?
-                       SQLITE_OPEN_READWRITE | SQLITE_OPEN_MEMORY :
-                       SQLITE_OPEN_READONLY, NULL);
-  if (r != SQLITE_OK)
+  if (!is_partitioned (db_path))
     {
-      if (error)
-	if (asprintf(error, "Cannot open database (%s) read-only: %s",
-		     path, sqlite3_errmsg(*db)) < 0)
-	  *error = strdup("open_database_ro: Out of memory");
-      sqlite3_close(*db);
-      *db = NULL;
+      if (open_database_read (db_path, PARTITION_ALL_ROWS, &db, error) != 0)
+	return -EIO;
+      r = metrics_find_boots (db, &b);
+      if (r < 0 && error)
+	if (asprintf (error, "sqlite_read_metrics: SQL error: %s",
+		      sqlite3_errmsg (db)) < 0)
+	  *error = strdup ("sqlite_read_metrics: Out of memory");
+      if (r == 0)
+	r = metrics_exec (db, &b, 1, cb_func, userdata, error);
+      sqlite3_close (db);
       return r;
     }
 
-  sqlite3_busy_timeout(*db, TIMEOUT);
+  n = list_partitions (db_path, &parts, error);
+  if (n < 0)
+    return n;
 
-  if (empty_file)
-    r = create_table (*db, error);
+  /* the boots are in the newest partitions, the counters and sessions
+     in all of them */
+  r = 0;
+  for (int pass = 0; pass < 2 && r == 0; pass++)
+    for (int i = 0; i < n && r == 0 && (pass == 1 || b.no_prev); i++)
+      {
+	char *part_path = partition_path (db_path, parts[i]);
 
-  return r == SQLITE_OK ? 0 : -1;
+	if (part_path == NULL)
+	  {
+	    if (error)
+	      *error = strdup ("sqlite_read_metrics: Out of memory");
+	    r = -ENOMEM;
+	    break;
+	  }
+	if (open_database_read (part_path, PARTITION_ALL_ROWS, &db,
+				error) != 0)
+	  r = -EIO;
+	else if (pass == 0)
+	  {
+	    r = metrics_find_boots (db, &b);
+	    if (r < 0 && error)
+	      if (asprintf (error, "Cannot read partition (%s): %s",
+			    part_path, sqlite3_errmsg (db)) < 0)
+		*error = strdup ("sqlite_read_metrics: Out of memory");
+	  }
+	else
+	  r = metrics_exec (db, &b, i == 0, cb_func, userdata, error);
+	sqlite3_close (db);
+	free (part_path);
+      }
+  free (parts);
+  return r;
 }
 
+/* Calls cb_func with the columns of one prepared statement row. */
 static int
-open_database_rw (const char *path, sqlite3 **db, char **error)
+exec_row (sqlite3_stmt *res,
+	  int (*cb_func)(void *unused, int argc, char **argv,
+			 char **azColName),
+	  void *userdata)
 {
+  static char *colnames[] = {"ID", "Type", "User", "Login", "Logout",
+				   "TTY", "RemoteHost", "Service"};
+  const unsigned char *text[8];
+  char buf[1024], *row = buf;
+  size_t len = 0, bytes[8];
+  char *argv[8];
   int r;
 
-  char *buf = strdup(path);
-  mkdir_p(dirname(buf), 0755);
-  free(buf);
-
-#if WITH_WTMPDBD
-  mode_t old_umask = umask(0077);
-#endif
-
-  r = sqlite3_open (path, db);
-#if WITH_WTMPDBD
-  umask (old_umask);
-#endif
-  if (r != SQLITE_OK)
+  /* the callback gets writable copies, as from sqlite3_exec */
+  for (int i = 0; i < 8; i++)
     {
-      if (error)
-	if (asprintf (error, "Cannot create/open database (%s): %s",
-		      path, sqlite3_errmsg (*db)) < 0)
-	  *error = strdup ("open_database_rw: Out of memory");
-
-      sqlite3_close (*db);
-      *db = NULL;
-      return -r;
+      text[i] = sqlite3_column_text (res, i);
+      bytes[i] = text[i] ? (size_t)sqlite3_column_bytes (res, i) + 1 : 0;
+      len += bytes[i];
     }
+  if (len > sizeof (buf) && (row = malloc (len)) == NULL)
+    return -ENOMEM;
 
-  sqlite3_busy_timeout(*db, TIMEOUT);
+  len = 0;
+  for (int i = 0; i < 8; i++)
+    {
+      argv[i] = text[i] ? memcpy (row + len, text[i], bytes[i]) : NULL;
+      len += bytes[i];
+    }
 
-  r = create_table (*db, error);
-  return r == SQLITE_OK ? 0 : -1;
+  r = cb_func (userdata, 8, argv, colnames);
+  if (row != buf)
+    free (row);
+  return r;
 }
 
-/* Add a new entry. Returns ID (>=0) on success, -1 on failure. */
-static int64_t
-add_entry (sqlite3 *db, int type, const char *user,
-	   uint64_t usec_login, const char *tty, const char *rhost,
-	   const char *service, char **error)
+/* A cursor reads the result of sqlite_read_all in pages. The statement
+   stays open between the pages, so all of them come from one read
+   transaction, which is a snapshot of the database in WAL mode and
+   does not block writers. The partitions of a partitioned database are
+   read newest first, as by sqlite_read_all, each in its own read
+   transaction from its first page on; only for uniq the rows are
+   collected in memory first. With a rollback journal the transaction
+   would lock out writers, so there every page is read in its own
+   transaction and the entries read before get skipped. */
+struct sqlite_cursor {
+  sqlite3 *db;
+  sqlite3_stmt *res;	/* NULL after the last entry of db */
+  uint64_t offset;	/* entries of db read so far */
+  int snapshot;		/* the read transaction is kept between pages */
+  char *sql;
+  char *db_path;	/* of a partitioned database, else NULL */
+  int *parts;		/* the partitions, newest first */
+  int nparts;
+  int next_part;	/* index of the partition read next */
+};
+
+/* Opens path for the cursor and starts reading it.
+   Returns 0 on success, <0 on failure. */
+static int
+cursor_start (struct sqlite_cursor *c, const char *path, int uniq,
+	      char **error)
 {
-  sqlite3_stmt *res;
-  char *sql_insert = "INSERT INTO wtmp (Type,User,Login,TTY,RemoteHost,Service) VALUES(?,?,?,?,?,?);";
-
-  if (sqlite3_prepare_v2 (db, sql_insert, -1, &res, 0) != SQLITE_OK)
+  if (open_database_read (path, uniq ? PARTITION_UNIQ_ROWS :
+			  PARTITION_ALL_ROWS, &c->db, error) != 0)
+    return -EIO;
+  c->offset = 0;
+
+  /* archives don't change and are read without locks */
+  c->snapshot = is_partitioned (path) || is_compressed (path) ||
+    is_archive (path) ||
+    sql_exists (c->db, "SELECT 1 FROM pragma_journal_mode "
+		"WHERE journal_mode = 'wal'") == 1;
+
+  /* reading the schema starts the read transaction */
+  if (sqlite3_prepare_v2 (c->db, c->sql, -1, &c->res, 0) != SQLITE_OK ||
+      sqlite3_bind_int64 (c->res, 1, 0) != SQLITE_OK ||
+      (c->snapshot && sqlite3_exec (c->db, "BEGIN; PRAGMA schema_version",
+				    NULL, NULL, NULL) != SQLITE_OK))
     {
       if (error)
-        if (asprintf (error, "Failed to prepare statement (add_entry): %s",
-                      sqlite3_errmsg (db)) < 0)
-          *error = strdup ("add_entry: Out of memory");
-
-      return -1;
+	if (asprintf (error, "sqlite_cursor_open: SQL error: %s",
+		      sqlite3_errmsg (c->db)) < 0)
+	  *error = strdup ("sqlite_cursor_open: Out of memory");
+      return -EIO;
     }
+  return 0;
+}
 
-  if (sqlite3_bind_int (res, 1, type) != SQLITE_OK)
-    {
-      if (error)
-        if (asprintf (error, "Failed to create add statement for 'type': %s",
-                      sqlite3_errmsg (db)) < 0)
-          *error = strdup("add_entry: Out of memory");
+/* Closes the current database of the cursor and opens the next
+   partition.
+   Returns 1 if there is one, 0 after the last, <0 on failure. */
+static int
+cursor_next_partition (struct sqlite_cursor *c, char **error)
+{
+  char *part_path;
+  int r;
 
-      sqlite3_finalize(res);
-      return -1;
-    }
+  sqlite3_finalize (c->res);
+  c->res = NULL;
+  sqlite3_close (c->db);
+  c->db = NULL;
+  if (c->next_part >= c->nparts)
+    return 0;
 
-  if (sqlite3_bind_text (res, 2, user, -1, SQLITE_STATIC) != SQLITE_OK)
+  part_path = partition_path (c->db_path, c->parts[c->next_part++]);
+  if (part_path == NULL)
     {
       if (error)
-        if (asprintf (error, "Failed to create add statement for 'user': %s",
-                      sqlite3_errmsg (db)) < 0)
-          *error = strdup ("add_entry: Out of memory");
-
-      sqlite3_finalize (res);
-      return -1;
+	*error = strdup ("sqlite_cursor_read: Out of memory");
+      return -ENOMEM;
     }
+  r = cursor_start (c, part_path, 0, error);
+  free (part_path);
+  return r < 0 ? r : 1;
+}
 
-  if (sqlite3_bind_int64 (res, 3, usec_login) != SQLITE_OK)
+int
+sqlite_cursor_open (const char *db_path, int uniq,
+		    struct sqlite_cursor **cursor, char **error)
+{
+  struct sqlite_cursor *c;
+  char query[512];
+  int r;
+
+  if (read_all_sql (uniq, WTMPDB_COL_ALL, query, sizeof (query)) < 0)
     {
       if (error)
-        if (asprintf (error, "Failed to create add statement for 'login' time (add_entry): %s",
-                      sqlite3_errmsg (db)) < 0)
-          *error = strdup("add_entry: Out of memory");
-
-      sqlite3_finalize(res);
-      return -1;
+	*error = strdup ("sqlite_cursor_open: query too long");
+      return -EINVAL;
     }
 
-  if (sqlite3_bind_text (res, 4, tty, -1, SQLITE_STATIC) != SQLITE_OK)
+  c = calloc (1, sizeof (*c));
+  if (c == NULL || asprintf (&c->sql, "%s LIMIT -1 OFFSET ?1", query) < 0)
     {
+      free (c);
       if (error)
-        if (asprintf (error, "Failed to create add statement for 'tty': %s",
-                      sqlite3_errmsg (db)) < 0)
-          *error = strdup("add_entry: Out of memory");
-
-      sqlite3_finalize(res);
-      return -1;
+	*error = strdup ("sqlite_cursor_open: Out of memory");
+      return -ENOMEM;
     }
 
-  if (sqlite3_bind_text (res, 5, rhost, -1, SQLITE_STATIC) != SQLITE_OK)
+  if (!uniq && is_partitioned (db_path))
     {
-      if (error)
-        if (asprintf (error, "Failed to create add statement for 'rhost': %s",
-                      sqlite3_errmsg (db)) < 0)
-          *error = strdup("add_entry: Out of memory");
-
-      sqlite3_finalize(res);
-      return -1;
+      c->nparts = list_partitions (db_path, &c->parts, error);
+      c->db_path = strdup (db_path);
+      if (c->nparts < 0 || c->db_path == NULL)
+	{
+	  r = c->nparts < 0 ? c->nparts : -ENOMEM;
+	  if (r == -ENOMEM && error)
+	    *error = strdup ("sqlite_cursor_open: Out of memory");
+	  c->nparts = 0;
+	  sqlite_cursor_close (c);
+	  return r;
+	}
+      r = cursor_next_partition (c, error);
     }
-
-  if (sqlite3_bind_text (res, 6, service, -1, SQLITE_STATIC) != SQLITE_OK)
+  else
+    r = cursor_start (c, db_path, uniq, error);
+  if (r < 0)
     {
-      if (error)
-        if (asprintf (error, "Failed to create add statement for 'service': %s",
-                      sqlite3_errmsg (db)) < 0)
-          *error = strdup("add_entry: Out of memory");
-
-      sqlite3_finalize(res);
-      return -1;
+      sqlite_cursor_close (c);
+      return r;
     }
 
-  int step = sqlite3_step (res);
+  *cursor = c;
+  return 0;
+}
 
-  if (step != SQLITE_DONE)
+/* Calls cb_func for the next up to count entries, a non-zero return
+   value stops after the entry.
+   Returns the number of entries, 0 after the last one, <0 on failure. */
+int
+sqlite_cursor_read (struct sqlite_cursor *c, size_t count,
+		    int (*cb_func)(void *unused, int argc, char **argv,
+				   char **azColName),
+		    void *userdata, char **error)
+{
+  size_t n = 0;
+  int r = SQLITE_ROW;
+
+  while (n < count)
     {
-      if (error)
-        if (asprintf (error, "Adding an entry failed: %s",
-                      sqlite3_errstr(step)) < 0)
-          *error = strdup("add_entry: Out of memory");
+      if (c->res == NULL)
+	{
+	  /* the next partition, if any */
+	  if (c->db_path == NULL)
+	    break;
+	  r = cursor_next_partition (c, error);
+	  if (r < 0)
+	    return r;
+	  if (r == 0)
+	    break;
+	  continue;
+	}
 
-      sqlite3_finalize(res);
-      return -1;
+      r = sqlite3_step (c->res);
+      if (r == SQLITE_DONE)
+	{
+	  sqlite3_finalize (c->res);
+	  c->res = NULL;
+	  continue;
+	}
+      if (r != SQLITE_ROW)
+	{
+	  if (error)
+	    if (asprintf (error, "sqlite_cursor_read: SQL error: %s",
+			  sqlite3_errmsg (c->db)) < 0)
+	      *error = strdup ("sqlite_cursor_read: Out of memory");
+	  return -EIO;
+	}
+      n++;
+      c->offset++;
+      if (exec_row (c->res, cb_func, userdata) != 0)
+	break;
     }
 
-  sqlite3_finalize(res);
+  if (c->res != NULL && !c->snapshot)
+    {
+      /* releases the lock */
+      sqlite3_reset (c->res);
+      sqlite3_bind_int64 (c->res, 1, (sqlite3_int64)c->offset);
+    }
 
-  return sqlite3_last_insert_rowid(db);
+  return (int)n;
 }
 
-/*
-  Add new wtmp entry to db.
-  login timestamp is in usec.
-  Returns ID on success, < 0 on failure.
- */
-int64_t
-sqlite_login(const char *db_path, int type, const char *user,
-	     uint64_t usec_login, const char *tty, const char *rhost,
-	     const char *service, char **error)
+void
+sqlite_cursor_close (struct sqlite_cursor *c)
 {
-  sqlite3 *db;
-  int64_t id;
-  int r;
-
-  r = open_database_rw(db_path, &db, error);
-  if (r < 0)
-    return r;
-
-  id = add_entry(db, type, user, usec_login, tty, rhost, service, error);
+  if (c == NULL)
+    return;
+  sqlite3_finalize (c->res);
+  sqlite3_close (c->db);
+  free (c->sql);
+  free (c->db_path);
+  free (c->parts);
+  free (c);
+}
 
-  sqlite3_close(db);
+static int
+is_archive_suffix (const char *s)
+{
+  return strcmp (s, ".db") == 0 || strcmp (s, ".db" COMPRESS_SUFFIX) == 0;
+}
 
-  return id;
+/* Returns the date of the archive name <prefix>_YYYYMMDD[-HHMMSS].db[.z],
+   NULL if name is none. */
+static const char *
+archive_date (const char *name, const char *prefix, size_t prefix_len)
+{
+  const char *date = name + prefix_len + 1;
+
+  if (strncmp (name, prefix, prefix_len) != 0 || name[prefix_len] != '_' ||
+      strspn (date, "0123456789") != 8)
+    return NULL;
+  if (is_archive_suffix (date + 8) ||
+      (date[8] == '-' && strspn (date + 9, "0123456789") == 6 &&
+       is_archive_suffix (date + 15)))
+    return date;
+  return NULL;
 }
 
-/* Updates logout field.
-   logout timestamp is in usec.
-   Returns 0 on success, < 0 on failure. */
 static int
-update_logout (sqlite3 *db, int64_t id, uint64_t usec_logout, char **error)
+cmp_name_desc (const struct dirent **a, const struct dirent **b)
 {
-  sqlite3_stmt *res;
-  char *sql = "UPDATE wtmp SET Logout = ? WHERE ID = ?";
+  return strcmp ((*b)->d_name, (*a)->d_name);
+}
 
-  if (sqlite3_prepare_v2 (db, sql, -1, &res, 0) != SQLITE_OK)
+/* Returns the number of archives of db_path and stores their paths in
+   *paths, newest first, or < 0 on failure. */
+static int
+list_archives (const char *db_path, char ***paths, char **error)
+{
+  char *dir = strdup (db_path);
+  char *file = strdup (db_path);
+  struct dirent **list = NULL;
+  char **found = NULL;
+  const char *dname, *prefix;
+  int n, count = 0, r = 0;
+
+  *paths = NULL;
+  if (dir == NULL || file == NULL)
     {
+      free (dir);
+      free (file);
       if (error)
-        if (asprintf (error, "Failed to prepare statement (update_logout): %s",
-                      sqlite3_errmsg (db)) < 0)
-          *error = strdup ("update_logout: Out of memory");
-
-      return -1;
+	*error = strdup ("list_archives: Out of memory");
+      return -ENOMEM;
     }
+  strip_extension (file);
+  prefix = basename (file);
+  dname = dirname (dir);
 
-  if (sqlite3_bind_int64 (res, 1, usec_logout) != SQLITE_OK)
+  n = scandir (dname, &list, NULL, cmp_name_desc);
+  if (n < 0)
     {
+      r = -errno;
       if (error)
-        if (asprintf (error, "Failed to create update query (logout): %s",
-                      sqlite3_errmsg (db)) < 0)
-          *error = strdup("update_logout: Out of memory");
-
-      sqlite3_finalize(res);
-      return -1;
+	if (asprintf (error, "Cannot read directory %s: %s", dname,
+		      strerror (-r)) < 0)
+	  *error = strdup ("list_archives: Out of memory");
+      n = 0;
     }
+  else if (n > 0 && (found = calloc (n, sizeof (char *))) == NULL)
+    r = -ENOMEM;
 
-  if (sqlite3_bind_int64 (res, 2, id) != SQLITE_OK)
+  for (int i = 0; i < n; i++)
     {
-      if (error)
-        if (asprintf (error, "Failed to create update query (ID): %s",
-                      sqlite3_errmsg (db)) < 0)
-          *error = strdup("update_logout: Out of memory");
+      if (r == 0 && archive_date (list[i]->d_name, prefix,
+				  strlen (prefix)) != NULL &&
+	  asprintf (&found[count++], "%s/%s", dname, list[i]->d_name) < 0)
+	{
+	  found[--count] = NULL;
+	  r = -ENOMEM;
+	}
+      free (list[i]);
+    }
+  free (list);
+  free (dir);
+  free (file);
 
-      sqlite3_finalize(res);
-      return -1;
+  if (r < 0)
+    {
+      if (r == -ENOMEM && error)
+	*error = strdup ("list_archives: Out of memory");
+      for (int i = 0; i < count; i++)
+	free (found[i]);
+      free (found);
+      return r;
     }
+  *paths = found;
+  return count;
+}
 
-  int step = sqlite3_step (res);
+/* Returns 1 if the filter of the archive path rules out an entry
+   matching m, 0 if it may contain one or has no filter. */
+static int
+filter_rules_out (const char *path, const struct wtmpdb_match *m)
+{
+  char *filter = bloom_path (path);
+  struct bloom *b;
+  int r;
 
-  if (step != SQLITE_DONE)
-    {
-      if (error)
-        if (asprintf (error, "Updating logout time failed: %s",
-                      sqlite3_errstr(step)) < 0)
-          *error = strdup("update_logout: Out of memory");
+  b = filter ? bloom_read (filter) : NULL;
+  free (filter);
+  if (b == NULL)
+    return 0;
 
-      sqlite3_finalize(res);
-      return -1;
-    }
+  r = (m->user && !bloom_maybe (b, BLOOM_USER, m->user)) ||
+    (m->rhost && !bloom_maybe (b, BLOOM_RHOST, m->rhost)) ||
+    (m->tty && !bloom_maybe (b, BLOOM_TTY, m->tty));
+  bloom_free (b);
+  return r;
+}
 
-  int changes;
-  if ((changes = sqlite3_changes (db)) != 1)
+/* Calls cb_func for the entries of the database file path matching m,
+   unless its filter rules out a match.
+   Returns 0 on success, <0 on failure. */
+static int
+read_match_file (const char *db_path, const struct wtmpdb_match *m,
+		 int (*cb_func)(void *unused, int argc, char **argv,
+				char **azColName),
+		 void *userdata, char **error)
+{
+  sqlite3 *db;
+  sqlite3_stmt *res;
+  int r;
+
+  if (filter_rules_out (db_path, m))
+    return 0;
+
+  r = open_database_ro (db_path, &db, error);
+  if (r != 0)
+    return -EIO;
+
+  if (sqlite3_prepare_v2 (db, "SELECT * FROM wtmp WHERE "
+			  "(?1 IS NULL OR User = ?1) AND "
+			  "(?2 IS NULL OR RemoteHost = ?2) AND "
+			  "(?3 IS NULL OR TTY = ?3) "
+			  "ORDER BY Login DESC, Logout ASC", -1,
+			  &res, 0) != SQLITE_OK)
     {
       if (error)
-        if (asprintf (error, "Update of logout time changed wrong number of rows, expected 1, got %d",
-                      changes) < 0)
-          *error = strdup("update_logout: Out of memory");
-
-      sqlite3_finalize(res);
-      return -1;
+	if (asprintf (error, "Failed to prepare statement (sqlite_read_match): %s",
+		      sqlite3_errmsg (db)) < 0)
+	  *error = strdup ("sqlite_read_match: Out of memory");
+      sqlite3_close (db);
+      return -EIO;
     }
+  sqlite3_bind_text (res, 1, m->user, -1, SQLITE_STATIC);
+  sqlite3_bind_text (res, 2, m->rhost, -1, SQLITE_STATIC);
+  sqlite3_bind_text (res, 3, m->tty, -1, SQLITE_STATIC);
+
+  while ((r = sqlite3_step (res)) == SQLITE_ROW)
+    if (exec_row (res, cb_func, userdata) != 0)
+      {
+	r = SQLITE_ABORT;
+	break;
+      }
+  if (r != SQLITE_DONE && error)
+    if (asprintf (error, "sqlite_read_match: SQL error: %s",
+		  r == SQLITE_ABORT ? "query aborted" : sqlite3_errstr (r)) < 0)
+      *error = strdup ("sqlite_read_match: Out of memory");
 
   sqlite3_finalize (res);
+  sqlite3_close (db);
+  return r == SQLITE_DONE ? 0 : -EIO;
+}
 
-  return 0;
+/* The IDs of the entries passed to cb_func so far. rotate_swap keeps
+   the open sessions and the last boot with their IDs, so they are in
+   the archive, too, and get skipped there. */
+struct match_seen {
+  int (*cb_func)(void *unused, int argc, char **argv, char **azColName);
+  void *userdata;
+  int64_t *ids;
+  size_t n, size;
+  size_t sorted;	/* the IDs of the files read before */
+  int failed;
+};
+
+static int
+cmp_id (const void *a, const void *b)
+{
+  int64_t ia = *(const int64_t *)a;
+  int64_t ib = *(const int64_t *)b;
+
+  return (ia > ib) - (ia < ib);
 }
 
+static int
+match_seen_cb (void *data, int argc, char **argv, char **azColName)
+{
+  struct match_seen *s = data;
+  int64_t id = strtoll (argv[0] ? argv[0] : "0", NULL, 10);
+
+  if (bsearch (&id, s->ids, s->sorted, sizeof (int64_t), cmp_id) != NULL)
+    return 0;
+  if (s->n == s->size)
+    {
+      int64_t *tmp = realloc (s->ids, (s->size + 256) * sizeof (int64_t));
 
-/*
-  Add logout timestamp to existingentry.
-  logout timestamp is in usec.
-  ID is the return value of wtmpdb_login/logwtmpdb.
-  Returns 0 on success, < 0 on failure.
- */
+      if (tmp == NULL)
+	{
+	  s->failed = 1;
+	  return 1;
+	}
+      s->ids = tmp;
+      s->size += 256;
+    }
+  s->ids[s->n++] = id;
+  return s->cb_func (s->userdata, argc, argv, azColName);
+}
+
+/* Calls cb_func for all entries matching m, newest first: those of
+   db_path, then those of the archives rotated out of it. Archives and
+   partitions whose filter rules out a match are not opened.
+   Returns 0 on success, <0 on failure. */
 int
-sqlite_logout (const char *db_path, int64_t id, uint64_t usec_logout,
-	       char **error)
+sqlite_read_match (const char *db_path, const struct wtmpdb_match *m,
+		   int (*cb_func)(void *unused, int argc, char **argv,
+				  char **azColName),
+		   void *userdata, char **error)
 {
-  sqlite3 *db;
-  int r;
+  struct match_seen seen = { .cb_func = cb_func, .userdata = userdata };
+  char **archives = NULL;
+  int n = 0, r;
 
-  r = open_database_rw (db_path, &db, error);
-  if (r < 0)
-    return r;
+  if (is_partitioned (db_path))
+    {
+      int *parts;
 
-  r = update_logout(db, id, usec_logout, error);
+      n = list_partitions (db_path, &parts, error);
+      r = n < 0 ? n : 0;
+      for (int i = 0; i < n && r == 0; i++)
+	{
+	  char *part_path = partition_path (db_path, parts[i]);
+
+	  if (part_path == NULL)
+	    {
+	      if (error)
+		*error = strdup ("sqlite_read_match: Out of memory");
+	      r = -ENOMEM;
+	    }
+	  else
+	    r = read_match_file (part_path, m, cb_func, userdata, error);
+	  free (part_path);
+	}
+      free (parts);
+      return r;
+    }
 
-  sqlite3_close (db);
+  if (!is_archive (db_path))
+    {
+      n = list_archives (db_path, &archives, error);
+      if (n < 0)
+	return n;
+    }
+  if (n == 0)
+    return read_match_file (db_path, m, cb_func, userdata, error);
 
+  r = read_match_file (db_path, m, match_seen_cb, &seen, error);
+  for (int i = 0; i < n; i++)
+    {
+      if (r == 0)
+	{
+	  qsort (seen.ids, seen.n, sizeof (int64_t), cmp_id);
+	  seen.sorted = seen.n;
+	  r = read_match_file (archives[i], m, match_seen_cb, &seen, error);
+	}
+      free (archives[i]);
+    }
+  free (archives);
+  free (seen.ids);
+  if (seen.failed)
+    {
+      if (error)
+	{
+	  free (*error);
+	  *error = strdup ("sqlite_read_match: Out of memory");
+	}
+      r = -ENOMEM;
+    }
   return r;
 }
 
-static int64_t
-search_id (sqlite3 *db, const char *tty, char **error)
+/* The newest login of user. Until migration 6 is done, wtmp_lastlog
+   may be incomplete and wtmp gets searched.
+   Returns 0 if found, -ENOENT if not, other <0 values on failure. */
+static int
+search_last_login (sqlite3 *db, const char *user,
+		   int (*cb_func)(void *unused, int argc, char **argv,
+				  char **azColName),
+		   void *userdata, char **error)
 {
-  int64_t id = -1;
   sqlite3_stmt *res;
-  char *sql = "SELECT ID FROM wtmp WHERE TTY = ? AND Logout IS NULL ORDER BY Login DESC LIMIT 1";
+  int64_t version = 0;
+  int r;
 
-  if (sqlite3_prepare_v2 (db, sql, -1, &res, 0) != SQLITE_OK)
+  sql_int64 (db, "PRAGMA user_version", 0, 0, &version, NULL);
+  if (sqlite3_prepare_v2 (db, version >= 6 ?
+			  "SELECT wtmp.* FROM wtmp_lastlog JOIN wtmp USING (ID) "
+			  "WHERE wtmp_lastlog.User = ?1" :
+			  "SELECT * FROM wtmp WHERE User = ?1 AND Type = "
+			  STR(USER_PROCESS) " ORDER BY Login DESC LIMIT 1",
+			  -1, &res, 0) != SQLITE_OK)
     {
-      int r = -ENOTSUP;
       if (error)
-        if (asprintf (error, "Failed to prepare statement (search_id): %s",
-                      sqlite3_errmsg (db)) < 0)
-	  {
-	    r = -ENOMEM;
-	    *error = strdup ("search_id: Out of memory");
-	  }
-      return r;
+	if (asprintf (error, "Failed to prepare statement (search_last_login): %s",
+		      sqlite3_errmsg (db)) < 0)
+	  *error = strdup ("search_last_login: Out of memory");
+      return -EIO;
     }
+  sqlite3_bind_text (res, 1, user, -1, SQLITE_STATIC);
 
-  if (sqlite3_bind_text (res, 1, tty, -1, SQLITE_STATIC) != SQLITE_OK)
+  r = sqlite3_step (res);
+  if (r == SQLITE_ROW)
     {
-      int r = -EPROTO;
-      if (error)
-        if (asprintf (error, "Failed to create search query 'tty': %s",
-                      sqlite3_errmsg (db)) < 0)
-	  {
-	    r = -ENOMEM;
-	    *error = strdup("search_id: Out of memory");
-	  }
-
-      sqlite3_finalize(res);
-      return r;
+      exec_row (res, cb_func, userdata);
+      r = 0;
     }
-
-  int step = sqlite3_step (res);
-
-  if (step == SQLITE_ROW)
-    id = sqlite3_column_int64 (res, 0);
-  else if (step == SQLITE_DONE)
+  else if (r == SQLITE_DONE)
     {
-      id = -ENOENT;
       if (error)
-        if (asprintf (error, "Open entry for tty '%s' not found (search_id)", tty) < 0)
-	  {
-	    *error = strdup("search_id: Out of memory");
-	    id = -ENOMEM;
-	  }
+	if (asprintf (error, "No login of '%s' found", user) < 0)
+	  *error = strdup ("search_last_login: Out of memory");
+      r = -ENOENT;
     }
   else
     {
-      id = -ENOENT;
       if (error)
-        if (asprintf (error, "Error searching open entry for tty '%s': %s",
-		      tty, sqlite3_errstr(step)) < 0)
-	  {
-	    *error = strdup("search_id: Out of memory");
-	    id = -ENOMEM;
-	  }
+	if (asprintf (error, "search_last_login: SQL error: %s",
+		      sqlite3_errstr (r)) < 0)
+	  *error = strdup ("search_last_login: Out of memory");
+      r = -EIO;
     }
 
   sqlite3_finalize (res);
+  return r;
+}
 
-  return id;
+/* The newest login of user in the archives of db_path, which
+   rotate_swap left without the closed sessions. Archives whose filter
+   rules out user are not opened, damaged ones are skipped.
+   Returns 0 if found, -ENOENT if not. */
+static int
+archived_last_login (const char *db_path, const char *user,
+		     int (*cb_func)(void *unused, int argc, char **argv,
+				    char **azColName),
+		     void *userdata)
+{
+  const struct wtmpdb_match m = { .user = user };
+  char **archives;
+  int n, r = -ENOENT;
+
+  n = list_archives (db_path, &archives, NULL);
+  for (int i = 0; i < n; i++)
+    {
+      sqlite3 *db;
+
+      /* newest archive first */
+      if (r != 0 && !filter_rules_out (archives[i], &m) &&
+	  open_database_ro (archives[i], &db, NULL) == 0)
+	{
+	  if (search_last_login (db, user, cb_func, userdata, NULL) == 0)
+	    r = 0;
+	  sqlite3_close (db);
+	}
+      free (archives[i]);
+    }
+  if (n > 0)
+    free (archives);
+  return r;
 }
 
-int64_t
-sqlite_get_id (const char *db_path, const char *tty, char **error)
+int
+sqlite_get_last_login (const char *db_path, const char *user,
+		       int (*cb_func)(void *unused, int argc, char **argv,
+				      char **azColName),
+		       void *userdata, char **error)
 {
   sqlite3 *db;
-  int64_t retval;
   int r;
 
+  if (is_partitioned (db_path))
+    {
+      int *parts;
+      int n = list_partitions (db_path, &parts, error);
+
+      if (n < 0)
+	return n;
+
+      /* newest partition first */
+      r = -ENOENT;
+      for (int i = 0; i < n && r == -ENOENT; i++)
+	{
+	  char *part_path = partition_path (db_path, parts[i]);
+
+	  if (error)
+	    *error = mfree (*error);
+	  if (part_path == NULL)
+	    {
+	      if (error)
+		*error = strdup ("sqlite_get_last_login: Out of memory");
+	      r = -ENOMEM;
+	    }
+	  else
+	    {
+	      r = open_database_ro (part_path, &db, error);
+	      free (part_path);
+	      if (r != 0)
+		r = -r;
+	      else
+		{
+		  r = search_last_login (db, user, cb_func, userdata, error);
+		  sqlite3_close (db);
+		}
+	    }
+	}
+      free (parts);
+      if (r == -ENOENT && n == 0 && error)
+	if (asprintf (error, "No login of '%s' found", user) < 0)
+	  *error = strdup ("sqlite_get_last_login: Out of memory");
+      return r;
+    }
+
   r = open_database_ro (db_path, &db, error);
   if (r != 0)
     return -r;
 
-  retval = search_id (db, tty, error);
+  r = search_last_login (db, user, cb_func, userdata, error);
 
   sqlite3_close (db);
 
-  return retval;
+  if (r == -ENOENT && !is_archive (db_path) &&
+      archived_last_login (db_path, user, cb_func, userdata) == 0)
+    {
+      if (error)
+	*error = mfree (*error);
+      r = 0;
+    }
+  return r;
 }
 
-/* Reads all entries from database and calls the callback function for
-   each entry.
-   Returns 0 on success, -1 on failure. */
+/* Reads the change counter, the highest ID and all entries which were
+   added after watermark (all entries if watermark is < 0) plus the
+   entries listed in ids, all in one read transaction.
+   Returns 0 on success, -ENOENT if the database has no change counter
+   yet, other <0 values on failure. */
 int
-sqlite_read_all (const char *db_path, int uniq,
-		 int (*cb_func)(void *unused, int argc, char **argv,
-				char **azColName),
-		 void *userdata, char **error)
+sqlite_read_delta (const char *db_path, int64_t watermark,
+		   const int64_t *ids, size_t n_ids,
+		   uint64_t *counter, int64_t *max_id,
+		   int (*cb_func)(void *unused, int argc, char **argv,
+				  char **azColName),
+		   void *userdata, char **error)
 {
   sqlite3 *db;
-  char *err_msg = 0;
+  sqlite3_stmt *res = NULL;
+  const char *what = "begin";
   int r;
 
   r = open_database_ro (db_path, &db, error);
   if (r != 0)
     return -r;
 
-  char *sql = uniq
-	? "SELECT ID, Type, User, Login, Logout, TTY, RemoteHost, Service FROM ("
-		"SELECT *,ROW_NUMBER() OVER (PARTITION BY User ORDER BY Login DESC) AS rn "
-		"FROM wtmp WHERE Login IS NOT NULL AND TTY != '~') WHERE rn = 1"
-	: "SELECT * FROM wtmp ORDER BY Login DESC, Logout ASC";
+  if (sqlite3_exec (db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK)
+    goto sql_error;
 
-  r = sqlite3_exec (db, sql, cb_func, userdata, &err_msg);
-  sqlite3_close (db);
-  if (r != SQLITE_OK)
+  what = "counter";
+  if (sqlite3_prepare_v2 (db, "SELECT (SELECT Counter FROM wtmp_changes WHERE ID = 0), "
+			  "(SELECT MAX(ID) FROM wtmp)", -1, &res, 0) != SQLITE_OK)
     {
+      /* database was never opened read-write by this version */
+      sqlite3_close (db);
       if (error)
-        if (asprintf (error, "sqlite_read_all: SQL error: %s", err_msg) < 0)
-          *error = strdup ("sqlite_read_all: Out of memory");
+	if (asprintf (error, "Database %s has no change counter", db_path) < 0)
+	  *error = strdup ("sqlite_read_delta: Out of memory");
+      return -ENOENT;
+    }
+  if (sqlite3_step (res) != SQLITE_ROW)
+    goto sql_error;
+  *counter = (uint64_t)sqlite3_column_int64 (res, 0);
+  *max_id = sqlite3_column_type (res, 1) == SQLITE_NULL ?
+    -1 : sqlite3_column_int64 (res, 1);
+  sqlite3_finalize (res);
+  res = NULL;
+
+  what = "entries";
+  if (sqlite3_prepare_v2 (db, "SELECT * FROM wtmp WHERE ID > ?", -1,
+			  &res, 0) != SQLITE_OK ||
+      sqlite3_bind_int64 (res, 1, watermark) != SQLITE_OK)
+    goto sql_error;
+  while ((r = sqlite3_step (res)) == SQLITE_ROW)
+    if (exec_row (res, cb_func, userdata) != 0)
+      goto aborted;
+  if (r != SQLITE_DONE)
+    goto sql_error;
+  sqlite3_finalize (res);
+  res = NULL;
 
-      sqlite3_free (err_msg);
-      return -r;
+  if (n_ids > 0)
+    {
+      what = "refresh";
+      if (sqlite3_prepare_v2 (db, "SELECT * FROM wtmp WHERE ID = ?", -1,
+			      &res, 0) != SQLITE_OK)
+	goto sql_error;
+      for (size_t i = 0; i < n_ids; i++)
+	{
+	  if (ids[i] > watermark)
+	    continue; /* already reported above */
+	  sqlite3_reset (res);
+	  if (sqlite3_bind_int64 (res, 1, ids[i]) != SQLITE_OK)
+	    goto sql_error;
+	  r = sqlite3_step (res);
+	  if (r == SQLITE_ROW)
+	    {
+	      if (exec_row (res, cb_func, userdata) != 0)
+		goto aborted;
+	    }
+	  else if (r != SQLITE_DONE)
+	    goto sql_error;
+	}
+      sqlite3_finalize (res);
+      res = NULL;
     }
 
+  sqlite3_exec (db, "COMMIT", NULL, NULL, NULL);
+  sqlite3_close (db);
   return 0;
+
+ aborted:
+  sqlite3_finalize (res);
+  sqlite3_close (db);
+  if (error)
+    *error = strdup ("sqlite_read_delta: query aborted");
+  return -SQLITE_ABORT;
+
+ sql_error:
+  if (error)
+    if (asprintf (error, "sqlite_read_delta (%s): SQL error: %s",
+		  what, sqlite3_errmsg (db)) < 0)
+      *error = strdup ("sqlite_read_delta: Out of memory");
+  sqlite3_finalize (res);
+  sqlite3_close (db);
+  return -EIO;
 }
 
 static int
@@ -508,7 +2876,7 @@ export_row (sqlite3 *db_dest, sqlite3_stmt *sqlStatement, char **error)
     fprintf (stderr, "export_row: Invalid numeric time entry for 'login': '%s'\n",
 	     sqlite3_column_text( sqlStatement, 5 ));
 
-  int64_t id = add_entry (db_dest, type, user, login_t, tty, host,
+  int64_t id = add_entry (db_dest, 0, type, user, login_t, tty, host,
 			  service, error);
   if (id >=0)
     {
@@ -531,19 +2899,338 @@ export_row (sqlite3 *db_dest, sqlite3_stmt *sqlStatement, char **error)
     }
   else
     {
-       fprintf (stderr, "export_row: Cannot insert DB value: '%s'\n", *error);
-       return -1;
+       fprintf (stderr, "export_row: Cannot insert DB value: '%s'\n", *error);
+       return -1;
+    }
+
+  return 0;
+}
+
+/* Removes a database file and its journals.
+   Returns 0 on success, <0 on failure. */
+static int
+remove_database (const char *path, char **error)
+{
+  static const char *suffix[] = {"-journal", "-wal", "-shm"};
+
+  if (unlink (path) < 0)
+    {
+      int r = -errno;
+      if (error)
+	if (asprintf (error, "Cannot remove %s: %s", path, strerror (-r)) < 0)
+	  *error = strdup ("remove_database: Out of memory");
+      return r;
+    }
+
+  for (size_t i = 0; i < sizeof (suffix) / sizeof (suffix[0]); i++)
+    {
+      char *journal;
+
+      if (asprintf (&journal, "%s%s", path, suffix[i]) >= 0)
+	{
+	  unlink (journal);
+	  free (journal);
+	}
+    }
+
+  char *filter = bloom_path (path);
+  if (filter)
+    unlink (filter);
+  free (filter);
+  return 0;
+}
+
+/* The distinct users, hosts and TTYs of a database */
+#define FILTER_VALUES "SELECT 'u', User FROM wtmp UNION " \
+  "SELECT 'h', RemoteHost FROM wtmp WHERE RemoteHost IS NOT NULL UNION " \
+  "SELECT 't', TTY FROM wtmp WHERE TTY IS NOT NULL"
+
+/* Writes the Bloom filter of the users, hosts and TTYs of the archive
+   path, so readers searching for a value can skip it (see bloom.h).
+   Returns 0 on success, <0 on failure. */
+static int
+write_filter (const char *path, char **error)
+{
+  struct bloom *b = NULL;
+  sqlite3_stmt *res = NULL;
+  char *filter = NULL;
+  sqlite3 *db;
+  int r;
+
+  r = open_database_ro (path, &db, error);
+  if (r != 0)
+    return -EIO;
+
+  r = -EIO;
+  if (sqlite3_prepare_v2 (db, "SELECT COUNT(*) FROM (" FILTER_VALUES ")",
+			  -1, &res, 0) != SQLITE_OK ||
+      sqlite3_step (res) != SQLITE_ROW)
+    goto out;
+  b = bloom_new ((size_t)sqlite3_column_int64 (res, 0));
+  filter = bloom_path (path);
+  if (b == NULL || filter == NULL)
+    {
+      r = -ENOMEM;
+      goto out;
+    }
+  sqlite3_finalize (res);
+
+  if (sqlite3_prepare_v2 (db, FILTER_VALUES, -1, &res, 0) != SQLITE_OK)
+    goto out;
+  while ((r = sqlite3_step (res)) == SQLITE_ROW)
+    bloom_add (b, *(const char *)sqlite3_column_text (res, 0),
+	       (const char *)sqlite3_column_text (res, 1));
+  if (r != SQLITE_DONE)
+    {
+      r = -EIO;
+      goto out;
+    }
+  r = bloom_write (b, filter);
+
+ out:
+  if (r < 0 && error)
+    {
+      if (r == -EIO)
+	{
+	  if (asprintf (error, "Cannot create filter of %s: %s", path,
+			sqlite3_errmsg (db)) < 0)
+	    *error = strdup ("write_filter: Out of memory");
+	}
+      else if (r == -ENOMEM)
+	*error = strdup ("write_filter: Out of memory");
+      else if (asprintf (error, "Cannot write filter %s: %s", filter,
+			 strerror (-r)) < 0)
+	*error = strdup ("write_filter: Out of memory");
+    }
+  sqlite3_finalize (res);
+  sqlite3_close (db);
+  bloom_free (b);
+  free (filter);
+  return r;
+}
+
+/* Switches the database of db from WAL back to a rollback journal,
+   which copies the WAL into the database file and removes it. Archives
+   and backups are single files this way. This needs the only
+   connection to the database, SQLite doesn't call the busy handler for
+   it, so it is retried until the busy timeout is reached.
+   Returns 0 on success, <0 on failure. */
+static int
+set_rollback_mode (sqlite3 *db, const char *path, char **error)
+{
+  uint64_t deadline = monotonic_usec () + busy_timeout;
+  sqlite3_stmt *res;
+  int persist = 0;
+  int r = -EBUSY;
+
+  /* no WAL and WAL index files are left behind */
+  sqlite3_file_control (db, "main", SQLITE_FCNTL_PERSIST_WAL, &persist);
+  while (sqlite3_prepare_v2 (db, "PRAGMA journal_mode = DELETE", -1, &res,
+			     0) == SQLITE_OK)
+    {
+      if (sqlite3_step (res) == SQLITE_ROW &&
+	  strcmp ((const char *)sqlite3_column_text (res, 0), "delete") == 0)
+	r = 0;
+      sqlite3_finalize (res);
+      if (r == 0 || sqlite3_errcode (db) != SQLITE_BUSY ||
+	  monotonic_usec () >= deadline)
+	break;
+      usleep (BUSY_MIN_USEC);
+    }
+  if (r < 0 && error)
+    if (asprintf (error, "Cannot switch %s to a rollback journal: %s", path,
+		  sqlite3_errmsg (db)) < 0)
+      *error = strdup ("set_rollback_mode: Out of memory");
+  return r;
+}
+
+/* Marks path as archive, see is_archive.
+   Returns 0 on success, <0 on failure. */
+static int
+mark_archive (const char *path, char **error)
+{
+  sqlite3 *db;
+  int r;
+
+  r = open_database_rw (path, &db, error);
+  if (r < 0)
+    return r;
+  if (sqlite3_exec (db, "PRAGMA application_id = " STR(ARCHIVE_APPLICATION_ID),
+		    NULL, NULL, NULL) != SQLITE_OK)
+    {
+      if (error)
+	if (asprintf (error, "Cannot mark %s as archive: %s", path,
+		      sqlite3_errmsg (db)) < 0)
+	  *error = strdup ("sqlite_rotate: Out of memory");
+      r = -EIO;
+    }
+  /* archives are opened immutable, which ignores a WAL */
+  if (r == 0)
+    r = set_rollback_mode (db, path, error);
+  sqlite3_close (db);
+  return r;
+}
+
+/* Writes the compressed archive path.z of path and removes path.
+   Returns 0 on success, <0 on failure. */
+static int
+compress_archive (const char *path, char **error)
+{
+  sqlite3 *db;
+  char *zpath;
+  int r;
+
+  if (asprintf (&zpath, "%s" COMPRESS_SUFFIX, path) < 0)
+    {
+      if (error)
+	*error = strdup ("sqlite_rotate: Out of memory");
+      return -ENOMEM;
+    }
+  /* don't replace an archive written by an earlier run */
+  if (access (zpath, F_OK) == 0)
+    {
+      if (error)
+	if (asprintf (error, "Compressed archive %s exists already, "
+		      "%s is kept uncompressed", zpath, path) < 0)
+	  *error = strdup ("sqlite_rotate: Out of memory");
+      free (zpath);
+      return -EEXIST;
+    }
+
+  /* the compressed file must be complete without the WAL */
+  r = open_database_rw (path, &db, error);
+  if (r == 0)
+    {
+      r = set_rollback_mode (db, path, error);
+      sqlite3_close (db);
+    }
+  if (r == 0)
+    r = compress_database (path, zpath, error);
+  if (r == 0)
+    r = remove_database (path, error);
+  free (zpath);
+  return r;
+}
+
+/* Removes the partitions of all months which ended before the
+   threshold and all but the newest keep partitions, if keep > 0.
+   With compress, the expired partitions get compressed instead of
+   removed. Nothing is archived, so wtmpdb_name is not set.
+   Returns 0 on success, <0 on failure. */
+static int
+rotate_partitions (const char *db_path, const int days, const int keep_parts,
+		   int compress, uint64_t *entries, char **error)
+{
+  struct timespec threshold;
+  uint64_t counter = 0;
+  int *parts;
+  int keep, n, r = 0;
+
+  clock_gettime (CLOCK_REALTIME, &threshold);
+  threshold.tv_sec -= days * 86400;
+  keep = usec2partition (wtmpdb_timespec2usec (threshold));
+
+  n = list_partitions (db_path, &parts, error);
+  if (n < 0)
+    return n;
+
+  for (int i = 0; i < n && r == 0; i++)
+    {
+      char *part_path;
+      sqlite3 *db;
+      sqlite3_stmt *res;
+      int zip;
+
+      if (parts[i] >= keep && (keep_parts <= 0 || i < keep_parts))
+	continue;
+
+      part_path = partition_path (db_path, parts[i]);
+      if (part_path == NULL)
+	{
+	  if (error)
+	    *error = strdup ("sqlite_rotate: Out of memory");
+	  r = -ENOMEM;
+	  break;
+	}
+      /* beyond keep_parts partitions get removed in any case */
+      zip = compress && (keep_parts <= 0 || i < keep_parts);
+      if (zip && is_compressed (part_path))
+	{
+	  free (part_path);
+	  continue;
+	}
+
+      /* only for the statistics, a damaged partition gets removed, too */
+      if (open_database_ro (part_path, &db, NULL) == 0)
+	{
+	  if (sqlite3_prepare_v2 (db, "SELECT COUNT(*) FROM wtmp", -1,
+				  &res, 0) == SQLITE_OK)
+	    {
+	      if (sqlite3_step (res) == SQLITE_ROW)
+		counter += (uint64_t)sqlite3_column_int64 (res, 0);
+	      sqlite3_finalize (res);
+	    }
+	  sqlite3_close (db);
+	}
+
+      if (zip)
+	r = compress_archive (part_path, error);
+      else
+	r = remove_database (part_path, error);
+      free (part_path);
+    }
+  free (parts);
+
+  /* Partitions of past months only get logouts, which don't change
+     the filter. A missing filter only means the partition is always
+     read, so errors are ignored. */
+  n = r == 0 ? list_partitions (db_path, &parts, NULL) : 0;
+  for (int i = 0; i < n; i++)
+    {
+      char *part_path, *filter;
+
+      if (parts[i] >= usec2partition ((uint64_t)time (NULL) * USEC_PER_SEC))
+	continue;
+      part_path = partition_path (db_path, parts[i]);
+      filter = part_path ? bloom_path (part_path) : NULL;
+      if (filter && access (filter, F_OK) < 0)
+	write_filter (part_path, NULL);
+      free (filter);
+      free (part_path);
+    }
+  if (n > 0)
+    free (parts);
+
+  if (entries)
+    *entries = counter;
+  return r;
+}
+
+/* Returns the name of the archive <dir>/<name>_<date>.db of db_path. */
+static char *
+archive_path (const char *db_path, const char *date)
+{
+  char *dir = strdup (db_path);
+  char *file = strdup (db_path);
+  char *path = NULL;
+
+  if (dir && file)
+    {
+      strip_extension (file);
+      if (asprintf (&path, "%s/%s_%s.db", dirname (dir), basename (file),
+		    date) < 0)
+	path = NULL;
     }
-
-  return 0;
+  free (dir);
+  free (file);
+  return path;
 }
 
-/* Reads all entries from database and calls the callback function for
-   each entry.
+/* Moves all entries older than days to an archive database.
    Returns 0 on success, <0 on failure. */
-int
-sqlite_rotate(const char *db_path, const int days, char **wtmpdb_name,
-	      uint64_t *entries, char **error)
+static int
+rotate_copy (const char *db_path, const int days, char **wtmpdb_name,
+	     uint64_t *entries, char **error)
 {
   sqlite3 *db_src;
   sqlite3 *db_dest;
@@ -551,17 +3238,15 @@ sqlite_rotate(const char *db_path, const int days, char **wtmpdb_name,
   struct timespec threshold;
   clock_gettime (CLOCK_REALTIME, &threshold);
   threshold.tv_sec -= days * 86400;
-  struct tm *tm = localtime (&threshold.tv_sec);
+  struct tm tm;
+  localtime_r (&threshold.tv_sec, &tm);
   uint64_t login_t = wtmpdb_timespec2usec (threshold);
   char date[10];
-  strftime (date, 10, "%Y%m%d", tm);
-  char *dest_path = NULL;
-  char *dest_file = strdup(db_path);
+  strftime (date, 10, "%Y%m%d", &tm);
+  char *dest_path = archive_path (db_path, date);
   int r;
 
-  strip_extension(dest_file);
-
-  if (asprintf (&dest_path, "%s/%s_%s.db", dirname(dest_file), basename(dest_file), date) < 0)
+  if (dest_path == NULL)
     {
       *error = strdup ("sqlite_rotate: Out of memory");
       return -ENOMEM;
@@ -571,7 +3256,6 @@ sqlite_rotate(const char *db_path, const int days, char **wtmpdb_name,
   if (r < 0)
     {
       free(dest_path);
-      free(dest_file);
       return r;
     }
 
@@ -579,7 +3263,6 @@ sqlite_rotate(const char *db_path, const int days, char **wtmpdb_name,
   if (r < 0)
     {
       free(dest_path);
-      free(dest_file);
       sqlite3_close (db_dest);
       return r;
     }
@@ -596,7 +3279,6 @@ sqlite_rotate(const char *db_path, const int days, char **wtmpdb_name,
       sqlite3_close (db_src);
       sqlite3_close (db_dest);
       free(dest_path);
-      free(dest_file);
       return -1;
     }
 
@@ -611,7 +3293,6 @@ sqlite_rotate(const char *db_path, const int days, char **wtmpdb_name,
       sqlite3_close (db_src);
       sqlite3_close (db_dest);
       free(dest_path);
-      free(dest_file);
       return -1;
     }
 
@@ -629,7 +3310,6 @@ sqlite_rotate(const char *db_path, const int days, char **wtmpdb_name,
       sqlite3_close (db_src);
       sqlite3_close (db_dest);
       free(dest_path);
-      free(dest_file);
       return -1;
     }
 
@@ -646,7 +3326,6 @@ sqlite_rotate(const char *db_path, const int days, char **wtmpdb_name,
       sqlite3_close (db_src);
       sqlite3_close (db_dest);
       free(dest_path);
-      free(dest_file);
       return -1;
     }
 
@@ -661,7 +3340,6 @@ sqlite_rotate(const char *db_path, const int days, char **wtmpdb_name,
       sqlite3_close (db_src);
       sqlite3_close (db_dest);
       free(dest_path);
-      free(dest_file);
       return -1;
     }
 
@@ -678,7 +3356,6 @@ sqlite_rotate(const char *db_path, const int days, char **wtmpdb_name,
       sqlite3_close (db_src);
       sqlite3_close (db_dest);
       free(dest_path);
-      free(dest_file);
       return -1;
     }
 
@@ -697,11 +3374,419 @@ sqlite_rotate(const char *db_path, const int days, char **wtmpdb_name,
     unlink (dest_path);
 
   free(dest_path);
-  free(dest_file);
 
   return 0;
 }
 
+/* Renames db_path to an archive and continues with a new database,
+   which gets the open sessions and the last boot entry with their
+   IDs. Writers are locked out from copying the entries until the new
+   database is in place, so the costs depend on the number of open
+   sessions only. The old database is retired within that transaction,
+   writers which got it anyway see that and reopen db_path (see
+   open_write) instead of writing to the archive.
+   Returns 0 on success, <0 on failure. */
+static int
+rotate_swap (const char *db_path, char **wtmpdb_name, uint64_t *entries,
+	     char **error)
+{
+  sqlite3 *db_src = NULL;
+  sqlite3 *db_dest = NULL;
+  sqlite3_stmt *res = NULL;
+  char *dest_path = NULL;
+  char *new_path = NULL;
+  const char *what = "lock";
+  struct stat st;
+  struct tm tm;
+  time_t now = time (NULL);
+  uint64_t counter = 0;
+  int rollback_mode = 0;
+  int retired = 0;
+  int lock = -1;
+  char date[32];
+  int r;
+
+  localtime_r (&now, &tm);
+  strftime (date, sizeof (date), "%Y%m%d-%H%M%S", &tm);
+  dest_path = archive_path (db_path, date);
+  if (dest_path == NULL || asprintf (&new_path, "%s.new", db_path) < 0)
+    {
+      free (dest_path);
+      if (error)
+	*error = strdup ("sqlite_rotate: Out of memory");
+      return -ENOMEM;
+    }
+
+  /* waits for the writers which have the file open, new ones wait
+     until it was replaced (see open_write) */
+  lock = lock_path (db_path, LOCK_EX);
+  if (lock < -1)
+    {
+      r = lock;
+      if (error)
+	if (asprintf (error, "Cannot lock %s: %s", db_path,
+		      strerror (-r)) < 0)
+	  *error = strdup ("sqlite_rotate: Out of memory");
+      goto out;
+    }
+
+  r = open_database_rw (db_path, &db_src, error);
+  if (r < 0)
+    goto out;
+  if (stat (db_path, &st) < 0)
+    {
+      r = -errno;
+      if (error)
+	if (asprintf (error, "Cannot stat %s: %s", db_path, strerror (-r)) < 0)
+	  *error = strdup ("sqlite_rotate: Out of memory");
+      goto out;
+    }
+
+  /* The WAL and its index are named after the database, they must not
+     stay behind for the new one. Connections which opened the old
+     file before keep working with the rollback journal. */
+  r = set_rollback_mode (db_src, db_path, error);
+  if (r < 0)
+    goto out;
+  rollback_mode = 1;
+
+  /* blocks all writers until the new database is in place */
+  if (sqlite3_exec (db_src, "BEGIN IMMEDIATE", NULL, NULL, NULL) != SQLITE_OK)
+    goto sql_error_src;
+
+  /* the new database must not hand out IDs of the archive again */
+  unlink (new_path);
+  what = "create";
+  r = sqlite3_open_v2 (new_path, &db_dest, SQLITE_OPEN_READWRITE |
+		       SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, NULL);
+  if (r != SQLITE_OK ||
+      sqlite3_exec (db_dest, "CREATE TABLE wtmp(ID INTEGER PRIMARY KEY AUTOINCREMENT, "
+		    WTMP_COLUMNS ") STRICT", NULL, NULL, NULL) != SQLITE_OK ||
+      create_table (db_dest, NULL) != 0)
+    goto sql_error_dest;
+  set_busy_handler (db_dest);
+
+  what = "attach";
+  if (sqlite3_prepare_v2 (db_dest, "ATTACH ? AS live", -1, &res, 0) != SQLITE_OK ||
+      sqlite3_bind_text (res, 1, db_path, -1, SQLITE_STATIC) != SQLITE_OK ||
+      sqlite3_step (res) != SQLITE_DONE)
+    goto sql_error_dest;
+  sqlite3_finalize (res);
+  res = NULL;
+
+  what = "copy";
+  if (sqlite3_exec (db_dest, "BEGIN;"
+		    "INSERT INTO main.wtmp SELECT * FROM live.wtmp "
+		    "WHERE (Type = " STR(USER_PROCESS) " AND Logout IS NULL) OR "
+		    "ID = (SELECT ID FROM live.wtmp WHERE Type = " STR(BOOT_TIME) " "
+		    "ORDER BY Login DESC LIMIT 1);"
+		    "DELETE FROM sqlite_sequence WHERE name = 'wtmp';"
+		    "INSERT INTO sqlite_sequence (name, seq) "
+		    "SELECT 'wtmp', IFNULL(MAX(ID), 0) FROM live.wtmp;"
+		    "INSERT INTO main.wtmp_changes (ID, Counter) "
+		    "SELECT 1, IFNULL(MAX(ID), 0) FROM live.wtmp;"
+		    "COMMIT", NULL, NULL, NULL) != SQLITE_OK)
+    goto sql_error_dest;
+
+  what = "count";
+  if (sqlite3_prepare_v2 (db_dest, "SELECT COUNT(*) FROM live.wtmp", -1,
+			  &res, 0) != SQLITE_OK ||
+      sqlite3_step (res) != SQLITE_ROW)
+    goto sql_error_dest;
+  counter = (uint64_t)sqlite3_column_int64 (res, 0);
+  sqlite3_finalize (res);
+  res = NULL;
+  sqlite3_close (db_dest);
+  db_dest = NULL;
+  if (counter == 0)
+    {
+      r = 0;
+      goto out;
+    }
+
+  /* same owner and permissions as the live database, changing the
+     owner requires privileges */
+  if ((chown (new_path, st.st_uid, st.st_gid) < 0 && geteuid () == 0) ||
+      chmod (new_path, st.st_mode & 07777) < 0)
+    {
+      r = -errno;
+      if (error)
+	if (asprintf (error, "Cannot set permissions of %s: %s", new_path,
+		      strerror (-r)) < 0)
+	  *error = strdup ("sqlite_rotate: Out of memory");
+      goto out;
+    }
+
+  /* writers which get the old file from now on reopen db_path */
+  what = "retire";
+  if (sqlite3_exec (db_src, "PRAGMA application_id = "
+		    STR(RETIRED_APPLICATION_ID) "; COMMIT",
+		    NULL, NULL, NULL) != SQLITE_OK)
+    goto sql_error_src;
+  retired = 1;
+
+  /* the live database never vanishes: link it to the archive, then
+     replace it atomically */
+  if (link (db_path, dest_path) < 0)
+    {
+      r = -errno;
+      if (error)
+	if (asprintf (error, "Cannot create archive %s: %s", dest_path,
+		      strerror (-r)) < 0)
+	  *error = strdup ("sqlite_rotate: Out of memory");
+      goto out;
+    }
+  if (rename (new_path, db_path) < 0)
+    {
+      r = -errno;
+      if (error)
+	if (asprintf (error, "Cannot replace %s: %s", db_path,
+		      strerror (-r)) < 0)
+	  *error = strdup ("sqlite_rotate: Out of memory");
+      unlink (dest_path);
+      goto out;
+    }
+
+  /* The WAL and its index of the new database were removed when
+     db_dest was closed, readers without write access to the directory
+     could not open it until the next login. The first connection via
+     db_path creates them, they persist (see open_database_file). */
+  if (open_database_file (db_path, &db_dest, NULL) == 0)
+    {
+      sqlite3_exec (db_dest, "SELECT 1 FROM sqlite_master", NULL, NULL, NULL);
+      sqlite3_close (db_dest);
+      db_dest = NULL;
+    }
+
+  if (wtmpdb_name)
+    {
+      *wtmpdb_name = dest_path;
+      dest_path = NULL;
+    }
+  if (entries)
+    *entries = counter;
+  r = 0;
+  goto out;
+
+ sql_error_dest:
+  if (error)
+    if (asprintf (error, "sqlite_rotate (%s): SQL error: %s", what,
+		  db_dest ? sqlite3_errmsg (db_dest) : "out of memory") < 0)
+      *error = strdup ("sqlite_rotate: Out of memory");
+  r = -EIO;
+  goto out;
+
+ sql_error_src:
+  if (error)
+    if (asprintf (error, "sqlite_rotate (%s): SQL error: %s", what,
+		  sqlite3_errmsg (db_src)) < 0)
+      *error = strdup ("sqlite_rotate: Out of memory");
+  r = -EBUSY;
+
+ out:
+  sqlite3_finalize (res);
+  if (db_dest)
+    sqlite3_close (db_dest);
+  if (db_src)
+    {
+      /* nothing was changed, just release the lock */
+      sqlite3_exec (db_src, "ROLLBACK", NULL, NULL, NULL);
+      /* the database was not replaced, writers may use it again */
+      if (retired && r < 0)
+	sqlite3_exec (db_src, "PRAGMA application_id = 0", NULL, NULL, NULL);
+      if (rollback_mode && (r < 0 || counter == 0))
+	sqlite3_exec (db_src, "PRAGMA journal_mode = WAL", NULL, NULL, NULL);
+      sqlite3_close (db_src);
+    }
+  if (lock >= 0)
+    close (lock);
+  if (r < 0 || counter == 0)
+    unlink (new_path);
+  free (new_path);
+  free (dest_path);
+  return r;
+}
+
+/* Returns 1 if db_path exceeds max_size or max_rows of opts or if
+   none of them is set, 0 if not, <0 on failure. Both checks are
+   cheap: the size is page_count * page_size, the number of entries
+   is estimated by the range of IDs since the last rotation. */
+static int
+rotate_needed (const char *db_path, const struct wtmpdb_rotate_opts *opts,
+	       char **error)
+{
+  sqlite3 *db;
+  sqlite3_stmt *res;
+  uint64_t size, rows;
+  int r;
+
+  if (opts->max_size == 0 && opts->max_rows == 0)
+    return 1;
+  if (access (db_path, F_OK) < 0)
+    return 0;
+
+  r = open_database_ro (db_path, &db, error);
+  if (r != 0)
+    return -r;
+
+  if (sqlite3_prepare_v2 (db, "SELECT (SELECT page_count FROM pragma_page_count()) * "
+			  "(SELECT page_size FROM pragma_page_size()), "
+			  "(SELECT IFNULL(MAX(ID) - IFNULL((SELECT Counter FROM wtmp_changes "
+			  "WHERE ID = 1), MIN(ID) - 1), 0) FROM wtmp)",
+			  -1, &res, 0) != SQLITE_OK ||
+      sqlite3_step (res) != SQLITE_ROW)
+    {
+      if (error)
+	if (asprintf (error, "Cannot get size of %s: %s", db_path,
+		      sqlite3_errmsg (db)) < 0)
+	  *error = strdup ("rotate_needed: Out of memory");
+      sqlite3_finalize (res);
+      sqlite3_close (db);
+      return -EIO;
+    }
+  size = (uint64_t)sqlite3_column_int64 (res, 0);
+  rows = (uint64_t)sqlite3_column_int64 (res, 1);
+  sqlite3_finalize (res);
+  sqlite3_close (db);
+
+  return (opts->max_size > 0 && size > opts->max_size) ||
+    (opts->max_rows > 0 && rows > opts->max_rows);
+}
+
+/* Removes all but the newest keep archives of db_path and the archives
+   created before keep_days, 0 disables the respective limit. The
+   archives are <name>_YYYYMMDD[-HHMMSS].db[.z] next to db_path.
+   Returns 0 on success, <0 on failure. */
+static int
+prune_archives (const char *db_path, int keep, int keep_days, char **error)
+{
+  char *dir = strdup (db_path);
+  char *file = strdup (db_path);
+  struct dirent **list = NULL;
+  char threshold[9] = "";
+  const char *dname, *prefix;
+  size_t prefix_len;
+  int n, found = 0, r = 0;
+
+  if (dir == NULL || file == NULL)
+    {
+      free (dir);
+      free (file);
+      if (error)
+	*error = strdup ("prune_archives: Out of memory");
+      return -ENOMEM;
+    }
+  strip_extension (file);
+  prefix = basename (file);
+  prefix_len = strlen (prefix);
+
+  if (keep_days > 0)
+    {
+      time_t t = time (NULL) - (time_t)keep_days * 86400;
+      struct tm tm;
+
+      localtime_r (&t, &tm);
+      strftime (threshold, sizeof (threshold), "%Y%m%d", &tm);
+    }
+
+  dname = dirname (dir);
+  n = scandir (dname, &list, NULL, cmp_name_desc);
+  if (n < 0)
+    {
+      r = -errno;
+      if (error)
+	if (asprintf (error, "Cannot read directory %s: %s", dname,
+		      strerror (-r)) < 0)
+	  *error = strdup ("prune_archives: Out of memory");
+      n = 0;
+    }
+
+  for (int i = 0; i < n; i++)
+    {
+      const char *name = list[i]->d_name;
+      const char *date = archive_date (name, prefix, prefix_len);
+      char *path;
+
+      /* newest first, the date sorts like a number */
+      if (r == 0 && date != NULL)
+	{
+	  found++;
+	  if ((keep > 0 && found > keep) ||
+	      (threshold[0] && strncmp (date, threshold, 8) < 0))
+	    {
+	      if (asprintf (&path, "%s/%s", dname, name) < 0)
+		{
+		  if (error)
+		    *error = strdup ("prune_archives: Out of memory");
+		  r = -ENOMEM;
+		}
+	      else
+		{
+		  r = remove_database (path, error);
+		  free (path);
+		}
+	    }
+	}
+      free (list[i]);
+    }
+  free (list);
+  free (dir);
+  free (file);
+  return r;
+}
+
+/* Archives old entries of db_path according to opts and removes
+   expired archives.
+   Returns 0 on success, <0 on failure. */
+int
+sqlite_rotate (const char *db_path, const struct wtmpdb_rotate_opts *opts,
+	       char **wtmpdb_name, uint64_t *entries, char **error)
+{
+  int r;
+
+  /* partitions are by time, size limits don't apply */
+  if (is_partitioned (db_path))
+    return rotate_partitions (db_path, opts->days, opts->keep,
+			      opts->flags & WTMPDB_ROTATE_COMPRESS,
+			      entries, error);
+
+  r = rotate_needed (db_path, opts, error);
+  if (r > 0)
+    {
+      char *name = NULL;
+
+      r = (opts->flags & WTMPDB_ROTATE_SWAP) ?
+	rotate_swap (db_path, &name, entries, error) :
+	rotate_copy (db_path, opts->days, &name, entries, error);
+      if (r >= 0 && name)
+	r = mark_archive (name, error);
+      if (r >= 0 && name && (opts->flags & WTMPDB_ROTATE_COMPRESS))
+	{
+	  r = compress_archive (name, error);
+	  if (r == 0)
+	    {
+	      char *zname;
+
+	      if (asprintf (&zname, "%s" COMPRESS_SUFFIX, name) >= 0)
+		{
+		  free (name);
+		  name = zname;
+		}
+	    }
+	}
+      /* without filter the archive is never skipped, so ignore errors */
+      if (r >= 0 && name)
+	write_filter (name, NULL);
+      if (wtmpdb_name)
+	*wtmpdb_name = name;
+      else
+	free (name);
+    }
+  if (r >= 0 && (opts->keep > 0 || opts->keep_days > 0))
+    r = prune_archives (db_path, opts->keep, opts->keep_days, error);
+  return r < 0 ? r : 0;
+}
+
 static uint64_t
 search_boottime (sqlite3 *db, char **error)
 {
@@ -746,6 +3831,42 @@ sqlite_get_boottime (const char *db_path,
   sqlite3 *db;
   int r;
 
+  if (is_partitioned (db_path))
+    {
+      int *parts;
+      int n = list_partitions (db_path, &parts, error);
+
+      if (n < 0)
+	return n;
+
+      *boottime = 0;
+      for (int i = 0; i < n && *boottime == 0; i++)
+	{
+	  char *part_path = partition_path (db_path, parts[i]);
+
+	  if (error)
+	    *error = mfree (*error);
+	  if (part_path == NULL)
+	    {
+	      free (parts);
+	      if (error)
+		*error = strdup ("sqlite_get_boottime: Out of memory");
+	      return -ENOMEM;
+	    }
+	  r = sqlite_get_boottime (part_path, boottime, error);
+	  free (part_path);
+	  if (r < 0)
+	    {
+	      free (parts);
+	      return r;
+	    }
+	}
+      free (parts);
+      if (*boottime == 0 && error && *error == NULL)
+	*error = strdup ("Boot time not found");
+      return 0;
+    }
+
   r = open_database_ro (db_path, &db, error);
   if (r != 0)
     return -r;
@@ -756,3 +3877,345 @@ sqlite_get_boottime (const char *db_path,
 
   return 0;
 }
+
+#define BACKUP_PAGES 64 /* pages copied per step */
+#define BACKUP_SLEEP 10 /* ms between the steps, writers get the lock */
+
+/* Copies one database file to dest, via a temporary file which is
+   renamed at the end, so dest is always complete.
+   Returns 0 on success, <0 on failure. */
+static int
+backup_file (const char *db_path, const char *dest, unsigned int flags,
+	     char **error)
+{
+  sqlite3 *db_src;
+  sqlite3 *db_dest = NULL;
+  sqlite3_stmt *res = NULL;
+  sqlite3_backup *backup;
+  char *tmp_path;
+  struct stat st;
+  int snapshot = 0;
+  int r;
+
+  if (asprintf (&tmp_path, "%s.tmp", dest) < 0)
+    {
+      if (error)
+	*error = strdup ("sqlite_backup: Out of memory");
+      return -ENOMEM;
+    }
+  unlink (tmp_path);
+
+  r = open_database_ro (db_path, &db_src, error);
+  if (r != 0)
+    {
+      free (tmp_path);
+      return -EIO;
+    }
+
+  if (flags & WTMPDB_BACKUP_VACUUM)
+    {
+      /* reads everything in one transaction */
+      if (sqlite3_prepare_v2 (db_src, "VACUUM INTO ?", -1, &res, 0) != SQLITE_OK ||
+	  sqlite3_bind_text (res, 1, tmp_path, -1, SQLITE_STATIC) != SQLITE_OK ||
+	  sqlite3_step (res) != SQLITE_DONE)
+	{
+	  if (error)
+	    if (asprintf (error, "Cannot vacuum %s into %s: %s", db_path,
+			  tmp_path, sqlite3_errmsg (db_src)) < 0)
+	      *error = strdup ("sqlite_backup: Out of memory");
+	  r = -EIO;
+	}
+      sqlite3_finalize (res);
+    }
+  else
+    {
+      r = sqlite3_open_v2 (tmp_path, &db_dest, SQLITE_OPEN_READWRITE |
+			   SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, NULL);
+      backup = r == SQLITE_OK ?
+	sqlite3_backup_init (db_dest, "main", db_src, "main") : NULL;
+      if (backup == NULL)
+	{
+	  if (error)
+	    if (asprintf (error, "Cannot create %s: %s", tmp_path,
+			  sqlite3_errmsg (db_dest)) < 0)
+	      *error = strdup ("sqlite_backup: Out of memory");
+	  r = -EIO;
+	}
+      else
+	{
+	  /* Every write of another connection restarts the backup with
+	     the first page, on a busy database it never ends. A read
+	     transaction keeps a snapshot of a WAL database without
+	     blocking writers; in a rollback journal it would block
+	     them, the source is only locked while a step copies its
+	     pages then. */
+	  if (sqlite3_prepare_v2 (db_src, "PRAGMA journal_mode", -1, &res,
+				  0) == SQLITE_OK)
+	    {
+	      if (sqlite3_step (res) == SQLITE_ROW &&
+		  strcmp ((const char *)sqlite3_column_text (res, 0),
+			  "wal") == 0)
+		snapshot = sqlite3_exec (db_src, "BEGIN; "
+					 "SELECT 1 FROM sqlite_master",
+					 NULL, NULL, NULL) == SQLITE_OK;
+	      sqlite3_finalize (res);
+	      res = NULL;
+	    }
+	  do
+	    {
+	      r = sqlite3_backup_step (backup, BACKUP_PAGES);
+	      if (r == SQLITE_OK || r == SQLITE_BUSY || r == SQLITE_LOCKED)
+		sqlite3_sleep (BACKUP_SLEEP);
+	    }
+	  while (r == SQLITE_OK || r == SQLITE_BUSY || r == SQLITE_LOCKED);
+	  sqlite3_backup_finish (backup);
+	  if (snapshot)
+	    sqlite3_exec (db_src, "COMMIT", NULL, NULL, NULL);
+	  if (r != SQLITE_DONE)
+	    {
+	      if (error)
+		if (asprintf (error, "Backup of %s failed: %s", db_path,
+			      sqlite3_errstr (r)) < 0)
+		  *error = strdup ("sqlite_backup: Out of memory");
+	      r = -EIO;
+	    }
+	  else
+	    /* the copy of a WAL database is in WAL mode, too */
+	    r = set_rollback_mode (db_dest, tmp_path, error);
+	}
+      sqlite3_close (db_dest);
+    }
+  sqlite3_close (db_src);
+
+  if (r == 0 && stat (db_path, &st) == 0)
+    chmod (tmp_path, st.st_mode & 07777);
+  if (r == 0 && rename (tmp_path, dest) < 0)
+    {
+      r = -errno;
+      if (error)
+	if (asprintf (error, "Cannot rename %s to %s: %s", tmp_path, dest,
+		      strerror (-r)) < 0)
+	  *error = strdup ("sqlite_backup: Out of memory");
+    }
+  if (r < 0)
+    unlink (tmp_path);
+  free (tmp_path);
+  return r;
+}
+
+/* Copies db_path to dest while it is in use. For a partitioned database
+   dest is a directory and gets a copy of each partition.
+   Returns 0 on success, <0 on failure. */
+int
+sqlite_backup (const char *db_path, const char *dest, unsigned int flags,
+	       char **error)
+{
+  int *parts;
+  int n, r = 0;
+
+  if (!is_partitioned (db_path))
+    return backup_file (db_path, dest, flags, error);
+
+  if (mkdir (dest, 0755) < 0 && errno != EEXIST)
+    {
+      r = -errno;
+      if (error)
+	if (asprintf (error, "Cannot create directory %s: %s", dest,
+		      strerror (-r)) < 0)
+	  *error = strdup ("sqlite_backup: Out of memory");
+      return r;
+    }
+
+  n = list_partitions (db_path, &parts, error);
+  if (n < 0)
+    return n;
+
+  for (int i = 0; i < n && r == 0; i++)
+    {
+      char *part_path = partition_path (db_path, parts[i]);
+      char *dest_path = partition_path (dest, parts[i]);
+
+      if (part_path == NULL || dest_path == NULL)
+	{
+	  if (error)
+	    *error = strdup ("sqlite_backup: Out of memory");
+	  r = -ENOMEM;
+	}
+      else
+	r = backup_file (part_path, dest_path, flags, error);
+      free (part_path);
+      free (dest_path);
+    }
+  free (parts);
+  return r;
+}
+
+/* Runs pending migrations of path for about usec, see migrate.
+   Archives don't change anymore and are left alone. */
+static int
+migrate_file (const char *path, uint64_t usec, char **error)
+{
+  sqlite3 *db;
+  int r;
+
+  if (is_compressed (path) || is_archive (path))
+    return 0;
+
+  r = open_database_rw (path, &db, error);
+  if (r < 0)
+    return r;
+  r = migrate (db, usec, error);
+  sqlite3_close (db);
+  return r;
+}
+
+/* Runs pending schema migrations, for a partitioned database for
+   about usec per partition.
+   Returns 0 if the schema is current, 1 if migrations are pending,
+   <0 on failure. */
+int
+sqlite_migrate (const char *db_path, uint64_t usec, char **error)
+{
+  int *parts;
+  int n, r = 0, pending = 0;
+
+  if (!is_partitioned (db_path))
+    return migrate_file (db_path, usec, error);
+
+  n = list_partitions (db_path, &parts, error);
+  if (n < 0)
+    return n;
+
+  for (int i = 0; i < n && r >= 0; i++)
+    {
+      char *part_path = partition_path (db_path, parts[i]);
+
+      if (part_path == NULL)
+	{
+	  if (error)
+	    *error = strdup ("sqlite_migrate: Out of memory");
+	  r = -ENOMEM;
+	}
+      else if ((r = migrate_file (part_path, usec, error)) > 0)
+	pending = 1;
+      free (part_path);
+    }
+  free (parts);
+  return r < 0 ? r : pending;
+}
+
+/* Runs the maintenance task (WTMPDB_MAINT_*) on path. Archives don't
+   change anymore and are left alone.
+   Returns 0 on success, <0 on failure. */
+static int
+maintain_file (const char *path, unsigned int task, char **error)
+{
+  const char *sql = NULL;
+  sqlite3 *db;
+  int r;
+
+  if (is_compressed (path) || is_archive (path))
+    return 0;
+
+  r = open_database_rw (path, &db, error);
+  if (r < 0)
+    return r;
+
+  switch (task)
+    {
+    case WTMPDB_MAINT_MIGRATE:
+      r = migrate (db, 0, error);
+      break;
+    case WTMPDB_MAINT_CHECKPOINT:
+      /* catches up on the switch to WAL if the database was in use
+	 when create_table tried */
+      sqlite3_exec (db, "PRAGMA journal_mode = WAL", NULL, NULL, NULL);
+      /* does not wait for readers or writers */
+      sql = "PRAGMA wal_checkpoint(PASSIVE)";
+      break;
+    case WTMPDB_MAINT_ANALYZE:
+      /* a sample of rows per index is enough */
+      sql = "PRAGMA analysis_limit = 1000; ANALYZE";
+      break;
+    case WTMPDB_MAINT_OPTIMIZE:
+      /* analyzes the tables whose statistics are outdated */
+      sql = "PRAGMA analysis_limit = 1000; PRAGMA optimize = 0x10002";
+      break;
+    default:
+      if (error)
+	if (asprintf (error, "Unknown maintenance task %#x", task) < 0)
+	  *error = strdup ("sqlite_maintain: Out of memory");
+      r = -EINVAL;
+      break;
+    }
+
+  if (sql && sqlite3_exec (db, sql, NULL, NULL, NULL) != SQLITE_OK)
+    {
+      if (error)
+	if (asprintf (error, "Maintenance of %s failed: %s", path,
+		      sqlite3_errmsg (db)) < 0)
+	  *error = strdup ("sqlite_maintain: Out of memory");
+      r = -EIO;
+    }
+  sqlite3_close (db);
+  return r;
+}
+
+/* Runs the maintenance tasks in the order of wtmpdb.h, for a partitioned
+   database on all partitions.
+   Returns 0 on success, -EINVAL for unknown tasks, <0 on failure. */
+int
+sqlite_maintain (const char *db_path, unsigned int tasks, char **error)
+{
+  static const unsigned int maint_order[] = {
+    WTMPDB_MAINT_MIGRATE, WTMPDB_MAINT_CHECKPOINT,
+    WTMPDB_MAINT_ANALYZE, WTMPDB_MAINT_OPTIMIZE
+  };
+  const int partitioned = is_partitioned (db_path);
+  int *parts = NULL;
+  int n = 0, r = 0;
+
+  if (tasks & ~WTMPDB_MAINT_ALL)
+    {
+      if (error)
+	if (asprintf (error, "Unknown maintenance tasks %#x",
+		      tasks & ~WTMPDB_MAINT_ALL) < 0)
+	  *error = strdup ("sqlite_maintain: Out of memory");
+      return -EINVAL;
+    }
+
+  if (partitioned)
+    {
+      n = list_partitions (db_path, &parts, error);
+      if (n < 0)
+	return n;
+    }
+
+  for (size_t t = 0;
+       t < sizeof (maint_order) / sizeof (maint_order[0]) && r >= 0; t++)
+    {
+      unsigned int task = maint_order[t];
+
+      if (!(tasks & task))
+	continue;
+      /* an empty partition directory has nothing to maintain */
+      if (!partitioned)
+	r = maintain_file (db_path, task, error);
+      for (int i = 0; i < n && r >= 0; i++)
+	{
+	  char *part_path = partition_path (db_path, parts[i]);
+
+	  if (part_path == NULL)
+	    {
+	      if (error)
+		*error = strdup ("sqlite_maintain: Out of memory");
+	      r = -ENOMEM;
+	    }
+	  else
+	    r = maintain_file (part_path, task, error);
+	  free (part_path);
+	}
+    }
+  free (parts);
+  return r;
+}
@@ -27,22 +27,81 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 extern int64_t sqlite_login (const char *db_path, int type, const char *user,
 			     uint64_t usec_login, const char *tty,
 			     const char *rhost, const char *service,
-			     char **error);
+			     const char *token, char **error);
 extern int sqlite_logout (const char *db_path, int64_t id,
 			  uint64_t usec_logout, char **error);
+struct sqlite_row {
+  int64_t id;
+  int is_new;
+  int type;
+  const char *user;
+  uint64_t login;
+  uint64_t logout;
+  const char *tty;
+  const char *rhost;
+  const char *service;
+};
+extern int sqlite_write_rows (const char *db_path, struct sqlite_row *rows,
+			      size_t n, char **error);
 extern int64_t sqlite_get_id (const char *db_path, const char *tty,
 			      char **error);
-extern int sqlite_read_all (const char *db_path, int uniq,
+extern int sqlite_read_all (const char *db_path, int uniq, unsigned int columns,
 			    int (*cb_func)(void *unused, int argc, char **argv,
 					   char **azColName),
 			    void *userdata, char **error);
+struct sqlite_cursor;
+extern int sqlite_cursor_open (const char *db_path, int uniq,
+			       struct sqlite_cursor **cursor, char **error);
+extern int sqlite_cursor_read (struct sqlite_cursor *cursor, size_t count,
+			       int (*cb_func)(void *unused, int argc,
+					      char **argv, char **azColName),
+			       void *userdata, char **error);
+extern void sqlite_cursor_close (struct sqlite_cursor *cursor);
+struct batch_ctx;
+extern int sqlite_read_batch (const char *db_path, int uniq,
+			      struct batch_ctx *ctx, char **error);
+extern int sqlite_read_boots (const char *db_path,
+			      int (*cb_func)(void *unused, int argc, char **argv,
+					     char **azColName),
+			      void *userdata, char **error);
+extern int sqlite_read_delta (const char *db_path, int64_t watermark,
+			      const int64_t *ids, size_t n_ids,
+			      uint64_t *counter, int64_t *max_id,
+			      int (*cb_func)(void *unused, int argc, char **argv,
+					     char **azColName),
+			      void *userdata, char **error);
+struct wtmpdb_match;
+extern int sqlite_read_match (const char *db_path,
+			      const struct wtmpdb_match *m,
+			      int (*cb_func)(void *unused, int argc, char **argv,
+					     char **azColName),
+			      void *userdata, char **error);
+extern int sqlite_get_last_login (const char *db_path, const char *user,
+				  int (*cb_func)(void *unused, int argc, char **argv,
+						 char **azColName),
+				  void *userdata, char **error);
+extern int sqlite_read_metrics (const char *db_path,
+				int (*cb_func)(void *unused, int argc, char **argv,
+					       char **azColName),
+				void *userdata, char **error);
 extern int sqlite_get_boottime(const char *db_path, uint64_t *boottime,
 			       char **error);
-extern int sqlite_rotate (const char *db_path, const int days,
+extern int sqlite_backup (const char *db_path, const char *dest,
+			  unsigned int flags, char **error);
+extern int sqlite_migrate (const char *db_path, uint64_t usec, char **error);
+extern int sqlite_maintain (const char *db_path, unsigned int tasks,
+			    char **error);
+struct wtmpdb_stats;
+extern void sqlite_get_stats (struct wtmpdb_stats *stats);
+extern void sqlite_set_busy_timeout (uint64_t usec);
+struct wtmpdb_rotate_opts;
+extern int sqlite_rotate (const char *db_path,
+			  const struct wtmpdb_rotate_opts *opts,
 			  char **wtmpdb_name, uint64_t *entries,
 			  char **error);
@@ -30,8 +30,11 @@
 #if WITH_WTMPDBD
 
 #include <inttypes.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <unistd.h>
 #include <systemd/sd-varlink.h>
 
 #include "basics.h"
@@ -51,13 +54,25 @@
 #define TAKE_PTR_TYPE(ptr, type) TAKE_GENERIC(ptr, type, NULL)
 #define TAKE_PTR(ptr) TAKE_PTR_TYPE(ptr, typeof(ptr))
 
+/* How long a call waits for wtmpdbd, 0 for the default of sd-varlink */
+static _Atomic uint64_t call_timeout = 0;
+
+void
+varlink_set_timeout (uint64_t usec)
+{
+  call_timeout = usec;
+}
+
 static int
 connect_to_wtmpdbd(sd_varlink **ret, const char *socket, char **error)
 {
   _cleanup_(sd_varlink_unrefp) sd_varlink *link = NULL;
+  uint64_t timeout = call_timeout;
   int r;
 
   r = sd_varlink_connect_address(&link, socket);
+  if (r >= 0 && timeout != 0)
+    r = sd_varlink_set_relative_timeout(link, timeout);
   if (r < 0)
     {
       if (error)
@@ -71,6 +86,18 @@ connect_to_wtmpdbd(sd_varlink **ret, const char *socket, char **error)
   return 0;
 }
 
+/* root uses the write socket of wtmpdbd, whose calls are not delayed
+   by other users reading the database. Older daemons don't have it. */
+static int
+connect_for_write(sd_varlink **ret, char **error)
+{
+  if (geteuid () == 0 &&
+      connect_to_wtmpdbd(ret, _VARLINK_WTMPDB_WRITE_SOCKET, NULL) == 0)
+    return 0;
+
+  return connect_to_wtmpdbd(ret, _VARLINK_WTMPDB_SOCKET, error);
+}
+
 struct id_error {
   int64_t id;
   char *error;
@@ -90,7 +117,7 @@ id_error_free (struct id_error *var)
 int64_t
 varlink_login (int type, const char *user, uint64_t usec_login,
 	       const char *tty, const char *rhost,
-	       const char *service, char **error)
+	       const char *service, const char *token, char **error)
 {
   _cleanup_(id_error_free) struct id_error p = {
     .id = -1,
@@ -106,7 +133,7 @@ varlink_login (int type, const char *user, uint64_t usec_login,
   sd_json_variant *result;
   int r;
 
-  r = connect_to_wtmpdbd(&link, _VARLINK_WTMPDB_SOCKET, error);
+  r = connect_for_write(&link, error);
   if (r < 0)
     return r;
 
@@ -120,6 +147,8 @@ varlink_login (int type, const char *user, uint64_t usec_login,
     r = sd_json_variant_merge_objectbo(&params, SD_JSON_BUILD_PAIR("RemoteHost", SD_JSON_BUILD_STRING(rhost)));
   if (r >= 0 && service)
     r = sd_json_variant_merge_objectbo(&params, SD_JSON_BUILD_PAIR("Service", SD_JSON_BUILD_STRING(service)));
+  if (r >= 0 && token)
+    r = sd_json_variant_merge_objectbo(&params, SD_JSON_BUILD_PAIR("Token", SD_JSON_BUILD_STRING(token)));
   if (r < 0)
     {
       if (error)
@@ -195,7 +224,7 @@ varlink_logout (int64_t id, uint64_t usec_logout, char **error)
   sd_json_variant *result;
   int r;
 
-  r = connect_to_wtmpdbd(&link, _VARLINK_WTMPDB_SOCKET, error);
+  r = connect_for_write(&link, error);
   if (r < 0)
     return r;
 
@@ -268,7 +297,7 @@ varlink_get_id (const char *tty, char **error)
   const char *error_id;
   int r;
 
-  r = connect_to_wtmpdbd(&link, _VARLINK_WTMPDB_SOCKET, error);
+  r = connect_for_write(&link, error);
   if (r < 0)
     return r;
 
@@ -398,6 +427,76 @@ varlink_get_boottime (uint64_t *boottime, char **error)
   return 0;
 }
 
+int
+varlink_backup (const char *dest, unsigned int flags, char **error)
+{
+  _cleanup_(status_free) struct status p = {
+    .success = false,
+    .error = NULL,
+  };
+  static const sd_json_dispatch_field dispatch_table[] = {
+    { "Success", SD_JSON_VARIANT_BOOLEAN, sd_json_dispatch_stdbool, offsetof(struct status, success), 0 },
+    { "ErrorMsg", SD_JSON_VARIANT_STRING, sd_json_dispatch_string,  offsetof(struct status, error), 0 },
+    {}
+  };
+  _cleanup_(sd_varlink_unrefp) sd_varlink *link = NULL;
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *params = NULL;
+  sd_json_variant *result;
+  int r;
+
+  r = connect_to_wtmpdbd(&link, _VARLINK_WTMPDB_SOCKET, error);
+  if (r < 0)
+    return r;
+
+  r = sd_json_buildo(&params,
+		     SD_JSON_BUILD_PAIR("Destination", SD_JSON_BUILD_STRING(dest)),
+		     SD_JSON_BUILD_PAIR_CONDITION(flags & WTMPDB_BACKUP_VACUUM,
+						  "Vacuum", SD_JSON_BUILD_BOOLEAN(true)));
+  if (r < 0)
+    {
+      if (error)
+	if (asprintf (error, "Failed to build JSON data: %s",
+		      strerror(-r)) < 0)
+	  *error = strdup ("Out of memory");
+      return r;
+    }
+
+  const char *error_id;
+  r = sd_varlink_call(link, "org.openSUSE.wtmpdb.Backup", params, &result, &error_id);
+  if (r < 0)
+    {
+      if (error)
+	if (asprintf (error, "Failed to call Backup method: %s",
+		      strerror(-r)) < 0)
+	  *error = strdup ("Out of memory");
+      return r;
+    }
+
+  r = sd_json_dispatch(result, dispatch_table, SD_JSON_ALLOW_EXTENSIONS, &p);
+  if (r < 0)
+    {
+      if (error)
+	if (asprintf (error, "Failed to parse JSON answer: %s",
+		      strerror(-r)) < 0)
+	  *error = strdup("Out of memory");
+      return r;
+    }
+
+  if (error_id && strlen(error_id) > 0)
+    {
+      if (error)
+	{
+	  if (p.error)
+	    *error = strdup(p.error);
+	  else
+	    *error = strdup(error_id);
+	}
+      return -EIO;
+    }
+
+  return 0;
+}
+
 struct rotate {
   bool success;
   char *error;
@@ -413,7 +512,8 @@ rotate_free (struct rotate *var)
 }
 
 int
-varlink_rotate (const int days, char **backup_name, uint64_t *entries, char **error)
+varlink_rotate (const struct wtmpdb_rotate_opts *opts, char **backup_name,
+		uint64_t *entries, char **error)
 {
   _cleanup_(rotate_free) struct rotate p = {
     .success = false,
@@ -437,7 +537,21 @@ varlink_rotate (const int days, char **backup_name, uint64_t *entries, char **er
   if (r < 0)
     return r;
 
-  r = sd_json_buildo(&params, SD_JSON_BUILD_PAIR("Days", SD_JSON_BUILD_INTEGER(days)));
+  /* the optional fields are only sent if set, older daemons don't
+     know them */
+  r = sd_json_buildo(&params, SD_JSON_BUILD_PAIR("Days", SD_JSON_BUILD_INTEGER(opts->days)),
+		     SD_JSON_BUILD_PAIR_CONDITION(opts->flags & WTMPDB_ROTATE_SWAP,
+						  "Swap", SD_JSON_BUILD_BOOLEAN(true)),
+		     SD_JSON_BUILD_PAIR_CONDITION(opts->flags & WTMPDB_ROTATE_COMPRESS,
+						  "Compress", SD_JSON_BUILD_BOOLEAN(true)),
+		     SD_JSON_BUILD_PAIR_CONDITION(opts->max_size > 0,
+						  "MaxSize", SD_JSON_BUILD_INTEGER(opts->max_size)),
+		     SD_JSON_BUILD_PAIR_CONDITION(opts->max_rows > 0,
+						  "MaxRows", SD_JSON_BUILD_INTEGER(opts->max_rows)),
+		     SD_JSON_BUILD_PAIR_CONDITION(opts->keep > 0,
+						  "Keep", SD_JSON_BUILD_INTEGER(opts->keep)),
+		     SD_JSON_BUILD_PAIR_CONDITION(opts->keep_days > 0,
+						  "KeepDays", SD_JSON_BUILD_INTEGER(opts->keep_days)));
   if (r < 0)
     {
       if (error)
@@ -493,6 +607,7 @@ struct read_all {
   bool success;
   char *error;
   sd_json_variant *contents_json;
+  char *cursor;
 };
 
 static void
@@ -500,6 +615,7 @@ read_all_free (struct read_all *var)
 {
   var->error = mfree(var->error);
   var->contents_json = sd_json_variant_unref(var->contents_json);
+  var->cursor = mfree(var->cursor);
 }
 
 struct wtmpdb_entry {
@@ -522,20 +638,128 @@ wtmpdb_entry_free (struct wtmpdb_entry *var)
   var->service = mfree(var->service);
 }
 
-int
-varlink_read_all (int uniq, int (*cb_func)(void *unused, int argc, char **argv,
+/* Passes the WtmpdbEntry objects of the array data to cb_func, a
+   non-zero return value stops after the entry.
+   Returns the number of entries passed, < 0 on failure. */
+static int
+dispatch_entries (sd_json_variant *data,
+		  int (*cb_func)(void *unused, int argc, char **argv,
 				 char **azColName),
 		  void *userdata, char **error)
+{
+  int r;
+
+  if (!sd_json_variant_is_array(data))
+    {
+      fprintf(stderr, "JSON 'Data' is no array!\n");
+      return -EINVAL;
+    }
+
+  size_t n = sd_json_variant_elements(data);
+  for (size_t i = 0; i < n; i++)
+    {
+      static char *azColName[8] = {"ID", "Type", "User", "Login", "Logout", "TTY", "RemoteHost", "Service"};
+      _cleanup_(wtmpdb_entry_free) struct wtmpdb_entry e = {
+	.id = -1,
+	.type = -1,
+	.user = NULL,
+	.login = 0,
+	.logout = 0,
+	.tty = NULL,
+	.remote_host = NULL,
+	.service = NULL
+      };
+      static const sd_json_dispatch_field dispatch_entry_table[] = {
+	{ "ID",         SD_JSON_VARIANT_INTEGER, sd_json_dispatch_int64,  offsetof(struct wtmpdb_entry, id), SD_JSON_MANDATORY },
+	{ "Type",       SD_JSON_VARIANT_INTEGER, sd_json_dispatch_int,    offsetof(struct wtmpdb_entry, type), 0 },
+	{ "User",       SD_JSON_VARIANT_STRING,  sd_json_dispatch_string, offsetof(struct wtmpdb_entry, user), SD_JSON_MANDATORY },
+	{ "Login",      SD_JSON_VARIANT_INTEGER, sd_json_dispatch_uint64, offsetof(struct wtmpdb_entry, login), 0 },
+	{ "Logout",     SD_JSON_VARIANT_INTEGER, sd_json_dispatch_uint64, offsetof(struct wtmpdb_entry, logout), 0 },
+	{ "TTY",        SD_JSON_VARIANT_STRING,  sd_json_dispatch_string, offsetof(struct wtmpdb_entry, tty), 0 },
+	{ "RemoteHost", SD_JSON_VARIANT_STRING,  sd_json_dispatch_string, offsetof(struct wtmpdb_entry, remote_host), 0 },
+	{ "Service",    SD_JSON_VARIANT_STRING,  sd_json_dispatch_string, offsetof(struct wtmpdb_entry, service), 0 },
+	{}
+      };
+
+      sd_json_variant *entry = sd_json_variant_by_index(data, i);
+      if (!sd_json_variant_is_object(entry))
+	{
+	  fprintf(stderr, "entry is no object!\n");
+	  return -EINVAL;
+	}
+
+      r = sd_json_dispatch(entry, dispatch_entry_table, SD_JSON_ALLOW_EXTENSIONS, &e);
+      if (r < 0)
+	{
+	  if (error)
+	    if (asprintf (error, "Failed to parse JSON wtmpdb entry: %s",
+			  strerror(-r)) < 0)
+	      *error = strdup("Out of memory");
+	  return r;
+	}
+
+      char *ret[8];
+      if (asprintf (&ret[0], "%" PRId64, e.id) < 0)
+	return -ENOMEM;
+      if (asprintf (&ret[1], "%i", e.type) < 0)
+	return -ENOMEM;
+      ret[2] = e.user;
+      if (asprintf (&ret[3], "%" PRIu64, e.login) < 0)
+	return -ENOMEM;
+      if (e.logout > 0)
+	{
+	  if (asprintf (&ret[4], "%" PRIu64, e.logout) < 0)
+	    return -ENOMEM;
+	}
+      else
+	ret[4] = NULL;
+      ret[5] = e.tty;
+      if (strlen(e.remote_host) > 0)
+	ret[6] = e.remote_host;
+      else
+	ret[6] = NULL;
+      if (strlen(e.service) > 0)
+	ret[7] = e.service;
+      else
+	ret[7] = NULL;
+
+      r = cb_func(userdata, 8, ret, azColName);
+
+      free(ret[0]);
+      free(ret[1]);
+      free(ret[3]);
+      free(ret[4]);
+
+      /* a non-zero return value stops after the entry */
+      if (r != 0)
+	return (int)(i + 1);
+    }
+
+  return n;
+}
+
+/* Calls ReadAll and passes the entries to cb_func. With limit >= 0 or
+   a cursor, the reply is one page and *next gets the cursor for the
+   following one, NULL after the last page.
+   Returns the number of entries, < 0 on failure. */
+static int
+read_all_call (int uniq, int64_t limit, const char *cursor, bool close,
+	       char **next,
+	       int (*cb_func)(void *unused, int argc, char **argv,
+			      char **azColName),
+	       void *userdata, char **error)
 {
   _cleanup_(read_all_free) struct read_all p = {
     .success = false,
     .error = NULL,
     .contents_json = NULL,
+    .cursor = NULL,
   };
   static const sd_json_dispatch_field dispatch_table[] = {
     { "Success",    SD_JSON_VARIANT_BOOLEAN, sd_json_dispatch_stdbool, offsetof(struct read_all, success), 0 },
     { "ErrorMsg",   SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct read_all, error), 0 },
     { "Data",       SD_JSON_VARIANT_ARRAY,   sd_json_dispatch_variant, offsetof(struct read_all, contents_json), 0 },
+    { "Cursor",     SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct read_all, cursor), 0 },
     {}
   };
   _cleanup_(sd_varlink_unrefp) sd_varlink *link = NULL;
@@ -547,13 +771,19 @@ varlink_read_all (int uniq, int (*cb_func)(void *unused, int argc, char **argv,
   if (r < 0)
     return r;
 
-  r = sd_json_buildo(&params, SD_JSON_BUILD_PAIR("Uniq", SD_JSON_BUILD_INTEGER(uniq)));
+  r = sd_json_buildo(&params, SD_JSON_BUILD_PAIR("Uniq", SD_JSON_BUILD_INTEGER(uniq)),
+		     SD_JSON_BUILD_PAIR_CONDITION(limit >= 0,
+						  "Limit", SD_JSON_BUILD_INTEGER(limit)),
+		     SD_JSON_BUILD_PAIR_CONDITION(cursor != NULL,
+						  "Cursor", SD_JSON_BUILD_STRING(cursor)),
+		     SD_JSON_BUILD_PAIR_CONDITION(close,
+						  "Close", SD_JSON_BUILD_BOOLEAN(true)));
   if (r < 0)
     {
       if (error)
-    if (asprintf (error, "Failed to build JSON data: %s",
-              strerror(-r)) < 0)
-      *error = strdup ("Out of memory");
+	if (asprintf (error, "Failed to build JSON data: %s",
+		      strerror(-r)) < 0)
+	  *error = strdup ("Out of memory");
       return r;
     }
 
@@ -580,6 +810,331 @@ varlink_read_all (int uniq, int (*cb_func)(void *unused, int argc, char **argv,
       return r;
     }
 
+  if (error_id && strlen(error_id) > 0)
+    {
+      if (error)
+	{
+	  if (p.error)
+	    *error = strdup(p.error);
+	  else
+	    *error = strdup(error_id);
+	}
+      if (strcmp (error_id, "org.openSUSE.wtmpdb.InvalidCursor") == 0)
+	return -ESTALE;
+      return -EIO;
+    }
+
+  if (next)
+    {
+      *next = p.cursor;
+      p.cursor = NULL;
+    }
+
+  /* an empty page has no data */
+  if (p.contents_json == NULL && (limit >= 0 || cursor != NULL))
+    return 0;
+
+  return dispatch_entries (p.contents_json, cb_func, userdata, error);
+}
+
+int
+varlink_read_all (int uniq, int (*cb_func)(void *unused, int argc, char **argv,
+				 char **azColName),
+		  void *userdata, char **error)
+{
+  int r = read_all_call (uniq, -1, NULL, false, NULL, cb_func, userdata,
+			 error);
+
+  return r < 0 ? r : 0;
+}
+
+int
+varlink_get_last_login (const char *user,
+			int (*cb_func)(void *unused, int argc, char **argv,
+				       char **azColName),
+			void *userdata, char **error)
+{
+  _cleanup_(read_all_free) struct read_all p = {
+    .success = false,
+    .error = NULL,
+    .contents_json = NULL,
+    .cursor = NULL,
+  };
+  static const sd_json_dispatch_field dispatch_table[] = {
+    { "Success",    SD_JSON_VARIANT_BOOLEAN, sd_json_dispatch_stdbool, offsetof(struct read_all, success), 0 },
+    { "ErrorMsg",   SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct read_all, error), 0 },
+    { "Data",       SD_JSON_VARIANT_ARRAY,   sd_json_dispatch_variant, offsetof(struct read_all, contents_json), 0 },
+    {}
+  };
+  _cleanup_(sd_varlink_unrefp) sd_varlink *link = NULL;
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *params = NULL;
+  sd_json_variant *result;
+  const char *error_id;
+  int r;
+
+  r = connect_for_write(&link, error);
+  if (r < 0)
+    return r;
+
+  r = sd_json_buildo(&params, SD_JSON_BUILD_PAIR("User", SD_JSON_BUILD_STRING(user)));
+  if (r < 0)
+    {
+      if (error)
+	if (asprintf (error, "Failed to build JSON data: %s",
+		      strerror(-r)) < 0)
+	  *error = strdup ("Out of memory");
+      return r;
+    }
+
+  r = sd_varlink_call(link, "org.openSUSE.wtmpdb.GetLastLogin", params, &result, &error_id);
+  if (r < 0)
+    {
+      if (error)
+	if (asprintf (error, "Failed to call GetLastLogin method: %s",
+		      strerror(-r)) < 0)
+	  *error = strdup ("Out of memory");
+      return r;
+    }
+
+  /* dispatch before checking error_id, we may need the result for the error
+     message */
+  r = sd_json_dispatch(result, dispatch_table, SD_JSON_ALLOW_EXTENSIONS, &p);
+  if (r < 0)
+    {
+      if (error)
+	if (asprintf (error, "Failed to parse JSON answer: %s",
+		      strerror(-r)) < 0)
+	  *error = strdup("Out of memory");
+      return r;
+    }
+
+  if (error_id && strlen(error_id) > 0)
+    {
+      if (error)
+	{
+	  if (p.error)
+	    *error = strdup(p.error);
+	  else
+	    *error = strdup(error_id);
+	}
+      if (strcmp(error_id, "org.openSUSE.wtmpdb.NoEntryFound") == 0)
+	return -ENOENT;
+      else
+	return -EIO;
+    }
+
+  r = dispatch_entries (p.contents_json, cb_func, userdata, error);
+  return r < 0 ? r : 0;
+}
+
+/* Returns -EOPNOTSUPP if wtmpdbd is too old for ReadMatch. */
+int
+varlink_read_match (const struct wtmpdb_match *match,
+		    int (*cb_func)(void *unused, int argc, char **argv,
+				   char **azColName),
+		    void *userdata, char **error)
+{
+  _cleanup_(read_all_free) struct read_all p = {
+    .success = false,
+    .error = NULL,
+    .contents_json = NULL,
+    .cursor = NULL,
+  };
+  static const sd_json_dispatch_field dispatch_table[] = {
+    { "Success",    SD_JSON_VARIANT_BOOLEAN, sd_json_dispatch_stdbool, offsetof(struct read_all, success), 0 },
+    { "ErrorMsg",   SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct read_all, error), 0 },
+    { "Data",       SD_JSON_VARIANT_ARRAY,   sd_json_dispatch_variant, offsetof(struct read_all, contents_json), 0 },
+    {}
+  };
+  _cleanup_(sd_varlink_unrefp) sd_varlink *link = NULL;
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *params = NULL;
+  sd_json_variant *result;
+  const char *error_id;
+  int r;
+
+  r = connect_to_wtmpdbd(&link, _VARLINK_WTMPDB_SOCKET, error);
+  if (r < 0)
+    return r;
+
+  r = sd_json_buildo(&params,
+		     SD_JSON_BUILD_PAIR_CONDITION(match->user != NULL,
+						  "User", SD_JSON_BUILD_STRING(match->user)),
+		     SD_JSON_BUILD_PAIR_CONDITION(match->rhost != NULL,
+						  "RemoteHost", SD_JSON_BUILD_STRING(match->rhost)),
+		     SD_JSON_BUILD_PAIR_CONDITION(match->tty != NULL,
+						  "TTY", SD_JSON_BUILD_STRING(match->tty)));
+  if (r < 0)
+    {
+      if (error)
+	if (asprintf (error, "Failed to build JSON data: %s",
+		      strerror(-r)) < 0)
+	  *error = strdup ("Out of memory");
+      return r;
+    }
+
+  r = sd_varlink_call(link, "org.openSUSE.wtmpdb.ReadMatch", params, &result, &error_id);
+  if (r < 0)
+    {
+      if (error)
+	if (asprintf (error, "Failed to call ReadMatch method: %s",
+		      strerror(-r)) < 0)
+	  *error = strdup ("Out of memory");
+      return r;
+    }
+
+  /* dispatch before checking error_id, we may need the result for the error
+     message */
+  r = sd_json_dispatch(result, dispatch_table, SD_JSON_ALLOW_EXTENSIONS, &p);
+  if (r < 0)
+    {
+      if (error)
+	if (asprintf (error, "Failed to parse JSON answer: %s",
+		      strerror(-r)) < 0)
+	  *error = strdup("Out of memory");
+      return r;
+    }
+
+  if (error_id && strlen(error_id) > 0)
+    {
+      if (error)
+	{
+	  if (p.error)
+	    *error = strdup(p.error);
+	  else
+	    *error = strdup(error_id);
+	}
+      if (strcmp(error_id, "org.varlink.service.MethodNotFound") == 0)
+	return -EOPNOTSUPP;
+      return -EIO;
+    }
+
+  r = dispatch_entries (p.contents_json, cb_func, userdata, error);
+  return r < 0 ? r : 0;
+}
+
+/* Pages of ReadAll. A cursor is opened in wtmpdbd right away, so all
+   pages show the database at the time of varlink_cursor_open. */
+struct varlink_cursor {
+  char *token;	/* NULL after the last page */
+};
+
+int
+varlink_cursor_open (int uniq, struct varlink_cursor **cursor, char **error)
+{
+  struct varlink_cursor *c = calloc (1, sizeof (*c));
+  int r;
+
+  if (c == NULL)
+    {
+      if (error)
+	*error = strdup ("varlink_cursor_open: Out of memory");
+      return -ENOMEM;
+    }
+
+  r = read_all_call (uniq, 0, NULL, false, &c->token, NULL, NULL, error);
+  if (r < 0)
+    {
+      free (c);
+      return r;
+    }
+  *cursor = c;
+  return 0;
+}
+
+int
+varlink_cursor_read (struct varlink_cursor *cursor, size_t count,
+		     int (*cb_func)(void *unused, int argc, char **argv,
+				    char **azColName),
+		     void *userdata, char **error)
+{
+  _cleanup_(freep) char *token = cursor->token;
+
+  cursor->token = NULL;
+  if (token == NULL)
+    return 0;
+
+  if (count > INT_MAX)
+    count = INT_MAX;
+  return read_all_call (0, count, token, false, &cursor->token,
+			cb_func, userdata, error);
+}
+
+void
+varlink_cursor_close (struct varlink_cursor *cursor)
+{
+  if (cursor == NULL)
+    return;
+  if (cursor->token)
+    read_all_call (0, -1, cursor->token, true, NULL, NULL, NULL, NULL);
+  free (cursor->token);
+  free (cursor);
+}
+
+struct wtmpdb_boot {
+  int64_t id;
+  char *user;
+  uint64_t boottime;
+  uint64_t shutdowntime;
+  char *kernel;
+  uint64_t nextboot;
+  uint64_t sessions;
+  bool crash;
+};
+
+static void
+wtmpdb_boot_free (struct wtmpdb_boot *var)
+{
+  var->user = mfree(var->user);
+  var->kernel = mfree(var->kernel);
+}
+
+int
+varlink_read_boots (int (*cb_func)(void *unused, int argc, char **argv,
+				   char **azColName),
+		    void *userdata, char **error)
+{
+  _cleanup_(read_all_free) struct read_all p = {
+    .success = false,
+    .error = NULL,
+    .contents_json = NULL,
+  };
+  static const sd_json_dispatch_field dispatch_table[] = {
+    { "Success",    SD_JSON_VARIANT_BOOLEAN, sd_json_dispatch_stdbool, offsetof(struct read_all, success), 0 },
+    { "ErrorMsg",   SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct read_all, error), 0 },
+    { "Data",       SD_JSON_VARIANT_ARRAY,   sd_json_dispatch_variant, offsetof(struct read_all, contents_json), 0 },
+    {}
+  };
+  _cleanup_(sd_varlink_unrefp) sd_varlink *link = NULL;
+  sd_json_variant *result;
+  int r;
+
+  r = connect_to_wtmpdbd(&link, _VARLINK_WTMPDB_SOCKET, error);
+  if (r < 0)
+    return r;
+
+  const char *error_id;
+  r = sd_varlink_call(link, "org.openSUSE.wtmpdb.ReadBoots", NULL, &result, &error_id);
+  if (r < 0)
+    {
+      if (error)
+	if (asprintf (error, "Failed to call ReadBoots method: %s",
+		      strerror(-r)) < 0)
+	  *error = strdup ("Out of memory");
+      return r;
+    }
+
+  /* dispatch before checking error_id, we may need the result for the error
+     message */
+  r = sd_json_dispatch(result, dispatch_table, SD_JSON_ALLOW_EXTENSIONS, &p);
+  if (r < 0)
+    {
+      if (error)
+	if (asprintf (error, "Failed to parse JSON answer: %s",
+		      strerror(-r)) < 0)
+	  *error = strdup("Out of memory");
+      return r;
+    }
+
   if (error_id && strlen(error_id) > 0)
     {
       if (error)
@@ -600,26 +1155,26 @@ varlink_read_all (int uniq, int (*cb_func)(void *unused, int argc, char **argv,
 
   for (size_t i = 0; i < sd_json_variant_elements(p.contents_json); i++)
     {
-      static char *azColName[8] = {"ID", "Type", "User", "Login", "Logout", "TTY", "RemoteHost", "Service"};
-      _cleanup_(wtmpdb_entry_free) struct wtmpdb_entry e = {
+      static char *azColName[8] = {"ID", "User", "BootTime", "ShutdownTime", "Kernel", "NextBoot", "Sessions", "Crash"};
+      _cleanup_(wtmpdb_boot_free) struct wtmpdb_boot e = {
 	.id = -1,
-	.type = -1,
 	.user = NULL,
-	.login = 0,
-	.logout = 0,
-	.tty = NULL,
-	.remote_host = NULL,
-	.service = NULL
+	.boottime = 0,
+	.shutdowntime = 0,
+	.kernel = NULL,
+	.nextboot = 0,
+	.sessions = 0,
+	.crash = false
       };
       static const sd_json_dispatch_field dispatch_entry_table[] = {
-	{ "ID",         SD_JSON_VARIANT_INTEGER, sd_json_dispatch_int64,  offsetof(struct wtmpdb_entry, id), SD_JSON_MANDATORY },
-	{ "Type",       SD_JSON_VARIANT_INTEGER, sd_json_dispatch_int,    offsetof(struct wtmpdb_entry, type), 0 },
-	{ "User",       SD_JSON_VARIANT_STRING,  sd_json_dispatch_string, offsetof(struct wtmpdb_entry, user), SD_JSON_MANDATORY },
-	{ "Login",      SD_JSON_VARIANT_INTEGER, sd_json_dispatch_uint64, offsetof(struct wtmpdb_entry, login), 0 },
-	{ "Logout",     SD_JSON_VARIANT_INTEGER, sd_json_dispatch_uint64, offsetof(struct wtmpdb_entry, logout), 0 },
-	{ "TTY",        SD_JSON_VARIANT_STRING,  sd_json_dispatch_string, offsetof(struct wtmpdb_entry, tty), 0 },
-	{ "RemoteHost", SD_JSON_VARIANT_STRING,  sd_json_dispatch_string, offsetof(struct wtmpdb_entry, remote_host), 0 },
-	{ "Service",    SD_JSON_VARIANT_STRING,  sd_json_dispatch_string, offsetof(struct wtmpdb_entry, service), 0 },
+	{ "ID",           SD_JSON_VARIANT_INTEGER, sd_json_dispatch_int64,   offsetof(struct wtmpdb_boot, id), SD_JSON_MANDATORY },
+	{ "User",         SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct wtmpdb_boot, user), SD_JSON_MANDATORY },
+	{ "BootTime",     SD_JSON_VARIANT_INTEGER, sd_json_dispatch_uint64,  offsetof(struct wtmpdb_boot, boottime), 0 },
+	{ "ShutdownTime", SD_JSON_VARIANT_INTEGER, sd_json_dispatch_uint64,  offsetof(struct wtmpdb_boot, shutdowntime), 0 },
+	{ "Kernel",       SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct wtmpdb_boot, kernel), 0 },
+	{ "NextBoot",     SD_JSON_VARIANT_INTEGER, sd_json_dispatch_uint64,  offsetof(struct wtmpdb_boot, nextboot), 0 },
+	{ "Sessions",     SD_JSON_VARIANT_INTEGER, sd_json_dispatch_uint64,  offsetof(struct wtmpdb_boot, sessions), 0 },
+	{ "Crash",        SD_JSON_VARIANT_BOOLEAN, sd_json_dispatch_stdbool, offsetof(struct wtmpdb_boot, crash), 0 },
 	{}
       };
 
@@ -634,43 +1189,37 @@ varlink_read_all (int uniq, int (*cb_func)(void *unused, int argc, char **argv,
       if (r < 0)
 	{
 	  if (error)
-	    if (asprintf (error, "Failed to parse JSON wtmpdb entry: %s",
+	    if (asprintf (error, "Failed to parse JSON boot entry: %s",
 			  strerror(-r)) < 0)
 	      *error = strdup("Out of memory");
 	  return r;
 	}
 
-      char *ret[8];
+      char *ret[8] = { NULL };
       if (asprintf (&ret[0], "%" PRId64, e.id) < 0)
 	return -ENOMEM;
-      if (asprintf (&ret[1], "%i", e.type) < 0)
-	return -ENOMEM;
-      ret[2] = e.user;
-      if (asprintf (&ret[3], "%" PRIu64, e.login) < 0)
-	return -ENOMEM;
-      if (e.logout > 0)
+      ret[1] = e.user;
+      if (asprintf (&ret[2], "%" PRIu64, e.boottime) < 0)
 	{
-	  if (asprintf (&ret[4], "%" PRIu64, e.logout) < 0)
-	    return -ENOMEM;
+	  free (ret[0]);
+	  return -ENOMEM;
 	}
-      else
-	ret[4] = NULL;
-      ret[5] = e.tty;
-      if (strlen(e.remote_host) > 0)
-	ret[6] = e.remote_host;
-      else
+      if (e.shutdowntime > 0 && asprintf (&ret[3], "%" PRIu64, e.shutdowntime) < 0)
+	ret[3] = NULL;
+      ret[4] = (e.kernel && strlen(e.kernel) > 0) ? e.kernel : NULL;
+      if (e.nextboot > 0 && asprintf (&ret[5], "%" PRIu64, e.nextboot) < 0)
+	ret[5] = NULL;
+      if (asprintf (&ret[6], "%" PRIu64, e.sessions) < 0)
 	ret[6] = NULL;
-      if (strlen(e.service) > 0)
-	ret[7] = e.service;
-      else
-	ret[7] = NULL;
+      ret[7] = e.crash ? "1" : "0";
 
-      cb_func(userdata, 8, ret, azColName); /* XXX Don't ignore return value */
+      cb_func(userdata, 8, ret, azColName);
 
       free(ret[0]);
-      free(ret[1]);
+      free(ret[2]);
       free(ret[3]);
-      free(ret[4]);
+      free(ret[5]);
+      free(ret[6]);
     }
 
   return 0;
@@ -27,17 +27,43 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 extern int64_t varlink_login (int type, const char *user,
 			      uint64_t usec_login, const char *tty,
 			      const char *rhost, const char *service,
-			      char **error);
+			      const char *token, char **error);
+extern void varlink_set_timeout (uint64_t usec);
 extern int varlink_logout (int64_t id, uint64_t usec_logout, char **error);
 extern int64_t varlink_get_id (const char *tty, char **error);
 extern int varlink_read_all (int uniq, int (*cb_func)(void *unused, int argc, char **argv,
 					    char **azColName),
 			     void *userdata, char **error);
+extern int varlink_get_last_login (const char *user,
+				   int (*cb_func)(void *unused, int argc, char **argv,
+						  char **azColName),
+				   void *userdata, char **error);
+struct wtmpdb_match;
+extern int varlink_read_match (const struct wtmpdb_match *match,
+			       int (*cb_func)(void *unused, int argc, char **argv,
+					      char **azColName),
+			       void *userdata, char **error);
+struct varlink_cursor;
+extern int varlink_cursor_open (int uniq, struct varlink_cursor **cursor,
+				char **error);
+extern int varlink_cursor_read (struct varlink_cursor *cursor, size_t count,
+				int (*cb_func)(void *unused, int argc, char **argv,
+					       char **azColName),
+				void *userdata, char **error);
+extern void varlink_cursor_close (struct varlink_cursor *cursor);
+extern int varlink_read_boots (int (*cb_func)(void *unused, int argc, char **argv,
+					      char **azColName),
+			       void *userdata, char **error);
 extern int varlink_get_boottime (uint64_t *boottime, char **error);
-extern int varlink_rotate (const int days, char **wtmpdb_name,
-			   uint64_t *entries, char **error);
+extern int varlink_backup (const char *dest, unsigned int flags,
+			   char **error);
+struct wtmpdb_rotate_opts;
+extern int varlink_rotate (const struct wtmpdb_rotate_opts *opts,
+			   char **wtmpdb_name, uint64_t *entries,
+			   char **error);
@@ -0,0 +1,316 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Stable pseudonyms for user names and remote hosts.
+
+   The pseudonyms are derived with SipHash-2-4, keyed by the seed given
+   by the user (or a random key), so the same input always maps to the
+   same pseudonym for the same seed, but cannot be reversed without it.
+   Every distinct input is hashed only once, the result is memoized.
+   The pseudonyms are short, so two inputs can get the same one; the
+   memo keeps the pseudonyms handed out and the later input gets hashed
+   again with the next round of the key until its pseudonym is unused.
+   Within one run, distinct inputs always get distinct pseudonyms. */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/random.h>
+
+#include "anon.h"
+
+static uint64_t key[2];
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND \
+  do { \
+    v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32); \
+    v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2; \
+    v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0; \
+    v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32); \
+  } while (0)
+
+static uint64_t
+siphash24 (const uint64_t k[2], char domain, const char *in, size_t len)
+{
+  uint64_t v0 = 0x736f6d6570736575ULL ^ k[0];
+  uint64_t v1 = 0x646f72616e646f6dULL ^ k[1];
+  uint64_t v2 = 0x6c7967656e657261ULL ^ k[0];
+  uint64_t v3 = 0x7465646279746573ULL ^ k[1];
+  uint64_t b = ((uint64_t)(len + 1)) << 56;
+  uint64_t m = 0;
+  size_t n = 0;
+
+  /* the domain byte separates users from hosts */
+  for (size_t i = 0; i <= len; i++)
+    {
+      unsigned char c = i == 0 ? (unsigned char)domain : (unsigned char)in[i - 1];
+
+      m |= ((uint64_t)c) << (8 * n);
+      if (++n == 8)
+	{
+	  v3 ^= m;
+	  SIPROUND;
+	  SIPROUND;
+	  v0 ^= m;
+	  m = 0;
+	  n = 0;
+	}
+    }
+  b |= m;
+
+  v3 ^= b;
+  SIPROUND;
+  SIPROUND;
+  v0 ^= b;
+  v2 ^= 0xff;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/* Initializes the key from seed, or randomly if seed is NULL.
+   Returns 0 on success, <0 on failure. */
+int
+anon_init (const char *seed)
+{
+  if (seed == NULL)
+    return getrandom (key, sizeof (key), 0) == sizeof (key) ? 0 : -errno;
+
+  static const uint64_t zero[2] = {0, 0};
+  key[0] = siphash24 (zero, '0', seed, strlen (seed));
+  key[1] = siphash24 (zero, '1', seed, strlen (seed));
+  return 0;
+}
+
+struct memo_entry {
+  char *in;
+  char *out;
+};
+
+struct memo {
+  size_t n, size;
+  struct memo_entry *tab;
+  const char **outs;	/* the pseudonyms of tab, hashed by themselves */
+};
+
+static struct memo users, hosts;
+
+static uint64_t
+memo_hash (const char *s)
+{
+  /* FNV-1a, only used for the hash table */
+  uint64_t h = 0xcbf29ce484222325ULL;
+
+  for (; *s; s++)
+    {
+      h ^= (unsigned char)*s;
+      h *= 0x100000001b3ULL;
+    }
+  return h;
+}
+
+static struct memo_entry *
+memo_lookup (struct memo *m, const char *in)
+{
+  size_t i = memo_hash (in) & (m->size - 1);
+
+  while (m->tab[i].in && strcmp (m->tab[i].in, in) != 0)
+    i = (i + 1) & (m->size - 1);
+  return &m->tab[i];
+}
+
+static const char **
+memo_lookup_out (struct memo *m, const char *out)
+{
+  size_t i = memo_hash (out) & (m->size - 1);
+
+  while (m->outs[i] && strcmp (m->outs[i], out) != 0)
+    i = (i + 1) & (m->size - 1);
+  return &m->outs[i];
+}
+
+static int
+memo_grow (struct memo *m)
+{
+  struct memo old = *m;
+
+  m->size = old.size ? old.size * 2 : 64;
+  m->n = 0;
+  m->tab = calloc (m->size, sizeof (*m->tab));
+  m->outs = calloc (m->size, sizeof (*m->outs));
+  if (m->tab == NULL || m->outs == NULL)
+    {
+      free (m->tab);
+      free (m->outs);
+      *m = old;
+      return -ENOMEM;
+    }
+  for (size_t i = 0; i < old.size; i++)
+    if (old.tab[i].in)
+      {
+	*memo_lookup (m, old.tab[i].in) = old.tab[i];
+	*memo_lookup_out (m, old.tab[i].out) = old.tab[i].out;
+	m->n++;
+      }
+  free (old.tab);
+  free (old.outs);
+  return 0;
+}
+
+/* Returns the memoized pseudonym of in, creating it with make() if
+   needed. make() gets the round of the key to use, which is only
+   increased if the pseudonym was handed out for another input. */
+static const char *
+memo_get (struct memo *m, const char *in,
+	  char *(*make)(const char *in, uint64_t round))
+{
+  struct memo_entry *e;
+  const char **o;
+  char *out;
+
+  if (2 * (m->n + 1) > m->size && memo_grow (m) < 0)
+    goto oom;
+
+  e = memo_lookup (m, in);
+  if (e->in)
+    return e->out;
+
+  for (uint64_t round = 0;; round++)
+    {
+      if ((out = make (in, round)) == NULL)
+	goto oom;
+      o = memo_lookup_out (m, out);
+      if (*o == NULL)
+	break;
+      free (out);
+    }
+
+  if ((e->in = strdup (in)) == NULL)
+    {
+      free (out);
+      goto oom;
+    }
+  e->out = out;
+  *o = out;
+  m->n++;
+  return e->out;
+
+ oom:
+  fprintf (stderr, "Out of memory\n");
+  exit (EXIT_FAILURE);
+}
+
+/* SipHash of in with the key of the given round, round 0 is the key
+   from anon_init */
+static uint64_t
+anon_hash (char domain, const char *in, uint64_t round)
+{
+  const uint64_t k[2] = { key[0] + round, key[1] };
+
+  return siphash24 (k, domain, in, strlen (in));
+}
+
+static void
+encode (char *buf, size_t len, uint64_t h)
+{
+  static const char alphabet[] = "abcdefghijkmnpqrstuvwxyz23456789";
+
+  for (size_t i = 0; i < len; i++, h >>= 5)
+    buf[i] = alphabet[h & 31];
+  buf[len] = '\0';
+}
+
+static char *
+make_user (const char *user, uint64_t round)
+{
+  char buf[9];
+
+  buf[0] = 'u';
+  encode (buf + 1, 7, anon_hash ('u', user, round));
+  return strdup (buf);
+}
+
+static char *
+make_host (const char *host, uint64_t round)
+{
+  uint64_t h = anon_hash ('h', host, round);
+  char buf[INET6_ADDRSTRLEN];
+  struct in_addr a4;
+  struct in6_addr a6;
+
+  if (inet_pton (AF_INET, host, &a4) == 1)
+    {
+      /* private range, so it cannot be mistaken for a real address */
+      snprintf (buf, sizeof (buf), "10.%u.%u.%u",
+		(unsigned)(h & 0xff), (unsigned)((h >> 8) & 0xff),
+		(unsigned)((h >> 16) & 0xff));
+    }
+  else if (inet_pton (AF_INET6, host, &a6) == 1)
+    {
+      /* unique local address */
+      uint64_t h2 = anon_hash ('H', host, round);
+
+      a6.s6_addr[0] = 0xfd;
+      for (int i = 1; i < 8; i++)
+	a6.s6_addr[i] = (h >> (8 * i)) & 0xff;
+      for (int i = 8; i < 16; i++)
+	a6.s6_addr[i] = (h2 >> (8 * (i - 8))) & 0xff;
+      if (inet_ntop (AF_INET6, &a6, buf, sizeof (buf)) == NULL)
+	return NULL;
+    }
+  else
+    {
+      memcpy (buf, "host-", 5);
+      encode (buf + 5, 8, h);
+    }
+
+  return strdup (buf);
+}
+
+const char *
+anon_user (const char *user)
+{
+  return memo_get (&users, user, make_user);
+}
+
+const char *
+anon_host (const char *host)
+{
+  if (host[0] == '\0')
+    return host;
+  return memo_get (&hosts, host, make_host);
+}
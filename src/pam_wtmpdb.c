@@ -26,6 +26,7 @@
 */
 
 #include <time.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,6 +40,7 @@
 #define WTMPDB_DEBUG        01  /* send info to syslog(3) */
 #define WTMPDB_QUIET        02  /* keep quiet about things */
 #define WTMPDB_SKIP         04  /* Skip if service is in skip list */
+#define WTMPDB_SHOWLAST    010  /* show the previous login of the user */
 
 static const char *wtmpdb_path = _PATH_WTMPDB;
 
@@ -148,8 +150,31 @@ _pam_parse_args (pam_handle_t *pamh,
 	ctrl |= WTMPDB_DEBUG;
       else if (strcmp (*argv, "silent") == 0)
 	ctrl |= WTMPDB_QUIET;
+      else if (strcmp (*argv, "showlast") == 0)
+	ctrl |= WTMPDB_SHOWLAST;
       else if ((str = skip_prefix(*argv, "database=")) != NULL)
 	wtmpdb_path = str;
+      else if ((str = skip_prefix (*argv, "busy_timeout=")) != NULL)
+	{
+	  char *ep;
+	  unsigned long msec = strtoul (str, &ep, 10);
+
+	  if (*str == '\0' || *ep != '\0')
+	    pam_syslog (pamh, LOG_ERR, "Invalid busy_timeout: %s", str);
+	  else
+	    wtmpdb_set_busy_timeout ((uint64_t)msec * 1000);
+	}
+      else if ((str = skip_prefix (*argv, "daemon_timeout=")) != NULL)
+	{
+	  char *ep;
+	  unsigned long msec = strtoul (str, &ep, 10);
+
+	  if (*str == '\0' || *ep != '\0' || msec == 0)
+	    pam_syslog (pamh, LOG_ERR, "Invalid daemon_timeout: %s", str);
+	  else
+	    wtmpdb_set_varlink_timeout ((uint64_t)msec * 1000,
+					WTMPDB_VARLINK_FALLBACK);
+	}
       else if ((str = skip_prefix (*argv, "skip_if=")) != NULL)
         {
           const void *void_str = NULL;
@@ -209,6 +234,62 @@ free_idptr(pam_handle_t *pamh __attribute__((__unused__)), void *idptr,
   free (idptr);
 }
 
+struct last_login {
+  char time[64];
+  char tty[64];
+  char rhost[256];
+};
+
+static int
+last_login_cb (void *data, int argc, char **argv,
+	       char **azColName __attribute__((__unused__)))
+{
+  struct last_login *l = data;
+  time_t t;
+  struct tm tm;
+
+  if (argc != 8 || argv[3] == NULL)
+    return 0;
+
+  t = strtoull (argv[3], NULL, 10) / USEC_PER_SEC;
+  if (localtime_r (&t, &tm) == NULL ||
+      strftime (l->time, sizeof (l->time), "%a %b %e %H:%M:%S %Z %Y",
+		&tm) == 0)
+    l->time[0] = '\0';
+  snprintf (l->tty, sizeof (l->tty), "%s", argv[5] ? argv[5] : "");
+  snprintf (l->rhost, sizeof (l->rhost), "%s", argv[6] ? argv[6] : "");
+  return 0;
+}
+
+/* Shows the previous login like pam_lastlog, must run before the new
+   one is written. */
+static void
+show_last_login (pam_handle_t *pamh, int ctrl, const char *user)
+{
+  struct last_login l = { "", "", "" };
+  char *error = NULL;
+  int r;
+
+  r = wtmpdb_get_last_login (wtmpdb_path, user, last_login_cb, &l, &error);
+  if (r < 0)
+    {
+      if (r != -ENOENT)
+	pam_syslog (pamh, LOG_ERR, "Cannot get last login of %s: %s", user,
+		    error ? error : strerror (-r));
+      else if (ctrl & WTMPDB_DEBUG)
+	pam_syslog (pamh, LOG_DEBUG, "No previous login of %s", user);
+      free (error);
+      return;
+    }
+  if (l.time[0] == '\0')
+    return;
+
+  if (l.rhost[0] != '\0')
+    pam_info (pamh, "Last login: %s from %s on %s", l.time, l.rhost, l.tty);
+  else
+    pam_info (pamh, "Last login: %s on %s", l.time, l.tty);
+}
+
 int
 pam_sm_open_session (pam_handle_t *pamh, int flags,
 		     int argc, const char **argv)
@@ -284,6 +365,9 @@ pam_sm_open_session (pam_handle_t *pamh, int flags,
   if (ctrl & WTMPDB_DEBUG)
     pam_syslog (pamh, LOG_DEBUG, "service=%s", service);
 
+  if ((ctrl & WTMPDB_SHOWLAST) && !(ctrl & WTMPDB_QUIET))
+    show_last_login (pamh, ctrl, user);
+
   if ((id = logwtmpdb (wtmpdb_path, tty, user, rhost, service, &error)) < 0)
     {
       if (error)
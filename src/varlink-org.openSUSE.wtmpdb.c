@@ -12,6 +12,16 @@ static SD_VARLINK_DEFINE_STRUCT_TYPE(WtmpdbEntry,
 				     SD_VARLINK_DEFINE_FIELD(RemoteHost, SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
 				     SD_VARLINK_DEFINE_FIELD(Service,    SD_VARLINK_STRING, SD_VARLINK_NULLABLE));
 
+static SD_VARLINK_DEFINE_STRUCT_TYPE(WtmpdbBoot,
+				     SD_VARLINK_DEFINE_FIELD(ID,           SD_VARLINK_INT,    0),
+				     SD_VARLINK_DEFINE_FIELD(User,         SD_VARLINK_STRING, 0),
+				     SD_VARLINK_DEFINE_FIELD(BootTime,     SD_VARLINK_INT,    0),
+				     SD_VARLINK_DEFINE_FIELD(ShutdownTime, SD_VARLINK_INT,    SD_VARLINK_NULLABLE),
+				     SD_VARLINK_DEFINE_FIELD(Kernel,       SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
+				     SD_VARLINK_DEFINE_FIELD(NextBoot,     SD_VARLINK_INT,    SD_VARLINK_NULLABLE),
+				     SD_VARLINK_DEFINE_FIELD(Sessions,     SD_VARLINK_INT,    0),
+				     SD_VARLINK_DEFINE_FIELD(Crash,        SD_VARLINK_BOOL,   0));
+
 static SD_VARLINK_DEFINE_METHOD(
 		Login,
 		SD_VARLINK_FIELD_COMMENT("Request to add a login record"),
@@ -21,6 +31,8 @@ static SD_VARLINK_DEFINE_METHOD(
 		SD_VARLINK_DEFINE_INPUT(TTY, SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
 		SD_VARLINK_DEFINE_INPUT(RemoteHost, SD_VARLINK_STRING,  SD_VARLINK_NULLABLE),
 		SD_VARLINK_DEFINE_INPUT(Service, SD_VARLINK_STRING,  SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("A login with the token of an earlier one returns its ID"),
+		SD_VARLINK_DEFINE_INPUT(Token, SD_VARLINK_STRING,  SD_VARLINK_NULLABLE),
 		SD_VARLINK_DEFINE_OUTPUT(ID, SD_VARLINK_INT, 0),
 		SD_VARLINK_DEFINE_OUTPUT(ErrorMsg, SD_VARLINK_STRING, SD_VARLINK_NULLABLE));
 
@@ -50,19 +62,71 @@ static SD_VARLINK_DEFINE_METHOD(
                 ReadAll,
                 SD_VARLINK_FIELD_COMMENT("Get all entries from the database"),
 		SD_VARLINK_DEFINE_INPUT(Uniq, SD_VARLINK_INT,  0),
+		SD_VARLINK_FIELD_COMMENT("Return at most Limit entries and a Cursor for the next ones"),
+		SD_VARLINK_DEFINE_INPUT(Limit,  SD_VARLINK_INT,    SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Continue reading the state of the database the cursor was opened on"),
+		SD_VARLINK_DEFINE_INPUT(Cursor, SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Release the cursor without reading"),
+		SD_VARLINK_DEFINE_INPUT(Close,  SD_VARLINK_BOOL,   SD_VARLINK_NULLABLE),
 		SD_VARLINK_DEFINE_OUTPUT(Success,  SD_VARLINK_BOOL, 0),
 		SD_VARLINK_DEFINE_OUTPUT_BY_TYPE(Data, WtmpdbEntry, SD_VARLINK_ARRAY | SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Unset after the last page"),
+		SD_VARLINK_DEFINE_OUTPUT(Cursor, SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
+                SD_VARLINK_DEFINE_OUTPUT(ErrorMsg, SD_VARLINK_STRING, SD_VARLINK_NULLABLE));
+
+static SD_VARLINK_DEFINE_METHOD(
+		GetLastLogin,
+		SD_VARLINK_FIELD_COMMENT("Get the newest login of User"),
+		SD_VARLINK_DEFINE_INPUT(User, SD_VARLINK_STRING, 0),
+		SD_VARLINK_DEFINE_OUTPUT(Success,  SD_VARLINK_BOOL, 0),
+		SD_VARLINK_DEFINE_OUTPUT_BY_TYPE(Data, WtmpdbEntry, SD_VARLINK_ARRAY | SD_VARLINK_NULLABLE),
+		SD_VARLINK_DEFINE_OUTPUT(ErrorMsg, SD_VARLINK_STRING, SD_VARLINK_NULLABLE));
+
+static SD_VARLINK_DEFINE_METHOD(
+		ReadMatch,
+		SD_VARLINK_FIELD_COMMENT("Get the entries with User, RemoteHost and TTY, unset matches all, also from the archives"),
+		SD_VARLINK_DEFINE_INPUT(User,       SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
+		SD_VARLINK_DEFINE_INPUT(RemoteHost, SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
+		SD_VARLINK_DEFINE_INPUT(TTY,        SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
+		SD_VARLINK_DEFINE_OUTPUT(Success,  SD_VARLINK_BOOL, 0),
+		SD_VARLINK_DEFINE_OUTPUT_BY_TYPE(Data, WtmpdbEntry, SD_VARLINK_ARRAY | SD_VARLINK_NULLABLE),
+		SD_VARLINK_DEFINE_OUTPUT(ErrorMsg, SD_VARLINK_STRING, SD_VARLINK_NULLABLE));
+
+static SD_VARLINK_DEFINE_METHOD(
+                ReadBoots,
+                SD_VARLINK_FIELD_COMMENT("Get one entry per boot with session count and crash flag"),
+		SD_VARLINK_DEFINE_OUTPUT(Success,  SD_VARLINK_BOOL, 0),
+		SD_VARLINK_DEFINE_OUTPUT_BY_TYPE(Data, WtmpdbBoot, SD_VARLINK_ARRAY | SD_VARLINK_NULLABLE),
                 SD_VARLINK_DEFINE_OUTPUT(ErrorMsg, SD_VARLINK_STRING, SD_VARLINK_NULLABLE));
 
 static SD_VARLINK_DEFINE_METHOD(
 		Rotate,
 		SD_VARLINK_FIELD_COMMENT("Request to rotate database"),
 		SD_VARLINK_DEFINE_INPUT(Days,        SD_VARLINK_INT,  0),
+		SD_VARLINK_FIELD_COMMENT("Archive the whole database, keep open sessions and the last boot"),
+		SD_VARLINK_DEFINE_INPUT(Swap,        SD_VARLINK_BOOL, SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Store the archive page-compressed as <archive>.z"),
+		SD_VARLINK_DEFINE_INPUT(Compress,    SD_VARLINK_BOOL, SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Rotate only if the database is larger (bytes) or has more entries"),
+		SD_VARLINK_DEFINE_INPUT(MaxSize,     SD_VARLINK_INT,  SD_VARLINK_NULLABLE),
+		SD_VARLINK_DEFINE_INPUT(MaxRows,     SD_VARLINK_INT,  SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Remove all but the newest archives resp. archives older than days"),
+		SD_VARLINK_DEFINE_INPUT(Keep,        SD_VARLINK_INT,  SD_VARLINK_NULLABLE),
+		SD_VARLINK_DEFINE_INPUT(KeepDays,    SD_VARLINK_INT,  SD_VARLINK_NULLABLE),
 		SD_VARLINK_DEFINE_OUTPUT(Success,    SD_VARLINK_BOOL, 0),
 		SD_VARLINK_DEFINE_OUTPUT(Entries,    SD_VARLINK_INT, SD_VARLINK_NULLABLE),
 		SD_VARLINK_DEFINE_OUTPUT(BackupName, SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
 		SD_VARLINK_DEFINE_OUTPUT(ErrorMsg,   SD_VARLINK_STRING, SD_VARLINK_NULLABLE));
 
+static SD_VARLINK_DEFINE_METHOD(
+		Backup,
+		SD_VARLINK_FIELD_COMMENT("Copy the database to Destination while it is in use. Destination is an absolute path in the sandbox of wtmpdbd, only below /var/lib/wtmpdb with the shipped unit"),
+		SD_VARLINK_DEFINE_INPUT(Destination, SD_VARLINK_STRING, 0),
+		SD_VARLINK_FIELD_COMMENT("Create a compact copy with VACUUM INTO"),
+		SD_VARLINK_DEFINE_INPUT(Vacuum,      SD_VARLINK_BOOL, SD_VARLINK_NULLABLE),
+		SD_VARLINK_DEFINE_OUTPUT(Success,    SD_VARLINK_BOOL, 0),
+		SD_VARLINK_DEFINE_OUTPUT(ErrorMsg,   SD_VARLINK_STRING, SD_VARLINK_NULLABLE));
+
 static SD_VARLINK_DEFINE_METHOD(
 		Quit,
 		SD_VARLINK_FIELD_COMMENT("Stop the daemon"),
@@ -79,6 +143,12 @@ static SD_VARLINK_DEFINE_METHOD(
                 SD_VARLINK_FIELD_COMMENT("The maximum log level, using BSD syslog log level integers."),
                 SD_VARLINK_DEFINE_INPUT(Level, SD_VARLINK_INT, SD_VARLINK_NULLABLE));
 
+static SD_VARLINK_DEFINE_METHOD(
+		GetStats,
+		SD_VARLINK_FIELD_COMMENT("Replies of ReadAll and GetBootTime served from the cache resp. computed"),
+		SD_VARLINK_DEFINE_OUTPUT(CacheHits,   SD_VARLINK_INT, 0),
+		SD_VARLINK_DEFINE_OUTPUT(CacheMisses, SD_VARLINK_INT, 0));
+
 static SD_VARLINK_DEFINE_METHOD(
                 GetEnvironment,
                 SD_VARLINK_FIELD_COMMENT("Returns the current environment block, i.e. the contents of environ[]."),
@@ -86,6 +156,7 @@ static SD_VARLINK_DEFINE_METHOD(
 
 static SD_VARLINK_DEFINE_ERROR(NoEntryFound);
 static SD_VARLINK_DEFINE_ERROR(InternalError);
+static SD_VARLINK_DEFINE_ERROR(InvalidCursor);
 
 SD_VARLINK_DEFINE_INTERFACE(
                 org_openSUSE_wtmpdb,
@@ -93,6 +164,8 @@ SD_VARLINK_DEFINE_INTERFACE(
 		SD_VARLINK_INTERFACE_COMMENT("Wtmpdbd control APIs"),
 		SD_VARLINK_SYMBOL_COMMENT("Wtmpdb entry struct"),
 		&vl_type_WtmpdbEntry,
+		SD_VARLINK_SYMBOL_COMMENT("Wtmpdb boot struct"),
+		&vl_type_WtmpdbBoot,
 		SD_VARLINK_SYMBOL_COMMENT("Add login entry"),
                 &vl_method_Login,
 		SD_VARLINK_SYMBOL_COMMENT("Close login entry with logout time"),
@@ -103,15 +176,29 @@ SD_VARLINK_DEFINE_INTERFACE(
                 &vl_method_GetBootTime,
 		SD_VARLINK_SYMBOL_COMMENT("Get all entries from database"),
                 &vl_method_ReadAll,
+		SD_VARLINK_SYMBOL_COMMENT("Get newest login of a user"),
+                &vl_method_GetLastLogin,
+		SD_VARLINK_SYMBOL_COMMENT("Get the entries of a user, host or TTY"),
+                &vl_method_ReadMatch,
+		SD_VARLINK_SYMBOL_COMMENT("Get all boots from database"),
+                &vl_method_ReadBoots,
+		SD_VARLINK_SYMBOL_COMMENT("Rotate database"),
+                &vl_method_Rotate,
+		SD_VARLINK_SYMBOL_COMMENT("Backup database"),
+                &vl_method_Backup,
  		SD_VARLINK_SYMBOL_COMMENT("Stop the daemon"),
                 &vl_method_Quit,
 		SD_VARLINK_SYMBOL_COMMENT("Checks if the service is running."),
                 &vl_method_Ping,
                 SD_VARLINK_SYMBOL_COMMENT("Sets the maximum log level."),
                 &vl_method_SetLogLevel,
+		SD_VARLINK_SYMBOL_COMMENT("Get statistics of the daemon"),
+		&vl_method_GetStats,
                 SD_VARLINK_SYMBOL_COMMENT("Get current environment block."),
                 &vl_method_GetEnvironment,
 		SD_VARLINK_SYMBOL_COMMENT("No entry found"),
                 &vl_error_NoEntryFound,
 		SD_VARLINK_SYMBOL_COMMENT("Internal Error"),
-		&vl_error_InternalError);
+		&vl_error_InternalError,
+		SD_VARLINK_SYMBOL_COMMENT("Cursor of ReadAll is unknown or expired"),
+		&vl_error_InvalidCursor);
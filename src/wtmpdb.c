@@ -53,6 +53,7 @@
 #endif
 
 #include "import.h"
+#include "anon.h"
 #include "wtmpdb.h"
 
 static char *wtmpdb_path = NULL;
@@ -77,6 +78,16 @@ static const char *TM_FMT_SPEC[] = {
 };
 
 #define TIMEFMT_VALUE 255
+#define CACHE_VALUE 254
+#define ANONYMIZE_VALUE 253
+#define MAX_SIZE_VALUE 252
+#define MAX_ROWS_VALUE 251
+#define KEEP_VALUE 250
+#define KEEP_DAYS_VALUE 249
+#define VACUUM_VALUE 248
+#define TEXTFILE_VALUE 247
+#define USER_VALUE 246
+#define HOST_VALUE 245
 
 #define LOGROTATE_DAYS 60
 
@@ -111,6 +122,14 @@ static uint64_t present = 0; /* Who was present at the specified time in µs? */
 static uint64_t since = 0; /* Who was logged in after this time in µs? */
 static uint64_t until = 0; /* Who was logged in until this time in µs? */
 static char **match = NULL; /* user/tty to display only */
+static struct wtmpdb_match filter; /* --user/--host, read via read_match */
+static uint64_t last_reboot = UINT64_MAX; /* oldest boot seen so far */
+static uint64_t *boots = NULL; /* boot times for filter, newest first */
+static size_t n_boots = 0;
+static size_t next_boot = 0;
+static int use_cache = 0;
+static int anonymize = 0;
+static const char *cache_dir = NULL; /* NULL = _PATH_WTMPDB_CACHE */
 
 typedef enum cmd_idx {
 	CMD_NONE = 0,
@@ -120,12 +139,18 @@ typedef enum cmd_idx {
 	CMD_BOOTTIME,
 	CMD_ROTATE,
 	CMD_IMPORT,
+	CMD_BOOTS,
+	CMD_BACKUP,
+	CMD_OPTIMIZE,
+	CMD_METRICS,
 	CMD_MAX			/* per contract the always the last one */
 } cmd_idx_t;
 
 static const char *cmd_name[] = {
 	"unknown",	"last",		"boot",		"shutdown",		"boottime",
-	"rotate",	"import",	NULL
+	"rotate",	"import",	"boots",	"backup",	"optimize",
+	"metrics",
+	NULL
 };
 
 
@@ -454,8 +479,6 @@ static int
 print_entry(void *unused __attribute__((__unused__)),
 	int argc, char **argv, char **azColName)
 {
-	static uint64_t last_reboot = UINT64_MAX;
-
 	char host_buf[NI_MAXHOST];
 	struct times_buf {
 		char login[LAST_TIMESTAMP_LEN];
@@ -629,6 +652,11 @@ print_entry(void *unused __attribute__((__unused__)),
 		}
 	}
 
+	if (anonymize && type == USER_PROCESS) {
+		user = anon_user(user);
+		host = anon_host(host);
+	}
+
 	if (xflag && (type == BOOT_TIME) && last_reboot != UINT64_MAX && has_logout) {
 		/* A little bit odd because this function is expected to be applied to
 			a record list ordered by login_t, at least if boot record selection
@@ -676,7 +704,8 @@ usage (int retval, cmd_idx_t cmd)
     fputs("\n\nCommon options:\n", output);
   } else {
     fprintf (output, "Usage: wtmpdb %s [options]%s\n", cmd_name[cmd],
-		(cmd == CMD_LAST || cmd == CMD_IMPORT) ? " [operand]" : "");
+		(cmd == CMD_LAST || cmd == CMD_IMPORT || cmd == CMD_BACKUP)
+		? " [operand]" : "");
     fputs ("\nOptions:\n", output);
   }
   fputs ("  -f, --file FILE     Use FILE as wtmpdb database\n", output);
@@ -686,9 +715,12 @@ usage (int retval, cmd_idx_t cmd)
     fprintf (output, "\nOptions for %s:\n", cmd_name[CMD_LAST]);
   if (cmd == CMD_LAST || cmd == CMD_NONE) {
   fputs ("  -a, --hostlast      Display hostnames as last entry\n", output);
+  fputs ("  --anonymize[=SEED]  Replace user and host names by pseudonyms\n", output);
+  fputs ("  --cache[=DIR]       Keep the result in DIR and reuse it if possible\n", output);
   fputs ("  -c, --compact       Hide logouts and set login time format to 'compact'\n", output);
   fputs ("  -d, --dns           Translate IP addresses into a hostname\n", output);
   fputs ("  -F, --fulltimes     Display full times and dates\n", output);
+  fputs ("  --host HOST         Read only the entries from HOST\n", output);
   fputs ("  -i, --ip            Translate hostnames to IP addresses\n", output);
   fputs ("  -j, --json          Generate JSON output\n", output);
   fputs ("  -L, --legacy        Session duration precision in minutes instead of seconds\n", output);
@@ -700,6 +732,7 @@ usage (int retval, cmd_idx_t cmd)
   fputs ("  -s, --since TIME    Display who was logged in after TIME\n", output);
   fputs ("  -t, --until TIME    Display who was logged in until TIME\n", output);
   fputs ("  -u, --unique        Display the latest entry for each user, only.\n", output);
+  fputs ("  --user USER         Read only the entries of USER\n", output);
   fputs ("  -w, --fullnames     Display full IP addresses and user and domain names\n", output);
   fputs ("  -x, --system        Display system shutdown entries\n", output);
     fputs ("  --time-format FMT   Display timestamps in the specified format.\n", output);
@@ -719,6 +752,21 @@ usage (int retval, cmd_idx_t cmd)
     fputs ("\nOptions for rotate (exports old entries to wtmpdb_<datetime>)):\n", output);
   if (cmd == CMD_NONE || cmd == CMD_ROTATE) {
   fputs ("  -d, --days INTEGER  Export all entries which are older than the given days\n", output);
+  fputs ("  -s, --swap          Archive the whole database, keep open sessions and the\n"
+	 "                      last boot in the new one\n", output);
+  fputs ("  -z, --compress      Store the archive page-compressed, it stays readable\n", output);
+  fputs ("  --max-size SIZE[KMG] Rotate only if the database is larger\n", output);
+  fputs ("  --max-rows N        Rotate only if the database has more entries\n", output);
+  fputs ("  --keep N            Remove all but the newest N archives\n", output);
+  fputs ("  --keep-days DAYS    Remove archives older than DAYS days\n", output);
+  }
+  if (cmd == CMD_NONE)
+    fprintf (output, "\nOptions for %s:\n", cmd_name[CMD_BOOTS]);
+  if (cmd == CMD_NONE || cmd == CMD_BOOTS) {
+  fputs ("  -j, --json          Generate JSON output\n", output);
+  fputs ("  -n, --limit N       Display only the last N boots\n", output);
+  fputs ("  --time-format FMT   Display timestamps in the specified format.\n", output);
+  fputs ("  -w, --fullnames     Display full user and kernel names\n", output);
   }
   if (cmd == CMD_NONE)
     fprintf (output, "\nOperands for %s:\n", cmd_name[CMD_IMPORT]);
@@ -726,9 +774,57 @@ usage (int retval, cmd_idx_t cmd)
     fputs ("\nOperands:\n", output);
   if (cmd == CMD_IMPORT || cmd == CMD_NONE)
   fputs ("  logs...             Legacy log files to import\n", output);
+  if (cmd == CMD_NONE)
+    fprintf (output, "\nOptions for %s:\n", cmd_name[CMD_BACKUP]);
+  if (cmd == CMD_NONE || cmd == CMD_BACKUP) {
+  fputs ("  --vacuum            Create a compact copy in one transaction\n", output);
+  }
+  if (cmd == CMD_NONE)
+    fprintf (output, "\nOperands for %s:\n", cmd_name[CMD_BACKUP]);
+  if (cmd == CMD_BACKUP)
+    fputs ("\nOperands:\n", output);
+  if (cmd == CMD_BACKUP || cmd == CMD_NONE)
+  fputs ("  dest                File (directory) to write the copy to\n", output);
+  if (cmd == CMD_NONE)
+    fprintf (output, "\nOptions for %s:\n", cmd_name[CMD_METRICS]);
+  if (cmd == CMD_NONE || cmd == CMD_METRICS) {
+  fputs ("  --textfile PATH     Replace PATH instead of writing to stdout\n", output);
+  }
   exit (retval);
 }
 
+/* Parses a size with an optional K, M or G suffix (base 1024). */
+static int
+parse_size (const char *str, uint64_t *size)
+{
+  char *endptr;
+  uint64_t val;
+
+  errno = 0;
+  val = strtoull (str, &endptr, 10);
+  if (errno != 0 || endptr == str)
+    return -EINVAL;
+  switch (*endptr)
+    {
+    case 'G': case 'g':
+      val *= 1024;
+      /* fallthrough */
+    case 'M': case 'm':
+      val *= 1024;
+      /* fallthrough */
+    case 'K': case 'k':
+      val *= 1024;
+      endptr++;
+      break;
+    default:
+      break;
+    }
+  if (*endptr != '\0')
+    return -EINVAL;
+  *size = val;
+  return 0;
+}
+
 static int
 main_rotate (int argc, char **argv)
 {
@@ -736,17 +832,23 @@ main_rotate (int argc, char **argv)
     {"help",     no_argument,       NULL, 'h'},
     {"version",  no_argument,       NULL, 'v'},
     {"file", required_argument, NULL, 'f'},
-    {"days", no_argument, NULL, 'd'},
+    {"days", required_argument, NULL, 'd'},
+    {"swap", no_argument, NULL, 's'},
+    {"compress", no_argument, NULL, 'z'},
+    {"max-size", required_argument, NULL, MAX_SIZE_VALUE},
+    {"max-rows", required_argument, NULL, MAX_ROWS_VALUE},
+    {"keep", required_argument, NULL, KEEP_VALUE},
+    {"keep-days", required_argument, NULL, KEEP_DAYS_VALUE},
     {NULL, 0, NULL, '\0'}
   };
   char *error = NULL;
-  int days = LOGROTATE_DAYS;
-  char *wtmpdb_backup = NULL;
+  struct wtmpdb_rotate_opts opts = { .days = LOGROTATE_DAYS };
+  char *backup_name = NULL;
   uint64_t entries = 0;
 
   int c;
 
-  while ((c = getopt_long (argc, argv, "f:d:hv", longopts, NULL)) != -1)
+  while ((c = getopt_long (argc, argv, "f:d:szhv", longopts, NULL)) != -1)
     {
       switch (c)
         {
@@ -754,7 +856,29 @@ main_rotate (int argc, char **argv)
           wtmpdb_path = optarg;
           break;
 	case 'd':
-	  days = atoi (optarg);
+	  opts.days = atoi (optarg);
+	  break;
+	case 's':
+	  opts.flags |= WTMPDB_ROTATE_SWAP;
+	  break;
+	case 'z':
+	  opts.flags |= WTMPDB_ROTATE_COMPRESS;
+	  break;
+	case MAX_SIZE_VALUE:
+	  if (parse_size (optarg, &opts.max_size) < 0)
+	    {
+	      fprintf (stderr, "Invalid size: %s\n", optarg);
+	      usage (EXIT_FAILURE, CMD_ROTATE);
+	    }
+	  break;
+	case MAX_ROWS_VALUE:
+	  opts.max_rows = strtoull (optarg, NULL, 10);
+	  break;
+	case KEEP_VALUE:
+	  opts.keep = atoi (optarg);
+	  break;
+	case KEEP_DAYS_VALUE:
+	  opts.keep_days = atoi (optarg);
 	  break;
         case 'v':
           show_version();
@@ -774,8 +898,8 @@ main_rotate (int argc, char **argv)
       usage (EXIT_FAILURE, CMD_ROTATE);
     }
 
-  if (wtmpdb_rotate (wtmpdb_path, days, &error,
-		     &wtmpdb_backup, &entries) != 0)
+  if (wtmpdb_rotate_v2 (wtmpdb_path, &opts, &error,
+			&backup_name, &entries) != 0)
     {
       if (error)
         {
@@ -788,17 +912,251 @@ main_rotate (int argc, char **argv)
       exit (EXIT_FAILURE);
     }
 
-  if (entries == 0 || wtmpdb_backup == NULL)
+  if (entries == 0)
     printf ("No old entries found\n");
+  else if (backup_name == NULL)
+    /* partitioned database: expired partitions were removed */
+    printf ("%lli expired entries %s\n", (long long unsigned int)entries,
+	    (opts.flags & WTMPDB_ROTATE_COMPRESS) ? "compressed" : "removed");
   else
     printf ("%lli entries moved to %s\n",
-	    (long long unsigned int)entries, wtmpdb_backup);
+	    (long long unsigned int)entries, backup_name);
+
+  free (backup_name);
+
+  return EXIT_SUCCESS;
+}
+
+static int
+main_backup (int argc, char **argv)
+{
+  struct option const longopts[] = {
+    {"help",     no_argument,       NULL, 'h'},
+    {"version",  no_argument,       NULL, 'v'},
+    {"file", required_argument, NULL, 'f'},
+    {"vacuum", no_argument, NULL, VACUUM_VALUE},
+    {NULL, 0, NULL, '\0'}
+  };
+  char *error = NULL;
+  unsigned int flags = 0;
+  int c;
+
+  while ((c = getopt_long (argc, argv, "f:hv", longopts, NULL)) != -1)
+    {
+      switch (c)
+        {
+        case 'f':
+          wtmpdb_path = optarg;
+          break;
+	case VACUUM_VALUE:
+	  flags |= WTMPDB_BACKUP_VACUUM;
+	  break;
+        case 'v':
+          show_version();
+          break;
+        case 'h':
+          usage (EXIT_SUCCESS, CMD_BACKUP);
+          break;
+        default:
+          usage (EXIT_FAILURE, CMD_BACKUP);
+          break;
+        }
+    }
+
+  if (argc != optind + 1)
+    {
+      if (argc > optind)
+	fprintf (stderr, "Unexpected argument: %s\n", argv[optind + 1]);
+      else
+	fprintf (stderr, "No destination specified\n");
+      usage (EXIT_FAILURE, CMD_BACKUP);
+    }
+
+  /* the copy gets written locally, even if wtmpdbd runs: the daemon
+     resolves dest in its own sandbox, not in the caller's */
+  if (wtmpdb_backup (wtmpdb_path ? wtmpdb_path : _PATH_WTMPDB, argv[optind],
+		     flags, &error) < 0)
+    {
+      if (error)
+        {
+          fprintf (stderr, "%s\n", error);
+          free (error);
+        }
+      else
+        fprintf (stderr, "Couldn't create backup\n");
+
+      exit (EXIT_FAILURE);
+    }
 
-  free (wtmpdb_backup);
+  return EXIT_SUCCESS;
+}
+
+static int
+main_optimize (int argc, char **argv)
+{
+  struct option const longopts[] = {
+    {"help",     no_argument,       NULL, 'h'},
+    {"version",  no_argument,       NULL, 'v'},
+    {"file", required_argument, NULL, 'f'},
+    {NULL, 0, NULL, '\0'}
+  };
+  static const struct {
+    const char *name;
+    unsigned int task;
+  } tasks[] = {
+    { "migrate",    WTMPDB_MAINT_MIGRATE },
+    { "checkpoint", WTMPDB_MAINT_CHECKPOINT },
+    { "analyze",    WTMPDB_MAINT_ANALYZE },
+    { "optimize",   WTMPDB_MAINT_OPTIMIZE },
+  };
+  int c;
+
+  while ((c = getopt_long (argc, argv, "f:hv", longopts, NULL)) != -1)
+    {
+      switch (c)
+        {
+        case 'f':
+          wtmpdb_path = optarg;
+          break;
+        case 'v':
+          show_version();
+          break;
+        case 'h':
+          usage (EXIT_SUCCESS, CMD_OPTIMIZE);
+          break;
+        default:
+          usage (EXIT_FAILURE, CMD_OPTIMIZE);
+          break;
+        }
+    }
+
+  if (argc > optind)
+    {
+      fprintf (stderr, "Unexpected argument: %s\n", argv[optind]);
+      usage (EXIT_FAILURE, CMD_OPTIMIZE);
+    }
+
+  for (size_t i = 0; i < sizeof (tasks) / sizeof (tasks[0]); i++)
+    {
+      struct timespec start, end;
+      char *error = NULL;
+
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      /* the database gets maintained locally, even if wtmpdbd runs */
+      if (wtmpdb_maintain (wtmpdb_path ? wtmpdb_path : _PATH_WTMPDB,
+			   tasks[i].task, &error) < 0)
+	{
+	  if (error)
+	    {
+	      fprintf (stderr, "%s\n", error);
+	      free (error);
+	    }
+	  else
+	    fprintf (stderr, "Couldn't %s the database\n", tasks[i].name);
+
+	  exit (EXIT_FAILURE);
+	}
+      clock_gettime (CLOCK_MONOTONIC, &end);
+      printf ("%-10s %llu ms\n", tasks[i].name, (unsigned long long)
+	      (wtmpdb_timespec2usec (end) - wtmpdb_timespec2usec (start)) / 1000);
+    }
 
   return EXIT_SUCCESS;
 }
 
+static int
+main_metrics (int argc, char **argv)
+{
+  struct option const longopts[] = {
+    {"help",     no_argument,       NULL, 'h'},
+    {"version",  no_argument,       NULL, 'v'},
+    {"file", required_argument, NULL, 'f'},
+    {"textfile", required_argument, NULL, TEXTFILE_VALUE},
+    {NULL, 0, NULL, '\0'}
+  };
+  const char *textfile = NULL;
+  char *error = NULL;
+  int c;
+
+  while ((c = getopt_long (argc, argv, "f:hv", longopts, NULL)) != -1)
+    {
+      switch (c)
+        {
+        case 'f':
+          wtmpdb_path = optarg;
+          break;
+	case TEXTFILE_VALUE:
+	  textfile = optarg;
+	  break;
+        case 'v':
+          show_version();
+          break;
+        case 'h':
+          usage (EXIT_SUCCESS, CMD_METRICS);
+          break;
+        default:
+          usage (EXIT_FAILURE, CMD_METRICS);
+          break;
+        }
+    }
+
+  if (argc > optind)
+    {
+      fprintf (stderr, "Unexpected argument: %s\n", argv[optind]);
+      usage (EXIT_FAILURE, CMD_METRICS);
+    }
+
+  /* read locally, even if wtmpdbd runs: the varlink interface has no
+     method for the counters and would send every entry */
+  if (wtmpdb_write_metrics (wtmpdb_path ? wtmpdb_path : _PATH_WTMPDB,
+			    textfile, &error) < 0)
+    {
+      if (error)
+        {
+          fprintf (stderr, "%s\n", error);
+          free (error);
+        }
+      else
+        fprintf (stderr, "Couldn't write the metrics\n");
+
+      exit (EXIT_FAILURE);
+    }
+
+  return EXIT_SUCCESS;
+}
+
+/* ID, User, BootTime, ShutdownTime, Kernel, NextBoot, Sessions, Crash */
+static int
+add_boot (void *unused __attribute__((__unused__)),
+	  int argc, char **argv,
+	  char **azColName __attribute__((__unused__)))
+{
+	if (argc != 8 || argv[2] == NULL)
+		return 0;
+
+	uint64_t *tmp = realloc(boots, (n_boots + 1) * sizeof(*boots));
+	if (tmp == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	boots = tmp;
+	boots[n_boots++] = strtoull(argv[2], NULL, 10);
+	return 0;
+}
+
+/* ID, Type, User, LoginTime, LogoutTime, TTY, RemoteHost, Service */
+static int
+print_match (void *unused, int argc, char **argv, char **azColName)
+{
+	uint64_t login_t = argc == 8 && argv[3] ? strtoull(argv[3], NULL, 10) : 0;
+
+	/* the first boot after the login ends the session */
+	while (next_boot < n_boots && boots[next_boot] > login_t)
+		last_reboot = boots[next_boot++];
+
+	return print_entry(unused, argc, argv, azColName);
+}
+
 static int
 main_last (int argc, char **argv)
 {
@@ -823,13 +1181,23 @@ main_last (int argc, char **argv)
     {"unique", no_argument, NULL, 'u'},
     {"until", required_argument, NULL, 't'},
     {"time-format", required_argument, NULL, TIMEFMT_VALUE},
+    {"cache", optional_argument, NULL, CACHE_VALUE},
+    {"anonymize", optional_argument, NULL, ANONYMIZE_VALUE},
     {"json", no_argument, NULL, 'j'},
+    {"user", required_argument, NULL, USER_VALUE},
+    {"host", required_argument, NULL, HOST_VALUE},
     {NULL, 0, NULL, '\0'}
   };
   int time_fmt = TIMEFMT_CTIME;
   char *error = NULL;
   int c;
 
+  if ((cache_dir = getenv("WTMPDB_CACHE")) != NULL) {
+	  use_cache = 1;
+	  if (*cache_dir == '\0')
+		  cache_dir = NULL;
+  }
+
   if (getenv("LAST_COMPACT")) {
 	  compact = 1;
 	  time_fmt = time_format("compact"); /* We allow to overwrite login_t fmt */
@@ -925,6 +1293,24 @@ main_last (int argc, char **argv)
 	case 'x':
 	  xflag = 1;
 	  break;
+	case ANONYMIZE_VALUE:
+	  if (anon_init (optarg) < 0)
+	    {
+	      fprintf (stderr, "Cannot initialize anonymization key\n");
+	      exit (EXIT_FAILURE);
+	    }
+	  anonymize = 1;
+	  break;
+	case CACHE_VALUE:
+	  use_cache = 1;
+	  cache_dir = optarg;
+	  break;
+	case USER_VALUE:
+	  filter.user = optarg;
+	  break;
+	case HOST_VALUE:
+	  filter.rhost = optarg;
+	  break;
 	case TIMEFMT_VALUE:
 	  time_fmt = time_format (optarg);
 	  if (time_fmt == -1)
@@ -977,6 +1363,14 @@ main_last (int argc, char **argv)
       usage (EXIT_FAILURE, CMD_LAST);
     }
 
+  const int filtered = filter.user || filter.rhost;
+
+  if (filtered && uniq)
+    {
+      fprintf (stderr, "The options -u and --user/--host cannot be used together.\n");
+      usage (EXIT_FAILURE, CMD_LAST);
+    }
+
 	if (present != 0) {
 		if (since != 0 && present < since)
 			return EXIT_SUCCESS;
@@ -989,10 +1383,38 @@ main_last (int argc, char **argv)
 	if (since != 0 && until != 0 && since > until)
 		return EXIT_SUCCESS;
 
+	/* don't read what is not displayed */
+	unsigned int columns = WTMPDB_COL_ALL;
+	if (noservice)
+		columns &= ~WTMPDB_COL_SERVICE;
+	if (nohostname)
+		columns &= ~WTMPDB_COL_REMOTEHOST;
+
 	if (jflag)
 		printf("{\n   \"entries\": [\n");
 
-	if (wtmpdb_read_all(wtmpdb_path, uniq, print_entry, &error) != 0)
+	if (filtered) {
+		/* the boot entries don't match, but end the sessions */
+		if (wtmpdb_read_boots(wtmpdb_path, add_boot, NULL, &error) != 0 ||
+		    wtmpdb_read_match(wtmpdb_path, &filter, print_match,
+				      NULL, &error) != 0)
+		{
+			if (error)
+			{
+				fprintf (stderr, "%s\n", error);
+				free (error);
+			}
+			else
+				fprintf (stderr, "Couldn't read the wtmp entries\n");
+
+			exit (EXIT_FAILURE);
+		}
+		free (boots);
+	} else if ((use_cache ?
+	     wtmpdb_read_all_cached(wtmpdb_path, uniq, cache_dir, print_entry,
+				    NULL, &error) :
+	     wtmpdb_read_all_v3(wtmpdb_path, uniq, columns, print_entry,
+				NULL, &error)) != 0)
     {
       if (error)
         {
@@ -1005,7 +1427,13 @@ main_last (int argc, char **argv)
       exit (EXIT_FAILURE);
     }
 
-  if (wtmp_start == UINT64_MAX)
+  if (filtered)
+    {
+      /* the oldest match is not where the database begins */
+      if (jflag)
+	printf ("\n   ]\n");
+    }
+  else if (wtmp_start == UINT64_MAX)
     {
       if (!jflag)
 	printf ("%s has no entries\n", wtmpdb_path?wtmpdb_path:"wtmpdb");
@@ -1027,6 +1455,170 @@ main_last (int argc, char **argv)
   return EXIT_SUCCESS;
 }
 
+/* ID, User, BootTime, ShutdownTime, Kernel, NextBoot, Sessions, Crash */
+static int
+print_boot (void *unused __attribute__((__unused__)),
+	    int argc, char **argv, char **azColName)
+{
+	struct {
+		char boot[LAST_TIMESTAMP_LEN];
+		char shutdown[LAST_TIMESTAMP_LEN];
+		char length[LAST_TIMESTAMP_LEN];
+	} times;
+	uint64_t boot_t, end_t;
+	char prefix = ' ';
+	char *endptr;
+
+	if (maxentries && currentry >= maxentries)
+		return 0;
+
+	if (argc != 8) {
+		fprintf(stderr, "Mangled entry:");
+		dump_entry(argc, argv, azColName);
+		exit(EXIT_FAILURE);
+	}
+
+	const char *user = argv[1];
+	const char *kernel = argv[4] ? argv[4] : "";
+	const char *sessions = argv[6] ? argv[6] : "0";
+	const int crash = argv[7] && atoi(argv[7]) != 0;
+
+	boot_t = strtoull(argv[2] ? argv[2] : "", &endptr, 10);
+	if (endptr == argv[2] || *endptr != '\0') {
+		fprintf(stderr, "Invalid numeric time entry for 'boot': '%s'\n",
+			argv[2]);
+		return 0;
+	}
+
+	format_time(login_fmt, times.boot, sizeof(times.boot), boot_t);
+	if (argv[3]) {
+		end_t = strtoull(argv[3], NULL, 10);
+		format_time(logout_fmt, times.shutdown, sizeof(times.shutdown), end_t);
+	} else if (argv[5]) {
+		/* no shutdown recorded but booted again: uptime is an estimate */
+		end_t = strtoull(argv[5], NULL, 10);
+		prefix = '?';
+		snprintf(times.shutdown, sizeof(times.shutdown), "crash");
+	} else {
+		end_t = time_now;
+		prefix = '.';
+		snprintf(times.shutdown, sizeof(times.shutdown), "running");
+	}
+	if (end_t < boot_t)
+		end_t = boot_t;
+	calc_time_length(times.length, sizeof(times.length), boot_t, end_t, prefix);
+
+	if (jflag) {
+		if (first_entry)
+			first_entry = 0;
+		else
+			printf(",\n");
+		printf("     { \"user\": \"%s\",\n", user);
+		printf("       \"kernel\": \"%s\",\n", kernel);
+		printf("       \"boot\": \"%s\",\n", times.boot);
+		printf("       \"shutdown\": \"%s\",\n", times.shutdown);
+		printf("       \"uptime\": \"%s\",\n", remove_parentheses(times.length));
+		printf("       \"sessions\": %s,\n", sessions);
+		printf("       \"crash\": %s\n", crash ? "true" : "false");
+		printf("     }");
+	} else {
+		printf("%-8.*s %-16.*s %-*.*s - %-*.*s %-14s %5s session(s)\n",
+			wflag ? (int)strlen(user) : name_len, map_soft_reboot(user),
+			wflag ? (int)strlen(kernel) : host_len, kernel,
+			login_len, login_len, times.boot,
+			logout_len, logout_len, times.shutdown,
+			times.length, sessions);
+	}
+
+	currentry++;
+	return 0;
+}
+
+static int
+main_boots (int argc, char **argv)
+{
+  struct option const longopts[] = {
+    {"help",     no_argument,       NULL, 'h'},
+    {"version",  no_argument,       NULL, 'v'},
+    {"file", required_argument, NULL, 'f'},
+    {"fullnames", no_argument, NULL, 'w'},
+    {"json", no_argument, NULL, 'j'},
+    {"limit", required_argument, NULL, 'n'},
+    {"time-format", required_argument, NULL, TIMEFMT_VALUE},
+    {NULL, 0, NULL, '\0'}
+  };
+  char *error = NULL;
+  int c;
+
+  time_format ("compact");
+
+  while ((c = getopt_long (argc, argv, "f:hjn:vw", longopts, NULL)) != -1)
+    {
+      switch (c)
+        {
+        case 'f':
+          wtmpdb_path = optarg;
+          break;
+	case 'j':
+	  jflag = 1;
+	  break;
+	case 'n':
+	  maxentries = strtoul (optarg, NULL, 10);
+	  break;
+	case 'w':
+	  wflag = 1;
+	  break;
+	case TIMEFMT_VALUE:
+	  if (time_format (optarg) == -1)
+	    {
+	      fprintf (stderr, "Invalid time format '%s'\n", optarg);
+	      exit (EXIT_FAILURE);
+	    }
+	  break;
+        case 'v':
+          show_version();
+          break;
+        case 'h':
+          usage (EXIT_SUCCESS, CMD_BOOTS);
+          break;
+        default:
+          usage (EXIT_FAILURE, CMD_BOOTS);
+          break;
+        }
+    }
+
+  if (argc > optind)
+    {
+      fprintf (stderr, "Unexpected argument: %s\n", argv[optind]);
+      usage (EXIT_FAILURE, CMD_BOOTS);
+    }
+
+  parse_time ("now", &time_now);
+
+  if (jflag)
+    printf ("{\n   \"boots\": [\n");
+
+  if (wtmpdb_read_boots (wtmpdb_path, print_boot, NULL, &error) != 0)
+    {
+      if (error)
+        {
+          fprintf (stderr, "%s\n", error);
+          free (error);
+        }
+      else
+        fprintf (stderr, "Couldn't read boot entries\n");
+
+      exit (EXIT_FAILURE);
+    }
+
+  if (jflag)
+    printf ("\n   ]\n}\n");
+  else if (currentry == 0)
+    printf ("%s has no boot entries\n", wtmpdb_path?wtmpdb_path:"wtmpdb");
+
+  return EXIT_SUCCESS;
+}
+
 #if HAVE_AUDIT
 static void
 log_audit (int type)
@@ -1413,6 +2005,14 @@ main (int argc, char **argv)
     return main_rotate (--argc, ++argv);
   if (strcmp (argv[1], cmd_name[CMD_IMPORT]) == 0)
     return main_import (--argc, ++argv);
+  if (strcmp (argv[1], cmd_name[CMD_BOOTS]) == 0)
+    return main_boots (--argc, ++argv);
+  if (strcmp (argv[1], cmd_name[CMD_BACKUP]) == 0)
+    return main_backup (--argc, ++argv);
+  if (strcmp (argv[1], cmd_name[CMD_OPTIMIZE]) == 0)
+    return main_optimize (--argc, ++argv);
+  if (strcmp (argv[1], cmd_name[CMD_METRICS]) == 0)
+    return main_metrics (--argc, ++argv);
 
   while ((c = getopt_long (argc, argv, "f:hv", longopts, NULL)) != -1)
     {
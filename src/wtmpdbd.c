@@ -18,12 +18,20 @@
 
 #include "config.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <getopt.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <libintl.h>
 #include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/random.h>
 #include <systemd/sd-daemon.h>
 #include <systemd/sd-varlink.h>
 #include <systemd/sd-journal.h>
@@ -36,6 +44,7 @@
 
 static int log_level = LOG_WARNING;
 static int socket_activation = false;
+static const char *metrics_path = NULL;
 
 static void
 set_max_log_level (int level)
@@ -177,6 +186,303 @@ vl_method_get_environment(sd_varlink *link, sd_json_variant *parameters,
 #endif
 }
 
+/* Maintenance of the database runs when nothing was written for
+   MAINT_IDLE_USEC, one task at a time with MAINT_PAUSE_USEC in
+   between, so a login never waits for more than one task. Each task
+   runs at most once per interval. The last run is the mtime of a stamp
+   file next to the database, the daemon exits when idle and would run
+   every task again after a restart otherwise. */
+#define MAINT_IDLE_USEC (10*USEC_PER_SEC)
+#define MAINT_PAUSE_USEC (1*USEC_PER_SEC)
+
+static const struct maint_task {
+  const char *name;
+  const char *stamp;
+  unsigned int task;
+  uint64_t interval;
+} maint_tasks[] = {
+  { "checkpoint", _PATH_WTMPDB ".checkpoint", WTMPDB_MAINT_CHECKPOINT,  5*60*USEC_PER_SEC },
+  { "optimize",   _PATH_WTMPDB ".optimize",   WTMPDB_MAINT_OPTIMIZE,   60*60*USEC_PER_SEC },
+  { "analyze",    _PATH_WTMPDB ".analyze",    WTMPDB_MAINT_ANALYZE, 24*60*60*USEC_PER_SEC },
+};
+
+static sd_event_source *maint_source = NULL;
+
+static uint64_t
+now_monotonic (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return wtmpdb_timespec2usec (ts);
+}
+
+/* Returns the last run of t (CLOCK_REALTIME), 0 if it didn't run yet */
+static uint64_t
+maint_last (const struct maint_task *t)
+{
+  struct stat st;
+
+  if (stat (t->stamp, &st) < 0)
+    return 0;
+  return wtmpdb_timespec2usec (st.st_mtim);
+}
+
+/* Records the run of t */
+static void
+maint_done (const struct maint_task *t)
+{
+  int fd = open (t->stamp, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+
+  if (fd < 0 || futimens (fd, NULL) < 0)
+    log_msg (LOG_WARNING, "Cannot update %s: %s", t->stamp, strerror (errno));
+  if (fd >= 0)
+    close (fd);
+}
+
+/* Called after every write, maintenance waits until it is idle again */
+static void
+maint_postpone (void)
+{
+  if (maint_source == NULL)
+    return;
+  sd_event_source_set_time_relative (maint_source, MAINT_IDLE_USEC);
+  sd_event_source_set_enabled (maint_source, SD_EVENT_ONESHOT);
+}
+
+/* Cursors of paged ReadAll calls. Every cursor keeps a read transaction
+   open, so that all pages show the same state of the database; it gets
+   dropped after the last page, on Close, if it was not used for
+   CURSOR_IDLE_USEC or if the slots are needed for a newer one. */
+#define MAX_CURSORS 16
+#define CURSOR_IDLE_USEC (60*USEC_PER_SEC)
+
+static struct {
+  char token[33];	/* empty if unused */
+  struct wtmpdb_cursor *cursor;
+  uint64_t used;	/* CLOCK_MONOTONIC */
+} cursors[MAX_CURSORS];
+
+static void
+cursor_drop (size_t i)
+{
+  wtmpdb_cursor_close (cursors[i].cursor);
+  cursors[i].cursor = NULL;
+  cursors[i].token[0] = '\0';
+}
+
+static void
+cursors_expire (void)
+{
+  uint64_t now = now_monotonic ();
+
+  for (size_t i = 0; i < MAX_CURSORS; i++)
+    if (cursors[i].token[0] != '\0' &&
+	now - cursors[i].used >= CURSOR_IDLE_USEC)
+      {
+	log_msg (LOG_DEBUG, "Cursor %s expired", cursors[i].token);
+	cursor_drop (i);
+      }
+}
+
+static ssize_t
+cursor_find (const char *token)
+{
+  for (size_t i = 0; i < MAX_CURSORS; i++)
+    if (cursors[i].token[0] != '\0' && strcmp (cursors[i].token, token) == 0)
+      return i;
+  return -1;
+}
+
+/* Returns the slot of a new cursor, < 0 on failure */
+static ssize_t
+cursor_add (int uniq, char **error)
+{
+  unsigned char rnd[16];
+  size_t slot = 0;
+  int r;
+
+  for (size_t i = 0; i < MAX_CURSORS; i++)
+    {
+      if (cursors[i].token[0] == '\0')
+	{
+	  slot = i;
+	  break;
+	}
+      if (cursors[i].used < cursors[slot].used)
+	slot = i;
+    }
+  if (cursors[slot].token[0] != '\0')
+    {
+      log_msg (LOG_WARNING, "Too many cursors, dropping %s",
+	       cursors[slot].token);
+      cursor_drop (slot);
+    }
+
+  if (getrandom (rnd, sizeof (rnd), 0) != sizeof (rnd))
+    {
+      r = -errno;
+      if (asprintf (error, "Cannot create cursor token: %s",
+		    strerror (-r)) < 0)
+	*error = strdup ("cursor_add: Out of memory");
+      return r;
+    }
+
+  r = wtmpdb_cursor_open (_PATH_WTMPDB, uniq, &cursors[slot].cursor, error);
+  if (r < 0)
+    return r;
+
+  for (size_t i = 0; i < sizeof (rnd); i++)
+    snprintf (cursors[slot].token + 2 * i, 3, "%02x", rnd[i]);
+  cursors[slot].used = now_monotonic ();
+  return slot;
+}
+
+/* Replies of ReadAll without Limit and Cursor and of GetBootTime are
+   kept until the database changes. Login, Logout and Rotate drop them;
+   writes of other processes are noticed by the inode, size and
+   modification time of the database and its write-ahead log. Only a
+   database file is cached, no partitioned directory. */
+enum {
+  CACHE_READ_ALL,
+  CACHE_READ_ALL_UNIQ,
+  CACHE_BOOTTIME,
+  CACHE_SLOTS
+};
+#define CACHE_MAX_ENTRIES 100000 /* larger ReadAll replies are not kept */
+
+struct db_stamp {
+  struct stat db;
+  struct stat wal;
+};
+
+static struct {
+  sd_json_variant *reply;	/* NULL if not cached */
+  struct db_stamp stamp;
+} reply_cache[CACHE_SLOTS];
+static uint64_t cache_hits = 0;
+static uint64_t cache_misses = 0;
+
+/* Returns 0 on success, < 0 if the database cannot be cached */
+static int
+db_stamp (struct db_stamp *st)
+{
+  memset (st, 0, sizeof (*st));
+  if (stat (_PATH_WTMPDB, &st->db) < 0 || !S_ISREG (st->db.st_mode))
+    return -1;
+  if (stat (_PATH_WTMPDB"-wal", &st->wal) < 0)
+    memset (&st->wal, 0, sizeof (st->wal));
+  return 0;
+}
+
+static int
+stat_equal (const struct stat *a, const struct stat *b)
+{
+  return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+    a->st_size == b->st_size &&
+    a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+    a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+static void
+cache_invalidate (void)
+{
+  for (size_t i = 0; i < CACHE_SLOTS; i++)
+    reply_cache[i].reply = sd_json_variant_unref (reply_cache[i].reply);
+}
+
+/* Returns the cached reply of slot, NULL if there is none. *st gets
+   the state of the database to store a new reply with. */
+static sd_json_variant *
+cache_lookup (size_t slot, struct db_stamp *st, bool *cacheable)
+{
+  *cacheable = db_stamp (st) == 0;
+  if (reply_cache[slot].reply && *cacheable &&
+      stat_equal (&st->db, &reply_cache[slot].stamp.db) &&
+      stat_equal (&st->wal, &reply_cache[slot].stamp.wal))
+    {
+      cache_hits++;
+      log_msg (LOG_DEBUG, "Reply cache hit (%llu hits, %llu misses)",
+	       (unsigned long long)cache_hits,
+	       (unsigned long long)cache_misses);
+      return reply_cache[slot].reply;
+    }
+  cache_misses++;
+  reply_cache[slot].reply = sd_json_variant_unref (reply_cache[slot].reply);
+  return NULL;
+}
+
+static void
+cache_store (size_t slot, const struct db_stamp *st, sd_json_variant *reply)
+{
+  sd_json_variant_unref (reply_cache[slot].reply);
+  reply_cache[slot].reply = sd_json_variant_ref (reply);
+  reply_cache[slot].stamp = *st;
+}
+
+static int
+vl_method_get_stats(sd_varlink *link, sd_json_variant *parameters,
+		    sd_varlink_method_flags_t _unused_(flags),
+		    void _unused_(*userdata))
+{
+  int r;
+
+  log_msg (LOG_INFO, "Varlink method \"GetStats\" called...");
+
+  r = sd_varlink_dispatch(link, parameters, NULL, NULL);
+  if (r != 0)
+    return r;
+
+  return sd_varlink_replybo(link,
+			    SD_JSON_BUILD_PAIR_UNSIGNED("CacheHits", cache_hits),
+			    SD_JSON_BUILD_PAIR_UNSIGNED("CacheMisses", cache_misses));
+}
+
+static int
+maint_run (sd_event_source *s, uint64_t _unused_(usec),
+	   void _unused_(*userdata))
+{
+  struct timespec ts;
+  uint64_t now, next = UINT64_MAX;
+
+  clock_gettime (CLOCK_REALTIME, &ts);
+  now = wtmpdb_timespec2usec (ts);
+
+  cursors_expire ();
+  for (size_t i = 0; i < sizeof (maint_tasks) / sizeof (maint_tasks[0]); i++)
+    {
+      const struct maint_task *t = &maint_tasks[i];
+      _cleanup_(freep) char *error = NULL;
+      uint64_t last = maint_last (t);
+      uint64_t start, end;
+      int r;
+
+      /* a stamp from the future means the clock was set back */
+      if (last != 0 && last <= now && now - last < t->interval)
+	{
+	  if (last + t->interval - now < next)
+	    next = last + t->interval - now;
+	  continue;
+	}
+
+      start = now_monotonic ();
+      r = wtmpdb_maintain (_PATH_WTMPDB, t->task, &error);
+      end = now_monotonic ();
+      maint_done (t);
+      if (r < 0)
+	log_msg (LOG_ERR, "Maintenance task %s failed: %s", t->name, error);
+      else
+	log_msg (LOG_INFO, "Maintenance task %s took %llu ms", t->name,
+		 (unsigned long long)(end - start) / 1000);
+      next = MAINT_PAUSE_USEC;
+      break;
+    }
+
+  if (sd_event_source_set_time_relative (s, next) < 0)
+    return sd_event_source_set_enabled (s, SD_EVENT_OFF);
+  return sd_event_source_set_enabled (s, SD_EVENT_ONESHOT);
+}
+
 struct login_record {
   int type;
   char *user;
@@ -184,6 +490,7 @@ struct login_record {
   char *tty;
   char *rhost;
   char *service;
+  char *token;
 };
 
 static void
@@ -193,6 +500,7 @@ login_record_free (struct login_record *var)
   var->tty = mfree(var->tty);
   var->rhost = mfree(var->rhost);
   var->service = mfree(var->service);
+  var->token = mfree(var->token);
 }
 
 static int
@@ -208,6 +516,7 @@ vl_method_login(sd_varlink *link, sd_json_variant *parameters,
     .tty = NULL,
     .rhost = NULL,
     .service = NULL,
+    .token = NULL,
   };
   static const sd_json_dispatch_field dispatch_table[] = {
     { "Type",       SD_JSON_VARIANT_INTEGER, sd_json_dispatch_int,     offsetof(struct login_record, type),       SD_JSON_MANDATORY },
@@ -216,6 +525,7 @@ vl_method_login(sd_varlink *link, sd_json_variant *parameters,
     { "TTY",        SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct login_record, tty),        0 },
     { "RemoteHost", SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct login_record, rhost),      0 },
     { "Service",    SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct login_record, service),    0 },
+    { "Token",      SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct login_record, token),      0 },
     {}
   };
   int64_t id = -1;
@@ -246,7 +556,8 @@ vl_method_login(sd_varlink *link, sd_json_variant *parameters,
       return sd_varlink_error(link, SD_VARLINK_ERROR_PERMISSION_DENIED, parameters);
     }
 
-  id = wtmpdb_login (_PATH_WTMPDB, p.type, p.user, p.usec_login, p.tty, p.rhost, p.service, &error);
+  id = wtmpdb_login_v2 (_PATH_WTMPDB, p.type, p.user, p.usec_login, p.tty, p.rhost, p.service, p.token, &error);
+  cache_invalidate ();
   if (id < 0 || error != NULL)
     {
       log_msg(LOG_ERR, "Get ID request from db failed: %s", error);
@@ -254,6 +565,7 @@ vl_method_login(sd_varlink *link, sd_json_variant *parameters,
 				SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error));
     }
 
+  maint_postpone ();
   return sd_varlink_replybo(link, SD_JSON_BUILD_PAIR_INTEGER("ID", id));
 }
 
@@ -303,6 +615,7 @@ vl_method_logout(sd_varlink *link, sd_json_variant *parameters,
     }
 
   id = wtmpdb_logout (_PATH_WTMPDB, p.id, p.usec_logout, &error);
+  cache_invalidate ();
   if (id < 0 || error != NULL)
     {
       /* let wtmpdb_logout return better error codes, e.g. not found vs real error */
@@ -313,6 +626,7 @@ vl_method_logout(sd_varlink *link, sd_json_variant *parameters,
 
     }
 
+  maint_postpone ();
   return sd_varlink_replybo(link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true));
 }
 
@@ -373,8 +687,12 @@ vl_method_get_boottime(sd_varlink *link, sd_json_variant *parameters,
   static const sd_json_dispatch_field dispatch_table[] = {
     {}
   };
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *reply = NULL;
   _cleanup_(freep) char *error = NULL;
   uint64_t boottime = 0;
+  struct db_stamp st;
+  sd_json_variant *cached;
+  bool cacheable;
   int r;
 
   log_msg (LOG_INFO, "Varlink method \"GetBootTime\" called...");
@@ -386,6 +704,10 @@ vl_method_get_boottime(sd_varlink *link, sd_json_variant *parameters,
       return r;
     }
 
+  cached = cache_lookup (CACHE_BOOTTIME, &st, &cacheable);
+  if (cached)
+    return sd_varlink_reply(link, cached);
+
   boottime = wtmpdb_get_boottime (_PATH_WTMPDB, &error);
   if (boottime == 0 || error != NULL)
     {
@@ -396,16 +718,32 @@ vl_method_get_boottime(sd_varlink *link, sd_json_variant *parameters,
 
     }
 
-  return sd_varlink_replybo(link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
-			    SD_JSON_BUILD_PAIR_INTEGER("BootTime", boottime));
+  r = sd_json_buildo(&reply, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
+		     SD_JSON_BUILD_PAIR_INTEGER("BootTime", boottime));
+  if (r < 0)
+    return r;
+  if (cacheable)
+    cache_store (CACHE_BOOTTIME, &st, reply);
+  return sd_varlink_reply(link, reply);
 }
 
-static int incomplete = 0;
+/* The entries of a reply, incomplete is set if one could not be
+   added. */
+struct entries {
+  sd_json_variant *array;
+  int incomplete;
+};
+
+static void
+entries_clear (struct entries *e)
+{
+  e->array = sd_json_variant_unref (e->array);
+}
 
 static int
 wtmpdb_cb_func (void *u, int argc, char **argv, char _unused_(**azColName))
 {
-  sd_json_variant **array = u;
+  struct entries *e = u;
   char *endptr;
   uint64_t logout_t = 0;
   int r;
@@ -415,11 +753,12 @@ wtmpdb_cb_func (void *u, int argc, char **argv, char _unused_(**azColName))
   if (argc != 8)
     {
       log_msg(LOG_ERR, "Invalid number of arguments: got %i, expected 8", argc);
-      incomplete = 1;
+      e->incomplete = 1;
       return 0;
     }
 
-  const int id = atoi (argv[0]);
+  /* IDs of partitioned databases don't fit into an int */
+  const int64_t id = strtoll (argv[0], NULL, 10);
   const int type = atoi (argv[1]);
   const char *user = argv[2];
   const char *tty = argv[5]?argv[5]:"?";
@@ -430,7 +769,7 @@ wtmpdb_cb_func (void *u, int argc, char **argv, char _unused_(**azColName))
       || (endptr == argv[3]) || (*endptr != '\0'))
     {
       log_msg(LOG_ERR, "Invalid numeric time entry for 'login': '%s'\n", argv[3]);
-      incomplete = 1;
+      e->incomplete = 1;
       return 0;
     }
   if (argv[4])
@@ -440,15 +779,15 @@ wtmpdb_cb_func (void *u, int argc, char **argv, char _unused_(**azColName))
           || (endptr == argv[4]) || (*endptr != '\0'))
 	{
 	  log_msg(LOG_ERR, "Invalid numeric time entry for 'logout': '%s'\n", argv[4]);
-	  incomplete = 1;
+	  e->incomplete = 1;
 	  return 0;
 	}
     }
 
-  log_msg(LOG_DEBUG, "ID: %i, Type: %i, User: %s, Login: %lu, Logout: %lu, TTY: %s, RemoteHost: %s, Service: %s",
+  log_msg(LOG_DEBUG, "ID: %li, Type: %i, User: %s, Login: %lu, Logout: %lu, TTY: %s, RemoteHost: %s, Service: %s",
 	  id, type, user, login_t, logout_t, tty, host, service);
 
-  r = sd_json_variant_append_arraybo(array,
+  r = sd_json_variant_append_arraybo(&e->array,
 				     SD_JSON_BUILD_PAIR_INTEGER("ID", id),
 				     SD_JSON_BUILD_PAIR_INTEGER("Type", type),
 				     SD_JSON_BUILD_PAIR_STRING("User", user),
@@ -460,30 +799,197 @@ wtmpdb_cb_func (void *u, int argc, char **argv, char _unused_(**azColName))
   if (r < 0)
     {
       log_msg(LOG_ERR, "Appending array failed: %s", strerror(-r));
-      incomplete = 1;
+      e->incomplete = 1;
+    }
+
+  return 0;
+}
+
+/* Calls which take a while run in a thread of their own with their
+   own database connection, so that they don't delay Login and Logout.
+   The connections and the event loop of the main thread are not
+   touched there. The thread calls run and signals fd when it is done,
+   then reply sends the reply from the event loop. */
+struct job {
+  sd_varlink *link;
+  void (*run) (struct job *job);
+  int (*reply) (struct job *job);
+  pthread_t thread;
+  int fd;
+  int r;
+  char *error;
+  /* Backup */
+  char *dest;
+  unsigned int flags;
+  /* ReadAll, ReadMatch, ReadBoots */
+  int uniq;
+  char *user, *rhost, *tty;
+  bool cacheable;
+  size_t cache_slot;
+  struct db_stamp st;
+  struct entries entries;
+};
+
+/* running jobs, the daemon doesn't exit idle meanwhile */
+static unsigned int jobs_running;
+
+static void
+job_free (struct job *job)
+{
+  sd_varlink_unref(job->link);
+  if (job->fd >= 0)
+    close(job->fd);
+  free(job->dest);
+  free(job->user);
+  free(job->rhost);
+  free(job->tty);
+  free(job->error);
+  entries_clear(&job->entries);
+  free(job);
+}
+
+/* Returns a new job for link, NULL with errno set on failure. */
+static struct job *
+job_new (sd_varlink *link)
+{
+  struct job *job = calloc(1, sizeof(*job));
+
+  if (job == NULL)
+    return NULL;
+  job->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (job->fd < 0)
+    {
+      free(job);
+      return NULL;
+    }
+  job->link = sd_varlink_ref(link);
+  return job;
+}
+
+static void *
+job_thread (void *arg)
+{
+  struct job *job = arg;
+
+  job->run(job);
+  eventfd_write(job->fd, 1);
+  return NULL;
+}
+
+/* Sends the reply when the thread of the job is done. */
+static int
+job_done (sd_event_source *s, int _unused_(fd), uint32_t _unused_(revents),
+	  void *userdata)
+{
+  struct job *job = userdata;
+  int r;
+
+  pthread_join(job->thread, NULL);
+  jobs_running--;
+
+  r = job->reply(job);
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Sending reply failed: %s", strerror(-r));
+      sd_varlink_error_errno(job->link, r);
     }
 
+  sd_event_source_unref(s);
+  job_free(job);
   return 0;
 }
 
+/* Starts the thread of job, which gets freed on failure. */
+static int
+job_start (sd_varlink *link, sd_event *loop, struct job *job)
+{
+  sd_event_source *source = NULL;
+  int r;
 
+  r = sd_event_add_io(loop, &source, job->fd, EPOLLIN, job_done, job);
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Cannot watch thread: %s", strerror(-r));
+      job_free(job);
+      return r;
+    }
+  r = pthread_create(&job->thread, NULL, job_thread, job);
+  if (r != 0)
+    {
+      log_msg(LOG_ERR, "Cannot start thread: %s", strerror(r));
+      sd_event_source_unref(source);
+      job_free(job);
+      return sd_varlink_errorbo(link, "org.openSUSE.wtmpdb.InternalError",
+				SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
+				SD_JSON_BUILD_PAIR_STRING("ErrorMsg", strerror(r)));
+    }
+  jobs_running++;
+
+  return 0;
+}
+
+static void
+read_all_run (struct job *job)
+{
+  job->r = wtmpdb_read_all_v2 (_PATH_WTMPDB, job->uniq, &wtmpdb_cb_func,
+			       &job->entries, &job->error);
+}
+
+/* Sends the entries of ReadAll or ReadMatch. */
+static int
+entries_reply (struct job *job)
+{
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *reply = NULL;
+  int r;
+
+  if (job->r < 0 || job->error != NULL || job->entries.incomplete)
+    {
+      log_msg(LOG_ERR, "Didn't got all entries from db: %s", job->error);
+      return sd_varlink_errorbo(job->link, "org.openSUSE.wtmpdb.InternalError",
+				SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
+				SD_JSON_BUILD_PAIR_STRING("ErrorMsg", job->error?job->error:"unknown"));
+    }
+
+  r = sd_json_buildo(&reply, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
+		     SD_JSON_BUILD_PAIR_VARIANT("Data", job->entries.array));
+  if (r < 0)
+    return r;
+  if (job->cacheable &&
+      sd_json_variant_elements(job->entries.array) <= CACHE_MAX_ENTRIES)
+    cache_store (job->cache_slot, &job->st, reply);
+  return sd_varlink_reply(job->link, reply);
+}
+
+/* a page of a cursor is read in the event loop, so it is kept short */
+#define READ_PAGE_MAX 1000
 
 static int
 vl_method_read_all(sd_varlink *link, sd_json_variant *parameters,
 		   sd_varlink_method_flags_t _unused_(flags),
-		   void _unused_(*userdata))
+		   void *userdata)
 {
   struct p {
 	int uniq;
-  } p {
-	.uniq = 0
+	int64_t limit;
+	const char *cursor;
+	bool close;
+  } p = {
+	.uniq = 0,
+	.limit = -1,
+	.cursor = NULL,
+	.close = false
   };
-  _cleanup_(sd_json_variant_unrefp) sd_json_variant *array = NULL;
+  _cleanup_(entries_clear) struct entries e = { NULL, 0 };
   static const sd_json_dispatch_field dispatch_table[] = {
-    { "Uniq", SD_JSON_VARIANT_INTEGER, sd_json_dispatch_int, offsetof(struct p, uniq), SD_JSON_MANDATORY },
+    { "Uniq",   SD_JSON_VARIANT_INTEGER, sd_json_dispatch_int,          offsetof(struct p, uniq),   SD_JSON_MANDATORY },
+    { "Limit",  SD_JSON_VARIANT_INTEGER, sd_json_dispatch_int64,        offsetof(struct p, limit),  0 },
+    { "Cursor", SD_JSON_VARIANT_STRING,  sd_json_dispatch_const_string, offsetof(struct p, cursor), 0 },
+    { "Close",  SD_JSON_VARIANT_BOOLEAN, sd_json_dispatch_stdbool,      offsetof(struct p, close),  0 },
     {}
   };
   _cleanup_(freep) char *error = NULL;
+  sd_event *loop = userdata;
+  ssize_t slot;
   int r;
 
   log_msg (LOG_INFO, "Varlink method \"ReadAll\" called...");
@@ -495,19 +1001,312 @@ vl_method_read_all(sd_varlink *link, sd_json_variant *parameters,
       return r;
     }
 
-  incomplete = 0;
-  r = wtmpdb_read_all_v2 (_PATH_WTMPDB, p.uniq, &wtmpdb_cb_func, (void *)&array, &error);
-  if (r < 0 || error != NULL || incomplete)
+  cursors_expire ();
+
+  if (p.limit < 0 && p.cursor == NULL)
+    {
+      size_t cache_slot = p.uniq ? CACHE_READ_ALL_UNIQ : CACHE_READ_ALL;
+      struct db_stamp st;
+      sd_json_variant *cached;
+      bool cacheable = false;
+      struct job *job;
+
+      if (p.uniq == 0 || p.uniq == 1)
+	{
+	  cached = cache_lookup (cache_slot, &st, &cacheable);
+	  if (cached)
+	    return sd_varlink_reply(link, cached);
+	}
+
+      /* reading all entries takes a while, don't block logins meanwhile */
+      job = job_new(link);
+      if (job == NULL)
+	return -errno;
+      job->uniq = p.uniq;
+      job->cacheable = cacheable;
+      if (cacheable)
+	{
+	  job->cache_slot = cache_slot;
+	  job->st = st;
+	}
+      job->run = read_all_run;
+      job->reply = entries_reply;
+
+      return job_start(link, loop, job);
+    }
+
+  if (p.cursor)
+    {
+      slot = cursor_find (p.cursor);
+      if (slot < 0)
+	{
+	  log_msg(LOG_DEBUG, "Cursor %s not found", p.cursor);
+	  return sd_varlink_errorbo(link, "org.openSUSE.wtmpdb.InvalidCursor",
+				    SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
+				    SD_JSON_BUILD_PAIR_STRING("ErrorMsg", "Cursor expired"));
+	}
+      if (p.close)
+	{
+	  cursor_drop (slot);
+	  return sd_varlink_replybo(link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true));
+	}
+    }
+  else
+    slot = cursor_add (p.uniq, &error);
+  if (slot < 0)
+    {
+      log_msg(LOG_ERR, "Cannot open cursor: %s", error);
+      return sd_varlink_errorbo(link, "org.openSUSE.wtmpdb.InternalError",
+				SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
+				SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"unknown"));
+    }
+
+  if (p.limit > READ_PAGE_MAX)
+    p.limit = READ_PAGE_MAX;
+  r = 1;
+  if (p.limit > 0)
+    r = wtmpdb_cursor_read (cursors[slot].cursor, p.limit, &wtmpdb_cb_func,
+			    &e, &error);
+  if (r < 0 || e.incomplete)
     {
       log_msg(LOG_ERR, "Didn't got all entries from db: %s", error);
+      cursor_drop (slot);
       return sd_varlink_errorbo(link, "org.openSUSE.wtmpdb.InternalError",
 				SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
-                                SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"unknown"));
+				SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"unknown"));
+    }
+  /* fewer entries than requested: this was the last page */
+  if (p.limit > 0 && r < p.limit)
+    {
+      cursor_drop (slot);
+      return sd_varlink_replybo(link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
+				SD_JSON_BUILD_PAIR_VARIANT("Data", e.array));
+    }
 
+  cursors[slot].used = now_monotonic ();
+  return sd_varlink_replybo(link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
+			    SD_JSON_BUILD_PAIR_VARIANT("Data", e.array),
+			    SD_JSON_BUILD_PAIR_STRING("Cursor", cursors[slot].token));
+}
+
+static void
+read_match_run (struct job *job)
+{
+  struct wtmpdb_match m = {
+    .user = job->user,
+    .rhost = job->rhost,
+    .tty = job->tty,
+  };
+
+  job->r = wtmpdb_read_match (_PATH_WTMPDB, &m, &wtmpdb_cb_func,
+			      &job->entries, &job->error);
+}
+
+static int
+vl_method_read_match(sd_varlink *link, sd_json_variant *parameters,
+		     sd_varlink_method_flags_t _unused_(flags),
+		     void *userdata)
+{
+  struct p {
+	const char *user;
+	const char *rhost;
+	const char *tty;
+  } p = {
+	.user = NULL,
+	.rhost = NULL,
+	.tty = NULL
+  };
+  static const sd_json_dispatch_field dispatch_table[] = {
+    { "User",       SD_JSON_VARIANT_STRING, sd_json_dispatch_const_string, offsetof(struct p, user),  0 },
+    { "RemoteHost", SD_JSON_VARIANT_STRING, sd_json_dispatch_const_string, offsetof(struct p, rhost), 0 },
+    { "TTY",        SD_JSON_VARIANT_STRING, sd_json_dispatch_const_string, offsetof(struct p, tty),   0 },
+    {}
+  };
+  sd_event *loop = userdata;
+  struct job *job;
+  int r;
+
+  log_msg (LOG_INFO, "Varlink method \"ReadMatch\" called...");
+
+  r = sd_varlink_dispatch(link, parameters, dispatch_table, &p);
+  if (r != 0)
+    {
+      log_msg(LOG_ERR, "Read match request: varlink dispatch failed: %s", strerror (-r));
+      return r;
+    }
+
+  /* the archives may have to be read, too */
+  job = job_new(link);
+  if (job == NULL)
+    return -errno;
+  if ((p.user && (job->user = strdup(p.user)) == NULL) ||
+      (p.rhost && (job->rhost = strdup(p.rhost)) == NULL) ||
+      (p.tty && (job->tty = strdup(p.tty)) == NULL))
+    {
+      job_free(job);
+      return -ENOMEM;
+    }
+  job->run = read_match_run;
+  job->reply = entries_reply;
+
+  return job_start(link, loop, job);
+}
+
+static int
+vl_method_get_last_login(sd_varlink *link, sd_json_variant *parameters,
+			 sd_varlink_method_flags_t _unused_(flags),
+			 void _unused_(*userdata))
+{
+  struct p {
+	const char *user;
+  } p = {
+	.user = NULL
+  };
+  _cleanup_(entries_clear) struct entries e = { NULL, 0 };
+  static const sd_json_dispatch_field dispatch_table[] = {
+    { "User", SD_JSON_VARIANT_STRING, sd_json_dispatch_const_string, offsetof(struct p, user), SD_JSON_MANDATORY },
+    {}
+  };
+  _cleanup_(freep) char *error = NULL;
+  int r;
+
+  log_msg (LOG_INFO, "Varlink method \"GetLastLogin\" called...");
+
+  r = sd_varlink_dispatch(link, parameters, dispatch_table, &p);
+  if (r != 0)
+    {
+      log_msg(LOG_ERR, "Get last login request: varlink dispatch failed: %s", strerror (-r));
+      return r;
+    }
+
+  r = wtmpdb_get_last_login (_PATH_WTMPDB, p.user, &wtmpdb_cb_func, &e, &error);
+  if (r == -ENOENT)
+    return sd_varlink_errorbo(link, "org.openSUSE.wtmpdb.NoEntryFound",
+			      SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
+			      SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error));
+  if (r < 0 || e.incomplete)
+    {
+      log_msg(LOG_ERR, "Get last login from db failed: %s", error);
+      return sd_varlink_errorbo(link, "org.openSUSE.wtmpdb.InternalError",
+				SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
+				SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"unknown"));
     }
 
   return sd_varlink_replybo(link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
-			    SD_JSON_BUILD_PAIR_VARIANT("Data", array));
+			    SD_JSON_BUILD_PAIR_VARIANT("Data", e.array));
+}
+
+static int
+wtmpdb_boots_cb_func (void *u, int argc, char **argv, char _unused_(**azColName))
+{
+  struct entries *e = u;
+  char *endptr;
+  uint64_t values[4] = { 0, 0, 0, 0 };
+  /* BootTime, ShutdownTime, NextBoot, Sessions */
+  static const int idx[4] = { 2, 3, 5, 6 };
+  int r;
+
+  if (argc != 8)
+    {
+      log_msg(LOG_ERR, "Invalid number of arguments: got %i, expected 8", argc);
+      e->incomplete = 1;
+      return 0;
+    }
+
+  for (int i = 0; i < 4; i++)
+    {
+      const char *str = argv[idx[i]];
+
+      if (str == NULL)
+	continue;
+
+      errno = 0;
+      values[i] = strtoull(str, &endptr, 10);
+      if (errno == ERANGE || endptr == str || *endptr != '\0')
+	{
+	  log_msg(LOG_ERR, "Invalid numeric entry: '%s'\n", str);
+	  e->incomplete = 1;
+	  return 0;
+	}
+    }
+
+  r = sd_json_variant_append_arraybo(&e->array,
+				     SD_JSON_BUILD_PAIR_INTEGER("ID", atoll (argv[0])),
+				     SD_JSON_BUILD_PAIR_STRING("User", argv[1]),
+				     SD_JSON_BUILD_PAIR_INTEGER("BootTime", values[0]),
+				     SD_JSON_BUILD_PAIR_CONDITION(argv[3] != NULL,
+								  "ShutdownTime", SD_JSON_BUILD_INTEGER(values[1])),
+				     SD_JSON_BUILD_PAIR_STRING("Kernel", argv[4]?argv[4]:""),
+				     SD_JSON_BUILD_PAIR_CONDITION(argv[5] != NULL,
+								  "NextBoot", SD_JSON_BUILD_INTEGER(values[2])),
+				     SD_JSON_BUILD_PAIR_INTEGER("Sessions", values[3]),
+				     SD_JSON_BUILD_PAIR_BOOLEAN("Crash", argv[7] && atoi (argv[7]) != 0));
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Appending array failed: %s", strerror(-r));
+      e->incomplete = 1;
+    }
+
+  return 0;
+}
+
+static void
+read_boots_run (struct job *job)
+{
+  job->r = wtmpdb_read_boots (_PATH_WTMPDB, &wtmpdb_boots_cb_func,
+			      &job->entries, &job->error);
+}
+
+static int
+read_boots_reply (struct job *job)
+{
+  int r;
+
+  if (job->r < 0 || job->error != NULL || job->entries.incomplete)
+    {
+      log_msg(LOG_ERR, "Didn't got all boots from db: %s", job->error);
+      return sd_varlink_errorbo(job->link, "org.openSUSE.wtmpdb.InternalError",
+				SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
+                                SD_JSON_BUILD_PAIR_STRING("ErrorMsg", job->error?job->error:"unknown"));
+    }
+
+  if (job->entries.array == NULL)
+    {
+      r = sd_json_variant_new_array(&job->entries.array, NULL, 0);
+      if (r < 0)
+	return r;
+    }
+
+  return sd_varlink_replybo(job->link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
+			    SD_JSON_BUILD_PAIR_VARIANT("Data", job->entries.array));
+}
+
+static int
+vl_method_read_boots(sd_varlink *link, sd_json_variant *parameters,
+		     sd_varlink_method_flags_t _unused_(flags),
+		     void *userdata)
+{
+  sd_event *loop = userdata;
+  struct job *job;
+  int r;
+
+  log_msg (LOG_INFO, "Varlink method \"ReadBoots\" called...");
+
+  r = sd_varlink_dispatch(link, parameters, NULL, NULL);
+  if (r != 0)
+    {
+      log_msg(LOG_ERR, "Get boots request: varlink dispatch failed: %s", strerror (-r));
+      return r;
+    }
+
+  /* like ReadAll, this reads the whole database */
+  job = job_new(link);
+  if (job == NULL)
+    return -errno;
+  job->run = read_boots_run;
+  job->reply = read_boots_reply;
+
+  return job_start(link, loop, job);
 }
 
 static int
@@ -517,11 +1316,25 @@ vl_method_rotate(sd_varlink *link, sd_json_variant *parameters,
 {
   struct p {
     int days;
+    bool swap;
+    bool compress;
+    uint64_t max_size;
+    uint64_t max_rows;
+    int keep;
+    int keep_days;
   } p = {
-    .days = -1
+    .days = -1,
+    .swap = false,
+    .compress = false
   };
   static const sd_json_dispatch_field dispatch_table[] = {
-    { "Days", SD_JSON_VARIANT_INTEGER, sd_json_dispatch_int, offsetof(struct p, days), SD_JSON_MANDATORY },
+    { "Days",     SD_JSON_VARIANT_INTEGER, sd_json_dispatch_int,     offsetof(struct p, days),      SD_JSON_MANDATORY },
+    { "Swap",     SD_JSON_VARIANT_BOOLEAN, sd_json_dispatch_stdbool, offsetof(struct p, swap),      0 },
+    { "Compress", SD_JSON_VARIANT_BOOLEAN, sd_json_dispatch_stdbool, offsetof(struct p, compress),  0 },
+    { "MaxSize",  SD_JSON_VARIANT_INTEGER, sd_json_dispatch_uint64,  offsetof(struct p, max_size),  0 },
+    { "MaxRows",  SD_JSON_VARIANT_INTEGER, sd_json_dispatch_uint64,  offsetof(struct p, max_rows),  0 },
+    { "Keep",     SD_JSON_VARIANT_INTEGER, sd_json_dispatch_int,     offsetof(struct p, keep),      0 },
+    { "KeepDays", SD_JSON_VARIANT_INTEGER, sd_json_dispatch_int,     offsetof(struct p, keep_days), 0 },
     {}
   };
   _cleanup_(freep) char *error = NULL;
@@ -536,7 +1349,10 @@ vl_method_rotate(sd_varlink *link, sd_json_variant *parameters,
       return r;
     }
 
-  log_msg(LOG_DEBUG, "Rotate of database for entries older than '%i' days requested", p.days);
+  if (p.swap)
+    log_msg(LOG_DEBUG, "Rotate of database by swapping files requested");
+  else
+    log_msg(LOG_DEBUG, "Rotate of database for entries older than '%i' days requested", p.days);
 
   uid_t peer_uid;
   r = sd_varlink_get_peer_uid(link, &peer_uid);
@@ -553,7 +1369,17 @@ vl_method_rotate(sd_varlink *link, sd_json_variant *parameters,
 
   _cleanup_(freep) char *backup = NULL;
   uint64_t entries = 0;
-  r = wtmpdb_rotate (_PATH_WTMPDB, p.days, &error, &backup, &entries);
+  struct wtmpdb_rotate_opts opts = {
+    .days = p.days,
+    .flags = (p.swap ? WTMPDB_ROTATE_SWAP : 0) |
+	     (p.compress ? WTMPDB_ROTATE_COMPRESS : 0),
+    .max_size = p.max_size,
+    .max_rows = p.max_rows,
+    .keep = p.keep,
+    .keep_days = p.keep_days
+  };
+  r = wtmpdb_rotate_v2 (_PATH_WTMPDB, &opts, &error, &backup, &entries);
+  cache_invalidate ();
   if (r < 0 || error != NULL)
     {
       log_msg(LOG_ERR, "Rotate db failed: %s", error);
@@ -572,6 +1398,90 @@ vl_method_rotate(sd_varlink *link, sd_json_variant *parameters,
 			      SD_JSON_BUILD_PAIR_INTEGER("Entries", entries));
 }
 
+static void
+backup_run (struct job *job)
+{
+  job->r = wtmpdb_backup (_PATH_WTMPDB, job->dest, job->flags, &job->error);
+}
+
+static int
+backup_reply (struct job *job)
+{
+  if (job->r < 0)
+    {
+      log_msg(LOG_ERR, "Backup to '%s' failed: %s", job->dest,
+	      job->error ? job->error : strerror(-job->r));
+      return sd_varlink_errorbo(job->link, "org.openSUSE.wtmpdb.InternalError",
+				SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
+				SD_JSON_BUILD_PAIR_STRING("ErrorMsg", "Backup failed, see log of wtmpdbd"));
+    }
+  return sd_varlink_replybo(job->link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true));
+}
+
+static int
+vl_method_backup(sd_varlink *link, sd_json_variant *parameters,
+		 sd_varlink_method_flags_t _unused_(flags),
+		 void *userdata)
+{
+  struct p {
+    const char *dest;
+    bool vacuum;
+  } p = {
+    .dest = NULL,
+    .vacuum = false
+  };
+  static const sd_json_dispatch_field dispatch_table[] = {
+    { "Destination", SD_JSON_VARIANT_STRING,  sd_json_dispatch_const_string, offsetof(struct p, dest),   SD_JSON_MANDATORY },
+    { "Vacuum",      SD_JSON_VARIANT_BOOLEAN, sd_json_dispatch_stdbool,      offsetof(struct p, vacuum), 0 },
+    {}
+  };
+  sd_event *loop = userdata;
+  struct job *job;
+  int r;
+
+  log_msg (LOG_INFO, "Varlink method \"Backup\" called...");
+
+  r = sd_varlink_dispatch(link, parameters, dispatch_table, &p);
+  if (r != 0)
+    {
+      log_msg(LOG_ERR, "Backup request: varlink dispatch failed: %s", strerror (-r));
+      return r;
+    }
+
+  uid_t peer_uid;
+  r = sd_varlink_get_peer_uid(link, &peer_uid);
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Failed to get peer UID: %s", strerror(-r));
+      return r;
+    }
+  if (peer_uid != 0)
+    {
+      log_msg(LOG_WARNING, "Backup: peer UID %i denied", peer_uid);
+      return sd_varlink_error(link, SD_VARLINK_ERROR_PERMISSION_DENIED, parameters);
+    }
+  if (p.dest[0] != '/')
+    return sd_varlink_error_invalid_parameter_name(link, "Destination");
+
+  log_msg(LOG_DEBUG, "Backup of database to '%s' requested", p.dest);
+
+  /* the backup takes a while, don't block logins meanwhile */
+  job = job_new(link);
+  if (job == NULL)
+    return -errno;
+  job->dest = strdup(p.dest);
+  if (job->dest == NULL)
+    {
+      job_free(job);
+      return -ENOMEM;
+    }
+  job->flags = p.vacuum ? WTMPDB_BACKUP_VACUUM : 0;
+  job->run = backup_run;
+  job->reply = backup_reply;
+
+  return job_start(link, loop, job);
+}
+
 static int
 vl_method_quit (sd_varlink *link, sd_json_variant *parameters,
 		  sd_varlink_method_flags_t _unused_(flags),
@@ -643,11 +1553,63 @@ announce_stopping (void)
     log_msg (LOG_ERR, "sd_notify(STOPPING) failed: %s", strerror(-r));
 }
 
+/* The database schema is migrated in slices of MIGRATE_SLICE_USEC with
+   a pause of MIGRATE_PAUSE_USEC in between, varlink calls go first. */
+#define MIGRATE_SLICE_USEC (20*1000)
+#define MIGRATE_PAUSE_USEC (100*1000)
+
+static int
+migrate_database (sd_event_source *s, uint64_t _unused_(usec),
+		  void _unused_(*userdata))
+{
+  _cleanup_(freep) char *error = NULL;
+  int r;
+
+  r = wtmpdb_migrate (_PATH_WTMPDB, MIGRATE_SLICE_USEC, &error);
+  if (r > 0)
+    {
+      r = sd_event_source_set_time_relative (s, MIGRATE_PAUSE_USEC);
+      if (r < 0)
+	return r;
+      return sd_event_source_set_enabled (s, SD_EVENT_ONESHOT);
+    }
+
+  if (r < 0)
+    log_msg (LOG_ERR, "Migrating the database schema failed: %s", error);
+  else
+    log_msg (LOG_DEBUG, "Database schema is up to date");
+  return sd_event_source_set_enabled (s, SD_EVENT_OFF);
+}
+
+/* With --metrics, the metrics get written to the text file at start,
+   every METRICS_INTERVAL_USEC and at exit. */
+#define METRICS_INTERVAL_USEC (60*USEC_PER_SEC)
+
+static void
+metrics_export (void)
+{
+  _cleanup_(freep) char *error = NULL;
+
+  if (wtmpdb_write_metrics (_PATH_WTMPDB, metrics_path, &error) < 0)
+    log_msg (LOG_ERR, "Writing the metrics failed: %s", error);
+}
+
+static int
+metrics_run (sd_event_source *s, uint64_t _unused_(usec),
+	     void _unused_(*userdata))
+{
+  metrics_export ();
+  if (sd_event_source_set_time_relative (s, METRICS_INTERVAL_USEC) < 0)
+    return sd_event_source_set_enabled (s, SD_EVENT_OFF);
+  return sd_event_source_set_enabled (s, SD_EVENT_ONESHOT);
+}
+
 /* event loop which quits after 30 seconds idle time */
 #define DEFAULT_EXIT_USEC (30*USEC_PER_SEC)
 
 static int
-varlink_event_loop_with_idle(sd_event *e, sd_varlink_server *s)
+varlink_event_loop_with_idle(sd_event *e, sd_varlink_server *s,
+			     sd_varlink_server *w)
 {
   int r, code;
 
@@ -663,7 +1625,9 @@ varlink_event_loop_with_idle(sd_event *e, sd_varlink_server *s)
       if (r < 0)
 	return r;
 
-      if (r == 0 && (sd_varlink_server_current_connections(s) == 0))
+      if (r == 0 && (sd_varlink_server_current_connections(s) == 0) &&
+	  (sd_varlink_server_current_connections(w) == 0) &&
+	  jobs_running == 0)
 	sd_event_exit(e, 0);
     }
 
@@ -674,67 +1638,147 @@ varlink_event_loop_with_idle(sd_event *e, sd_varlink_server *s)
   return code;
 }
 
+/* Login, Logout and the lookups of pam_wtmpdb have a socket of their
+   own, which only root can use. Its calls are dispatched before the
+   ones of the generic socket, which still offers all methods, but
+   accepts only READ_CONNECTIONS_MAX connections, READ_CONNECTIONS_UID_MAX
+   per user. */
+#define READ_CONNECTIONS_MAX 32
+#define READ_CONNECTIONS_UID_MAX 4
+
 static int
-run_varlink (void)
+new_server (sd_varlink_server **ret, sd_event *event, const char *description,
+	    int64_t priority)
 {
-  int r;
-  _cleanup_(sd_event_unrefp) sd_event *event = NULL;
   _cleanup_(sd_varlink_server_unrefp) sd_varlink_server *varlink_server = NULL;
+  int r;
 
-  r = mkdir_p(_VARLINK_WTMPDB_SOCKET_DIR, 0755);
+  r = sd_varlink_server_new (&varlink_server, SD_VARLINK_SERVER_ACCOUNT_UID|SD_VARLINK_SERVER_INHERIT_USERDATA);
   if (r < 0)
     {
-      log_msg(LOG_ERR, "Failed to create directory '"_VARLINK_WTMPDB_SOCKET_DIR"' for Varlink socket: %s",
-	      strerror(-r));
+      log_msg (LOG_ERR, "Failed to allocate varlink server: %s",
+	       strerror (-r));
       return r;
     }
 
-  r = sd_event_new (&event);
+  r = sd_varlink_server_set_description (varlink_server, description);
   if (r < 0)
     {
-      log_msg (LOG_ERR, "Failed to create new event: %s",
+      log_msg (LOG_ERR, "Failed to set varlink server description: %s",
 	       strerror (-r));
       return r;
     }
 
-  r = sd_varlink_server_new (&varlink_server, SD_VARLINK_SERVER_ACCOUNT_UID|SD_VARLINK_SERVER_INHERIT_USERDATA);
+  r = sd_varlink_server_set_info (varlink_server, NULL, PACKAGE" (wtmpdbd)",
+				  VERSION, "https://github.com/thkukuk/wtmpdb");
+  if (r < 0)
+    return r;
+
+  r = sd_varlink_server_add_interface (varlink_server, &vl_interface_org_openSUSE_wtmpdb);
   if (r < 0)
     {
-      log_msg (LOG_ERR, "Failed to allocate varlink server: %s",
-	       strerror (-r));
+      log_msg(LOG_ERR, "Failed to add interface: %s", strerror(-r));
       return r;
     }
 
-  r = sd_varlink_server_set_description (varlink_server, "wtmpdbd");
+  sd_varlink_server_set_userdata (varlink_server, event);
+
+  r = sd_varlink_server_attach_event (varlink_server, event, priority);
   if (r < 0)
     {
-      log_msg (LOG_ERR, "Failed to set varlink server description: %s",
+      log_msg (LOG_ERR, "Failed to attach to event: %s", strerror (-r));
+      return r;
+    }
+
+  *ret = varlink_server;
+  varlink_server = NULL;
+  return 0;
+}
+
+/* With socket activation, the write socket is passed as "varlink-write" */
+static int
+listen_write_socket (sd_varlink_server *write_server)
+{
+  char **names = NULL;
+  int n, r = 0;
+
+  n = sd_listen_fds_with_names (false, &names);
+  if (n < 0)
+    {
+      log_msg (LOG_ERR, "Failed to get passed sockets: %s", strerror (-n));
+      return n;
+    }
+
+  for (int i = 0; i < n; i++)
+    {
+      if (r == 0 && strcmp (names[i], "varlink-write") == 0)
+	{
+	  r = sd_varlink_server_listen_fd (write_server, SD_LISTEN_FDS_START + i);
+	  if (r < 0)
+	    log_msg (LOG_ERR, "Failed to listen on write socket: %s",
+		     strerror (-r));
+	}
+      free (names[i]);
+    }
+  free (names);
+  return r;
+}
+
+static int
+run_varlink (void)
+{
+  int r;
+  _cleanup_(sd_event_unrefp) sd_event *event = NULL;
+  _cleanup_(sd_varlink_server_unrefp) sd_varlink_server *varlink_server = NULL;
+  _cleanup_(sd_varlink_server_unrefp) sd_varlink_server *write_server = NULL;
+  _cleanup_(sd_event_source_unrefp) sd_event_source *migrate_source = NULL;
+  _cleanup_(sd_event_source_unrefp) sd_event_source *metrics_source = NULL;
+
+  r = mkdir_p(_VARLINK_WTMPDB_SOCKET_DIR, 0755);
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Failed to create directory '"_VARLINK_WTMPDB_SOCKET_DIR"' for Varlink socket: %s",
+	      strerror(-r));
+      return r;
+    }
+
+  r = sd_event_new (&event);
+  if (r < 0)
+    {
+      log_msg (LOG_ERR, "Failed to create new event: %s",
 	       strerror (-r));
       return r;
     }
 
-  r = sd_varlink_server_set_info (varlink_server, NULL, PACKAGE" (wtmpdbd)",
-				  VERSION, "https://github.com/thkukuk/wtmpdb");
+  r = new_server (&varlink_server, event, "wtmpdbd", SD_EVENT_PRIORITY_NORMAL);
   if (r < 0)
     return r;
 
-  r = sd_varlink_server_add_interface (varlink_server, &vl_interface_org_openSUSE_wtmpdb);
+  r = sd_varlink_server_set_connections_max (varlink_server, READ_CONNECTIONS_MAX);
+  if (r >= 0)
+    r = sd_varlink_server_set_connections_per_uid_max (varlink_server,
+						       READ_CONNECTIONS_UID_MAX);
   if (r < 0)
     {
-      log_msg(LOG_ERR, "Failed to add interface: %s", strerror(-r));
+      log_msg (LOG_ERR, "Failed to set connection limits: %s", strerror (-r));
       return r;
     }
 
   r = sd_varlink_server_bind_method_many (varlink_server,
 					  "org.openSUSE.wtmpdb.GetBootTime",    vl_method_get_boottime,
 					  "org.openSUSE.wtmpdb.GetEnvironment", vl_method_get_environment,
+					  "org.openSUSE.wtmpdb.GetStats",       vl_method_get_stats,
 					  "org.openSUSE.wtmpdb.GetID",          vl_method_get_id,
 					  "org.openSUSE.wtmpdb.Login",          vl_method_login,
 					  "org.openSUSE.wtmpdb.Logout",         vl_method_logout,
 					  "org.openSUSE.wtmpdb.Ping",           vl_method_ping,
 					  "org.openSUSE.wtmpdb.Quit",           vl_method_quit,
 					  "org.openSUSE.wtmpdb.ReadAll",        vl_method_read_all,
+					  "org.openSUSE.wtmpdb.ReadMatch",      vl_method_read_match,
+					  "org.openSUSE.wtmpdb.GetLastLogin",   vl_method_get_last_login,
+					  "org.openSUSE.wtmpdb.ReadBoots",      vl_method_read_boots,
 					  "org.openSUSE.wtmpdb.Rotate",         vl_method_rotate,
+					  "org.openSUSE.wtmpdb.Backup",         vl_method_backup,
 					  "org.openSUSE.wtmpdb.SetLogLevel",    vl_method_set_log_level);
   if (r < 0)
     {
@@ -743,15 +1787,56 @@ run_varlink (void)
       return r;
     }
 
-  sd_varlink_server_set_userdata (varlink_server, event);
+  r = new_server (&write_server, event, "wtmpdbd-write", SD_EVENT_PRIORITY_IMPORTANT);
+  if (r < 0)
+    return r;
 
-  r = sd_varlink_server_attach_event (varlink_server, event, SD_EVENT_PRIORITY_NORMAL);
+  r = sd_varlink_server_bind_method_many (write_server,
+					  "org.openSUSE.wtmpdb.GetID",          vl_method_get_id,
+					  "org.openSUSE.wtmpdb.Login",          vl_method_login,
+					  "org.openSUSE.wtmpdb.Logout",         vl_method_logout,
+					  "org.openSUSE.wtmpdb.GetLastLogin",   vl_method_get_last_login,
+					  "org.openSUSE.wtmpdb.Ping",           vl_method_ping);
   if (r < 0)
     {
-      log_msg (LOG_ERR, "Failed to attach to event: %s", strerror (-r));
+      log_msg(LOG_ERR, "Failed to bind Varlink methods: %s",
+	      strerror(-r));
+      return r;
+    }
+
+  r = sd_event_add_time_relative (event, &maint_source, CLOCK_MONOTONIC,
+				  MAINT_IDLE_USEC, 0, maint_run, NULL);
+  if (r >= 0)
+    r = sd_event_source_set_priority (maint_source, SD_EVENT_PRIORITY_IDLE);
+  if (r < 0)
+    {
+      log_msg (LOG_ERR, "Failed to add maintenance timer: %s", strerror (-r));
+      return r;
+    }
+
+  r = sd_event_add_time_relative (event, &migrate_source, CLOCK_MONOTONIC,
+				  0, 0, migrate_database, NULL);
+  if (r >= 0)
+    r = sd_event_source_set_priority (migrate_source, SD_EVENT_PRIORITY_IDLE);
+  if (r < 0)
+    {
+      log_msg (LOG_ERR, "Failed to add migration timer: %s", strerror (-r));
       return r;
     }
 
+  if (metrics_path)
+    {
+      r = sd_event_add_time_relative (event, &metrics_source, CLOCK_MONOTONIC,
+				      0, 0, metrics_run, NULL);
+      if (r >= 0)
+	r = sd_event_source_set_priority (metrics_source, SD_EVENT_PRIORITY_IDLE);
+      if (r < 0)
+	{
+	  log_msg (LOG_ERR, "Failed to add metrics timer: %s", strerror (-r));
+	  return r;
+	}
+    }
+
   r = sd_varlink_server_listen_auto (varlink_server);
   if (r < 0)
     {
@@ -759,8 +1844,13 @@ run_varlink (void)
       return r;
     }
 
-
-  if (!socket_activation)
+  if (socket_activation)
+    {
+      r = listen_write_socket (write_server);
+      if (r < 0)
+	return r;
+    }
+  else
     {
       r = sd_varlink_server_listen_address(varlink_server, _VARLINK_WTMPDB_SOCKET, 0666);
       if (r < 0)
@@ -768,14 +1858,24 @@ run_varlink (void)
 	  log_msg (LOG_ERR, "Failed to bind to Varlink socket: %s", strerror (-r));
 	  return r;
 	}
+      r = sd_varlink_server_listen_address(write_server, _VARLINK_WTMPDB_WRITE_SOCKET, 0600);
+      if (r < 0)
+	{
+	  log_msg (LOG_ERR, "Failed to bind to Varlink write socket: %s", strerror (-r));
+	  return r;
+	}
     }
 
   announce_ready();
   if (socket_activation)
-    r = varlink_event_loop_with_idle(event, varlink_server);
+    r = varlink_event_loop_with_idle(event, varlink_server, write_server);
   else
     r = sd_event_loop(event);
   announce_stopping();
+  maint_source = sd_event_source_unref (maint_source);
+  cache_invalidate ();
+  if (metrics_path)
+    metrics_export ();
 
   return r;
 }
@@ -786,6 +1886,8 @@ print_help (void)
   printf("wtmpdbd - manage wtmpdb\n");
 
   printf("  -s, --socket   Activation through socket\n");
+  printf("  -m, --metrics PATH\n"
+	 "                 Write metrics to PATH every minute\n");
   printf("  -d, --debug    Debug mode\n");
   printf("  -v, --verbose  Verbose logging\n");
   printf("  -?, --help     Give this help list\n");
@@ -802,6 +1904,7 @@ main (int argc, char **argv)
       static struct option long_options[] =
         {
 	  {"socket", no_argument, NULL, 's'},
+	  {"metrics", required_argument, NULL, 'm'},
           {"debug", no_argument, NULL, 'd'},
           {"verbose", no_argument, NULL, 'v'},
           {"version", no_argument, NULL, '\255'},
@@ -811,7 +1914,7 @@ main (int argc, char **argv)
         };
 
 
-      c = getopt_long (argc, argv, "sdvh?", long_options, &option_index);
+      c = getopt_long (argc, argv, "sm:dvh?", long_options, &option_index);
       if (c == (-1))
         break;
       switch (c)
@@ -819,6 +1922,9 @@ main (int argc, char **argv)
 	case 's':
 	  socket_activation = true;
 	  break;
+	case 'm':
+	  metrics_path = optarg;
+	  break;
         case 'd':
 	  set_max_log_level(LOG_DEBUG);
           break;
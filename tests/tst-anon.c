@@ -0,0 +1,163 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Test case:
+   The pseudonyms of users and hosts must be stable within a run and
+   for the same seed, and distinct for distinct inputs, also for more
+   IPv4 addresses than their 24 bits make likely without a collision.
+   wtmpdb last --anonymize (path given as argument) must leave entries
+   other than USER_PROCESS unchanged.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "wtmpdb.h"
+#include "../src/anon.h"
+
+#define ADDRS 20000
+
+static const char *db_path = "tst-anon.db";
+
+static int
+cmp_str (const void *p1, const void *p2)
+{
+  return strcmp (*(char * const *)p1, *(char * const *)p2);
+}
+
+static int
+check_distinct (void)
+{
+  static char *out[ADDRS];
+  char in[32];
+
+  for (int i = 0; i < ADDRS; i++)
+    {
+      snprintf (in, sizeof (in), "192.168.%d.%d", i / 256, i % 256);
+      out[i] = strdup (anon_host (in));
+      if (out[i] == NULL || strncmp (out[i], "10.", 3) != 0)
+	{
+	  fprintf (stderr, "%s: pseudonym %s\n", in, out[i] ? out[i] : "");
+	  return 1;
+	}
+      /* memoized and stable */
+      if (strcmp (anon_host (in), out[i]) != 0)
+	{
+	  fprintf (stderr, "%s: pseudonym changed\n", in);
+	  return 1;
+	}
+    }
+  qsort (out, ADDRS, sizeof (out[0]), cmp_str);
+  for (int i = 1; i < ADDRS; i++)
+    if (strcmp (out[i - 1], out[i]) == 0)
+      {
+	fprintf (stderr, "two addresses are mapped to %s\n", out[i]);
+	return 1;
+      }
+  for (int i = 0; i < ADDRS; i++)
+    free (out[i]);
+
+  if (strcmp (anon_user ("alice"), anon_user ("bob")) == 0 ||
+      strcmp (anon_user ("alice"), anon_user ("alice")) != 0 ||
+      strcmp (anon_host ("a.example.org"), anon_host ("b.example.org")) == 0 ||
+      strcmp (anon_host ("2001:db8::1"), anon_host ("2001:db8::2")) == 0 ||
+      strcmp (anon_host (""), "") != 0)
+    {
+      fprintf (stderr, "pseudonyms of users or hosts are not distinct\n");
+      return 1;
+    }
+  return 0;
+}
+
+/* Runs wtmpdb last --anonymize=seed, returns its output */
+static char *
+run_last (const char *wtmpdb, char *buf, size_t size)
+{
+  char cmd[1024];
+  FILE *fp;
+  size_t n;
+
+  snprintf (cmd, sizeof (cmd), "%s last -w -f %s --anonymize=seed",
+	    wtmpdb, db_path);
+  if ((fp = popen (cmd, "r")) == NULL)
+    {
+      perror (cmd);
+      return NULL;
+    }
+  n = fread (buf, 1, size - 1, fp);
+  buf[n] = '\0';
+  if (pclose (fp) != 0)
+    {
+      fprintf (stderr, "%s failed:\n%s", cmd, buf);
+      return NULL;
+    }
+  return buf;
+}
+
+static int
+check_last (const char *wtmpdb)
+{
+  static char out[2][4096];
+  uint64_t t = 1700000000ULL * USEC_PER_SEC;
+  char *error = NULL;
+
+  remove (db_path);
+  if (wtmpdb_login (db_path, BOOT_TIME, "reboot", t, "~", "6.8.0-tst",
+		    NULL, &error) < 0 ||
+      wtmpdb_login (db_path, USER_PROCESS, "alice", t + USEC_PER_SEC,
+		    "pts/0", "192.0.2.1", "sshd", &error) < 0)
+    {
+      fprintf (stderr, "login: %s\n", error ? error : "failed");
+      return 1;
+    }
+
+  if (run_last (wtmpdb, out[0], sizeof (out[0])) == NULL ||
+      run_last (wtmpdb, out[1], sizeof (out[1])) == NULL)
+    return 1;
+  if (strcmp (out[0], out[1]) != 0 ||
+      strstr (out[0], "alice") != NULL || strstr (out[0], "192.0.2.1") != NULL ||
+      strstr (out[0], "reboot") == NULL || strstr (out[0], "6.8.0-tst") == NULL)
+    {
+      fprintf (stderr, "wrong anonymized output:\n%s---\n%s", out[0], out[1]);
+      return 1;
+    }
+
+  remove (db_path);
+  return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  if (anon_init ("seed") < 0 || check_distinct () != 0)
+    return 1;
+  if (argc > 1 && check_last (argv[1]) != 0)
+    return 1;
+  return 0;
+}
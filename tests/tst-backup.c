@@ -0,0 +1,234 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Test case:
+   Back up a database with the backup API and with VACUUM INTO and
+   compare the entries of the copies with the original. Back up a
+   time-partitioned database into a directory. Back up a large database
+   while another process keeps logging in, the backup must finish.
+*/
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sqlite3.h>
+
+#include "wtmpdb.h"
+#include "tst-common.h"
+
+#define ENTRIES 500
+#define BUSY_ROWS 40000
+#define BUSY_TIMEOUT 60 /* sec, a restarting backup never ends */
+
+#define _STR(x) #x
+#define STR(x) _STR(x)
+
+static const char *db_path = "tst-backup.db";
+static const char *bak_path = "tst-backup-copy.db";
+static const char *db_dir = "tst-backup.d";
+static const char *bak_dir = "tst-backup-copy.d";
+
+static struct tst_rows result[2];
+
+static int
+compare (const char *orig, const char *copy)
+{
+  char *error = NULL;
+
+  tst_rows_reset (&result[0]);
+  tst_rows_reset (&result[1]);
+  if (wtmpdb_read_all_v2 (orig, 0, tst_collect, &result[0], &error) != 0 ||
+      wtmpdb_read_all_v2 (copy, 0, tst_collect, &result[1], &error) != 0)
+    {
+      fprintf (stderr, "read_all: %s\n", error ? error : "failed");
+      free (error);
+      return 1;
+    }
+  if (result[0].len == 0 || strcmp (result[0].text, result[1].text) != 0)
+    {
+      fprintf (stderr, "%s differs from %s:\n%s---\n%s", copy, orig,
+	       result[0].text, result[1].text);
+      return 1;
+    }
+  return 0;
+}
+
+static int
+fill (const char *path)
+{
+  uint64_t t = 1700000000ULL * USEC_PER_SEC;
+  char *error = NULL;
+
+  for (int i = 0; i < ENTRIES; i++)
+    {
+      char user[16], tty[16];
+      int64_t id;
+
+      t += 4 * 3600 * USEC_PER_SEC;
+      snprintf (user, sizeof (user), "user%d", i % 7);
+      snprintf (tty, sizeof (tty), "pts/%d", i % 5);
+      id = wtmpdb_login (path, i % 50 ? USER_PROCESS : BOOT_TIME, user, t,
+			 tty, "localhost", "tst", &error);
+      if (id < 0 || (i % 3 == 0 &&
+		     wtmpdb_logout (path, id, t + 60 * USEC_PER_SEC,
+				    &error) != 0))
+	{
+	  fprintf (stderr, "%s: %s\n", path, error ? error : "failed");
+	  free (error);
+	  return 1;
+	}
+    }
+  return 0;
+}
+
+static void
+cleanup (void)
+{
+  remove (db_path);
+  remove (bak_path);
+  tst_remove_dir (db_dir);
+  tst_remove_dir (bak_dir);
+}
+
+static int
+backup (const char *orig, const char *copy, unsigned int flags)
+{
+  char *error = NULL;
+
+  if (wtmpdb_backup (orig, copy, flags, &error) != 0)
+    {
+      fprintf (stderr, "backup of %s: %s\n", orig, error ? error : "failed");
+      free (error);
+      return 1;
+    }
+  return compare (orig, copy);
+}
+
+/* Logs in every few ms until it gets killed or the test ends */
+static void
+busy_writer (const char *path, pid_t parent)
+{
+  uint64_t t = 1800000000ULL * USEC_PER_SEC;
+
+  while (getppid () == parent)
+    {
+      if (wtmpdb_login (path, USER_PROCESS, "busy", t++, "pts/9",
+			"localhost", "tst", NULL) < 0)
+	_exit (1);
+      usleep (5000);
+    }
+  _exit (0);
+}
+
+static int
+backup_busy (void)
+{
+  int n_orig = 0, n_copy = 0;
+  char *error = NULL;
+  pid_t parent = getpid ();
+  sqlite3 *db;
+  pid_t pid;
+  int r;
+
+  /* a few MB, the backup takes many steps */
+  if (sqlite3_open (db_path, &db) != SQLITE_OK ||
+      sqlite3_exec (db, "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL "
+		    "SELECT i + 1 FROM n WHERE i < " STR(BUSY_ROWS) ") "
+		    "INSERT INTO wtmp (Type, User, Login, TTY, Service) "
+		    "SELECT " STR(USER_PROCESS) ", 'user' || (i % 100), "
+		    "1700000000000000 + i, 'pts/' || i, printf('%.100c', 'x') "
+		    "FROM n", NULL, NULL, NULL) != SQLITE_OK)
+    {
+      fprintf (stderr, "Cannot fill %s: %s\n", db_path, sqlite3_errmsg (db));
+      sqlite3_close (db);
+      return 1;
+    }
+  sqlite3_close (db);
+  if (wtmpdb_read_all_v2 (db_path, 0, tst_count, &n_orig, &error) != 0)
+    goto fail;
+
+  pid = fork ();
+  if (pid < 0)
+    {
+      perror ("fork");
+      return 1;
+    }
+  if (pid == 0)
+    busy_writer (db_path, parent);
+
+  alarm (BUSY_TIMEOUT);
+  r = wtmpdb_backup (db_path, bak_path, 0, &error);
+  alarm (0);
+  kill (pid, SIGTERM);
+  waitpid (pid, NULL, 0);
+  if (r != 0 ||
+      wtmpdb_read_all_v2 (bak_path, 0, tst_count, &n_copy, &error) != 0)
+    goto fail;
+  if (n_copy < n_orig)
+    {
+      fprintf (stderr, "busy backup: %d of %d entries\n", n_copy, n_orig);
+      return 1;
+    }
+  return 0;
+
+ fail:
+  fprintf (stderr, "busy backup: %s\n", error ? error : "failed");
+  free (error);
+  return 1;
+}
+
+int
+main(void)
+{
+  cleanup ();
+
+  if (fill (db_path) != 0 || backup (db_path, bak_path, 0) != 0)
+    return 1;
+  /* an existing copy gets replaced */
+  remove (bak_path);
+  if (backup (db_path, bak_path, WTMPDB_BACKUP_VACUUM) != 0 ||
+      backup (db_path, bak_path, 0) != 0)
+    return 1;
+
+  if (mkdir (db_dir, 0755) < 0)
+    {
+      perror (db_dir);
+      return 1;
+    }
+  if (fill (db_dir) != 0 || backup (db_dir, bak_dir, 0) != 0)
+    return 1;
+
+  if (backup_busy () != 0)
+    return 1;
+
+  cleanup ();
+  return 0;
+}
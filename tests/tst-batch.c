@@ -0,0 +1,175 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Test case:
+   Read entries with wtmpdb_read_batch and compare them with the
+   entries returned by wtmpdb_read_all_v2. An errno value of the
+   callback must be returned as such, not as SQL error.
+*/
+
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "wtmpdb.h"
+
+#define ENTRIES 2100
+
+static const char *db_path = "tst-batch.db";
+static const char *db_mem = "memory:tst-batch";
+
+static int64_t ids[ENTRIES];
+static int n_rows = 0;
+static int n_batched = 0;
+static int n_batches = 0;
+static int errors = 0;
+
+static int
+collect_row (void *unused __attribute__((__unused__)),
+	     int argc, char **argv,
+	     char **azColName __attribute__((__unused__)))
+{
+  if (argc != 8 || n_rows >= ENTRIES)
+    return 1;
+  ids[n_rows++] = strtoll (argv[0], NULL, 10);
+  return 0;
+}
+
+static int
+collect_batch (void *userdata, const struct wtmpdb_batch *batch)
+{
+  const char *tag = userdata;
+
+  n_batches++;
+  if (batch->count == 0 || batch->count > WTMPDB_BATCH_SIZE)
+    {
+      fprintf (stderr, "Invalid batch size %zu\n", batch->count);
+      return 1;
+    }
+  for (size_t i = 0; i < batch->count; i++, n_batched++)
+    {
+      if (n_batched >= ENTRIES || batch->id[i] != ids[n_batched])
+	{
+	  fprintf (stderr, "Entry %d differs\n", n_batched);
+	  errors++;
+	  return 1;
+	}
+      if (batch->type[i] != USER_PROCESS || batch->login[i] == 0 ||
+	  batch->user[i] == NULL || strncmp (batch->user[i], "user", 4) != 0 ||
+	  batch->service[i] == NULL || strcmp (batch->service[i], tag) != 0 ||
+	  batch->rhost[i] != NULL ||
+	  (batch->logout[i] != 0) != (batch->id[i] % 2 == 0))
+	{
+	  fprintf (stderr, "Entry %d has wrong content\n", n_batched);
+	  errors++;
+	  return 1;
+	}
+    }
+  return 0;
+}
+
+static int
+fail_batch (void *userdata __attribute__((__unused__)),
+	    const struct wtmpdb_batch *batch __attribute__((__unused__)))
+{
+  return -ENOMEM;
+}
+
+static int
+check_fail (const char *path)
+{
+  char *error = NULL;
+
+  if (wtmpdb_read_batch (path, 0, fail_batch, NULL, &error) != -ENOMEM ||
+      error == NULL || strstr (error, "Out of memory") == NULL)
+    {
+      fprintf (stderr, "%s: failing callback: %s\n", path,
+	       error ? error : "no error");
+      free (error);
+      return 1;
+    }
+  free (error);
+  return 0;
+}
+
+int
+main(void)
+{
+  char *error = NULL;
+  struct timespec ts;
+  uint64_t now;
+
+  remove (db_path);
+
+  clock_gettime (CLOCK_REALTIME, &ts);
+  now = wtmpdb_timespec2usec (ts);
+
+  for (int i = 0; i < ENTRIES; i++)
+    {
+      char user[32];
+      int64_t id;
+
+      snprintf (user, sizeof (user), "user%d", i % 17);
+      id = wtmpdb_login (db_path, USER_PROCESS, user, now - i * USEC_PER_SEC,
+			 "pts/1", NULL, "tst-batch", &error);
+      if (id < 0 || (id % 2 == 0 &&
+		     wtmpdb_logout (db_path, id, now, &error) != 0))
+	{
+	  fprintf (stderr, "%s\n", error ? error : "wtmpdb_login/logout failed");
+	  free (error);
+	  return 1;
+	}
+    }
+
+  if (wtmpdb_read_all_v2 (db_path, 0, collect_row, NULL, &error) != 0 ||
+      wtmpdb_read_batch (db_path, 0, collect_batch, "tst-batch", &error) != 0)
+    {
+      fprintf (stderr, "%s\n", error ? error : "reading entries failed");
+      free (error);
+      return 1;
+    }
+
+  if (errors || n_rows != ENTRIES || n_batched != ENTRIES ||
+      n_batches != (ENTRIES + WTMPDB_BATCH_SIZE - 1) / WTMPDB_BATCH_SIZE)
+    {
+      fprintf (stderr, "Got %d rows, %d batched entries in %d batches\n",
+	       n_rows, n_batched, n_batches);
+      return 1;
+    }
+
+  if (check_fail (db_path) != 0 ||
+      wtmpdb_login (db_mem, USER_PROCESS, "user", now, "pts/1", NULL,
+		    "tst-batch", &error) < 0 ||
+      check_fail (db_mem) != 0)
+    return 1;
+
+  remove (db_path);
+  return 0;
+}
@@ -0,0 +1,293 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Test case:
+   Rotation writes Bloom filters for past partitions and archives.
+   wtmpdb_read_match must return the same entries as filtering all
+   entries, and must not open files whose filter rules out the
+   searched value: these files get overwritten with garbage, reading
+   them would fail. A new login into a past month removes the filter.
+   For a database file, its archives are searched after it.
+*/
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "wtmpdb.h"
+#include "tst-common.h"
+
+#define MONTHS 6
+#define PER_MONTH 200
+
+static const char *db_dir = "tst-bloom.d";
+static const char *db_path = "tst-bloom.db";
+
+struct count {
+  const char *user;
+  int n;
+};
+
+static int
+count_user (void *data, int argc __attribute__((__unused__)), char **argv,
+	    char **azColName __attribute__((__unused__)))
+{
+  struct count *c = data;
+
+  if (c->user == NULL || strcmp (argv[2], c->user) == 0)
+    c->n++;
+  return 0;
+}
+
+/* Returns the number of entries of user via wtmpdb_read_match, <0 on
+   failure. */
+static int
+read_match (const char *path, const char *user, const char *rhost)
+{
+  struct wtmpdb_match m = { .user = user, .rhost = rhost };
+  struct count c = { .user = NULL, .n = 0 };
+  char *error = NULL;
+
+  if (wtmpdb_read_match (path, &m, count_user, &c, &error) != 0)
+    {
+      fprintf (stderr, "read_match %s: %s\n", user,
+	       error ? error : "failed");
+      free (error);
+      return -1;
+    }
+  return c.n;
+}
+
+static int
+read_filtered (const char *path, const char *user)
+{
+  struct count c = { .user = user, .n = 0 };
+  char *error = NULL;
+
+  if (wtmpdb_read_all_v2 (path, 0, count_user, &c, &error) != 0)
+    {
+      fprintf (stderr, "read_all: %s\n", error ? error : "failed");
+      free (error);
+      return -1;
+    }
+  return c.n;
+}
+
+static void
+cleanup (void)
+{
+  tst_remove_files (db_dir, "wtmp_");
+  rmdir (db_dir);
+  tst_remove_files (".", "tst-bloom_");
+  remove (db_path);
+}
+
+static int
+login (const char *path, const char *user, uint64_t t, const char *host)
+{
+  char *error = NULL;
+
+  if (wtmpdb_login (path, USER_PROCESS, user, t, "pts/0", host, "sshd",
+		    &error) < 0)
+    {
+      fprintf (stderr, "login %s: %s\n", user, error ? error : "failed");
+      free (error);
+      return 1;
+    }
+  return 0;
+}
+
+static int
+garble (const char *path)
+{
+  FILE *fp = fopen (path, "w");
+
+  if (fp == NULL)
+    {
+      perror (path);
+      return 1;
+    }
+  fputs ("no database\n", fp);
+  fclose (fp);
+  return 0;
+}
+
+static int
+test_partitions (void)
+{
+  struct wtmpdb_rotate_opts opts = { .days = 10000 };
+  uint64_t t = 1700000000ULL * USEC_PER_SEC;
+  uint64_t step = 30ULL * 86400 * USEC_PER_SEC / PER_MONTH;
+  char *error = NULL;
+  char path[512];
+  struct dirent *ent;
+  int alice, filters = 0;
+  DIR *d;
+
+  if (mkdir (db_dir, 0755) < 0)
+    {
+      perror (db_dir);
+      return 1;
+    }
+  for (int i = 0; i < MONTHS * PER_MONTH; i++)
+    {
+      char user[16], host[32];
+
+      t += step;
+      snprintf (user, sizeof (user), "user%d", i % 23);
+      snprintf (host, sizeof (host), "10.0.%d.%d", i % 7, i % 251);
+      /* alice only logs in during the first weeks */
+      if (login (db_dir, i == 20 || i == 40 ? "alice" : user, t, host) != 0)
+	return 1;
+    }
+
+  /* nothing is expired, but the filters get written */
+  if (wtmpdb_rotate_v2 (db_dir, &opts, &error, NULL, NULL) != 0)
+    {
+      fprintf (stderr, "rotate: %s\n", error ? error : "failed");
+      return 1;
+    }
+  d = opendir (db_dir);
+  while (d && (ent = readdir (d)) != NULL)
+    if (strstr (ent->d_name, ".bloom") != NULL)
+      filters++;
+  if (d)
+    closedir (d);
+  if (filters < MONTHS)
+    {
+      fprintf (stderr, "only %d filters written\n", filters);
+      return 1;
+    }
+
+  alice = read_filtered (db_dir, "alice");
+  if (alice != 2 || read_match (db_dir, "alice", NULL) != alice ||
+      read_match (db_dir, "user5", NULL) != read_filtered (db_dir, "user5") ||
+      read_match (db_dir, "user5", "10.0.5.5") < 1)
+    {
+      fprintf (stderr, "read_match differs from read_all\n");
+      return 1;
+    }
+
+  /* a new login into a past month removes its filter */
+  if (login (db_dir, "carol", 1700000000ULL * USEC_PER_SEC + 10 * 86400 * USEC_PER_SEC,
+	     "10.1.1.1") != 0 || read_match (db_dir, "carol", NULL) != 1)
+    {
+      fprintf (stderr, "login into past partition not found\n");
+      return 1;
+    }
+
+  /* only the partition with alice's logins may be opened */
+  d = opendir (db_dir);
+  while (d && (ent = readdir (d)) != NULL)
+    {
+      int part, len = 0;
+
+      if (sscanf (ent->d_name, "wtmp_%6d.db%n", &part, &len) != 1 ||
+	  ent->d_name[len] != '\0')
+	continue;
+      snprintf (path, sizeof (path), "%s/%s", db_dir, ent->d_name);
+      if (part != 202311 && garble (path) != 0)
+	return 1;
+    }
+  if (d)
+    closedir (d);
+  if (read_match (db_dir, "alice", NULL) != alice)
+    return 1;
+  return 0;
+}
+
+static int
+test_archive (void)
+{
+  struct wtmpdb_rotate_opts opts = { .flags = WTMPDB_ROTATE_SWAP };
+  char *archive = NULL;
+  char *error = NULL;
+
+  for (int i = 0; i < 100; i++)
+    if (login (db_path, "dave", (1700000000ULL + i * 60) * USEC_PER_SEC,
+	       "10.2.2.2") != 0)
+      return 1;
+  if (wtmpdb_rotate_v2 (db_path, &opts, &error, &archive, NULL) != 0 ||
+      archive == NULL)
+    {
+      fprintf (stderr, "rotate: %s\n", error ? error : "no archive");
+      return 1;
+    }
+  if (read_match (archive, "dave", NULL) != 100 ||
+      read_match (archive, NULL, "10.2.2.2") != 100)
+    {
+      fprintf (stderr, "read_match of archive %s failed\n", archive);
+      return 1;
+    }
+
+  /* the database is read first, then its archive */
+  if (login (db_path, "dave", 1800000000ULL * USEC_PER_SEC, "10.2.2.2") != 0 ||
+      login (db_path, "frank", 1800000060ULL * USEC_PER_SEC, "10.4.4.4") != 0)
+    return 1;
+  if (read_match (db_path, "dave", NULL) != 101 ||
+      read_match (db_path, NULL, "10.2.2.2") != 101 ||
+      read_match (db_path, "frank", NULL) != 1)
+    {
+      fprintf (stderr, "read_match of %s misses the archive\n", db_path);
+      return 1;
+    }
+
+  /* the archive may only be opened if its filter allows a match */
+  if (garble (archive) != 0 ||
+      read_match (archive, "eve", NULL) != 0 ||
+      read_match (archive, NULL, "10.3.3.3") != 0 ||
+      read_match (db_path, "frank", NULL) != 1 ||
+      read_match (db_path, NULL, "10.4.4.4") != 1)
+    {
+      fprintf (stderr, "read_match of archive %s failed\n", archive);
+      return 1;
+    }
+  fprintf (stderr, "expected failure: ");
+  if (read_match (db_path, "dave", NULL) >= 0)
+    {
+      fprintf (stderr, "garbled archive %s was not read\n", archive);
+      return 1;
+    }
+  free (archive);
+  return 0;
+}
+
+int
+main(void)
+{
+  cleanup ();
+
+  if (test_partitions () != 0 || test_archive () != 0)
+    return 1;
+
+  cleanup ();
+  return 0;
+}
@@ -0,0 +1,131 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Test case:
+   Read the boots of a database file, a partitioned one and the
+   in-memory backend with known boots and sessions. Every boot must
+   count the sessions which started within it, the boot which ended
+   without shutdown has crashed, the last one has no NextBoot.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "wtmpdb.h"
+#include "tst-common.h"
+
+#define T (1700000000ULL * USEC_PER_SEC)
+#define MIN (60 * USEC_PER_SEC)
+
+static const char *db_path = "tst-boots.db";
+static const char *db_dir = "tst-boots.d";
+static const char *db_mem = "memory:tst-boots";
+
+/* User, BootTime, ShutdownTime, Kernel, NextBoot, Sessions, Crash,
+   newest first */
+static const char *expected =
+  "reboot|1700007200000000|NULL|6.3|NULL|1|0|\n"
+  "reboot|1700003600000000|NULL|6.2|1700007200000000|0|1|\n"
+  "reboot|1700000000000000|1700003000000000|6.1|1700003600000000|2|0|\n";
+
+static int
+login (const char *path, int type, const char *user, uint64_t t,
+       const char *host, uint64_t logout)
+{
+  char *error = NULL;
+  int64_t id = wtmpdb_login (path, type, user, t, "pts/0", host, "tst",
+			     &error);
+
+  if (id < 0 || (logout && wtmpdb_logout (path, id, logout, &error) != 0))
+    {
+      fprintf (stderr, "%s: login/logout: %s\n", path,
+	       error ? error : "failed");
+      free (error);
+      return 1;
+    }
+  return 0;
+}
+
+/* Three boots one hour apart: the first with two sessions and a
+   shutdown, the second crashed without sessions, the third running
+   with one session */
+static int
+check (const char *path)
+{
+  struct tst_rows rows = { .skip = 1 };
+  char *error = NULL;
+  int r;
+
+  if (login (path, BOOT_TIME, "reboot", T, "6.1", T + 50 * MIN) != 0 ||
+      login (path, USER_PROCESS, "alice", T + MIN, "localhost",
+	     T + 10 * MIN) != 0 ||
+      login (path, USER_PROCESS, "bob", T + 20 * MIN, "localhost", 0) != 0 ||
+      login (path, BOOT_TIME, "reboot", T + 60 * MIN, "6.2", 0) != 0 ||
+      login (path, BOOT_TIME, "reboot", T + 120 * MIN, "6.3", 0) != 0 ||
+      login (path, USER_PROCESS, "alice", T + 121 * MIN, "localhost", 0) != 0)
+    return 1;
+
+  tst_rows_reset (&rows);
+  r = wtmpdb_read_boots (path, tst_collect, &rows, &error);
+  if (r != 0 || strcmp (rows.text, expected) != 0)
+    {
+      fprintf (stderr, "%s: boots (%d): %s\n%s---\n%s", path, r,
+	       error ? error : "", rows.text, expected);
+      free (error);
+      tst_rows_free (&rows);
+      return 1;
+    }
+  tst_rows_free (&rows);
+  return 0;
+}
+
+static void
+cleanup (void)
+{
+  remove (db_path);
+  tst_remove_dir (db_dir);
+}
+
+int
+main (void)
+{
+  cleanup ();
+  if (mkdir (db_dir, 0755) < 0)
+    {
+      perror (db_dir);
+      return 1;
+    }
+
+  if (check (db_path) != 0 || check (db_dir) != 0 || check (db_mem) != 0)
+    return 1;
+
+  cleanup ();
+  return 0;
+}
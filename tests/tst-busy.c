@@ -0,0 +1,140 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Test case:
+   Hold the write lock of the database from another connection. A login
+   has to wait until it is released and must fail if that takes longer
+   than the busy timeout. Check the statistics of both cases.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sqlite3.h>
+
+#include "wtmpdb.h"
+
+static const char *db_path = "tst-busy.db";
+
+struct locker {
+  sqlite3 *db;
+  useconds_t usec;
+};
+
+static void *
+unlock_later (void *arg)
+{
+  struct locker *l = arg;
+
+  usleep (l->usec);
+  sqlite3_exec (l->db, "COMMIT", NULL, NULL, NULL);
+  return NULL;
+}
+
+/* Locks the database for usec and logs in meanwhile. */
+static int64_t
+login_locked (useconds_t usec, char **error)
+{
+  struct locker l = { .usec = usec };
+  pthread_t thread;
+  int64_t id;
+
+  if (sqlite3_open (db_path, &l.db) != SQLITE_OK ||
+      sqlite3_exec (l.db, "BEGIN IMMEDIATE", NULL, NULL, NULL) != SQLITE_OK)
+    {
+      fprintf (stderr, "Cannot lock %s: %s\n", db_path, sqlite3_errmsg (l.db));
+      exit (1);
+    }
+  pthread_create (&thread, NULL, unlock_later, &l);
+  id = wtmpdb_login (db_path, USER_PROCESS, "user", USEC_PER_SEC, "pts/0",
+		     NULL, "tst", error);
+  pthread_join (thread, NULL);
+  sqlite3_close (l.db);
+  return id;
+}
+
+int
+main (void)
+{
+  struct wtmpdb_stats stats;
+  char *error = NULL;
+
+  remove (db_path);
+  if (wtmpdb_login (db_path, BOOT_TIME, "reboot", USEC_PER_SEC, "~", NULL,
+		    NULL, &error) != 1)
+    {
+      fprintf (stderr, "login failed: %s\n", error ? error : "");
+      return 1;
+    }
+  wtmpdb_get_stats (&stats);
+  if (stats.busy_waits != 0 || stats.busy_timeouts != 0)
+    {
+      fprintf (stderr, "unexpected waits without a lock\n");
+      return 1;
+    }
+
+  if (login_locked (200000, &error) != 2)
+    {
+      fprintf (stderr, "login did not wait for the lock: %s\n",
+	       error ? error : "");
+      return 1;
+    }
+  wtmpdb_get_stats (&stats);
+  if (stats.busy_waits != 1 || stats.busy_retries < 2 ||
+      stats.busy_usec < 100000 || stats.busy_timeouts != 0)
+    {
+      fprintf (stderr, "wait: %llu waits, %llu retries, %llu usec, %llu timeouts\n",
+	       (unsigned long long)stats.busy_waits,
+	       (unsigned long long)stats.busy_retries,
+	       (unsigned long long)stats.busy_usec,
+	       (unsigned long long)stats.busy_timeouts);
+      return 1;
+    }
+
+  wtmpdb_set_busy_timeout (50000);
+  if (login_locked (500000, &error) >= 0)
+    {
+      fprintf (stderr, "login did not give up after the busy timeout\n");
+      return 1;
+    }
+  free (error);
+  wtmpdb_get_stats (&stats);
+  /* each wait may overshoot by one backoff sleep of up to 64 ms */
+  if (stats.busy_waits != 2 || stats.busy_timeouts != 1 ||
+      stats.busy_usec > 200000 + 50000 + 2 * 64000)
+    {
+      fprintf (stderr, "timeout: %llu waits, %llu usec, %llu timeouts\n",
+	       (unsigned long long)stats.busy_waits,
+	       (unsigned long long)stats.busy_usec,
+	       (unsigned long long)stats.busy_timeouts);
+      return 1;
+    }
+
+  remove (db_path);
+  return 0;
+}
@@ -0,0 +1,184 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Test case:
+   Compare the result of wtmpdb_read_all_cached with wtmpdb_read_all
+   after new entries were added, sessions were closed and old entries
+   were removed.
+*/
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include "basics.h"
+
+#include "wtmpdb.h"
+#include "tst-common.h"
+
+static const char *db_path = "tst-cache.db";
+static const char *cache_dir = "tst-cache.d";
+
+static struct tst_rows result[2];
+
+static int
+compare (int uniq, const char *step)
+{
+  char *error = NULL;
+
+  tst_rows_reset (&result[0]);
+  tst_rows_reset (&result[1]);
+  if (wtmpdb_read_all_v2 (db_path, uniq, tst_collect, &result[0], &error) != 0 ||
+      wtmpdb_read_all_cached (db_path, uniq, cache_dir, tst_collect,
+			      &result[1], &error) != 0)
+    {
+      fprintf (stderr, "%s: %s\n", step, error ? error : "read failed");
+      free (error);
+      return 1;
+    }
+  if (strcmp (result[0].text, result[1].text) != 0)
+    {
+      fprintf (stderr, "%s (uniq=%d): cached result differs:\n%s---\n%s",
+	       step, uniq, result[0].text, result[1].text);
+      return 1;
+    }
+  return 0;
+}
+
+static int64_t
+login (const char *user, const char *tty, int days)
+{
+  char *error = NULL;
+  struct timespec ts;
+  int64_t id;
+
+  clock_gettime (CLOCK_REALTIME, &ts);
+  ts.tv_sec -= 86400 * days;
+  id = wtmpdb_login (db_path, USER_PROCESS, user, wtmpdb_timespec2usec (ts),
+		     tty, "localhost", "sshd", &error);
+  if (id < 0)
+    {
+      fprintf (stderr, "wtmpdb_login: %s\n", error ? error : "failed");
+      free (error);
+    }
+  return id;
+}
+
+static int
+logout (int64_t id)
+{
+  char *error = NULL;
+  struct timespec ts;
+
+  clock_gettime (CLOCK_REALTIME, &ts);
+  if (wtmpdb_logout (db_path, id, wtmpdb_timespec2usec (ts), &error) != 0)
+    {
+      fprintf (stderr, "wtmpdb_logout: %s\n", error ? error : "failed");
+      free (error);
+      return 1;
+    }
+  return 0;
+}
+
+static int
+compare_both (const char *step)
+{
+  /* twice: once filling/extending the cache, once using it unchanged */
+  for (int i = 0; i < 2; i++)
+    if (compare (0, step) != 0 || compare (1, step) != 0)
+      return 1;
+  return 0;
+}
+
+static void
+cleanup (void)
+{
+  _cleanup_(freep) char *cmd = NULL;
+
+  remove (db_path);
+  if (asprintf (&cmd, "rm -rf %s tst-cache_*.db", cache_dir) > 0)
+    if (system (cmd) != 0)
+      fprintf (stderr, "Cleanup failed\n");
+}
+
+int
+main(void)
+{
+  int64_t id1, id2;
+  char *error = NULL;
+
+  cleanup ();
+
+  if ((id1 = login ("user1", "pts/1", 5)) < 0 ||
+      login ("user2", "pts/2", 5) < 0 ||
+      (id2 = login ("user1", "pts/3", 1)) < 0)
+    return 1;
+  if (compare_both ("initial") != 0)
+    return 1;
+
+  /* append only */
+  if (login ("user3", "pts/4", 0) < 0 || login ("user2", "pts/5", 0) < 0)
+    return 1;
+  if (compare_both ("append") != 0)
+    return 1;
+
+  /* closing open sessions does not invalidate the cache */
+  if (logout (id1) != 0 || logout (id2) != 0)
+    return 1;
+  if (compare_both ("logout") != 0)
+    return 1;
+
+  /* more entries and users than the initial hash buckets of the cache */
+  for (int i = 0; i < 300; i++)
+    {
+      char user[16], tty[16];
+
+      snprintf (user, sizeof (user), "many%d", i % 150);
+      snprintf (tty, sizeof (tty), "pts/%d", i);
+      if ((id1 = login (user, tty, 0)) < 0 ||
+	  (i % 2 == 0 && logout (id1) != 0))
+	return 1;
+      if (i == 150 && compare_both ("many") != 0)
+	return 1;
+    }
+  if (compare_both ("many") != 0)
+    return 1;
+
+  /* deleting entries does */
+  if (wtmpdb_rotate (db_path, 3, &error, NULL, NULL) != 0)
+    {
+      fprintf (stderr, "wtmpdb_rotate: %s\n", error ? error : "failed");
+      free (error);
+      return 1;
+    }
+  if (compare_both ("rotate") != 0)
+    return 1;
+
+  cleanup ();
+  return 0;
+}
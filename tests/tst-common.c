@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "tst-common.h"
+
+static void
+rows_append (struct tst_rows *rows, const char *str)
+{
+  size_t len = strlen (str);
+
+  if (rows->len + len + 1 > rows->size)
+    {
+      size_t size = rows->size ? rows->size : 4096;
+
+      while (rows->len + len + 1 > size)
+	size *= 2;
+      rows->text = realloc (rows->text, size);
+      if (rows->text == NULL)
+	{
+	  fprintf (stderr, "Out of memory\n");
+	  exit (EXIT_FAILURE);
+	}
+      rows->size = size;
+    }
+  memcpy (rows->text + rows->len, str, len + 1);
+  rows->len += len;
+}
+
+void
+tst_rows_reset (struct tst_rows *rows)
+{
+  rows->len = 0;
+  rows_append (rows, "");
+}
+
+void
+tst_rows_free (struct tst_rows *rows)
+{
+  free (rows->text);
+  rows->text = NULL;
+  rows->len = rows->size = 0;
+}
+
+int
+tst_collect (void *data, int argc, char **argv,
+	     char **azColName __attribute__((__unused__)))
+{
+  struct tst_rows *rows = data;
+
+  for (int i = rows->skip; i < argc; i++)
+    {
+      rows_append (rows, argv[i] ? argv[i] : "NULL");
+      rows_append (rows, "|");
+    }
+  rows_append (rows, "\n");
+  return 0;
+}
+
+int
+tst_count (void *data, int argc __attribute__((__unused__)),
+	   char **argv __attribute__((__unused__)),
+	   char **azColName __attribute__((__unused__)))
+{
+  (*(int *)data)++;
+  return 0;
+}
+
+void
+tst_remove_files (const char *dir, const char *prefix)
+{
+  DIR *d = opendir (dir);
+  struct dirent *ent;
+
+  if (d == NULL)
+    return;
+  while ((ent = readdir (d)) != NULL)
+    if (prefix ? strncmp (ent->d_name, prefix, strlen (prefix)) == 0 :
+	ent->d_name[0] != '.')
+      {
+	char path[512];
+	snprintf (path, sizeof (path), "%s/%s", dir, ent->d_name);
+	remove (path);
+      }
+  closedir (d);
+}
+
+void
+tst_remove_dir (const char *dir)
+{
+  tst_remove_files (dir, NULL);
+  rmdir (dir);
+}
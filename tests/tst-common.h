@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Helpers shared by the test cases */
+
+#pragma once
+
+#include <stddef.h>
+
+/* The rows of a query as text, one line per row with the columns
+   separated by '|', for comparing the results of two queries. */
+struct tst_rows {
+  char *text;	/* "" after tst_rows_reset */
+  size_t len, size;
+  int skip;	/* leading columns to leave out, e.g. 1 for the ID */
+};
+
+/* Empties rows for the next query */
+extern void tst_rows_reset (struct tst_rows *rows);
+extern void tst_rows_free (struct tst_rows *rows);
+/* cb_func which appends a row to the struct tst_rows in data */
+extern int tst_collect (void *data, int argc, char **argv,
+			char **azColName);
+/* cb_func which increments the int in data */
+extern int tst_count (void *data, int argc, char **argv, char **azColName);
+
+/* Removes the files in dir starting with prefix, all but the hidden
+   ones if prefix is NULL */
+extern void tst_remove_files (const char *dir, const char *prefix);
+/* Removes dir with all its files */
+extern void tst_remove_dir (const char *dir);
@@ -0,0 +1,246 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Test case:
+   Rotate a database into a compressed archive and read the archive in
+   place, the entries must be the same as before. The archive must be
+   read-only. Compress the expired partitions of a partitioned database
+   and read across plain and compressed partitions.
+*/
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "wtmpdb.h"
+#include "tst-common.h"
+
+/* enough pages to exceed the page cache of the VFS */
+#define ENTRIES 3000
+
+static const char *db_path = "tst-compress.db";
+static const char *db_dir = "tst-compress.d";
+
+static struct tst_rows result[2];
+
+static int
+read_db (const char *path, int uniq, struct tst_rows *rows)
+{
+  char *error = NULL;
+
+  tst_rows_reset (rows);
+  if (wtmpdb_read_all_v2 (path, uniq, tst_collect, rows, &error) != 0)
+    {
+      fprintf (stderr, "read_all %s: %s\n", path, error ? error : "failed");
+      free (error);
+      return 1;
+    }
+  return 0;
+}
+
+static int
+fill (const char *path, uint64_t t, uint64_t step)
+{
+  char *error = NULL;
+
+  for (int i = 0; i < ENTRIES; i++)
+    {
+      char user[16], tty[16];
+      int64_t id;
+
+      t += step;
+      snprintf (user, sizeof (user), "user%d", i % 17);
+      snprintf (tty, sizeof (tty), "pts/%d", i % 5);
+      if (i % 100 == 0)
+	id = wtmpdb_login (path, BOOT_TIME, "reboot", t, "~", "6.12.0",
+			   NULL, &error);
+      else
+	id = wtmpdb_login (path, USER_PROCESS, user, t, tty,
+			   "host.example.com", "sshd", &error);
+      if (id < 0 || (i % 3 != 0 &&
+		     wtmpdb_logout (path, id, t + 60 * USEC_PER_SEC,
+				    &error) != 0))
+	{
+	  fprintf (stderr, "%s: %s\n", path, error ? error : "failed");
+	  free (error);
+	  return 1;
+	}
+    }
+  return 0;
+}
+
+static void
+cleanup (void)
+{
+  tst_remove_files (".", "tst-compress_");
+  remove (db_path);
+  tst_remove_dir (db_dir);
+}
+
+static int
+test_archive (void)
+{
+  struct wtmpdb_rotate_opts opts = {
+    .flags = WTMPDB_ROTATE_SWAP | WTMPDB_ROTATE_COMPRESS
+  };
+  struct stat st_db, st_z;
+  uint64_t entries = 0;
+  char *archive = NULL;
+  char *error = NULL;
+  size_t len;
+
+  if (fill (db_path, 1700000000ULL * USEC_PER_SEC, 600 * USEC_PER_SEC) != 0 ||
+      read_db (db_path, 0, &result[0]) != 0 || stat (db_path, &st_db) < 0)
+    return 1;
+
+  if (wtmpdb_rotate_v2 (db_path, &opts, &error, &archive, &entries) != 0 ||
+      archive == NULL)
+    {
+      fprintf (stderr, "rotate: %s\n", error ? error : "no archive");
+      return 1;
+    }
+  len = strlen (archive);
+  if (len < 5 || strcmp (archive + len - 5, ".db.z") != 0 ||
+      entries != ENTRIES || stat (archive, &st_z) < 0)
+    {
+      fprintf (stderr, "unexpected archive %s with %llu entries\n",
+	       archive, (unsigned long long)entries);
+      return 1;
+    }
+  archive[len - 2] = '\0';
+  if (access (archive, F_OK) == 0)
+    {
+      fprintf (stderr, "uncompressed archive %s not removed\n", archive);
+      return 1;
+    }
+  archive[len - 2] = '.';
+  if (st_z.st_size >= st_db.st_size / 2)
+    {
+      fprintf (stderr, "archive not compressed: %lld of %lld bytes\n",
+	       (long long)st_z.st_size, (long long)st_db.st_size);
+      return 1;
+    }
+
+  if (read_db (archive, 0, &result[1]) != 0)
+    return 1;
+  if (strcmp (result[0].text, result[1].text) != 0)
+    {
+      fprintf (stderr, "archive differs from database\n");
+      return 1;
+    }
+  if (read_db (archive, 1, &result[1]) != 0 || result[1].len == 0)
+    return 1;
+
+  if (wtmpdb_get_boottime (archive, &error) == 0)
+    {
+      fprintf (stderr, "get_boottime: %s\n", error ? error : "failed");
+      return 1;
+    }
+  if (wtmpdb_login (archive, USER_PROCESS, "user", 1, "pts/1", NULL, NULL,
+		    &error) >= 0)
+    {
+      fprintf (stderr, "login into compressed archive succeeded\n");
+      return 1;
+    }
+  free (error);
+  free (archive);
+  return 0;
+}
+
+static int
+test_partitions (void)
+{
+  struct wtmpdb_rotate_opts opts = {
+    .flags = WTMPDB_ROTATE_COMPRESS
+  };
+  uint64_t t = 1700000000ULL * USEC_PER_SEC;
+  struct timespec now;
+  uint64_t entries = 0;
+  char *error = NULL;
+  int compressed = 0;
+  struct dirent *ent;
+  DIR *d;
+
+  if (mkdir (db_dir, 0755) < 0)
+    {
+      perror (db_dir);
+      return 1;
+    }
+  /* about 4 months */
+  if (fill (db_dir, t, 3600 * USEC_PER_SEC) != 0 ||
+      read_db (db_dir, 0, &result[0]) != 0)
+    return 1;
+
+  /* compress all but the last month */
+  clock_gettime (CLOCK_REALTIME, &now);
+  opts.days = (now.tv_sec - (1700000000 + ENTRIES * 3600 - 31 * 86400)) / 86400;
+  if (wtmpdb_rotate_v2 (db_dir, &opts, &error, NULL, &entries) != 0 ||
+      entries == 0)
+    {
+      fprintf (stderr, "rotate: %s\n", error ? error : "nothing compressed");
+      return 1;
+    }
+
+  d = opendir (db_dir);
+  while (d && (ent = readdir (d)) != NULL)
+    if (strstr (ent->d_name, ".db.z") != NULL)
+      compressed++;
+  if (d)
+    closedir (d);
+  if (compressed < 2)
+    {
+      fprintf (stderr, "%d partitions compressed\n", compressed);
+      return 1;
+    }
+
+  if (read_db (db_dir, 0, &result[1]) != 0)
+    return 1;
+  if (strcmp (result[0].text, result[1].text) != 0)
+    {
+      fprintf (stderr, "partitioned database differs after compression\n");
+      return 1;
+    }
+  if (read_db (db_dir, 1, &result[1]) != 0 || result[1].len == 0)
+    return 1;
+  return 0;
+}
+
+int
+main(void)
+{
+  cleanup ();
+
+  if (test_archive () != 0 || test_partitions () != 0)
+    return 1;
+
+  cleanup ();
+  return 0;
+}
@@ -0,0 +1,186 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Test case:
+   Read a database in pages with a cursor while entries get added and
+   closed. The writes must not be blocked and all pages must show the
+   database as it was when the cursor was opened.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+
+#include "wtmpdb.h"
+
+#define ENTRIES 50
+#define PAGE 7
+
+static const char *db_path = "tst-cursor.db";
+
+struct seen {
+  int count;
+  int open;	/* entries without logout */
+};
+
+static int
+collect (void *data, int argc, char **argv,
+	 char **azColName __attribute__((__unused__)))
+{
+  struct seen *s = data;
+
+  if (argc != 8)
+    return 1;
+  s->count++;
+  if (argv[4] == NULL)
+    s->open++;
+  return 0;
+}
+
+static void
+cleanup (void)
+{
+  remove (db_path);
+  remove ("tst-cursor.db-wal");
+  remove ("tst-cursor.db-shm");
+}
+
+static int
+check_wal (void)
+{
+  sqlite3 *db;
+  sqlite3_stmt *res;
+  int r = 1;
+
+  if (sqlite3_open_v2 (db_path, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK)
+    {
+      fprintf (stderr, "open: %s\n", sqlite3_errmsg (db));
+      return 1;
+    }
+  if (sqlite3_prepare_v2 (db, "PRAGMA journal_mode", -1, &res, 0) == SQLITE_OK &&
+      sqlite3_step (res) == SQLITE_ROW &&
+      strcmp ((const char *)sqlite3_column_text (res, 0), "wal") == 0)
+    r = 0;
+  else
+    fprintf (stderr, "database is not in WAL mode\n");
+  sqlite3_finalize (res);
+  sqlite3_close (db);
+  return r;
+}
+
+int
+main (void)
+{
+  uint64_t t = 1700000000ULL * USEC_PER_SEC;
+  struct wtmpdb_cursor *cursor = NULL;
+  struct seen seen = { 0, 0 };
+  char *error = NULL;
+  int64_t first = -1;
+  int n;
+
+  cleanup ();
+  for (int i = 0; i < ENTRIES; i++)
+    {
+      char tty[16];
+      int64_t id;
+
+      snprintf (tty, sizeof (tty), "pts/%d", i);
+      id = wtmpdb_login (db_path, USER_PROCESS, "user", t + i, tty,
+			 "localhost", "tst", &error);
+      if (id < 0)
+	{
+	  fprintf (stderr, "login: %s\n", error ? error : "failed");
+	  return 1;
+	}
+      if (first < 0)
+	first = id;
+    }
+  if (check_wal () != 0)
+    return 1;
+
+  if (wtmpdb_cursor_open (db_path, 0, &cursor, &error) < 0)
+    {
+      fprintf (stderr, "cursor_open: %s\n", error ? error : "failed");
+      return 1;
+    }
+
+  /* writers must not wait for the reader */
+  wtmpdb_set_busy_timeout (100000);
+  for (int pages = 0; (n = wtmpdb_cursor_read (cursor, PAGE, collect,
+					       &seen, &error)) > 0; pages++)
+    {
+      char tty[16];
+
+      if (n > PAGE)
+	{
+	  fprintf (stderr, "page %d has %d entries\n", pages, n);
+	  return 1;
+	}
+      snprintf (tty, sizeof (tty), "new/%d", pages);
+      if (wtmpdb_login (db_path, USER_PROCESS, "other", t + ENTRIES + pages,
+			tty, "localhost", "tst", &error) < 0 ||
+	  wtmpdb_logout (db_path, first + pages, t + 2 * ENTRIES,
+			 &error) < 0)
+	{
+	  fprintf (stderr, "write during read: %s\n",
+		   error ? error : "failed");
+	  return 1;
+	}
+    }
+  if (n < 0)
+    {
+      fprintf (stderr, "cursor_read: %s\n", error ? error : "failed");
+      return 1;
+    }
+  wtmpdb_cursor_close (cursor);
+
+  if (seen.count != ENTRIES || seen.open != ENTRIES)
+    {
+      fprintf (stderr, "cursor saw %d entries, %d open, expected %d\n",
+	       seen.count, seen.open, ENTRIES);
+      return 1;
+    }
+
+  /* a new read sees the changes */
+  seen.count = seen.open = 0;
+  if (wtmpdb_read_all_v2 (db_path, 0, collect, &seen, &error) != 0)
+    {
+      fprintf (stderr, "read_all: %s\n", error ? error : "failed");
+      return 1;
+    }
+  n = (ENTRIES + PAGE - 1) / PAGE;
+  if (seen.count != ENTRIES + n || seen.open != ENTRIES)
+    {
+      fprintf (stderr, "read_all saw %d entries, %d open, expected %d/%d\n",
+	       seen.count, seen.open, ENTRIES + n, ENTRIES);
+      return 1;
+    }
+
+  cleanup ();
+  return 0;
+}
@@ -0,0 +1,292 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Test case:
+   Look up the newest login of users in a large database, in a
+   partitioned one and in the in-memory backend, which has no index
+   for it. The lookup must search wtmp_lastlog instead of scanning
+   wtmp and must ignore boots and entries added out of order.
+   A closed session which a swap rotation moved into an archive is
+   still found.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sqlite3.h>
+
+#include "wtmpdb.h"
+#include "tst-common.h"
+
+#define ROWS 5000
+#define GROW_START 1800000000000000
+
+#define _STR(x) #x
+#define STR(x) _STR(x)
+
+static const char *db_path = "tst-lastlog.db";
+static const char *db_dir = "tst-lastlog.d";
+static const char *db_mem = "memory:tst-lastlog";
+static const char *db_rotate = "tst-lastlog-rotate.db";
+
+struct last {
+  char tty[32];
+  uint64_t login;
+  int calls;
+};
+
+static int
+collect (void *data, int argc, char **argv,
+	 char **azColName __attribute__((__unused__)))
+{
+  struct last *l = data;
+
+  if (argc != 8 || argv[3] == NULL)
+    return 1;
+  snprintf (l->tty, sizeof (l->tty), "%s", argv[5] ? argv[5] : "");
+  l->login = strtoull (argv[3], NULL, 10);
+  l->calls++;
+  return 0;
+}
+
+static int
+check (const char *path, const char *user, const char *tty, uint64_t login)
+{
+  struct last l = { "", 0, 0 };
+  char *error = NULL;
+  int r = wtmpdb_get_last_login (path, user, collect, &l, &error);
+
+  if (r != 0 || l.calls != 1 || strcmp (l.tty, tty) != 0 ||
+      l.login != login)
+    {
+      fprintf (stderr, "%s: last login of %s: %d, %d calls, %s/%llu, "
+	       "expected %s/%llu: %s\n", path, user, r, l.calls, l.tty,
+	       (unsigned long long)l.login, tty, (unsigned long long)login,
+	       error ? error : "");
+      free (error);
+      return 1;
+    }
+  return 0;
+}
+
+static int
+check_none (const char *path, const char *user)
+{
+  struct last l = { "", 0, 0 };
+  char *error = NULL;
+  int r = wtmpdb_get_last_login (path, user, collect, &l, &error);
+
+  free (error);
+  if (r != -ENOENT || l.calls != 0)
+    {
+      fprintf (stderr, "%s: %s has a last login (%d)\n", path, user, r);
+      return 1;
+    }
+  return 0;
+}
+
+static int
+login (const char *path, int type, const char *user, uint64_t t,
+       const char *tty)
+{
+  char *error = NULL;
+
+  if (wtmpdb_login (path, type, user, t, tty, "localhost", "tst",
+		    &error) < 0)
+    {
+      fprintf (stderr, "%s: login: %s\n", path, error ? error : "failed");
+      free (error);
+      return 1;
+    }
+  return 0;
+}
+
+/* The same entries for every backend */
+static int
+fill (const char *path)
+{
+  uint64_t t = 1700000000ULL * USEC_PER_SEC;
+
+  if (login (path, USER_PROCESS, "alice", t, "pts/1") != 0 ||
+      login (path, USER_PROCESS, "bob", t + 1, "pts/2") != 0 ||
+      login (path, USER_PROCESS, "alice", t + 90 * 86400 * USEC_PER_SEC,
+	     "pts/3") != 0 ||
+      /* older, e.g. imported */
+      login (path, USER_PROCESS, "alice", t + 86400 * USEC_PER_SEC,
+	     "pts/4") != 0 ||
+      login (path, BOOT_TIME, "reboot", t + 100 * 86400 * USEC_PER_SEC,
+	     "~") != 0)
+    return 1;
+
+  if (check (path, "alice", "pts/3", t + 90 * 86400 * USEC_PER_SEC) != 0 ||
+      check (path, "bob", "pts/2", t + 1) != 0 ||
+      check_none (path, "reboot") != 0 ||
+      check_none (path, "carol") != 0)
+    return 1;
+  return 0;
+}
+
+/* Adds ROWS entries of many users to the database, all newer than the
+   ones of fill */
+static int
+grow (void)
+{
+  sqlite3 *db;
+
+  if (sqlite3_open (db_path, &db) != SQLITE_OK ||
+      sqlite3_exec (db, "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL "
+		    "SELECT i + 1 FROM n WHERE i < " STR(ROWS) ") "
+		    "INSERT INTO wtmp (Type, User, Login, TTY, Service) "
+		    "SELECT 3, 'user' || (i % 1000), " STR(GROW_START) " + i, "
+		    "'pts/' || i, 'tst' "
+		    "FROM n", NULL, NULL, NULL) != SQLITE_OK)
+    {
+      fprintf (stderr, "Cannot fill %s: %s\n", db_path, sqlite3_errmsg (db));
+      sqlite3_close (db);
+      return 1;
+    }
+  sqlite3_close (db);
+  return 0;
+}
+
+/* The query of search_last_login must look up the user in
+   wtmp_lastlog and the entry by its ID, never scan a table */
+static int
+check_plan (void)
+{
+  sqlite3 *db;
+  sqlite3_stmt *res;
+  int search = 0, scan = 0;
+
+  if (sqlite3_open_v2 (db_path, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK ||
+      sqlite3_prepare_v2 (db, "EXPLAIN QUERY PLAN "
+			  "SELECT wtmp.* FROM wtmp_lastlog JOIN wtmp USING (ID) "
+			  "WHERE wtmp_lastlog.User = ?1", -1, &res, 0) != SQLITE_OK)
+    {
+      fprintf (stderr, "Cannot explain lookup: %s\n", sqlite3_errmsg (db));
+      sqlite3_close (db);
+      return 1;
+    }
+  while (sqlite3_step (res) == SQLITE_ROW)
+    {
+      const char *detail = (const char *)sqlite3_column_text (res, 3);
+
+      if (detail == NULL)
+	continue;
+      if (strncmp (detail, "SEARCH wtmp_lastlog ", 20) == 0)
+	search = 1;
+      else if (strncmp (detail, "SCAN ", 5) == 0)
+	{
+	  fprintf (stderr, "lookup plan: %s\n", detail);
+	  scan = 1;
+	}
+    }
+  sqlite3_finalize (res);
+  sqlite3_close (db);
+
+  if (!search || scan)
+    {
+      fprintf (stderr, "lookup does not search wtmp_lastlog\n");
+      return 1;
+    }
+  return 0;
+}
+
+/* rotate_swap keeps only the open sessions */
+static int
+check_rotated (void)
+{
+  struct wtmpdb_rotate_opts opts = { .flags = WTMPDB_ROTATE_SWAP };
+  uint64_t t = 1700000000ULL * USEC_PER_SEC;
+  char *error = NULL;
+  int64_t id;
+
+  id = wtmpdb_login (db_rotate, USER_PROCESS, "carol", t, "pts/5",
+		     "localhost", "tst", &error);
+  if (id < 0 || wtmpdb_logout (db_rotate, id, t + 60 * USEC_PER_SEC,
+			       &error) != 0 ||
+      login (db_rotate, USER_PROCESS, "dave", t + 1, "pts/6") != 0 ||
+      wtmpdb_rotate_v2 (db_rotate, &opts, &error, NULL, NULL) != 0)
+    {
+      fprintf (stderr, "%s: %s\n", db_rotate, error ? error : "failed");
+      free (error);
+      return 1;
+    }
+
+  if (check (db_rotate, "carol", "pts/5", t) != 0 ||
+      check (db_rotate, "dave", "pts/6", t + 1) != 0 ||
+      check_none (db_rotate, "erin") != 0)
+    return 1;
+
+  /* a login after the rotation is newer than the archived one */
+  if (login (db_rotate, USER_PROCESS, "carol", t + 2, "pts/7") != 0 ||
+      check (db_rotate, "carol", "pts/7", t + 2) != 0)
+    return 1;
+  return 0;
+}
+
+static void
+cleanup (void)
+{
+  remove (db_path);
+  remove (db_rotate);
+  tst_remove_files (".", "tst-lastlog-rotate_");
+  tst_remove_dir (db_dir);
+}
+
+int
+main (void)
+{
+  char tty[32];
+
+  cleanup ();
+  if (mkdir (db_dir, 0755) < 0)
+    {
+      perror (db_dir);
+      return 1;
+    }
+
+  if (fill (db_path) != 0 || fill (db_dir) != 0 || fill (db_mem) != 0)
+    return 1;
+
+  /* user999 gets the last of the rows */
+  snprintf (tty, sizeof (tty), "pts/%d", ROWS - 1);
+  if (grow () != 0 ||
+      check (db_path, "user999", tty, GROW_START + ROWS - 1) != 0 ||
+      check (db_path, "alice", "pts/3",
+	     (1700000000ULL + 90 * 86400) * USEC_PER_SEC) != 0 ||
+      check (db_path, "bob", "pts/2", 1700000000ULL * USEC_PER_SEC + 1) != 0 ||
+      check_plan () != 0 ||
+      check_rotated () != 0)
+    return 1;
+
+  cleanup ();
+  return 0;
+}
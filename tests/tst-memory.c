@@ -0,0 +1,182 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Test case:
+   Run the same logins and logouts against an in-memory database and
+   an SQLite database and compare the results. Flush the in-memory
+   database to a file and compare that one, too.
+*/
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "wtmpdb.h"
+#include "tst-common.h"
+
+#define ENTRIES 200
+
+static const char *db_file = "tst-memory.db";
+static const char *db_flushed = "tst-memory-flushed.db";
+static const char *db_mem = "memory:tst?flush=tst-memory-flushed.db";
+
+static struct tst_rows result[2];
+
+static int
+compare (const char *db_path, const char *step)
+{
+  char *error = NULL;
+
+  for (int uniq = 0; uniq < 2; uniq++)
+    {
+      tst_rows_reset (&result[0]);
+      tst_rows_reset (&result[1]);
+      if (wtmpdb_read_all_v2 (db_file, uniq, tst_collect, &result[0], &error) != 0 ||
+	  wtmpdb_read_all_v2 (db_path, uniq, tst_collect, &result[1], &error) != 0)
+	{
+	  fprintf (stderr, "%s: %s\n", step, error ? error : "read failed");
+	  free (error);
+	  return 1;
+	}
+      if (strcmp (result[0].text, result[1].text) != 0)
+	{
+	  fprintf (stderr, "%s (uniq=%d): result differs:\n%s---\n%s",
+		   step, uniq, result[0].text, result[1].text);
+	  return 1;
+	}
+    }
+
+  tst_rows_reset (&result[0]);
+  tst_rows_reset (&result[1]);
+  if (wtmpdb_read_boots (db_file, tst_collect, &result[0], &error) != 0 ||
+      wtmpdb_read_boots (db_path, tst_collect, &result[1], &error) != 0)
+    {
+      fprintf (stderr, "%s: %s\n", step, error ? error : "read boots failed");
+      free (error);
+      return 1;
+    }
+  if (strcmp (result[0].text, result[1].text) != 0)
+    {
+      fprintf (stderr, "%s (boots): result differs:\n%s---\n%s",
+	       step, result[0].text, result[1].text);
+      return 1;
+    }
+  return 0;
+}
+
+/* Applies the same operation to both databases, the IDs must match. */
+static int
+login_both (int type, const char *user, uint64_t t, const char *tty)
+{
+  char *error = NULL;
+  int64_t id1 = wtmpdb_login (db_file, type, user, t, tty, "localhost",
+			      "tst", &error);
+  int64_t id2 = wtmpdb_login (db_mem, type, user, t, tty, "localhost",
+			      "tst", &error);
+
+  if (id1 < 0 || id1 != id2)
+    {
+      fprintf (stderr, "login: %lld != %lld: %s\n", (long long)id1,
+	       (long long)id2, error ? error : "");
+      free (error);
+      return 1;
+    }
+  return 0;
+}
+
+static int
+logout_both (const char *tty, uint64_t t)
+{
+  char *error = NULL;
+  int64_t id1 = wtmpdb_get_id (db_file, tty, &error);
+  int64_t id2 = wtmpdb_get_id (db_mem, tty, &error);
+
+  if (id1 < 0 || id1 != id2 ||
+      wtmpdb_logout (db_file, id1, t, &error) != 0 ||
+      wtmpdb_logout (db_mem, id2, t, &error) != 0)
+    {
+      fprintf (stderr, "logout %s: %lld/%lld: %s\n", tty, (long long)id1,
+	       (long long)id2, error ? error : "");
+      free (error);
+      return 1;
+    }
+  return 0;
+}
+
+int
+main(void)
+{
+  uint64_t t = 1700000000ULL * USEC_PER_SEC;
+  char *error = NULL;
+
+  remove (db_file);
+  remove (db_flushed);
+
+  for (int i = 0; i < ENTRIES; i++)
+    {
+      char user[16], tty[16];
+
+      t += USEC_PER_SEC;
+      if (i % 50 == 0 &&
+	  login_both (BOOT_TIME, "reboot", t, "~") != 0)
+	return 1;
+      snprintf (user, sizeof (user), "user%d", i % 7);
+      snprintf (tty, sizeof (tty), "pts/%d", i % 5);
+      if (login_both (USER_PROCESS, user, t, tty) != 0)
+	return 1;
+      if (i % 3 == 0 && logout_both (tty, t + 1) != 0)
+	return 1;
+      if (i == ENTRIES / 2 && wtmpdb_flush (db_mem, &error) != 0)
+	{
+	  fprintf (stderr, "wtmpdb_flush: %s\n", error ? error : "failed");
+	  return 1;
+	}
+    }
+
+  if (compare (db_mem, "memory") != 0)
+    return 1;
+
+  if (wtmpdb_get_boottime (db_file, &error) != wtmpdb_get_boottime (db_mem, &error))
+    {
+      fprintf (stderr, "boot time differs\n");
+      return 1;
+    }
+
+  if (wtmpdb_flush (db_mem, &error) != 0)
+    {
+      fprintf (stderr, "wtmpdb_flush: %s\n", error ? error : "failed");
+      return 1;
+    }
+  if (compare (db_flushed, "flushed") != 0)
+    return 1;
+
+  remove (db_file);
+  remove (db_flushed);
+  return 0;
+}
@@ -0,0 +1,270 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Test case:
+   Write the metrics of the same entries in a database file, in a
+   partitioned one and in the in-memory backend, which has no
+   read_metrics, and check the text file, also with the boots in two
+   partitions. Rotating must not decrease the counters.
+*/
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "wtmpdb.h"
+#include "tst-common.h"
+
+#define T (1700000000ULL * USEC_PER_SEC)
+
+static const char *db_path = "tst-metrics.db";
+static const char *db_dir = "tst-metrics.d";
+static const char *db_mem = "memory:tst-metrics";
+static const char *textfile = "tst-metrics.prom";
+
+static const char *expected[] = {
+  "wtmpdb_logins_total{type=\"boot\",service=\"\"} 2",
+  "wtmpdb_logins_total{type=\"user\",service=\"sshd\"} 4",
+  "wtmpdb_logins_total{type=\"user\",service=\"login\"} 2",
+  "wtmpdb_logins_total{type=\"user\",service=\"we\\\"ird\"} 1",
+  "wtmpdb_sessions_active{type=\"user\",service=\"sshd\"} 2",
+  "wtmpdb_sessions_active{type=\"user\",service=\"we\\\"ird\"} 1",
+  "wtmpdb_sessions_crashed{type=\"user\",service=\"sshd\"} 1",
+  "wtmpdb_sessions_crashed{type=\"user\",service=\"login\"} 1",
+  "wtmpdb_boot_time_seconds 1700000100.000000",
+  "# TYPE wtmpdb_logins counter",
+  "# TYPE wtmpdb_sessions_active gauge",
+};
+
+static int
+login (const char *path, int type, const char *user, uint64_t t,
+       const char *service, uint64_t logout)
+{
+  char *error = NULL;
+  int64_t id = wtmpdb_login (path, type, user, t, "pts/0", "localhost",
+			     service, &error);
+
+  if (id < 0 || (logout && wtmpdb_logout (path, id, logout, &error) != 0))
+    {
+      fprintf (stderr, "%s: login/logout: %s\n", path,
+	       error ? error : "failed");
+      free (error);
+      return 1;
+    }
+  return 0;
+}
+
+/* Two boots, the sessions without logout before the second one have
+   crashed. */
+static int
+fill (const char *path)
+{
+  uint64_t s = USEC_PER_SEC;
+
+  return login (path, BOOT_TIME, "reboot", T, NULL, 0) ||
+    login (path, USER_PROCESS, "alice", T + 10 * s, "sshd", 0) ||
+    login (path, USER_PROCESS, "bob", T + 20 * s, "sshd", T + 30 * s) ||
+    login (path, USER_PROCESS, "carol", T + 40 * s, "login", 0) ||
+    login (path, BOOT_TIME, "reboot", T + 100 * s, NULL, 0) ||
+    login (path, USER_PROCESS, "alice", T + 110 * s, "sshd", 0) ||
+    login (path, USER_PROCESS, "bob", T + 120 * s, "sshd", 0) ||
+    login (path, USER_PROCESS, "dave", T + 130 * s, "we\"ird", 0) ||
+    login (path, USER_PROCESS, "carol", T + 140 * s, "login", T + 150 * s);
+}
+
+/* Returns the content of the text file with a leading newline */
+static char *
+read_textfile (void)
+{
+  static char buf[8192];
+  FILE *fp = fopen (textfile, "r");
+  size_t n;
+
+  if (fp == NULL)
+    {
+      perror (textfile);
+      return NULL;
+    }
+  buf[0] = '\n';
+  n = fread (buf + 1, 1, sizeof (buf) - 2, fp);
+  buf[n + 1] = '\0';
+  fclose (fp);
+  return buf;
+}
+
+static int
+contains (const char *buf, const char *line)
+{
+  char needle[256];
+
+  snprintf (needle, sizeof (needle), "\n%s\n", line);
+  return strstr (buf, needle) != NULL;
+}
+
+static int
+check (const char *path)
+{
+  char *error = NULL;
+  char *buf;
+  size_t len;
+
+  if (wtmpdb_write_metrics (path, textfile, &error) != 0)
+    {
+      fprintf (stderr, "%s: write_metrics: %s\n", path,
+	       error ? error : "failed");
+      free (error);
+      return 1;
+    }
+  if ((buf = read_textfile ()) == NULL)
+    return 1;
+
+  for (size_t i = 0; i < sizeof (expected) / sizeof (expected[0]); i++)
+    if (!contains (buf, expected[i]))
+      {
+	fprintf (stderr, "%s: '%s' is missing in:%s", path, expected[i], buf);
+	return 1;
+      }
+  len = strlen (buf);
+  if (len < 6 || strcmp (buf + len - 6, "# EOF\n") != 0 ||
+      strstr (buf, "service=\"login\"} 0") != NULL ||
+      contains (buf, "wtmpdb_sessions_active{type=\"user\",service=\"login\"} 1"))
+    {
+      fprintf (stderr, "%s: wrong metrics:%s", path, buf);
+      return 1;
+    }
+  return 0;
+}
+
+/* The boots in two partitions, the crashed session is in the older
+   one. */
+static int
+check_months (void)
+{
+  static const char *lines[] = {
+    "wtmpdb_logins_total{type=\"boot\",service=\"\"} 2",
+    "wtmpdb_logins_total{type=\"user\",service=\"sshd\"} 2",
+    "wtmpdb_sessions_active{type=\"user\",service=\"sshd\"} 1",
+    "wtmpdb_sessions_crashed{type=\"user\",service=\"sshd\"} 1",
+    "wtmpdb_boot_time_seconds 1703456000.000000",
+  };
+  uint64_t s = USEC_PER_SEC, d = 86400 * USEC_PER_SEC;
+  char *error = NULL;
+  char *buf;
+
+  tst_remove_dir (db_dir);
+  if (mkdir (db_dir, 0755) < 0)
+    {
+      perror (db_dir);
+      return 1;
+    }
+  if (login (db_dir, BOOT_TIME, "reboot", T, NULL, 0) ||
+      login (db_dir, USER_PROCESS, "alice", T + 10 * s, "sshd", 0) ||
+      login (db_dir, BOOT_TIME, "reboot", T + 40 * d, NULL, 0) ||
+      login (db_dir, USER_PROCESS, "bob", T + 40 * d + 10 * s, "sshd", 0))
+    return 1;
+
+  if (wtmpdb_write_metrics (db_dir, textfile, &error) != 0 ||
+      (buf = read_textfile ()) == NULL)
+    {
+      fprintf (stderr, "%s: write_metrics: %s\n", db_dir,
+	       error ? error : "failed");
+      free (error);
+      return 1;
+    }
+  for (size_t i = 0; i < sizeof (lines) / sizeof (lines[0]); i++)
+    if (!contains (buf, lines[i]))
+      {
+	fprintf (stderr, "%s: '%s' is missing in:%s", db_dir, lines[i], buf);
+	return 1;
+      }
+  return 0;
+}
+
+static void
+cleanup (void)
+{
+  remove (db_path);
+  remove (textfile);
+  tst_remove_dir (db_dir);
+}
+
+int
+main (void)
+{
+  struct timespec now;
+  char *archive = NULL;
+  char *error = NULL;
+  uint64_t entries = 0;
+  char filter[512];
+  char *buf;
+
+  cleanup ();
+  if (mkdir (db_dir, 0755) < 0)
+    {
+      perror (db_dir);
+      return 1;
+    }
+
+  if (fill (db_path) != 0 || check (db_path) != 0 ||
+      fill (db_dir) != 0 || check (db_dir) != 0 ||
+      fill (db_mem) != 0 || check (db_mem) != 0 || check_months () != 0)
+    return 1;
+
+  /* the entries are removed, the counters stay */
+  clock_gettime (CLOCK_REALTIME, &now);
+  if (wtmpdb_rotate (db_path, (now.tv_sec - 1700000000) / 86400 - 1, &error,
+		     &archive, &entries) != 0 || entries == 0)
+    {
+      fprintf (stderr, "rotate: %s\n", error ? error : "nothing rotated");
+      return 1;
+    }
+  if (login (db_path, USER_PROCESS, "erin", T + 200 * USEC_PER_SEC,
+	     "sshd", 0) != 0 ||
+      wtmpdb_write_metrics (db_path, textfile, &error) != 0 ||
+      (buf = read_textfile ()) == NULL)
+    {
+      fprintf (stderr, "write_metrics after rotate: %s\n",
+	       error ? error : "failed");
+      return 1;
+    }
+  if (!contains (buf, "wtmpdb_logins_total{type=\"user\",service=\"sshd\"} 5") ||
+      !contains (buf, expected[0]))
+    {
+      fprintf (stderr, "counters changed by rotate:%s", buf);
+      return 1;
+    }
+
+  snprintf (filter, sizeof (filter), "%s.bloom", archive);
+  remove (filter);
+  remove (archive);
+  free (archive);
+  cleanup ();
+  return 0;
+}
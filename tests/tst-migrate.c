@@ -0,0 +1,248 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Test case:
+   Create a database with the schema of wtmpdb 0.76 and migrate it in
+   small steps while entries get added and closed. Check that all
+   changes arrive in the migrated table and that it got the index and
+   the last login of every user, and that maintenance creates the
+   statistics for the index and rejects unknown tasks, and that an
+   empty partition directory has nothing to maintain. A new database gets the current schema at
+   once.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sqlite3.h>
+
+#include "wtmpdb.h"
+#include "tst-common.h"
+
+#define ROWS 100000
+
+#define _STR(x) #x
+#define STR(x) _STR(x)
+
+static const char *db_path = "tst-migrate.db";
+static const char *db_new = "tst-migrate-new.db";
+static const char *db_dir = "tst-migrate.d";
+
+static int64_t
+query (const char *path, const char *sql)
+{
+  sqlite3 *db;
+  sqlite3_stmt *res;
+  int64_t value = -1;
+
+  if (sqlite3_open_v2 (path, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK)
+    {
+      fprintf (stderr, "Cannot open %s: %s\n", path, sqlite3_errmsg (db));
+      sqlite3_close (db);
+      return -1;
+    }
+  if (sqlite3_prepare_v2 (db, sql, -1, &res, 0) == SQLITE_OK &&
+      sqlite3_step (res) == SQLITE_ROW)
+    value = sqlite3_column_int64 (res, 0);
+  else
+    fprintf (stderr, "%s: %s\n", sql, sqlite3_errmsg (db));
+  sqlite3_finalize (res);
+  sqlite3_close (db);
+  return value;
+}
+
+static int
+create_old_database (void)
+{
+  sqlite3 *db;
+
+  remove (db_path);
+  if (sqlite3_open (db_path, &db) != SQLITE_OK ||
+      sqlite3_exec (db, "CREATE TABLE wtmp(ID INTEGER PRIMARY KEY, "
+		    "Type INTEGER, User TEXT NOT NULL, Login INTEGER, "
+		    "Logout INTEGER, TTY TEXT, RemoteHost TEXT, "
+		    "Service TEXT) STRICT;"
+		    "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL "
+		    "SELECT i + 1 FROM n WHERE i < " STR(ROWS) ") "
+		    "INSERT INTO wtmp SELECT i, "
+		    "CASE WHEN i % 100 = 1 THEN 1 ELSE 3 END, "
+		    "CASE WHEN i % 100 = 1 THEN 'reboot' ELSE 'user' || (i % 7) END, "
+		    "i * 1000000, NULL, 'pts/' || i, NULL, 'tst' FROM n",
+		    NULL, NULL, NULL) != SQLITE_OK)
+    {
+      fprintf (stderr, "Cannot create %s: %s\n", db_path, sqlite3_errmsg (db));
+      sqlite3_close (db);
+      return 1;
+    }
+  sqlite3_close (db);
+  return 0;
+}
+
+int
+main (void)
+{
+  char *error = NULL;
+  int64_t id;
+  int passes = 0, n = 0;
+  int r;
+
+  if (create_old_database () != 0)
+    return 1;
+
+  /* logins work on the old schema */
+  id = wtmpdb_login (db_path, USER_PROCESS, "first", (ROWS + 1) * USEC_PER_SEC,
+		     "pts/first", NULL, "tst", &error);
+  if (id != ROWS + 1)
+    {
+      fprintf (stderr, "login returned %lld: %s\n", (long long)id,
+	       error ? error : "");
+      return 1;
+    }
+
+  /* one transaction per call, every call uses a new connection;
+     the writers migrate for a few milliseconds, too */
+  while ((r = wtmpdb_migrate (db_path, 1, &error)) == 1)
+    {
+      passes++;
+      if (wtmpdb_logout (db_path, (passes * 37) % ROWS + 1,
+			 ((passes * 37) % ROWS + 1) * 10, &error) != 0 ||
+	  wtmpdb_login (db_path, USER_PROCESS, "user", (ROWS + 1 + passes) *
+			USEC_PER_SEC, "pts/x", NULL, "tst", &error) < 0)
+	{
+	  fprintf (stderr, "login/logout failed: %s\n", error ? error : "");
+	  return 1;
+	}
+    }
+  if (r != 0)
+    {
+      fprintf (stderr, "wtmpdb_migrate failed: %s\n", error ? error : "");
+      return 1;
+    }
+  if (passes == 0)
+    {
+      fprintf (stderr, "migration was not done in steps\n");
+      return 1;
+    }
+
+  if (query (db_path, "PRAGMA user_version") != 8 ||
+      query (db_path, "SELECT COUNT(*) FROM sqlite_master WHERE "
+	     "name = 'wtmp_type_login' AND tbl_name = 'wtmp'") != 1 ||
+      query (db_path, "SELECT COUNT(*) FROM sqlite_master WHERE "
+	     "name IN ('wtmp_new', 'wtmp_old')") != 0)
+    {
+      fprintf (stderr, "schema is not migrated\n");
+      return 1;
+    }
+  if (query (db_path, "SELECT COUNT(*) FROM wtmp") != ROWS + 1 + passes ||
+      query (db_path, "SELECT COUNT(*) FROM wtmp WHERE Logout = ID * 10") != passes ||
+      query (db_path, "SELECT COUNT(*) FROM wtmp WHERE Type = 1") != ROWS / 100)
+    {
+      fprintf (stderr, "entries got lost during migration (%d steps)\n",
+	       passes);
+      return 1;
+    }
+  /* the newest login of every user, also of those logged in meanwhile */
+  if (query (db_path, "SELECT COUNT(*) FROM wtmp_lastlog") != 9 ||
+      query (db_path, "SELECT COUNT(*) FROM (SELECT User, MAX(Login) AS L "
+	     "FROM wtmp WHERE Type = 3 GROUP BY User) m "
+	     "LEFT JOIN wtmp_lastlog l USING (User) "
+	     "LEFT JOIN wtmp w ON w.ID = l.ID WHERE w.Login IS NOT m.L") != 0)
+    {
+      fprintf (stderr, "wtmp_lastlog is not complete\n");
+      return 1;
+    }
+
+  /* the counters of the old entries and of those added meanwhile */
+  if (query (db_path, "SELECT COUNT(*) FROM (SELECT IFNULL(Type, 0) AS T, "
+	     "IFNULL(Service, '') AS S, COUNT(*) AS N FROM wtmp GROUP BY 1, 2) g "
+	     "LEFT JOIN wtmp_counters c ON c.Type = g.T AND c.Service = g.S "
+	     "WHERE c.Count IS NOT g.N") != 0)
+    {
+      fprintf (stderr, "wtmp_counters is not complete\n");
+      return 1;
+    }
+
+  if (wtmpdb_maintain (db_path, WTMPDB_MAINT_ALL, &error) != 0 ||
+      query (db_path, "SELECT COUNT(*) FROM sqlite_stat1 WHERE "
+	     "idx = 'wtmp_type_login'") != 1)
+    {
+      fprintf (stderr, "maintenance failed: %s\n", error ? error : "");
+      return 1;
+    }
+  /* unknown tasks are rejected, the highest bit too */
+  if (wtmpdb_maintain (db_path, 0x80000000u | WTMPDB_MAINT_CHECKPOINT,
+		       &error) != -EINVAL)
+    {
+      fprintf (stderr, "unknown maintenance task accepted\n");
+      return 1;
+    }
+  free (error);
+  error = NULL;
+
+  rmdir (db_dir);
+  if (mkdir (db_dir, 0755) < 0 ||
+      wtmpdb_maintain (db_dir, WTMPDB_MAINT_ALL, &error) != 0)
+    {
+      fprintf (stderr, "maintenance of empty %s failed: %s\n", db_dir,
+	       error ? error : "");
+      return 1;
+    }
+  rmdir (db_dir);
+
+  if (wtmpdb_read_all_v2 (db_path, 0, tst_count, &n, &error) != 0 ||
+      n != ROWS + 1 + passes)
+    {
+      fprintf (stderr, "read_all: %d entries: %s\n", n, error ? error : "");
+      return 1;
+    }
+  id = wtmpdb_login (db_path, USER_PROCESS, "last", (ROWS + 2 + passes) *
+		     USEC_PER_SEC, "pts/last", NULL, "tst", &error);
+  if (id != ROWS + 2 + passes)
+    {
+      fprintf (stderr, "login after migration returned %lld\n", (long long)id);
+      return 1;
+    }
+
+  /* a new database needs no migration */
+  remove (db_new);
+  if (wtmpdb_login (db_new, USER_PROCESS, "user", USEC_PER_SEC, "pts/0",
+		    NULL, "tst", &error) != 1 ||
+      query (db_new, "PRAGMA user_version") != 8 ||
+      wtmpdb_migrate (db_new, 0, &error) != 0)
+    {
+      fprintf (stderr, "new database is not current: %s\n",
+	       error ? error : "");
+      return 1;
+    }
+
+  remove (db_path);
+  remove (db_new);
+  return 0;
+}
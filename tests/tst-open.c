@@ -0,0 +1,388 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Test case:
+   Count the file operations of SQLite with a VFS which forwards to the
+   default one. The first login creates the directory and the database,
+   every later login and logout must not need more file operations than
+   the same statement run directly, i.e. the schema check and directory
+   creation are skipped on the hot path. The database must be created
+   without write access for others and without touching the umask.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sqlite3.h>
+
+#include "wtmpdb.h"
+
+#define LOGINS 10
+
+static const char *db_dir = "tst-open.d";
+static const char *db_path = "tst-open.d/sub/wtmp.db";
+
+static sqlite3_vfs *real_vfs;
+static unsigned int ops;
+
+struct count_file {
+  sqlite3_file base;
+  sqlite3_file *real;
+};
+
+#define REAL(f) (((struct count_file *)(f))->real)
+
+static int
+c_close (sqlite3_file *f)
+{
+  ops++;
+  return REAL(f)->pMethods->xClose (REAL(f));
+}
+
+static int
+c_read (sqlite3_file *f, void *buf, int n, sqlite3_int64 off)
+{
+  ops++;
+  return REAL(f)->pMethods->xRead (REAL(f), buf, n, off);
+}
+
+static int
+c_write (sqlite3_file *f, const void *buf, int n, sqlite3_int64 off)
+{
+  ops++;
+  return REAL(f)->pMethods->xWrite (REAL(f), buf, n, off);
+}
+
+static int
+c_truncate (sqlite3_file *f, sqlite3_int64 size)
+{
+  ops++;
+  return REAL(f)->pMethods->xTruncate (REAL(f), size);
+}
+
+static int
+c_sync (sqlite3_file *f, int flags)
+{
+  ops++;
+  return REAL(f)->pMethods->xSync (REAL(f), flags);
+}
+
+static int
+c_file_size (sqlite3_file *f, sqlite3_int64 *size)
+{
+  ops++;
+  return REAL(f)->pMethods->xFileSize (REAL(f), size);
+}
+
+static int
+c_lock (sqlite3_file *f, int lock)
+{
+  ops++;
+  return REAL(f)->pMethods->xLock (REAL(f), lock);
+}
+
+static int
+c_unlock (sqlite3_file *f, int lock)
+{
+  ops++;
+  return REAL(f)->pMethods->xUnlock (REAL(f), lock);
+}
+
+static int
+c_check_reserved_lock (sqlite3_file *f, int *out)
+{
+  ops++;
+  return REAL(f)->pMethods->xCheckReservedLock (REAL(f), out);
+}
+
+static int
+c_file_control (sqlite3_file *f, int op, void *arg)
+{
+  return REAL(f)->pMethods->xFileControl (REAL(f), op, arg);
+}
+
+static int
+c_sector_size (sqlite3_file *f)
+{
+  return REAL(f)->pMethods->xSectorSize (REAL(f));
+}
+
+static int
+c_device_characteristics (sqlite3_file *f)
+{
+  return REAL(f)->pMethods->xDeviceCharacteristics (REAL(f));
+}
+
+static int
+c_shm_map (sqlite3_file *f, int pg, int pgsz, int extend, void volatile **p)
+{
+  ops++;
+  return REAL(f)->pMethods->xShmMap (REAL(f), pg, pgsz, extend, p);
+}
+
+static int
+c_shm_lock (sqlite3_file *f, int offset, int n, int flags)
+{
+  ops++;
+  return REAL(f)->pMethods->xShmLock (REAL(f), offset, n, flags);
+}
+
+static void
+c_shm_barrier (sqlite3_file *f)
+{
+  REAL(f)->pMethods->xShmBarrier (REAL(f));
+}
+
+static int
+c_shm_unmap (sqlite3_file *f, int delete)
+{
+  ops++;
+  return REAL(f)->pMethods->xShmUnmap (REAL(f), delete);
+}
+
+static int
+c_fetch (sqlite3_file *f, sqlite3_int64 off, int n, void **p)
+{
+  return REAL(f)->pMethods->xFetch (REAL(f), off, n, p);
+}
+
+static int
+c_unfetch (sqlite3_file *f, sqlite3_int64 off, void *p)
+{
+  return REAL(f)->pMethods->xUnfetch (REAL(f), off, p);
+}
+
+static const sqlite3_io_methods count_methods = {
+  3, c_close, c_read, c_write, c_truncate, c_sync, c_file_size, c_lock,
+  c_unlock, c_check_reserved_lock, c_file_control, c_sector_size,
+  c_device_characteristics, c_shm_map, c_shm_lock, c_shm_barrier,
+  c_shm_unmap, c_fetch, c_unfetch
+};
+
+static int
+c_open (sqlite3_vfs *vfs __attribute__((__unused__)), const char *name,
+	sqlite3_file *f, int flags, int *out_flags)
+{
+  struct count_file *cf = (struct count_file *)f;
+  int r;
+
+  ops++;
+  cf->real = (sqlite3_file *)(cf + 1);
+  r = real_vfs->xOpen (real_vfs, name, cf->real, flags, out_flags);
+  f->pMethods = cf->real->pMethods ? &count_methods : NULL;
+  return r;
+}
+
+static int
+c_delete (sqlite3_vfs *vfs __attribute__((__unused__)), const char *name,
+	  int sync)
+{
+  ops++;
+  return real_vfs->xDelete (real_vfs, name, sync);
+}
+
+static int
+c_access (sqlite3_vfs *vfs __attribute__((__unused__)), const char *name,
+	  int flags, int *out)
+{
+  ops++;
+  return real_vfs->xAccess (real_vfs, name, flags, out);
+}
+
+static int
+c_full_pathname (sqlite3_vfs *vfs __attribute__((__unused__)),
+		 const char *name, int n, char *out)
+{
+  return real_vfs->xFullPathname (real_vfs, name, n, out);
+}
+
+static int
+c_randomness (sqlite3_vfs *vfs __attribute__((__unused__)), int n, char *out)
+{
+  return real_vfs->xRandomness (real_vfs, n, out);
+}
+
+static int
+c_sleep (sqlite3_vfs *vfs __attribute__((__unused__)), int usec)
+{
+  return real_vfs->xSleep (real_vfs, usec);
+}
+
+static int
+c_current_time (sqlite3_vfs *vfs __attribute__((__unused__)), double *t)
+{
+  return real_vfs->xCurrentTime (real_vfs, t);
+}
+
+static int
+c_get_last_error (sqlite3_vfs *vfs __attribute__((__unused__)), int n,
+		  char *out)
+{
+  return real_vfs->xGetLastError (real_vfs, n, out);
+}
+
+static int
+c_current_time_int64 (sqlite3_vfs *vfs __attribute__((__unused__)),
+		      sqlite3_int64 *t)
+{
+  return real_vfs->xCurrentTimeInt64 (real_vfs, t);
+}
+
+static sqlite3_vfs count_vfs = {
+  2, 0, 0, NULL, "count", NULL, c_open, c_delete, c_access,
+  c_full_pathname, NULL, NULL, NULL, NULL, c_randomness, c_sleep,
+  c_current_time, c_get_last_error, c_current_time_int64,
+  NULL, NULL, NULL
+};
+
+/* Returns the file operations of a login or logout run directly. */
+static unsigned int
+direct_ops (const char *sql)
+{
+  sqlite3 *db;
+  unsigned int start = ops;
+  int persist = 1;
+
+  /* the WAL is kept like by libwtmpdb */
+  if (sqlite3_open_v2 (db_path, &db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK ||
+      sqlite3_file_control (db, "main", SQLITE_FCNTL_PERSIST_WAL,
+			    &persist) != SQLITE_OK ||
+      sqlite3_exec (db, "PRAGMA journal_size_limit = 1048576", NULL, NULL,
+		    NULL) != SQLITE_OK ||
+      sqlite3_exec (db, sql, NULL, NULL, NULL) != SQLITE_OK)
+    {
+      fprintf (stderr, "%s: %s\n", sql, sqlite3_errmsg (db));
+      exit (1);
+    }
+  sqlite3_close (db);
+  return ops - start;
+}
+
+static void
+cleanup (void)
+{
+  char path[512];
+
+  snprintf (path, sizeof (path), "%s-journal", db_path);
+  remove (path);
+  snprintf (path, sizeof (path), "%s-wal", db_path);
+  remove (path);
+  snprintf (path, sizeof (path), "%s-shm", db_path);
+  remove (path);
+  remove (db_path);
+  snprintf (path, sizeof (path), "%s/sub", db_dir);
+  rmdir (path);
+  rmdir (db_dir);
+}
+
+int
+main(void)
+{
+  uint64_t t = 1700000000ULL * USEC_PER_SEC;
+  unsigned int first, login, logout, max_login = 0, max_logout = 0;
+  char *error = NULL;
+  char sql[256];
+  int64_t id;
+
+  cleanup ();
+  umask (022);
+  real_vfs = sqlite3_vfs_find (NULL);
+  count_vfs.szOsFile = sizeof (struct count_file) + real_vfs->szOsFile;
+  count_vfs.mxPathname = real_vfs->mxPathname;
+  if (sqlite3_vfs_register (&count_vfs, 1) != SQLITE_OK)
+    {
+      fprintf (stderr, "Cannot register VFS\n");
+      return 1;
+    }
+
+  ops = 0;
+  if (wtmpdb_login (db_path, USER_PROCESS, "user", t, "pts/0", "localhost",
+		    "tst", &error) < 0)
+    {
+      fprintf (stderr, "first login: %s\n", error ? error : "failed");
+      return 1;
+    }
+  first = ops;
+
+  struct stat st, st_wal;
+  char wal[256];
+
+  snprintf (wal, sizeof (wal), "%s-wal", db_path);
+  if (umask (022) != 022 || stat (db_path, &st) < 0 ||
+      stat (wal, &st_wal) < 0 || (st.st_mode & 022) != 0 ||
+      (st.st_mode & 0777) != (st_wal.st_mode & 0777))
+    {
+      fprintf (stderr, "database created with the wrong mode or umask\n");
+      return 1;
+    }
+
+  for (int i = 1; i <= LOGINS; i++)
+    {
+      ops = 0;
+      id = wtmpdb_login (db_path, USER_PROCESS, "user", t + i, "pts/1",
+			 "localhost", "tst", &error);
+      if (id < 0)
+	{
+	  fprintf (stderr, "login: %s\n", error ? error : "failed");
+	  return 1;
+	}
+      if (ops > max_login)
+	max_login = ops;
+
+      ops = 0;
+      if (wtmpdb_logout (db_path, id, t + i + 1, &error) != 0)
+	{
+	  fprintf (stderr, "logout: %s\n", error ? error : "failed");
+	  return 1;
+	}
+      if (ops > max_logout)
+	max_logout = ops;
+    }
+
+  /* the newest login, like the ones above */
+  snprintf (sql, sizeof (sql), "BEGIN IMMEDIATE; INSERT INTO wtmp "
+	    "(Type,User,Login,TTY,RemoteHost,Service) "
+	    "VALUES(3,'user',%llu,'pts/1','localhost','tst'); COMMIT",
+	    (unsigned long long)(t + LOGINS + 2));
+  login = direct_ops (sql);
+  logout = direct_ops ("BEGIN IMMEDIATE; UPDATE wtmp SET Logout = 2 "
+		       "WHERE ID = 1; COMMIT");
+  printf ("file operations: first login %u, login %u (direct %u), "
+	  "logout %u (direct %u)\n", first, max_login, login, max_logout,
+	  logout);
+
+  if (max_login > login || max_logout > logout || max_login >= first)
+    {
+      fprintf (stderr, "the hot path has more file operations than needed\n");
+      return 1;
+    }
+
+  cleanup ();
+  return 0;
+}
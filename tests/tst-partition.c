@@ -0,0 +1,242 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Test case:
+   Run the same logins and logouts over several months against a
+   partitioned database (directory) and a single database file and
+   compare the results without the IDs. Check that the partition is
+   encoded in the ID and that rotating removes old partition files.
+*/
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "wtmpdb.h"
+#include "tst-common.h"
+
+#define ENTRIES 120
+#define STEP (20 * 3600 * USEC_PER_SEC) /* 20 hours */
+
+static const char *db_file = "tst-partition.db";
+static const char *db_dir = "tst-partition.d";
+
+/* all columns except the first one (ID) */
+static struct tst_rows result[2] = { { .skip = 1 }, { .skip = 1 } };
+
+static int
+compare (void)
+{
+  char *error = NULL;
+
+  for (int uniq = 0; uniq < 2; uniq++)
+    {
+      tst_rows_reset (&result[0]);
+      tst_rows_reset (&result[1]);
+      if (wtmpdb_read_all_v2 (db_file, uniq, tst_collect, &result[0], &error) != 0 ||
+	  wtmpdb_read_all_v2 (db_dir, uniq, tst_collect, &result[1], &error) != 0)
+	{
+	  fprintf (stderr, "read_all: %s\n", error ? error : "failed");
+	  free (error);
+	  return 1;
+	}
+      if (strcmp (result[0].text, result[1].text) != 0)
+	{
+	  fprintf (stderr, "uniq=%d: result differs:\n%s---\n%s",
+		   uniq, result[0].text, result[1].text);
+	  return 1;
+	}
+    }
+
+  tst_rows_reset (&result[0]);
+  tst_rows_reset (&result[1]);
+  if (wtmpdb_read_boots (db_file, tst_collect, &result[0], &error) != 0 ||
+      wtmpdb_read_boots (db_dir, tst_collect, &result[1], &error) != 0)
+    {
+      fprintf (stderr, "read_boots: %s\n", error ? error : "failed");
+      free (error);
+      return 1;
+    }
+  if (strcmp (result[0].text, result[1].text) != 0)
+    {
+      fprintf (stderr, "boots: result differs:\n%s---\n%s",
+	       result[0].text, result[1].text);
+      return 1;
+    }
+
+  if (wtmpdb_get_boottime (db_file, &error) !=
+      wtmpdb_get_boottime (db_dir, &error))
+    {
+      fprintf (stderr, "boot time differs\n");
+      return 1;
+    }
+  return 0;
+}
+
+static int
+partition_of (uint64_t t)
+{
+  time_t sec = t / USEC_PER_SEC;
+  struct tm tm;
+
+  localtime_r (&sec, &tm);
+  return (tm.tm_year + 1900) * 100 + tm.tm_mon + 1;
+}
+
+static int
+login_both (int type, const char *user, uint64_t t, const char *tty)
+{
+  char *error = NULL;
+  int64_t id1 = wtmpdb_login (db_file, type, user, t, tty, "localhost",
+			      "tst", &error);
+  int64_t id2 = wtmpdb_login (db_dir, type, user, t, tty, "localhost",
+			      "tst", &error);
+
+  if (id1 < 0 || id2 < 0)
+    {
+      fprintf (stderr, "login: %s\n", error ? error : "failed");
+      free (error);
+      return 1;
+    }
+  if ((id2 >> 32) != partition_of (t))
+    {
+      fprintf (stderr, "ID %lld is not in partition %d\n", (long long)id2,
+	       partition_of (t));
+      return 1;
+    }
+  return 0;
+}
+
+static int
+logout_both (const char *tty, uint64_t t)
+{
+  char *error = NULL;
+  int64_t id1 = wtmpdb_get_id (db_file, tty, &error);
+  int64_t id2 = wtmpdb_get_id (db_dir, tty, &error);
+
+  if (id1 < 0 || id2 < 0 ||
+      wtmpdb_logout (db_file, id1, t, &error) != 0 ||
+      wtmpdb_logout (db_dir, id2, t, &error) != 0)
+    {
+      fprintf (stderr, "logout %s: %lld/%lld: %s\n", tty, (long long)id1,
+	       (long long)id2, error ? error : "");
+      free (error);
+      return 1;
+    }
+  return 0;
+}
+
+static void
+cleanup (void)
+{
+  remove (db_file);
+  tst_remove_dir (db_dir);
+}
+
+int
+main(void)
+{
+  uint64_t t = 1700000000ULL * USEC_PER_SEC;
+  struct timespec now;
+  uint64_t entries = 0;
+  char *backup = NULL;
+  char *error = NULL;
+  char path[512];
+  int first, n1 = 0, n2 = 0;
+
+  cleanup ();
+  if (mkdir (db_dir, 0755) < 0)
+    {
+      perror (db_dir);
+      return 1;
+    }
+
+  first = partition_of (t);
+  for (int i = 0; i < ENTRIES; i++)
+    {
+      char user[16], tty[16];
+
+      t += STEP;
+      if (i % 25 == 0 &&
+	  login_both (BOOT_TIME, "reboot", t, "~") != 0)
+	return 1;
+      snprintf (user, sizeof (user), "user%d", i % 7);
+      snprintf (tty, sizeof (tty), "pts/%d", i % 5);
+      /* the first session on pts/0 stays open over several month ends */
+      if ((i == 0 || i % 5 != 0) &&
+	  login_both (USER_PROCESS, user, t, tty) != 0)
+	return 1;
+      if (i == ENTRIES - 20 && logout_both ("pts/0", t) != 0)
+	return 1;
+      if (i % 3 == 0 && i % 5 != 0 && logout_both (tty, t + 1) != 0)
+	return 1;
+    }
+
+  if (compare () != 0)
+    return 1;
+
+  /* remove the oldest month */
+  snprintf (path, sizeof (path), "%s/wtmp_%06d.db", db_dir, first);
+  if (access (path, F_OK) != 0)
+    {
+      fprintf (stderr, "%s is missing\n", path);
+      return 1;
+    }
+  clock_gettime (CLOCK_REALTIME, &now);
+  int days = (now.tv_sec - (1700000000 + 32 * 86400)) / 86400;
+  if (wtmpdb_rotate (db_dir, days, &error, &backup, &entries) != 0)
+    {
+      fprintf (stderr, "rotate: %s\n", error ? error : "failed");
+      return 1;
+    }
+  if (access (path, F_OK) == 0 || entries == 0 || backup != NULL)
+    {
+      fprintf (stderr, "rotate did not remove %s (%llu entries)\n", path,
+	       (unsigned long long)entries);
+      return 1;
+    }
+  if (wtmpdb_read_all_v2 (db_dir, 0, tst_count, &n2, &error) != 0)
+    {
+      fprintf (stderr, "read_all: %s\n", error ? error : "failed");
+      return 1;
+    }
+  if (wtmpdb_read_all_v2 (db_file, 0, tst_count, &n1, &error) != 0 ||
+      (uint64_t)(n1 - n2) != entries)
+    {
+      fprintf (stderr, "%d entries left of %d, %llu removed\n", n2, n1,
+	       (unsigned long long)entries);
+      return 1;
+    }
+
+  tst_rows_free (&result[0]);
+  tst_rows_free (&result[1]);
+  cleanup ();
+  return 0;
+}
@@ -0,0 +1,412 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Test case:
+   Rotate a database by swapping files. The archive must contain all
+   entries, the new database the open sessions and the last boot with
+   their IDs. Closing a carried over session and adding new entries
+   must work, new IDs must not collide with archived ones.
+   Check the size and row limits and the removal of old archives.
+   Writers which wait for the lock during the swap must end up in the
+   new database, not in the archive. Readers without write access get
+   the new database, too.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sqlite3.h>
+
+#include "wtmpdb.h"
+
+#define ENTRIES 50
+#define LATE_SESSIONS 20000
+#define LATE_WRITERS 2
+
+#define _STR(x) #x
+#define STR(x) _STR(x)
+
+static const char *db_path = "tst-rotate.db";
+
+struct stats {
+  int rows;
+  int open;
+  int boots;
+  int64_t max_id;
+};
+
+static int
+collect (void *data, int argc __attribute__((__unused__)), char **argv,
+	 char **azColName __attribute__((__unused__)))
+{
+  struct stats *st = data;
+  int64_t id = strtoll (argv[0], NULL, 10);
+
+  st->rows++;
+  if (atoi (argv[1]) == BOOT_TIME)
+    st->boots++;
+  else if (argv[4] == NULL)
+    st->open++;
+  if (id > st->max_id)
+    st->max_id = id;
+  return 0;
+}
+
+static int
+read_stats (const char *path, struct stats *st)
+{
+  char *error = NULL;
+
+  memset (st, 0, sizeof (*st));
+  if (wtmpdb_read_all_v2 (path, 0, collect, st, &error) != 0)
+    {
+      fprintf (stderr, "read_all (%s): %s\n", path, error ? error : "failed");
+      free (error);
+      return 1;
+    }
+  return 0;
+}
+
+/* Returns 1 if path has the application ID of archives */
+static int
+is_archive (const char *path)
+{
+  char buf[4] = "";
+  FILE *fp = fopen (path, "r");
+
+  if (fp == NULL)
+    return 0;
+  if (fseek (fp, 68, SEEK_SET) != 0 || fread (buf, 4, 1, fp) != 1)
+    buf[0] = '\0';
+  fclose (fp);
+  return memcmp (buf, "wtma", 4) == 0;
+}
+
+/* Removes an archive and its filter */
+static void
+remove_archive (const char *path)
+{
+  char filter[512];
+
+  snprintf (filter, sizeof (filter), "%s.bloom", path);
+  remove (filter);
+  remove (path);
+}
+
+struct late_job {
+  int thread;
+  int sessions;
+  char *error;
+};
+
+static const char *late_path = "tst-rotate-late.db";
+static atomic_int late_stop;
+
+static void *
+late_writer (void *arg)
+{
+  struct late_job *job = arg;
+  char tty[32];
+
+  while (!atomic_load (&late_stop))
+    {
+      snprintf (tty, sizeof (tty), "late/%d/%d", job->thread, job->sessions);
+      if (wtmpdb_login (late_path, USER_PROCESS, "late",
+			1700000000ULL * USEC_PER_SEC, tty, NULL, "tst",
+			&job->error) < 0)
+	break;
+      job->sessions++;
+      usleep (5000);
+    }
+  return NULL;
+}
+
+/* Returns the number of entries of user in path, <0 on failure */
+static int
+count_user (const char *path, const char *user)
+{
+  sqlite3 *db;
+  sqlite3_stmt *res;
+  int n = -1;
+
+  if (sqlite3_open_v2 (path, &db, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK &&
+      sqlite3_prepare_v2 (db, "SELECT COUNT(*) FROM wtmp WHERE User = ?",
+			  -1, &res, 0) == SQLITE_OK)
+    {
+      sqlite3_bind_text (res, 1, user, -1, SQLITE_STATIC);
+      if (sqlite3_step (res) == SQLITE_ROW)
+	n = sqlite3_column_int (res, 0);
+      sqlite3_finalize (res);
+    }
+  else
+    fprintf (stderr, "%s: %s\n", path, sqlite3_errmsg (db));
+  sqlite3_close (db);
+  return n;
+}
+
+/* Rotates a database with many open sessions, so copying them takes
+   a while, while other threads keep logging in. Every login which
+   succeeded is an open session and must be in the new database. */
+static int
+test_late_writers (void)
+{
+  struct wtmpdb_rotate_opts opts = { .flags = WTMPDB_ROTATE_SWAP };
+  struct late_job jobs[LATE_WRITERS];
+  pthread_t threads[LATE_WRITERS];
+  char *archive_name = NULL;
+  char *error = NULL;
+  sqlite3 *db;
+  int sessions = 0, found, r;
+
+  remove (late_path);
+  if (wtmpdb_login (late_path, BOOT_TIME, "reboot",
+		    1700000000ULL * USEC_PER_SEC, "~", "6.0", NULL, &error) < 0)
+    {
+      fprintf (stderr, "late: %s\n", error ? error : "failed");
+      free (error);
+      return 1;
+    }
+  if (sqlite3_open_v2 (late_path, &db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK ||
+      sqlite3_exec (db, "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL "
+		    "SELECT i + 1 FROM n WHERE i < " STR(LATE_SESSIONS) ") "
+		    "INSERT INTO wtmp (Type, User, Login, TTY, Service) "
+		    "SELECT " STR(USER_PROCESS) ", 'user', 1700000000000000 + i, 'pts/' || i, "
+		    "'tst' FROM n", NULL, NULL, NULL) != SQLITE_OK)
+    {
+      fprintf (stderr, "late: %s\n", sqlite3_errmsg (db));
+      sqlite3_close (db);
+      return 1;
+    }
+  sqlite3_close (db);
+
+  atomic_store (&late_stop, 0);
+  for (int i = 0; i < LATE_WRITERS; i++)
+    {
+      jobs[i] = (struct late_job) { .thread = i };
+      if (pthread_create (&threads[i], NULL, late_writer, &jobs[i]) != 0)
+	{
+	  perror ("pthread_create");
+	  return 1;
+	}
+    }
+  usleep (20000);
+  r = wtmpdb_rotate_v2 (late_path, &opts, &error, &archive_name, NULL);
+  usleep (20000);
+  atomic_store (&late_stop, 1);
+  for (int i = 0; i < LATE_WRITERS; i++)
+    pthread_join (threads[i], NULL);
+
+  if (r != 0)
+    {
+      fprintf (stderr, "late: rotate: %s\n", error ? error : "failed");
+      free (error);
+      return 1;
+    }
+  for (int i = 0; i < LATE_WRITERS; i++)
+    {
+      if (jobs[i].error)
+	{
+	  fprintf (stderr, "late: writer %d: %s\n", i, jobs[i].error);
+	  free (jobs[i].error);
+	  return 1;
+	}
+      sessions += jobs[i].sessions;
+    }
+  found = count_user (late_path, "late");
+  if (found != sessions)
+    {
+      fprintf (stderr, "late: %d of %d sessions in the new database\n",
+	       found, sessions);
+      return 1;
+    }
+
+  remove_archive (archive_name);
+  free (archive_name);
+  remove (late_path);
+  return 0;
+}
+
+int
+main(void)
+{
+  struct wtmpdb_rotate_opts opts = { .flags = WTMPDB_ROTATE_SWAP };
+  uint64_t t = 1700000000ULL * USEC_PER_SEC;
+  struct stats before, archive, live;
+  char *archive_name = NULL;
+  char *error = NULL;
+  uint64_t entries = 0;
+  int64_t open_id = -1;
+  int64_t id;
+
+  remove (db_path);
+
+  for (int i = 0; i < ENTRIES; i++)
+    {
+      char tty[16];
+
+      t += USEC_PER_SEC;
+      if (i % 20 == 0 &&
+	  wtmpdb_login (db_path, BOOT_TIME, "reboot", t, "~", "6.0", NULL,
+			&error) < 0)
+	goto fail;
+      snprintf (tty, sizeof (tty), "pts/%d", i);
+      id = wtmpdb_login (db_path, USER_PROCESS, "user", t, tty, "localhost",
+			 "tst", &error);
+      if (id < 0)
+	goto fail;
+      if (i % 4 != 0 && wtmpdb_logout (db_path, id, t + 1, &error) != 0)
+	goto fail;
+      if (i % 4 == 0)
+	open_id = id;
+    }
+  if (read_stats (db_path, &before) != 0)
+    return 1;
+
+  if (wtmpdb_rotate_v2 (db_path, &opts, &error, &archive_name,
+			&entries) != 0)
+    goto fail;
+  if (archive_name == NULL || entries != (uint64_t)before.rows)
+    {
+      fprintf (stderr, "rotate: archive %s, %llu of %d entries\n",
+	       archive_name ? archive_name : "missing",
+	       (unsigned long long)entries, before.rows);
+      return 1;
+    }
+
+  /* readers without write access to the directory cannot create the
+     WAL and its index of the new database */
+  if (access ("tst-rotate.db-wal", F_OK) != 0 ||
+      access ("tst-rotate.db-shm", F_OK) != 0 ||
+      count_user (db_path, "user") != before.open)
+    {
+      fprintf (stderr, "%s cannot be read without write access\n", db_path);
+      return 1;
+    }
+
+  if (read_stats (archive_name, &archive) != 0 ||
+      read_stats (db_path, &live) != 0)
+    return 1;
+  if (archive.rows != before.rows ||
+      live.rows != before.open + 1 || live.open != before.open ||
+      live.boots != 1)
+    {
+      fprintf (stderr, "archive: %d rows, live: %d rows, %d open, %d boots\n",
+	       archive.rows, live.rows, live.open, live.boots);
+      return 1;
+    }
+  /* only the archive is opened immutable */
+  if (!is_archive (archive_name) || is_archive (db_path))
+    {
+      fprintf (stderr, "%s not marked as archive\n", archive_name);
+      return 1;
+    }
+
+  /* carried over sessions keep their ID */
+  if (wtmpdb_get_id (db_path, "pts/48", &error) != open_id ||
+      wtmpdb_logout (db_path, open_id, t + 2, &error) != 0)
+    goto fail;
+
+  /* new IDs continue after the archived ones, even if the newest
+     entry was not carried over */
+  id = wtmpdb_login (db_path, USER_PROCESS, "user", t + 3, "pts/99",
+		     "localhost", "tst", &error);
+  if (id <= before.max_id)
+    {
+      fprintf (stderr, "new ID %lld <= %lld\n", (long long)id,
+	       (long long)before.max_id);
+      return 1;
+    }
+
+  /* only one new entry since the rotation, so no rotation with a
+     row limit, but the old archives get removed */
+  static const char *old_archives[] = {"tst-rotate_20200101.db",
+				       "tst-rotate_20200102-120000.db"};
+  for (size_t i = 0; i < sizeof (old_archives) / sizeof (old_archives[0]); i++)
+    {
+      FILE *fp = fopen (old_archives[i], "w");
+      if (fp == NULL)
+	{
+	  perror (old_archives[i]);
+	  return 1;
+	}
+      fclose (fp);
+    }
+  opts.max_rows = 10;
+  opts.keep = 2;
+  opts.keep_days = 0;
+  entries = 0;
+  if (wtmpdb_rotate_v2 (db_path, &opts, &error, NULL, &entries) != 0)
+    goto fail;
+  if (entries != 0 || access (archive_name, F_OK) != 0 ||
+      access (old_archives[1], F_OK) != 0 ||
+      access (old_archives[0], F_OK) == 0)
+    {
+      fprintf (stderr, "keep: %llu entries rotated or wrong archives removed\n",
+	       (unsigned long long)entries);
+      return 1;
+    }
+  opts.keep = 0;
+  opts.keep_days = 30;
+  if (wtmpdb_rotate_v2 (db_path, &opts, &error, NULL, &entries) != 0)
+    goto fail;
+  if (access (archive_name, F_OK) != 0 || access (old_archives[1], F_OK) == 0)
+    {
+      fprintf (stderr, "keep-days: wrong archives removed\n");
+      return 1;
+    }
+
+  /* the size limit is exceeded */
+  opts.max_rows = 0;
+  opts.max_size = 4096;
+  opts.keep_days = 0;
+  remove_archive (archive_name);
+  free (archive_name);
+  archive_name = NULL;
+  sleep (1); /* new archive name */
+  if (wtmpdb_rotate_v2 (db_path, &opts, &error, &archive_name,
+			&entries) != 0)
+    goto fail;
+  if (archive_name == NULL || entries == 0)
+    {
+      fprintf (stderr, "max-size: not rotated\n");
+      return 1;
+    }
+
+  remove_archive (archive_name);
+  free (archive_name);
+  remove (db_path);
+
+  return test_late_writers ();
+
+ fail:
+  fprintf (stderr, "%s\n", error ? error : "failed");
+  free (error);
+  return 1;
+}
@@ -0,0 +1,204 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Test case:
+   Several threads log in and out concurrently on the same in-memory
+   and SQLite database while others read. Afterwards every login must
+   be found exactly once and every session must be closed.
+*/
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "wtmpdb.h"
+
+#define THREADS 8
+#define MEM_SESSIONS 2000
+#define DB_SESSIONS 20
+
+static const char *db_file = "tst-threads.db";
+static const char *db_mem = "memory:tst-threads";
+
+struct job {
+  const char *db_path;
+  int thread;
+  int sessions;
+  int failed;
+};
+
+static void *
+writer (void *arg)
+{
+  struct job *job = arg;
+  char tty[32], user[32];
+
+  snprintf (tty, sizeof (tty), "pts/%d", job->thread);
+  snprintf (user, sizeof (user), "user%d", job->thread);
+
+  for (int i = 0; i < job->sessions; i++)
+    {
+      char *error = NULL;
+      struct timespec ts;
+      int64_t id, found;
+
+      clock_gettime (CLOCK_REALTIME, &ts);
+      id = wtmpdb_login (job->db_path, USER_PROCESS, user,
+			 wtmpdb_timespec2usec (ts), tty, NULL, "tst", &error);
+      if (id < 0)
+	goto fail;
+
+      /* the tty is used by this thread only */
+      found = wtmpdb_get_id (job->db_path, tty, &error);
+      if (found != id)
+	{
+	  fprintf (stderr, "%s: thread %d: got ID %lld for %s, expected %lld\n",
+		   job->db_path, job->thread, (long long)found, tty,
+		   (long long)id);
+	  job->failed = 1;
+	  free (error);
+	  return NULL;
+	}
+
+      clock_gettime (CLOCK_REALTIME, &ts);
+      if (wtmpdb_logout (job->db_path, id, wtmpdb_timespec2usec (ts),
+			 &error) != 0)
+	goto fail;
+      continue;
+
+    fail:
+      fprintf (stderr, "%s: thread %d: %s\n", job->db_path, job->thread,
+	       error ? error : "failed");
+      free (error);
+      job->failed = 1;
+      return NULL;
+    }
+  return NULL;
+}
+
+struct count {
+  int entries;
+  int open;
+};
+
+static int
+count_cb (void *data, int argc, char **argv,
+	  char **azColName __attribute__((__unused__)))
+{
+  struct count *c = data;
+
+  if (argc != 8)
+    return 1;
+  c->entries++;
+  if (argv[4] == NULL)
+    c->open++;
+  return 0;
+}
+
+static void *
+reader (void *arg)
+{
+  struct job *job = arg;
+
+  for (int i = 0; i < job->sessions; i++)
+    {
+      struct count c = {0, 0};
+      char *error = NULL;
+
+      if (wtmpdb_read_all_v2 (job->db_path, i % 2, count_cb, &c, &error) != 0)
+	{
+	  fprintf (stderr, "%s: reader: %s\n", job->db_path,
+		   error ? error : "failed");
+	  free (error);
+	  job->failed = 1;
+	  return NULL;
+	}
+    }
+  return NULL;
+}
+
+static int
+run (const char *db_path, int sessions)
+{
+  pthread_t tid[THREADS + 1];
+  struct job jobs[THREADS + 1];
+  struct count c = {0, 0};
+  char *error = NULL;
+  int failed = 0;
+
+  for (int i = 0; i <= THREADS; i++)
+    {
+      jobs[i].db_path = db_path;
+      jobs[i].thread = i;
+      jobs[i].sessions = i < THREADS ? sessions : 20;
+      jobs[i].failed = 0;
+      if (pthread_create (&tid[i], NULL, i < THREADS ? writer : reader,
+			  &jobs[i]) != 0)
+	{
+	  fprintf (stderr, "pthread_create failed\n");
+	  return 1;
+	}
+    }
+  for (int i = 0; i <= THREADS; i++)
+    {
+      pthread_join (tid[i], NULL);
+      failed |= jobs[i].failed;
+    }
+  if (failed)
+    return 1;
+
+  if (wtmpdb_read_all_v2 (db_path, 0, count_cb, &c, &error) != 0)
+    {
+      fprintf (stderr, "%s: %s\n", db_path, error ? error : "read failed");
+      free (error);
+      return 1;
+    }
+  if (c.entries != THREADS * sessions || c.open != 0)
+    {
+      fprintf (stderr, "%s: found %d entries (%d open), expected %d\n",
+	       db_path, c.entries, c.open, THREADS * sessions);
+      return 1;
+    }
+  return 0;
+}
+
+int
+main(void)
+{
+  remove (db_file);
+
+  if (run (db_mem, MEM_SESSIONS) != 0)
+    return 1;
+  if (run (db_file, DB_SESSIONS) != 0)
+    return 1;
+
+  remove (db_file);
+  return 0;
+}
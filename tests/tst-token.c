@@ -0,0 +1,155 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+
+  Copyright (c) 2026, Jens Elkner <jel+wtmpdb@cs.ovgu.de>
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+     notice, this list of conditions and the following disclaimer in the
+     documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Test case:
+   A login with the token of an earlier one must return its ID without
+   adding an entry, in a database file, in a partitioned one and in a
+   database created before the tokens table.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sqlite3.h>
+
+#include "wtmpdb.h"
+#include "tst-common.h"
+
+#define LOGIN_TIME 1700000000000000
+
+static const char *db_path = "tst-token.db";
+static const char *db_dir = "tst-token.d";
+
+static int64_t
+login (const char *path, const char *tty, const char *token)
+{
+  char *error = NULL;
+  int64_t id = wtmpdb_login_v2 (path, USER_PROCESS, "user", LOGIN_TIME,
+				tty, "localhost", "tst", token, &error);
+
+  if (id < 0)
+    {
+      fprintf (stderr, "%s: login failed: %s\n", path,
+	       error ? error : "");
+      free (error);
+    }
+  return id;
+}
+
+static int
+entries (const char *path)
+{
+  char *error = NULL;
+  int n = 0;
+
+  if (wtmpdb_read_all_v2 (path, 0, tst_count, &n, &error) != 0)
+    {
+      fprintf (stderr, "%s: read_all failed: %s\n", path,
+	       error ? error : "");
+      free (error);
+      return -1;
+    }
+  return n;
+}
+
+static int
+check (const char *path)
+{
+  int64_t id1, id2, id3, id4;
+
+  id1 = login (path, "pts/1", "1f0c6d3ce1a44d6a8ad3b1e5f6a7b8c9");
+  id2 = login (path, "pts/1", "1f0c6d3ce1a44d6a8ad3b1e5f6a7b8c9");
+  id3 = login (path, "pts/2", "8ad3b1e5f6a7b8c91f0c6d3ce1a44d6a");
+  id4 = login (path, "pts/3", NULL);
+  if (id1 < 0 || id2 < 0 || id3 < 0 || id4 < 0)
+    return 1;
+  if (id1 != id2 || id3 == id1 || id4 == id1 || id4 == id3)
+    {
+      fprintf (stderr, "%s: IDs %lld, %lld, %lld, %lld\n", path,
+	       (long long)id1, (long long)id2, (long long)id3,
+	       (long long)id4);
+      return 1;
+    }
+  if (entries (path) != 3)
+    {
+      fprintf (stderr, "%s: %d entries instead of 3\n", path,
+	       entries (path));
+      return 1;
+    }
+  return 0;
+}
+
+static void
+cleanup (void)
+{
+  remove (db_path);
+  tst_remove_dir (db_dir);
+}
+
+int
+main (void)
+{
+  sqlite3 *db;
+
+  cleanup ();
+  if (check (db_path) != 0)
+    return 1;
+
+  if (mkdir (db_dir, 0755) < 0)
+    {
+      perror (db_dir);
+      return 1;
+    }
+  if (check (db_dir) != 0)
+    return 1;
+
+  /* a database of wtmpdb 0.77 gets the tokens table with the first write */
+  remove (db_path);
+  if (login (db_path, "pts/0", NULL) < 0)
+    return 1;
+  if (sqlite3_open (db_path, &db) != SQLITE_OK ||
+      sqlite3_exec (db, "DROP TABLE wtmp_tokens; PRAGMA user_version = 6",
+		    NULL, NULL, NULL) != SQLITE_OK)
+    {
+      fprintf (stderr, "downgrade failed: %s\n", sqlite3_errmsg (db));
+      return 1;
+    }
+  sqlite3_close (db);
+  if (login (db_path, "pts/1", "6a8ad3b1e5f6a7b8c91f0c6d3ce1a44d") !=
+      login (db_path, "pts/1", "6a8ad3b1e5f6a7b8c91f0c6d3ce1a44d") ||
+      entries (db_path) != 2)
+    {
+      fprintf (stderr, "tokens after migration 7: %d entries\n",
+	       entries (db_path));
+      return 1;
+    }
+
+  cleanup ();
+  return 0;
+}